@@ -20,7 +20,7 @@ then
   fi
   AC_MSG_RESULT([$PYTHON])
 else
-  AC_PATH_PROGS([PYTHON], [python python2 python2.3 python2.2])
+  AC_PATH_PROGS([PYTHON], [python3 python])
 fi
 
 m4_popdef([xpp_path])
@@ -70,4 +70,4 @@ fi
 # _XIPH_PYTHON_CFG(PYTHONPATH, CFGVAR)
 # Ask python in PYTHONPATH for the definition of CFGVAR
 m4_define([_XIPH_PYTHON_CFG],
-  [`$1 -c 'from distutils.sysconfig import get_config_var; print get_config_var("$2")' | sed 's/None//'`])
+  [`$1 -c 'import sysconfig; print(sysconfig.get_config_var("$2"))' | sed 's/None//'`])
@@ -0,0 +1,374 @@
+/* agc.c
+ * - Multiband automatic gain control plugin for ices
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+/* The signal is split into bands by subtracting low passed copies, so
+ * the bands always add back up to the input. Band levels are tracked
+ * slowly, once per block. The overall level sets a common gain towards
+ * the target; each band then gets a correction of at most AGC_BANDRANGE
+ * dB towards a typical spectral balance. Gains ease towards their
+ * targets and are held through quiet passages rather than pumping up
+ * the noise floor. The AGC can overshoot on transients; put a limiter
+ * after it. */
+
+#include "definitions.h"
+
+#include <math.h>
+
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+/* frames per pass, which is also the control rate */
+#define AGC_BLOCK 256
+#define AGC_MAXBANDS 3
+
+/* crossovers for three bands, in Hz */
+#define AGC_XOVER_LOW 250
+#define AGC_XOVER_HIGH 4000
+
+/* level detection and gain time constants, in seconds */
+#define AGC_DETECT_TIME 1.0
+#define AGC_GAIN_TIME 3.0
+/* below this level (dBFS) gains are held */
+#define AGC_GATE -45
+/* most a band is corrected relative to the others, in dB */
+#define AGC_BANDRANGE 6
+
+/* share of the power each band has in typical programme material */
+static const double agc_balance[AGC_MAXBANDS] = { 0.5, 0.4, 0.1 };
+
+/* two pole low pass, transposed direct form II, one state per channel */
+typedef struct {
+	float b0, b1, b2, a1, a2;
+	float z1[2];
+	float z2[2];
+} agc_biquad_t;
+
+typedef struct {
+	ices_plugin_t plugin;
+
+	/* mean square target, in int16 units squared */
+	double target;
+	int maxgain;
+	int bands;
+
+	unsigned int samplerate;
+	agc_biquad_t xover[AGC_MAXBANDS - 1];
+
+	double gate;
+	double mingain;
+	double maxgainlin;
+	double bandrange;
+	double level[AGC_MAXBANDS];
+	float gain[AGC_MAXBANDS];
+} agc_t;
+
+/* Private function declarations */
+static int agc_init(ices_plugin_t* self);
+static void agc_new_track(ices_plugin_t* self, input_stream_t* source);
+static int agc_process(ices_plugin_t* self, int ilen, int16_t* il, int16_t* ir);
+static void agc_shutdown(ices_plugin_t* self);
+static int agc_options(ices_plugin_t* self, int optid, void* opt);
+
+static void agc_reset(agc_t* agc, unsigned int samplerate);
+static void agc_lowpass(agc_biquad_t* bq, double freq, unsigned int samplerate);
+static void agc_split(agc_t* agc, const int16_t* left, const int16_t* right,
+		      int frames, float band[][2][AGC_BLOCK]);
+static double agc_meansquare(const float* left, const float* right, int frames);
+static void agc_mix(float band[][2][AGC_BLOCK], int bands, const float* from,
+		    const float* to, int frames, int16_t* left, int16_t* right);
+static inline int16_t agc_clip(float sample);
+
+/* Public function definitions */
+
+/* Create an AGC aiming for an average level of target dBFS */
+ices_plugin_t* agc_plugin(double target) {
+	agc_t* agc;
+
+	if (!(agc = calloc(1, sizeof(agc_t)))) {
+		ices_log_error("AGC could not allocate memory");
+		return NULL;
+	}
+
+	agc->plugin.name = "agc";
+	agc->plugin.init = agc_init;
+	agc->plugin.new_track = agc_new_track;
+	agc->plugin.process = agc_process;
+	agc->plugin.shutdown = agc_shutdown;
+	agc->plugin.options = agc_options;
+	agc->plugin.data = agc;
+
+	if (target > 0)
+		target = 0;
+	agc->target = pow(32768 * pow(10, target / 20), 2);
+	agc->maxgain = 12;
+	agc->bands = AGC_MAXBANDS;
+
+	return &agc->plugin;
+}
+
+/* Private function definitions */
+
+static int agc_options(ices_plugin_t* self, int optid, void* opt) {
+	agc_t* agc = (agc_t*) self->data;
+	int val = *((int*) opt);
+
+	switch (optid) {
+	case AGCOPT_MAXGAIN:
+		if (val < 0 || val > 40)
+			return -1;
+		agc->maxgain = val;
+		return 0;
+	case AGCOPT_BANDS:
+		if (val != 1 && val != AGC_MAXBANDS)
+			return -1;
+		agc->bands = val;
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+static int agc_init(ices_plugin_t* self) {
+	agc_t* agc = (agc_t*) self->data;
+	int i;
+
+	agc->gate = pow(32768 * pow(10, AGC_GATE / 20.0), 2);
+	agc->maxgainlin = pow(10, agc->maxgain / 20.0);
+	agc->mingain = 1 / agc->maxgainlin;
+	agc->bandrange = pow(10, AGC_BANDRANGE / 20.0);
+
+	for (i = 0; i < AGC_MAXBANDS; i++) {
+		agc->level[i] = agc->target * (agc->bands == 1 ? 1 : agc_balance[i]);
+		agc->gain[i] = 1;
+	}
+	agc_reset(agc, 44100);
+
+	ices_log_debug("AGC aiming for %.1f dBFS in %d band%s, at most %d dB gain",
+		       10 * log10(agc->target) - 20 * log10(32768), agc->bands,
+		       agc->bands == 1 ? "" : "s", agc->maxgain);
+
+	return 0;
+}
+
+/* Gains carry over from track to track: that is the point of an AGC */
+static void agc_new_track(ices_plugin_t* self, input_stream_t* source) {
+	agc_t* agc = (agc_t*) self->data;
+
+	if (source->samplerate && source->samplerate != agc->samplerate)
+		agc_reset(agc, source->samplerate);
+}
+
+static int agc_process(ices_plugin_t* self, int ilen, int16_t* il, int16_t* ir) {
+	agc_t* agc = (agc_t*) self->data;
+	float band[AGC_MAXBANDS][2][AGC_BLOCK];
+	float from[AGC_MAXBANDS];
+	double detect, ease, total, common, share, target;
+	int off, n, b;
+
+	for (off = 0; off < ilen; off += n) {
+		n = ilen - off < AGC_BLOCK ? ilen - off : AGC_BLOCK;
+
+		agc_split(agc, il + off, ir + off, n, band);
+
+		detect = 1 - exp(-n / (AGC_DETECT_TIME * agc->samplerate));
+		ease = 1 - exp(-n / (AGC_GAIN_TIME * agc->samplerate));
+		total = 0;
+		for (b = 0; b < agc->bands; b++) {
+			from[b] = agc->gain[b];
+			agc->level[b] += (agc_meansquare(band[b][0], band[b][1], n) - agc->level[b]) * detect;
+			total += agc->level[b];
+		}
+
+		if (total >= agc->gate) {
+			common = sqrt(agc->target / total);
+			if (common > agc->maxgainlin)
+				common = agc->maxgainlin;
+			else if (common < agc->mingain)
+				common = agc->mingain;
+
+			for (b = 0; b < agc->bands; b++) {
+				target = common;
+				share = agc->bands == 1 ? 1 : agc_balance[b];
+				if (agc->bands > 1 && agc->level[b] > agc->gate * share) {
+					share = sqrt(share * total / agc->level[b]);
+					if (share > agc->bandrange)
+						share = agc->bandrange;
+					else if (share < 1 / agc->bandrange)
+						share = 1 / agc->bandrange;
+					target *= share;
+				}
+				agc->gain[b] += (target - agc->gain[b]) * ease;
+			}
+		}
+
+		agc_mix(band, agc->bands, from, agc->gain, n, il + off, ir + off);
+	}
+
+	return ilen;
+}
+
+static void agc_shutdown(ices_plugin_t* self) {
+	free(self->data);
+
+	ices_log_debug("AGC shutting down");
+}
+
+/* Set up the crossovers for a samplerate */
+static void agc_reset(agc_t* agc, unsigned int samplerate) {
+	agc->samplerate = samplerate;
+	agc_lowpass(&agc->xover[0], AGC_XOVER_LOW, samplerate);
+	agc_lowpass(&agc->xover[1], AGC_XOVER_HIGH, samplerate);
+}
+
+/* Butterworth low pass coefficients, from the RBJ audio EQ cookbook */
+static void agc_lowpass(agc_biquad_t* bq, double freq, unsigned int samplerate) {
+	double w = 2 * M_PI * freq / samplerate;
+	double alpha = sin(w) / (2 * M_SQRT1_2);
+	double a0 = 1 + alpha;
+
+	bq->b0 = (1 - cos(w)) / 2 / a0;
+	bq->b1 = (1 - cos(w)) / a0;
+	bq->b2 = bq->b0;
+	bq->a1 = -2 * cos(w) / a0;
+	bq->a2 = (1 - alpha) / a0;
+	memset(bq->z1, 0, sizeof(bq->z1));
+	memset(bq->z2, 0, sizeof(bq->z2));
+}
+
+/* Split into low, mid and high (or just copy, with one band). The
+ * filters are recursive, so this is the one serial part. */
+static void agc_split(agc_t* agc, const int16_t* left, const int16_t* right,
+		      int frames, float band[][2][AGC_BLOCK]) {
+	const int16_t* in[2];
+	agc_biquad_t* lo = &agc->xover[0];
+	agc_biquad_t* hi = &agc->xover[1];
+	float x, y, rest;
+	int c, i;
+
+	in[0] = left;
+	in[1] = right;
+
+	if (agc->bands == 1) {
+		for (c = 0; c < 2; c++)
+			for (i = 0; i < frames; i++)
+				band[0][c][i] = in[c][i];
+		return;
+	}
+
+	for (c = 0; c < 2; c++) {
+		for (i = 0; i < frames; i++) {
+			x = in[c][i];
+
+			y = lo->b0 * x + lo->z1[c];
+			lo->z1[c] = lo->b1 * x - lo->a1 * y + lo->z2[c];
+			lo->z2[c] = lo->b2 * x - lo->a2 * y;
+			band[0][c][i] = y;
+			rest = x - y;
+
+			y = hi->b0 * rest + hi->z1[c];
+			hi->z1[c] = hi->b1 * rest - hi->a1 * y + hi->z2[c];
+			hi->z2[c] = hi->b2 * rest - hi->a2 * y;
+			band[1][c][i] = y;
+			band[2][c][i] = rest - y;
+		}
+	}
+}
+
+static double agc_meansquare(const float* left, const float* right, int frames) {
+	float sum = 0;
+	int i = 0;
+
+#ifdef __SSE2__
+	__m128 acc = _mm_setzero_ps();
+	float part[4];
+
+	for (; i + 4 <= frames; i += 4) {
+		__m128 l = _mm_loadu_ps(left + i);
+		__m128 r = _mm_loadu_ps(right + i);
+
+		acc = _mm_add_ps(acc, _mm_add_ps(_mm_mul_ps(l, l), _mm_mul_ps(r, r)));
+	}
+	_mm_storeu_ps(part, acc);
+	sum = part[0] + part[1] + part[2] + part[3];
+#endif
+
+	for (; i < frames; i++)
+		sum += left[i] * left[i] + right[i] * right[i];
+
+	return sum / (2.0 * frames);
+}
+
+/* Add the bands back up, ramping each from its old gain to its new one
+ * over the block */
+static void agc_mix(float band[][2][AGC_BLOCK], int bands, const float* from,
+		    const float* to, int frames, int16_t* left, int16_t* right) {
+	float step[AGC_MAXBANDS];
+	float g, l, r;
+	int b, i = 0;
+
+	for (b = 0; b < bands; b++)
+		step[b] = (to[b] - from[b]) / frames;
+
+#ifdef __SSE2__
+	for (; i + 8 <= frames; i += 8) {
+		__m128 l0 = _mm_setzero_ps();
+		__m128 l1 = _mm_setzero_ps();
+		__m128 r0 = _mm_setzero_ps();
+		__m128 r1 = _mm_setzero_ps();
+
+		for (b = 0; b < bands; b++) {
+			__m128 k = _mm_set1_ps(step[b]);
+			__m128 g0 = _mm_add_ps(_mm_set1_ps(from[b]),
+					       _mm_mul_ps(k, _mm_setr_ps(i, i + 1, i + 2, i + 3)));
+			__m128 g1 = _mm_add_ps(g0, _mm_mul_ps(k, _mm_set1_ps(4)));
+
+			l0 = _mm_add_ps(l0, _mm_mul_ps(_mm_loadu_ps(band[b][0] + i), g0));
+			l1 = _mm_add_ps(l1, _mm_mul_ps(_mm_loadu_ps(band[b][0] + i + 4), g1));
+			r0 = _mm_add_ps(r0, _mm_mul_ps(_mm_loadu_ps(band[b][1] + i), g0));
+			r1 = _mm_add_ps(r1, _mm_mul_ps(_mm_loadu_ps(band[b][1] + i + 4), g1));
+		}
+
+		_mm_storeu_si128((__m128i*) (left + i),
+				 _mm_packs_epi32(_mm_cvtps_epi32(l0), _mm_cvtps_epi32(l1)));
+		_mm_storeu_si128((__m128i*) (right + i),
+				 _mm_packs_epi32(_mm_cvtps_epi32(r0), _mm_cvtps_epi32(r1)));
+	}
+#endif
+
+	for (; i < frames; i++) {
+		l = r = 0;
+		for (b = 0; b < bands; b++) {
+			g = from[b] + step[b] * i;
+			l += band[b][0][i] * g;
+			r += band[b][1][i] * g;
+		}
+		left[i] = agc_clip(l);
+		right[i] = agc_clip(r);
+	}
+}
+
+static inline int16_t agc_clip(float sample) {
+	if (sample >= 32767)
+		return 32767;
+	if (sample <= -32768)
+		return -32768;
+
+	return (int16_t) lrintf(sample);
+}
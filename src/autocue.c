@@ -0,0 +1,459 @@
+/* autocue.c
+ * - Skip leading and trailing silence, remembering where it was
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+/* The decoded audio is measured in 10 ms windows as it is played. The
+ * first time a track is played its leading silence is skipped as it is
+ * found, and where the sound ends and where the outro starts fading are
+ * noted. If the track plays to the end these cue points are saved in
+ * BaseDirectory/ices.autocue, keyed by device, inode, size and mtime,
+ * and later plays stop at the cue out point instead of playing out the
+ * trailing silence. */
+
+#include "definitions.h"
+
+#include <math.h>
+
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+/* windows per second */
+#define AUTOCUE_RATE 100
+/* peak level below which a window is silent: -48 dBFS */
+#define AUTOCUE_SILENCE 130
+/* power relative to the track average at which it counts as fading: -20 dB */
+#define AUTOCUE_FADE 0.01
+/* never skip more than this much (s) of a track's start on the fly */
+#define AUTOCUE_MAXHEAD 30
+/* when the cache file has this many times more lines than entries,
+ * rewrite it */
+#define AUTOCUE_COMPACT 2
+
+typedef struct {
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+	int cuein;
+	int cueout;
+	int fade;
+	int used;
+} autocue_entry_t;
+
+extern ices_config_t ices_config;
+
+static autocue_entry_t* Cache = NULL;
+static size_t CacheSize = 0;
+static size_t CacheCount = 0;
+static FILE* CacheFile = NULL;
+
+/* Private function declarations */
+static void autocue_analyse(ices_autocue_t* ac, const int16_t* left,
+			    const int16_t* right, int samples);
+static void autocue_measure(const int16_t* left, const int16_t* right,
+			    int frames, float* sum, int* peak);
+static int autocue_peak(const int16_t* left, const int16_t* right, int frames);
+static int autocue_identify(input_stream_t* source, autocue_entry_t* key);
+static autocue_entry_t* autocue_lookup(const autocue_entry_t* key);
+static int autocue_insert(const autocue_entry_t* entry);
+static void autocue_load(const char* path);
+static void autocue_write(FILE* fp, const autocue_entry_t* entry);
+static size_t autocue_hash(const autocue_entry_t* key);
+
+/* Global function definitions */
+
+/* Read the cue cache and open it for appending */
+void ices_autocue_initialize(void) {
+	char path[1024];
+
+	if (!ices_config.autocue)
+		return;
+
+#ifndef HAVE_LIBLAME
+	/* every format reaches ices as PCM through LAME's decoder or not at all */
+	ices_log("AutoCue needs liblame to decode the audio, so it is off");
+	ices_config.autocue = 0;
+	return;
+#endif
+
+	snprintf(path, sizeof(path), "%s/ices.autocue", ices_config.base_directory);
+	autocue_load(path);
+
+	if (!(CacheFile = fopen(path, "a"))) {
+		ices_log("Could not open cue cache %s, cue points won't be remembered: %s",
+			 path, strerror(errno));
+		return;
+	}
+
+	ices_log_debug("Cue cache %s holds %lu tracks", path, (unsigned long) CacheCount);
+}
+
+void ices_autocue_shutdown(void) {
+	if (CacheFile) {
+		fclose(CacheFile);
+		CacheFile = NULL;
+	}
+
+	ices_util_free(Cache);
+	Cache = NULL;
+	CacheSize = CacheCount = 0;
+}
+
+/* Look the track up and get ready to play it. fadesecs is the crossfade
+ * length, if any: with a known fade start the track ends that long
+ * after it, so the crossfade covers the outro rather than the silence. */
+void ices_autocue_start(ices_autocue_t* ac, input_stream_t* source, int fadesecs) {
+	autocue_entry_t key;
+	autocue_entry_t* entry;
+
+	memset(ac, 0, sizeof(ices_autocue_t));
+	if (!ices_config.autocue)
+		return;
+
+	ac->samplerate = source->samplerate ? source->samplerate : 44100;
+	ac->window = ac->samplerate / AUTOCUE_RATE;
+	ac->head = 1;
+
+	if (autocue_identify(source, &key) < 0 || !(entry = autocue_lookup(&key)))
+		return;
+
+	ac->known = 1;
+	ac->cuein = entry->cuein;
+	ac->cueout = entry->cueout;
+	ac->fade = entry->fade;
+
+	ac->stop = ac->cueout;
+	if (fadesecs && ac->fade && ac->fade + fadesecs * 1000 < ac->stop)
+		ac->stop = ac->fade + fadesecs * 1000;
+
+	ices_log_debug("Cue points for %s: in %d ms, fade %d ms, out %d ms",
+		       source->path, ac->cuein, ac->fade, ac->cueout);
+}
+
+/* Drop silence at the start of the track and anything past the cue out
+ * point from a block of decoded audio, measuring the rest if the track
+ * wasn't known. Returns the samples left, moved to the buffer start. */
+int ices_autocue_process(ices_autocue_t* ac, int16_t* left, int16_t* right,
+			 int samples) {
+	unsigned long skip, stop;
+	int off = 0;
+	int n;
+
+	if (!ac->samplerate || ac->done)
+		return ac->done ? 0 : samples;
+
+	if (ac->head && ac->known) {
+		skip = (unsigned long) ac->cuein * ac->samplerate / 1000;
+		if (skip >= ac->frames + samples) {
+			ac->frames += samples;
+			return 0;
+		}
+		if (skip > ac->frames)
+			off = skip - ac->frames;
+		ac->head = 0;
+	} else if (ac->head) {
+		while (off < samples) {
+			n = samples - off < ac->window ? samples - off : ac->window;
+			if (autocue_peak(left + off, right + off, n) >= AUTOCUE_SILENCE
+			    || ac->frames + off >= (unsigned long) AUTOCUE_MAXHEAD * ac->samplerate) {
+				ac->head = 0;
+				ac->firstloud = ac->frames + off;
+				ices_log_debug("Skipped %lu ms of silence", ac->firstloud * 1000 / ac->samplerate);
+				break;
+			}
+			off += n;
+		}
+	}
+
+	if (off) {
+		memmove(left, left + off, (samples - off) * sizeof(int16_t));
+		memmove(right, right + off, (samples - off) * sizeof(int16_t));
+		ac->frames += off;
+		samples -= off;
+	}
+
+	if (ac->stop) {
+		stop = (unsigned long) ac->stop * ac->samplerate / 1000;
+		if (ac->frames + samples >= stop) {
+			samples = stop > ac->frames ? stop - ac->frames : 0;
+			ac->done = 1;
+			ices_log_debug("Reached cue out point at %d ms", ac->stop);
+		}
+	}
+
+	if (!ac->known && !ac->head)
+		autocue_analyse(ac, left, right, samples);
+	ac->frames += samples;
+
+	return samples;
+}
+
+/* The track played to its end: remember what was found */
+void ices_autocue_finish(ices_autocue_t* ac, input_stream_t* source) {
+	autocue_entry_t entry;
+
+	if (!ac->samplerate || ac->known || !ac->loudwindows)
+		return;
+	if (autocue_identify(source, &entry) < 0)
+		return;
+
+	entry.cuein = ac->firstloud * 1000 / ac->samplerate;
+	entry.cueout = ac->lastloud * 1000 / ac->samplerate;
+	entry.fade = ac->lastfade * 1000 / ac->samplerate;
+
+	if (autocue_insert(&entry) < 0)
+		return;
+	if (CacheFile) {
+		autocue_write(CacheFile, &entry);
+		fflush(CacheFile);
+	}
+
+	ices_log_debug("Found cue points for %s: in %d ms, fade %d ms, out %d ms",
+		       source->path, entry.cuein, entry.fade, entry.cueout);
+}
+
+/* Private function definitions */
+
+/* Feed audio into the 10 ms windows, and note each full window that has
+ * sound, or is still loud */
+static void autocue_analyse(ices_autocue_t* ac, const int16_t* left,
+			    const int16_t* right, int samples) {
+	unsigned long pos = ac->frames;
+	float power;
+	int off, n, peak;
+
+	for (off = 0; off < samples; off += n) {
+		n = ac->window - ac->wfill;
+		if (n > samples - off)
+			n = samples - off;
+
+		autocue_measure(left + off, right + off, n, &ac->wsum, &peak);
+		if (peak > ac->wpeak)
+			ac->wpeak = peak;
+		ac->wfill += n;
+		pos += n;
+
+		if (ac->wfill < ac->window)
+			continue;
+
+		if (ac->wpeak >= AUTOCUE_SILENCE) {
+			power = ac->wsum / (2 * ac->window);
+			ac->lastloud = pos;
+			ac->loudsum += power;
+			ac->loudwindows++;
+			if (power >= ac->loudsum / ac->loudwindows * AUTOCUE_FADE)
+				ac->lastfade = pos;
+		}
+
+		ac->wfill = 0;
+		ac->wsum = 0;
+		ac->wpeak = 0;
+	}
+}
+
+/* Add the sum of squares of a stretch of audio to *sum, and set *peak
+ * to its peak */
+static void autocue_measure(const int16_t* left, const int16_t* right,
+			    int frames, float* sum, int* peak) {
+	float acc = 0;
+	int i = 0;
+
+	*peak = 0;
+#ifdef __SSE2__
+	__m128 vsum = _mm_setzero_ps();
+	__m128i vmax = _mm_set1_epi16(0);
+	__m128i vmin = _mm_set1_epi16(0);
+	float part[4];
+	int16_t hi[8], lo[8];
+	int k;
+
+	for (; i + 8 <= frames; i += 8) {
+		__m128i l = _mm_loadu_si128((const __m128i*) (left + i));
+		__m128i r = _mm_loadu_si128((const __m128i*) (right + i));
+		/* halve first so that pairs of squares fit in 32 bits */
+		__m128i lh = _mm_srai_epi16(l, 1);
+		__m128i rh = _mm_srai_epi16(r, 1);
+
+		vsum = _mm_add_ps(vsum, _mm_cvtepi32_ps(_mm_madd_epi16(lh, lh)));
+		vsum = _mm_add_ps(vsum, _mm_cvtepi32_ps(_mm_madd_epi16(rh, rh)));
+		vmax = _mm_max_epi16(vmax, _mm_max_epi16(l, r));
+		vmin = _mm_min_epi16(vmin, _mm_min_epi16(l, r));
+	}
+
+	_mm_storeu_ps(part, vsum);
+	acc = 4 * (part[0] + part[1] + part[2] + part[3]);
+	_mm_storeu_si128((__m128i*) hi, vmax);
+	_mm_storeu_si128((__m128i*) lo, vmin);
+	for (k = 0; k < 8; k++) {
+		if (hi[k] > *peak)
+			*peak = hi[k];
+		if (-lo[k] > *peak)
+			*peak = -lo[k];
+	}
+#endif
+
+	for (; i < frames; i++) {
+		acc += (float) left[i] * left[i] + (float) right[i] * right[i];
+		if (abs(left[i]) > *peak)
+			*peak = abs(left[i]);
+		if (abs(right[i]) > *peak)
+			*peak = abs(right[i]);
+	}
+
+	*sum += acc;
+}
+
+static int autocue_peak(const int16_t* left, const int16_t* right, int frames) {
+	float sum = 0;
+	int peak = 0;
+
+	autocue_measure(left, right, frames, &sum, &peak);
+
+	return peak;
+}
+
+/* Fill in the identity of the file being played. Fails for pipes and
+ * the like, which can't be cached. */
+static int autocue_identify(input_stream_t* source, autocue_entry_t* key) {
+	struct stat st;
+
+	if (source->fd < 0 || fstat(source->fd, &st) < 0 || !S_ISREG(st.st_mode))
+		return -1;
+
+	memset(key, 0, sizeof(autocue_entry_t));
+	key->dev = st.st_dev;
+	key->ino = st.st_ino;
+	key->size = st.st_size;
+	key->mtime = st.st_mtime;
+
+	return 0;
+}
+
+static autocue_entry_t* autocue_lookup(const autocue_entry_t* key) {
+	size_t i;
+
+	if (!CacheSize)
+		return NULL;
+
+	for (i = autocue_hash(key) & (CacheSize - 1); Cache[i].used;
+	     i = (i + 1) & (CacheSize - 1))
+		if (Cache[i].ino == key->ino && Cache[i].dev == key->dev
+		    && Cache[i].size == key->size && Cache[i].mtime == key->mtime)
+			return &Cache[i];
+
+	return NULL;
+}
+
+/* Add or replace an entry, growing the table to keep it under half full */
+static int autocue_insert(const autocue_entry_t* entry) {
+	autocue_entry_t* old = Cache;
+	autocue_entry_t* slot;
+	size_t oldsize = CacheSize;
+	size_t i;
+
+	if ((slot = autocue_lookup(entry))) {
+		*slot = *entry;
+		slot->used = 1;
+		return 0;
+	}
+
+	if ((CacheCount + 1) * 2 > CacheSize) {
+		CacheSize = CacheSize ? CacheSize * 2 : 1024;
+		if (!(Cache = calloc(CacheSize, sizeof(autocue_entry_t)))) {
+			ices_log_error("Could not grow cue cache");
+			Cache = old;
+			CacheSize = oldsize;
+			return -1;
+		}
+		CacheCount = 0;
+		for (i = 0; i < oldsize; i++)
+			if (old[i].used)
+				autocue_insert(&old[i]);
+		ices_util_free(old);
+	}
+
+	for (i = autocue_hash(entry) & (CacheSize - 1); Cache[i].used;
+	     i = (i + 1) & (CacheSize - 1))
+		;
+	Cache[i] = *entry;
+	Cache[i].used = 1;
+	CacheCount++;
+
+	return 0;
+}
+
+/* Read the cache file; later lines override earlier ones. If it has
+ * grown too long with outdated lines it is rewritten. */
+static void autocue_load(const char* path) {
+	char tmppath[1024 + sizeof(".tmp")];
+	char line[256];
+	autocue_entry_t entry;
+	unsigned long dev, ino;
+	long long size, mtime;
+	unsigned long lines = 0;
+	size_t i;
+	FILE* fp;
+
+	if (!(fp = fopen(path, "r")))
+		return;
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "%lu %lu %lld %lld %d %d %d", &dev, &ino, &size,
+			   &mtime, &entry.cuein, &entry.cueout, &entry.fade) != 7)
+			continue;
+		entry.dev = dev;
+		entry.ino = ino;
+		entry.size = size;
+		entry.mtime = mtime;
+		autocue_insert(&entry);
+		lines++;
+	}
+	fclose(fp);
+
+	if (lines <= CacheCount * AUTOCUE_COMPACT)
+		return;
+
+	snprintf(tmppath, sizeof(tmppath), "%s.tmp", path);
+	if (!(fp = fopen(tmppath, "w")))
+		return;
+	for (i = 0; i < CacheSize; i++)
+		if (Cache[i].used)
+			autocue_write(fp, &Cache[i]);
+	if (fclose(fp) == 0 && rename(tmppath, path) == 0)
+		ices_log_debug("Compacted cue cache from %lu to %lu lines", lines,
+			       (unsigned long) CacheCount);
+	else
+		remove(tmppath);
+}
+
+static void autocue_write(FILE* fp, const autocue_entry_t* entry) {
+	fprintf(fp, "%lu %lu %lld %lld %d %d %d\n", (unsigned long) entry->dev,
+		(unsigned long) entry->ino, (long long) entry->size,
+		(long long) entry->mtime, entry->cuein, entry->cueout, entry->fade);
+}
+
+static size_t autocue_hash(const autocue_entry_t* key) {
+	uint64_t h = (uint64_t) key->ino;
+
+	h = (h ^ (uint64_t) key->dev) * 0x9e3779b97f4a7c15ULL;
+	h = (h ^ (uint64_t) key->size) * 0x9e3779b97f4a7c15ULL;
+	h = (h ^ (uint64_t) key->mtime) * 0x9e3779b97f4a7c15ULL;
+
+	return (size_t) (h >> 32);
+}
@@ -0,0 +1,59 @@
+/* autocue.h
+ * - Silence detection and cue point cache declarations for ices
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#ifndef _ICES_AUTOCUE_H
+#define _ICES_AUTOCUE_H
+
+/* Cue points of the track being played, and the analysis of it */
+typedef struct {
+	int known;          /* cue points came from the cache */
+	int cuein;          /* ms of silence at the start */
+	int cueout;         /* ms at which the audio ends */
+	int fade;           /* ms at which the outro starts fading */
+	int stop;           /* ms at which to end the track, 0 to play it all */
+
+	unsigned int samplerate;
+	unsigned long frames;   /* decoded so far, including skipped ones */
+	int head;               /* still looking for the first sound */
+	int done;               /* reached cueout */
+
+	/* the current analysis window */
+	int window;
+	int wfill;
+	float wsum;
+	int wpeak;
+
+	/* findings, in frames */
+	unsigned long firstloud;
+	unsigned long lastloud;
+	unsigned long lastfade;
+	double loudsum;
+	unsigned long loudwindows;
+} ices_autocue_t;
+
+/* Public function declarations */
+void ices_autocue_initialize(void);
+void ices_autocue_shutdown(void);
+void ices_autocue_start(ices_autocue_t* ac, input_stream_t* source,
+			int fadesecs);
+int ices_autocue_process(ices_autocue_t* ac, int16_t* left, int16_t* right,
+			 int samples);
+void ices_autocue_finish(ices_autocue_t* ac, input_stream_t* source);
+
+#endif
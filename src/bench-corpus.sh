@@ -0,0 +1,57 @@
+#!/bin/sh
+# Make a corpus of test tracks for ices-bench in each format ices reads:
+# MP3, Ogg Vorbis, FLAC and MP4/AAC, all from the same synthetic stereo
+# signal. Uses ffmpeg if there is one, otherwise sox and the lame,
+# oggenc and flac encoders, whichever are installed. Formats that can't
+# be made are skipped.
+#
+# Usage: bench-corpus.sh [directory] [seconds per track] [tracks per format]
+
+dir=${1:-bench-corpus}
+secs=${2:-120}
+tracks=${3:-3}
+
+mkdir -p "$dir" || exit 1
+
+have() {
+	command -v "$1" >/dev/null 2>&1
+}
+
+# a tone gliding up and down against a steady one, with a little noise
+synth() {
+	if have ffmpeg; then
+		ffmpeg -loglevel error -y -f lavfi -i \
+			"aevalsrc=0.4*sin(2*PI*(330+110*sin(2*PI*t/7)+$1*40)*t)+0.05*(random(0)-0.5)|0.3*sin(2*PI*(220+$1*30)*t)+0.05*(random(1)-0.5):s=44100:d=$secs" \
+			"$2"
+	elif have sox; then
+		sox -n -r 44100 -b 16 -c 2 "$2" synth "$secs" sine "$((330 + $1 * 40))" sine "$((220 + $1 * 30))" vol 0.4
+	else
+		return 1
+	fi
+}
+
+made=0
+i=1
+while [ "$i" -le "$tracks" ]; do
+	wav="$dir/.track$i.wav"
+	if ! synth "$i" "$wav"; then
+		echo "bench-corpus: need ffmpeg or sox to make test tracks" >&2
+		exit 1
+	fi
+
+	if have ffmpeg; then
+		ffmpeg -loglevel error -y -i "$wav" -c:a libmp3lame -b:a 128k "$dir/track$i.mp3" && made=$((made + 1))
+		ffmpeg -loglevel error -y -i "$wav" -c:a libvorbis -q:a 4 "$dir/track$i.ogg" && made=$((made + 1))
+		ffmpeg -loglevel error -y -i "$wav" -c:a flac "$dir/track$i.flac" && made=$((made + 1))
+		ffmpeg -loglevel error -y -i "$wav" -c:a aac -b:a 128k "$dir/track$i.m4a" && made=$((made + 1))
+	else
+		have lame && lame --quiet -b 128 "$wav" "$dir/track$i.mp3" && made=$((made + 1))
+		have oggenc && oggenc --quiet -q 4 -o "$dir/track$i.ogg" "$wav" && made=$((made + 1))
+		have flac && flac --silent -f -o "$dir/track$i.flac" "$wav" && made=$((made + 1))
+	fi
+
+	rm -f "$wav"
+	i=$((i + 1))
+done
+
+echo "bench-corpus: $made tracks of $secs s in $dir"
@@ -0,0 +1,303 @@
+/* control.c
+ * - Requests and commands over a local control socket
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+/* With Execution/ControlSocket set, ices listens on that UNIX socket for
+ * commands, one per line:
+ *
+ *   push <priority> <path>   queue a track, higher priorities first
+ *   insert <path>            queue a track ahead of everything queued
+ *   remove <id>              drop a queued track
+ *   list                     the queue, next first
+ *   skip                     go on to the next track
+ *   status                   what is playing, what is queued, and for
+ *                            each stream how many sends of this track
+ *                            were behind and the 99th percentile and
+ *                            most they were late by
+ *   reload                   as SIGHUP
+ *   dump                     write out the flight recorder
+ *   trace start [<file>]     write a Chrome trace of the pipeline
+ *   trace stop               and finish it
+ *
+ * Each answer is some lines of data followed by "OK" or "ERR <reason>".
+ * Queued tracks are played before anything from the playlist module.
+ *
+ * Commands, and signals, are only acted on from ices_control_poll(),
+ * which the stream loop calls between buffers. The socket and its
+ * clients are looked after by listener.c, which never waits for them. */
+
+#include "definitions.h"
+
+#include <limits.h>
+
+/* most queued tracks */
+#define CONTROL_QUEUE 1000
+/* most output kept for a client that isn't reading */
+#define CONTROL_OUTPUT (1024 * 1024)
+/* the priority of inserted tracks, above anything pushed */
+#define CONTROL_INSERT INT_MAX
+
+typedef struct {
+	char* path;
+	int priority;
+	int id;
+} control_request_t;
+
+extern ices_config_t ices_config;
+
+static ices_listener_t Listener = { -1 };
+
+/* highest priority first, in the order they came within one */
+static control_request_t Queue[CONTROL_QUEUE];
+static int QueueLen = 0;
+static int NextId = 1;
+
+static char* Playing = NULL;
+
+/* Private function declarations */
+static int control_input(ices_client_t* client);
+static void control_command(ices_client_t* client, char* line);
+static void control_queue(ices_client_t* client, int priority, const char* path);
+
+/* Public function definitions */
+
+/* Start listening on Execution/ControlSocket, if it is set */
+void ices_control_initialize(void) {
+	const char* path = ices_config.control;
+
+	if (!path || !*path)
+		return;
+
+	Listener.what = "control";
+	Listener.input = control_input;
+	Listener.outmax = CONTROL_OUTPUT;
+	/* only we get to tell ices what to do */
+	if (ices_listener_open_unix(&Listener, path, 1) < 0)
+		return;
+
+	ices_log_debug("Listening for commands on %s", path);
+}
+
+void ices_control_shutdown(void) {
+	ices_listener_close(&Listener);
+
+	while (QueueLen)
+		ices_util_free(Queue[--QueueLen].path);
+
+	ices_util_free(Playing);
+	Playing = NULL;
+}
+
+/* Act on pending signals and commands without waiting for anything */
+void ices_control_poll(void) {
+	ices_metrics_poll();
+	ices_signals_dispatch();
+	ices_listener_poll(&Listener);
+}
+
+/* Take the next queued track, if there is one. Returns 1 if entry was
+ * filled in, 0 if the playlist should be asked. */
+int ices_control_get_request(ices_lookahead_entry_t* entry) {
+	if (!QueueLen)
+		return 0;
+
+	memset(entry, 0, sizeof(ices_lookahead_entry_t));
+	entry->path = Queue[0].path;
+	QueueLen--;
+	memmove(Queue, Queue + 1, QueueLen * sizeof(control_request_t));
+
+	ices_log_debug("Playing request %s", entry->path);
+
+	return 1;
+}
+
+/* Note what the stream loop has started playing, for status */
+void ices_control_playing(const char* path) {
+	ices_util_free(Playing);
+	Playing = ices_util_strdup(path);
+}
+
+/* Private function definitions */
+
+/* Run the whole lines the client has sent */
+static int control_input(ices_client_t* client) {
+	char* line;
+	char* end;
+
+	for (line = client->in; (end = strchr(line, '\n')); line = end + 1) {
+		*end = '\0';
+		if (end > line && end[-1] == '\r')
+			end[-1] = '\0';
+		control_command(client, line);
+	}
+
+	client->inlen -= line - client->in;
+	memmove(client->in, line, client->inlen);
+	if (client->inlen == sizeof(client->in) - 1) {
+		ices_client_printf(client, "ERR line too long\n");
+		client->done = 1;
+	}
+
+	return 0;
+}
+
+static void control_command(ices_client_t* client, char* line) {
+	ices_stream_t* stream;
+	const char* path;
+	char* cmd;
+	char* arg;
+	char* end;
+	long priority;
+	int i;
+
+	while (isspace((unsigned char) *line))
+		line++;
+	cmd = line;
+	while (*line && !isspace((unsigned char) *line))
+		line++;
+	if (*line)
+		*line++ = '\0';
+	while (isspace((unsigned char) *line))
+		line++;
+	arg = line;
+
+	if (!*cmd)
+		return;
+
+	if (!strcmp(cmd, "push")) {
+		priority = strtol(arg, &end, 10);
+		if (end == arg || !isspace((unsigned char) *end)) {
+			ices_client_printf(client, "ERR usage: push <priority> <path>\n");
+			return;
+		}
+		while (isspace((unsigned char) *end))
+			end++;
+		if (priority >= CONTROL_INSERT)
+			priority = CONTROL_INSERT - 1;
+		else if (priority < INT_MIN)
+			priority = INT_MIN;
+		control_queue(client, (int) priority, end);
+	} else if (!strcmp(cmd, "insert")) {
+		control_queue(client, CONTROL_INSERT, arg);
+	} else if (!strcmp(cmd, "remove")) {
+		int id = atoi(arg);
+
+		for (i = 0; i < QueueLen && Queue[i].id != id; i++)
+			;
+		if (i == QueueLen) {
+			ices_client_printf(client, "ERR no request %s\n", arg);
+			return;
+		}
+		ices_util_free(Queue[i].path);
+		QueueLen--;
+		memmove(Queue + i, Queue + i + 1, (QueueLen - i) * sizeof(control_request_t));
+		ices_client_printf(client, "OK\n");
+	} else if (!strcmp(cmd, "list")) {
+		for (i = 0; i < QueueLen; i++) {
+			if (Queue[i].priority == CONTROL_INSERT)
+				ices_client_printf(client, "%d insert %s\n", Queue[i].id, Queue[i].path);
+			else
+				ices_client_printf(client, "%d %d %s\n", Queue[i].id, Queue[i].priority,
+						   Queue[i].path);
+		}
+		ices_client_printf(client, "OK\n");
+	} else if (!strcmp(cmd, "skip")) {
+		ices_log_debug("Skipping to the next track on request");
+		ices_stream_next();
+		ices_client_printf(client, "OK\n");
+	} else if (!strcmp(cmd, "status")) {
+		ices_client_printf(client, "playing %s\n", Playing ? Playing : "");
+		ices_client_printf(client, "queued %d\n", QueueLen);
+		for (stream = ices_config.streams; stream; stream = stream->next)
+			ices_client_printf(client, "stream %s %s behind %u/%u late %.3f %.3f\n",
+					   ices_util_nullcheck(stream->mount),
+					   stream->conn
+					   && shout_get_connected(stream->conn) == SHOUTERR_CONNECTED
+					   ? "connected" : "disconnected",
+					   stream->track_behind, stream->track_sends,
+					   ices_histogram_percentile(&stream->track_lateness, 99),
+					   stream->track_lateness.max);
+		ices_client_printf(client, "OK\n");
+	} else if (!strcmp(cmd, "dump")) {
+		if ((path = ices_flight_dump("dump command")))
+			ices_client_printf(client, "%s\nOK\n", path);
+		else
+			ices_client_printf(client, "ERR %s\n", ices_log_get_error());
+	} else if (!strcmp(cmd, "trace")) {
+		for (end = arg; *end && !isspace((unsigned char) *end); end++);
+		if (*end)
+			*end++ = '\0';
+		while (isspace((unsigned char) *end))
+			end++;
+		if (!strcmp(arg, "start")) {
+			if (ices_trace_open(*end ? end : NULL) < 0)
+				ices_client_printf(client, "ERR %s\n", ices_log_get_error());
+			else
+				ices_client_printf(client, "%s\nOK\n", ices_trace_filename());
+		} else if (!strcmp(arg, "stop")) {
+			ices_trace_close();
+			ices_client_printf(client, "OK\n");
+		} else
+			ices_client_printf(client, "ERR usage: trace start [<file>] | trace stop\n");
+	} else if (!strcmp(cmd, "reload")) {
+		ices_log_debug("Cycling logfiles and reloading playlist on request...");
+		ices_log_reopen_logfile();
+		ices_playlist_reload();
+		ices_client_printf(client, "OK\n");
+	} else
+		ices_client_printf(client, "ERR unknown command %s\n", cmd);
+}
+
+/* Queue path after everything of the same or higher priority, or in
+ * front of everything for an insert */
+static void control_queue(ices_client_t* client, int priority, const char* path) {
+	struct stat st;
+	int i;
+
+	if (!*path) {
+		ices_client_printf(client, "ERR no path given\n");
+		return;
+	}
+	if (stat(path, &st) < 0) {
+		ices_client_printf(client, "ERR %s: %s\n", path, strerror(errno));
+		return;
+	}
+	if (!S_ISREG(st.st_mode)) {
+		ices_client_printf(client, "ERR %s: not a regular file\n", path);
+		return;
+	}
+	if (QueueLen == CONTROL_QUEUE) {
+		ices_client_printf(client, "ERR the queue is full\n");
+		return;
+	}
+
+	if (priority == CONTROL_INSERT)
+		i = 0;
+	else
+		for (i = 0; i < QueueLen && Queue[i].priority >= priority; i++)
+			;
+
+	memmove(Queue + i + 1, Queue + i, (QueueLen - i) * sizeof(control_request_t));
+	Queue[i].path = ices_util_strdup(path);
+	Queue[i].priority = priority;
+	Queue[i].id = NextId++;
+	QueueLen++;
+
+	ices_log_debug("Queued request %d for %s at position %d", Queue[i].id, path, i + 1);
+	ices_client_printf(client, "%d\nOK\n", Queue[i].id);
+}
@@ -0,0 +1,30 @@
+/* control.h
+ * - Control socket and request queue declarations for ices
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#ifndef _ICES_CONTROL_H
+#define _ICES_CONTROL_H
+
+/* Public function declarations */
+void ices_control_initialize(void);
+void ices_control_shutdown(void);
+void ices_control_poll(void);
+int ices_control_get_request(ices_lookahead_entry_t* entry);
+void ices_control_playing(const char* path);
+
+#endif
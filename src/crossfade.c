@@ -24,53 +24,77 @@
 
 #include "definitions.h"
 
-static int cf_init(void);
-static void cf_new_track(input_stream_t *source);
-static int cf_process(int ilen, int16_t* il, int16_t* ir);
-static void cf_shutdown(void);
-static int cf_options(int optid, void *opt);
-
-static int resample(unsigned int oldrate, unsigned int newrate);
-
-static ices_plugin_t Crossfader = {
-	"crossfade",
-
-	cf_init,
-	cf_new_track,
-	cf_process,
-	cf_shutdown,
-	cf_options,
-
-	NULL
-};
-
-static int Fadelen;
-static int FadeSamples;
-static int FadeMinlen = 10;
-static int FadeCrossmix = 0;
-static int16_t* FL = NULL;
-static int16_t* FR = NULL;
-static int16_t* Swap = NULL;
-static int fpos = 0;
-static int flen = 0;
-
-static int NewTrack = 0;
+static int cf_init(ices_plugin_t *self);
+static void cf_new_track(ices_plugin_t *self, input_stream_t *source);
+static int cf_process(ices_plugin_t *self, int ilen, int16_t* il, int16_t* ir);
+static void cf_shutdown(ices_plugin_t *self);
+static int cf_options(ices_plugin_t *self, int optid, void *opt);
+
+static int resample(ices_plugin_t *self, unsigned int oldrate, unsigned int newrate);
+
+/* per-instance fader state, so that each stream can fade on its own */
+typedef struct {
+	ices_plugin_t plugin;
+
+	int Fadelen;
+	int FadeSamples;
+	int FadeMinlen;
+	int FadeCrossmix;
+	int16_t* FL;
+	int16_t* FR;
+	int16_t* Swap;
+	int fpos;
+	int flen;
+
+	int NewTrack;
+	int skipnext;
+	unsigned int lastrate;
+} crossfade_t;
 
 /* public functions */
 ices_plugin_t *crossfade_plugin(int secs) {
-	Fadelen = secs;
-	FadeSamples = secs * 44100;
+	crossfade_t *cf;
 
-	return &Crossfader;
+	if (!(cf = calloc(1, sizeof(crossfade_t)))) {
+		ices_log_error("Crossfader could not allocate memory");
+		return NULL;
+	}
+
+	cf->plugin.name = "crossfade";
+	cf->plugin.init = cf_init;
+	cf->plugin.new_track = cf_new_track;
+	cf->plugin.process = cf_process;
+	cf->plugin.shutdown = cf_shutdown;
+	cf->plugin.options = cf_options;
+	cf->plugin.data = cf;
+
+	cf->Fadelen = secs;
+	cf->FadeSamples = secs * 44100;
+	cf->FadeMinlen = 10;
+
+	return &cf->plugin;
+}
+
+/* Length of the longest crossfade in a chain, or 0 if it has none */
+int crossfade_seconds(ices_plugin_t *chain) {
+	int secs = 0;
+
+	for (; chain; chain = chain->next)
+		if (chain->init == cf_init && ((crossfade_t *) chain->data)->Fadelen > secs)
+			secs = ((crossfade_t *) chain->data)->Fadelen;
+
+	return secs;
 }
 
-static int cf_options(int optid, void *opt) {
+static int cf_options(ices_plugin_t *self, int optid, void *opt) {
+	crossfade_t *cf = (crossfade_t *) self->data;
+
 	switch (optid) {
 	case CFOPT_FADEMINLEN:
-		FadeMinlen = *( (int *) opt );
+		cf->FadeMinlen = *( (int *) opt );
 		return 0;
 	case CFOPT_CROSSMIX:
-		FadeCrossmix = *( (int *) opt );
+		cf->FadeCrossmix = *( (int *) opt );
 		return 0;
 	default:
 		return -1;
@@ -79,54 +103,59 @@ static int cf_options(int optid, void *opt) {
 
 
 /* private functions */
-static int cf_init(void) {
-	if (!(FL = malloc(FadeSamples * 2)))
+static int cf_init(ices_plugin_t *self) {
+	crossfade_t *cf = (crossfade_t *) self->data;
+
+	if (!(cf->FL = malloc(cf->FadeSamples * 2)))
 		goto err;
-	if (!(FR = malloc(FadeSamples * 2)))
+	if (!(cf->FR = malloc(cf->FadeSamples * 2)))
 		goto err;
-	if (!(Swap = malloc(FadeSamples * 2)))
+	if (!(cf->Swap = malloc(cf->FadeSamples * 2)))
 		goto err;
 
-	ices_log_debug("Crossfading %d seconds between tracks of at least %d seconds", Fadelen, FadeMinlen);
+	ices_log_debug("Crossfading %d seconds between tracks of at least %d seconds", cf->Fadelen, cf->FadeMinlen);
 	return 0;
 
  err:
+	/* the caller shuts us down, which releases whatever we did get */
 	ices_log_error("Crossfader could not allocate memory");
-	cf_shutdown();
 	return -1;
 }
 
-static void cf_new_track(input_stream_t *source) {
-	static int skipnext = 0;
-	static input_stream_t lasttrack;
+static void cf_new_track(ices_plugin_t *self, input_stream_t *source) {
+	crossfade_t *cf = (crossfade_t *) self->data;
 	int filesecs;
 
-	if (lasttrack.samplerate && lasttrack.samplerate != source->samplerate) {
-		if (resample(lasttrack.samplerate, source->samplerate) < 0)
-			skipnext = 1;
+	if (cf->lastrate && cf->lastrate != source->samplerate) {
+		if (resample(self, cf->lastrate, source->samplerate) < 0)
+			cf->skipnext = 1;
 	}
 
-	memcpy(&lasttrack, source, sizeof(lasttrack));
+	cf->lastrate = source->samplerate;
 
 	/* turn off crossfading for tracks less than twice the length of the fade */
-	if (skipnext) {
-		skipnext = 0;
+	if (cf->skipnext) {
+		cf->skipnext = 0;
 		return;
 	}
 
 	if (source->filesize && source->bitrate) {
 		filesecs = source->filesize / (source->bitrate * 128);
-		if (filesecs < FadeMinlen || filesecs <= Fadelen * 2) {
+		if (filesecs < cf->FadeMinlen || filesecs <= cf->Fadelen * 2) {
 			ices_log_debug("crossfade: not fading short track of %d secs", filesecs);
-			skipnext = 1;
+			cf->skipnext = 1;
 			return;
 		}
 	}
 
-	NewTrack = FadeSamples;
+	cf->NewTrack = cf->FadeSamples;
 }
 
-static int cf_process(int ilen, int16_t* il, int16_t* ir) {
+static int cf_process(ices_plugin_t *self, int ilen, int16_t* il, int16_t* ir) {
+	crossfade_t *cf = (crossfade_t *) self->data;
+	int16_t* FL = cf->FL;
+	int16_t* FR = cf->FR;
+	int FadeSamples = cf->FadeSamples;
 	int i, j, clen;
 	float weight;
 	int vmin = -32768;
@@ -134,72 +163,72 @@ static int cf_process(int ilen, int16_t* il, int16_t* ir) {
 
 	i = 0;
 	/* if the buffer is not full, don't attempt to crossfade, just fill it */
-	if (flen < FadeSamples)
-		NewTrack = 0;
+	if (cf->flen < FadeSamples)
+		cf->NewTrack = 0;
 
-	if (FadeCrossmix) {
+	if (cf->FadeCrossmix) {
 		/* crossmix the streams */
-		while (ilen && NewTrack > 0) {
+		while (ilen && cf->NewTrack > 0) {
 			/* Don't crossfade, crossmix instead - keep track of the values */
 			/* for a sample frame so we don't get quirks in the stream.     */
 			
-			if (FL[fpos] >= 0 && il[i] >= 0 && ((FL[fpos] + il[i]) >= (vmax-1)))
+			if (FL[cf->fpos] >= 0 && il[i] >= 0 && ((FL[cf->fpos] + il[i]) >= (vmax-1)))
 				il[i] = vmax;
-			else if (FL[fpos] <= 0 && il[i] <= 0 && ((FL[fpos] + il[i]) <= (vmin+1)))
+			else if (FL[cf->fpos] <= 0 && il[i] <= 0 && ((FL[cf->fpos] + il[i]) <= (vmin+1)))
 				il[i] = vmin;
-			else il[i] = FL[fpos] + il[i];
+			else il[i] = FL[cf->fpos] + il[i];
 			
-			if (FR[fpos] >= 0 && ir[i] >= 0 && ((FR[fpos] + ir[i]) >= (vmax-1)))
+			if (FR[cf->fpos] >= 0 && ir[i] >= 0 && ((FR[cf->fpos] + ir[i]) >= (vmax-1)))
 				ir[i] = vmax;
-			else if (FR[fpos] <= 0 && ir[i] <= 0 && ((FR[fpos] + ir[i]) <= (vmin+1)))
+			else if (FR[cf->fpos] <= 0 && ir[i] <= 0 && ((FR[cf->fpos] + ir[i]) <= (vmin+1)))
 				ir[i] = vmin;
-			else ir[i] = FR[fpos] + ir[i];
+			else ir[i] = FR[cf->fpos] + ir[i];
 			
 			i++;
-			fpos = (fpos + 1) % FadeSamples;
+			cf->fpos = (cf->fpos + 1) % FadeSamples;
 			ilen--;
-			NewTrack--;
-			if (!NewTrack)
-				flen = 0;
+			cf->NewTrack--;
+			if (!cf->NewTrack)
+				cf->flen = 0;
 		}
 
 	} else {
 		/* crossfade the streams */
-		while (ilen && NewTrack > 0) {
-			weight = (float) NewTrack / FadeSamples;
-			il[i] = FL[fpos] * weight + il[i] * (1 - weight);
-			ir[i] = FR[fpos] * weight + ir[i] * (1 - weight);
+		while (ilen && cf->NewTrack > 0) {
+			weight = (float) cf->NewTrack / FadeSamples;
+			il[i] = FL[cf->fpos] * weight + il[i] * (1 - weight);
+			ir[i] = FR[cf->fpos] * weight + ir[i] * (1 - weight);
 			i++;
-			fpos = (fpos + 1) % FadeSamples;
+			cf->fpos = (cf->fpos + 1) % FadeSamples;
 			ilen--;
-			NewTrack--;
-			if (!NewTrack)
-				flen = 0;
+			cf->NewTrack--;
+			if (!cf->NewTrack)
+				cf->flen = 0;
 		}
 	}
 
 	j = i;
-	while (ilen && flen < FadeSamples) {
-		clen = ilen < (FadeSamples - flen) ? ilen : (FadeSamples - flen);
-		if (FadeSamples - fpos < clen)
-			clen = FadeSamples - fpos;
-		memcpy(FL + fpos, il + j, clen * 2);
-		memcpy(FR + fpos, ir + j, clen * 2);
-		fpos = (fpos + clen) % FadeSamples;
+	while (ilen && cf->flen < FadeSamples) {
+		clen = ilen < (FadeSamples - cf->flen) ? ilen : (FadeSamples - cf->flen);
+		if (FadeSamples - cf->fpos < clen)
+			clen = FadeSamples - cf->fpos;
+		memcpy(FL + cf->fpos, il + j, clen * 2);
+		memcpy(FR + cf->fpos, ir + j, clen * 2);
+		cf->fpos = (cf->fpos + clen) % FadeSamples;
 		j += clen;
-		flen += clen;
+		cf->flen += clen;
 		ilen -= clen;
 	}
 
 	while (ilen) {
-		clen = ilen < (FadeSamples - fpos) ? ilen : FadeSamples - fpos;
-		memcpy(Swap, il + j, clen * 2);
-		memcpy(il + i, FL + fpos, clen * 2);
-		memcpy(FL + fpos, Swap, clen * 2);
-		memcpy(Swap, ir + j, clen * 2);
-		memcpy(ir + i, FR + fpos, clen * 2);
-		memcpy(FR + fpos, Swap, clen * 2);
-		fpos = (fpos + clen) % FadeSamples;
+		clen = ilen < (FadeSamples - cf->fpos) ? ilen : FadeSamples - cf->fpos;
+		memcpy(cf->Swap, il + j, clen * 2);
+		memcpy(il + i, FL + cf->fpos, clen * 2);
+		memcpy(FL + cf->fpos, cf->Swap, clen * 2);
+		memcpy(cf->Swap, ir + j, clen * 2);
+		memcpy(ir + i, FR + cf->fpos, clen * 2);
+		memcpy(FR + cf->fpos, cf->Swap, clen * 2);
+		cf->fpos = (cf->fpos + clen) % FadeSamples;
 		i += clen;
 		j += clen;
 		ilen -= clen;
@@ -208,28 +237,24 @@ static int cf_process(int ilen, int16_t* il, int16_t* ir) {
 	return i;
 }
 
-static void cf_shutdown(void) {
-	if (FL) {
-		free(FL);
-		FL = NULL;
-	}
-	if (FR) {
-		free(FR);
-		FR = NULL;
-	}
-	if (Swap) {
-		free(Swap);
-		Swap = NULL;
-	}
+/* releases the instance too: don't touch self afterwards */
+static void cf_shutdown(ices_plugin_t *self) {
+	crossfade_t *cf = (crossfade_t *) self->data;
+
+	ices_util_free(cf->FL);
+	ices_util_free(cf->FR);
+	ices_util_free(cf->Swap);
+	free(cf);
 
 	ices_log_debug("Crossfader shutting down");
 }
 
-static int resample(unsigned int oldrate, unsigned int newrate) {
+static int resample(ices_plugin_t *self, unsigned int oldrate, unsigned int newrate) {
+	crossfade_t *cf = (crossfade_t *) self->data;
 	int16_t* left;
 	int16_t* right;
 	int16_t* newswap;
-	unsigned int newsize = Fadelen * newrate;
+	unsigned int newsize = cf->Fadelen * newrate;
 	unsigned int newlen;
 	int i;
 	int off;
@@ -250,29 +275,29 @@ static int resample(unsigned int oldrate, unsigned int newrate) {
 
 	i = 0;
 	eps = 0;
-	off = (fpos + FadeSamples - flen) % FadeSamples;
-	newlen = flen * (float) newrate / oldrate;
+	off = (cf->fpos + cf->FadeSamples - cf->flen) % cf->FadeSamples;
+	newlen = cf->flen * (float) newrate / oldrate;
 	/* the trusty Bresenham algorithm */
 	while (i < newlen) {
-		left[i] = FL[off];
-		right[i] = FR[off];
+		left[i] = cf->FL[off];
+		right[i] = cf->FR[off];
 		eps += oldrate;
 		while (eps * 2 >= (int) newrate) {
-			off = (off + 1) % FadeSamples;
+			off = (off + 1) % cf->FadeSamples;
 			eps -= newrate;
 		}
 		i++;
 	}
 
-	free(FL);
-	free(FR);
-	free(Swap);
-	FL = left;
-	FR = right;
-	Swap = newswap;
-	FadeSamples = newsize;
-	flen = newlen;
-	fpos = i % FadeSamples;
+	free(cf->FL);
+	free(cf->FR);
+	free(cf->Swap);
+	cf->FL = left;
+	cf->FR = right;
+	cf->Swap = newswap;
+	cf->FadeSamples = newsize;
+	cf->flen = newlen;
+	cf->fpos = i % cf->FadeSamples;
 
 	return 0;
 }
@@ -20,12 +20,24 @@
 
 #include "definitions.h"
 #include "metadata.h"
+#include "ices_status.h"
+
+#include <sys/mman.h>
+#include <time.h>
 
 extern ices_config_t ices_config;
 
 char *ices_cue_filename = NULL;
 static int ices_cue_lineno = 0;
 
+/* the status file, mapped */
+static ices_status_t* Status = NULL;
+static int StatusTried = 0;
+/* a new track is starting, so the names need writing */
+static int NewTrack = 1;
+/* when the text cue file was last written */
+static time_t CueWritten = 0;
+
 /* Syntax of cue file
  * filename
  * size
@@ -35,47 +47,61 @@ static int ices_cue_lineno = 0;
  * current line in playlist
  * artist
  * songname
+ *
+ * It is rewritten when a track starts and then at most once a second.
+ * ices.status has the same and more, kept current after every buffer,
+ * see ices_status.h.
  */
 
+/* Private function declarations */
+static void cue_status_open(void);
+static void cue_status_update(input_stream_t* source, time_t now);
+static void cue_write(input_stream_t* source);
+static const char* cue_status_filename(void);
+
 /* Global function definitions */
 
-/* Update the cue file with a set of variables */
+/* Update the status and cue files with a set of variables. Called after
+ * every buffer, so the cue file is only rewritten when it's due. */
 void ices_cue_update(input_stream_t* source) {
-	if (ices_config.cuefile) {
-		char buf[1024];
-		char artist[1024];
-		char title[1024];
-		FILE *fp = ices_util_fopen_for_writing(ices_cue_get_filename());
-
-		if (!fp) {
-			ices_log("Could not open cuefile [%s] for writing, cuefile not updated!", ices_cue_get_filename());
-			return;
-		}
-
-		artist[0] = '\0';
-		title[0] = '\0';
-		ices_metadata_get(artist, sizeof(artist), title, sizeof(title));
-
-		fprintf(fp, "%s\n%d\n%d\n%s\n%f\n%d\n%s\n%s\n", source->path,
-			(int) source->filesize, source->bitrate,
-			ices_util_file_time(source->bitrate, source->filesize, buf),
-			ices_util_percent(source->bytes_read, source->filesize),
-			ices_cue_lineno, artist, title);
-
-		ices_util_fclose(fp);
+	time_t now;
+	int started = NewTrack;
+
+	if (!ices_config.cuefile)
+		return;
+
+	now = time(NULL);
+
+	if (!StatusTried++)
+		cue_status_open();
+	if (Status)
+		cue_status_update(source, now);
+
+	if (started || now != CueWritten) {
+		CueWritten = now;
+		cue_write(source);
 	}
 }
 
-/* Cleanup the cue module by removing the cue file */
+/* Cleanup the cue module by removing the cue and status files */
 void ices_cue_shutdown(void) {
 	const char *filename = ices_cue_get_filename();
 
 	if (filename && filename[0])
 		remove(filename);
+
+	if (Status) {
+		munmap(Status, sizeof(ices_status_t));
+		Status = NULL;
+		if ((filename = cue_status_filename()))
+			remove(filename);
+	}
 }
 
+/* Called as each track starts */
 void ices_cue_set_lineno(int lineno) {
 	ices_cue_lineno = lineno;
+	NewTrack = 1;
 }
 
 /* Mutator for the cue filename */
@@ -101,5 +127,106 @@ const char *ices_cue_get_filename(void) {
 	return buf;
 }
 
+/* Private function definitions */
+
+/* Create the status file and map it. Without it only the cue file is
+ * kept. */
+static void cue_status_open(void) {
+	const char* filename;
+	char namespace[1024];
+	void* map;
+	int fd;
 
+	if (!(filename = cue_status_filename()))
+		return;
 
+	if ((fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+		ices_log("Could not create status file %s: %s", filename,
+			 ices_util_strerror(errno, namespace, sizeof(namespace)));
+		return;
+	}
+
+	if (ftruncate(fd, sizeof(ices_status_t)) < 0
+	    || (map = mmap(NULL, sizeof(ices_status_t), PROT_READ | PROT_WRITE,
+			   MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		ices_log("Could not map status file %s: %s", filename,
+			 ices_util_strerror(errno, namespace, sizeof(namespace)));
+		close(fd);
+		remove(filename);
+		return;
+	}
+	close(fd);
+
+	Status = map;
+	Status->version = ICES_STATUS_VERSION;
+	Status->pid = getpid();
+	/* last, so a monitor never takes a half made file for a real one */
+	__sync_synchronize();
+	Status->magic = ICES_STATUS_MAGIC;
+}
+
+/* Write the status under the seqlock. The names only change with the
+ * track. */
+static void cue_status_update(input_stream_t* source, time_t now) {
+	Status->seq++;
+	__sync_synchronize();
+
+	if (NewTrack) {
+		Status->started = now;
+		Status->tracks++;
+		Status->lineno = ices_cue_lineno;
+		snprintf(Status->path, sizeof(Status->path), "%s", source->path);
+		Status->artist[0] = '\0';
+		Status->title[0] = '\0';
+		ices_metadata_get(Status->artist, sizeof(Status->artist),
+				  Status->title, sizeof(Status->title));
+		NewTrack = 0;
+	}
+	Status->updated = now;
+	Status->filesize = source->filesize;
+	Status->bytes_read = source->bytes_read;
+	Status->bitrate = source->bitrate;
+	Status->duration = source->duration;
+
+	__sync_synchronize();
+	Status->seq++;
+}
+
+/* Rewrite the text cue file */
+static void cue_write(input_stream_t* source) {
+	char buf[1024];
+	char artist[1024];
+	char title[1024];
+	FILE *fp = ices_util_fopen_for_writing(ices_cue_get_filename());
+
+	NewTrack = 0;
+
+	if (!fp) {
+		ices_log("Could not open cuefile [%s] for writing, cuefile not updated!", ices_cue_get_filename());
+		return;
+	}
+
+	artist[0] = '\0';
+	title[0] = '\0';
+	ices_metadata_get(artist, sizeof(artist), title, sizeof(title));
+
+	fprintf(fp, "%s\n%d\n%d\n%s\n%f\n%d\n%s\n%s\n", source->path,
+		(int) source->filesize, source->bitrate,
+		source->duration ? ices_util_time(source->duration / 1000, buf)
+		: ices_util_file_time(source->bitrate, source->filesize, buf),
+		ices_util_percent(source->bytes_read, source->filesize),
+		ices_cue_lineno, artist, title);
+
+	ices_util_fclose(fp);
+}
+
+static const char* cue_status_filename(void) {
+	static char buf[1024];
+
+	if (!ices_config.base_directory)
+		return NULL;
+
+	snprintf(buf, sizeof(buf), "%s/ices.status", ices_config.base_directory);
+
+	return buf;
+}
@@ -90,21 +90,40 @@
 
 #include "setup.h"
 #include "replaygain.h"
+#include "downmix.h"
 #include "stream.h"
 #include "log.h"
 #include "util.h"
 #include "cue.h"
+#include "autocue.h"
+#include "lookahead.h"
+#include "listener.h"
+#include "control.h"
+#include "metrics.h"
+#include "flight.h"
+#include "trace.h"
+#include "playlog.h"
 #include "id3.h"
 #include "mp3.h"
 #include "signals.h"
 #include "reencode.h"
+#include "dsp.h"
 #include "ices_config.h"
 #include "playlist/playlist.h"
 
 #define CFOPT_FADEMINLEN 1
 #define CFOPT_CROSSMIX 2
 
+#define LIMOPT_LOOKAHEAD 1
+#define LIMOPT_RELEASE 2
+
+#define AGCOPT_MAXGAIN 1
+#define AGCOPT_BANDS 2
+
 ices_plugin_t *crossfade_plugin(int secs);
+int crossfade_seconds(ices_plugin_t *chain);
+ices_plugin_t *limiter_plugin(double ceiling);
+ices_plugin_t *agc_plugin(double target);
 ices_plugin_t *replaygain_plugin(void);
 /*
 void rg_set_track_gain(double);
@@ -124,16 +143,24 @@ double rg_get_track_gain(void);
 #define ICES_DEFAULT_DESCRIPTION "Default description"
 #define ICES_DEFAULT_URL "http://www.icecast.org/"
 #define ICES_DEFAULT_BITRATE 128
+#define ICES_DEFAULT_LIMITER -1.0
+#define ICES_DEFAULT_AGC -18.0
 #define ICES_DEFAULT_ISPUBLIC 1
 #define ICES_DEFAULT_MODULE "ices"
 #define ICES_DEFAULT_CONFIGFILE "ices.conf"
 #define ICES_DEFAULT_PLAYLIST_FILE "playlist.txt"
 #define ICES_DEFAULT_RANDOMIZE_PLAYLIST 0
+#define ICES_DEFAULT_NOREPEAT 10
+#define ICES_DEFAULT_SCRIPT_PERSISTENT 0
+#define ICES_DEFAULT_SCRIPT_TIMEOUT 10
+#define ICES_DEFAULT_LOOKAHEAD 1
 #define ICES_DEFAULT_DAEMON 0
 #define ICES_DEFAULT_BASE_DIRECTORY "/tmp"
 #define ICES_DEFAULT_PLAYLIST_TYPE ices_playlist_builtin_e;
 #define ICES_DEFAULT_VERBOSE 0
 #define ICES_DEFAULT_REENCODE 0
 #define ICES_DEFAULT_CUEFILE 0
+#define ICES_DEFAULT_AUTOCUE 0
+#define ICES_DEFAULT_PLAYLOG 0
 
 #endif
@@ -0,0 +1,270 @@
+/* downmix.c
+ * - Multichannel to stereo downmixing for ices
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#include "definitions.h"
+
+#include <math.h>
+
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+/* frames converted to planar float per pass; keeps scratch on the stack */
+#define DOWNMIX_BLOCK 256
+
+/* -3 dB, the ITU-R BS.775 weight for centre and surround channels */
+#define DOWNMIX_M3DB 0.70710678f
+
+#define FL ices_speaker_front_left_e
+#define FR ices_speaker_front_right_e
+#define FC ices_speaker_front_center_e
+#define LFE ices_speaker_lfe_e
+#define BL ices_speaker_back_left_e
+#define BR ices_speaker_back_right_e
+#define BC ices_speaker_back_center_e
+#define SL ices_speaker_side_left_e
+#define SR ices_speaker_side_right_e
+
+/* channel order of Vorbis (and Opus) streams, by channel count */
+static const ices_speaker_t vorbis_layouts[ICES_DOWNMIX_MAXCHANNELS][ICES_DOWNMIX_MAXCHANNELS] = {
+	{ FC },
+	{ FL, FR },
+	{ FL, FC, FR },
+	{ FL, FR, BL, BR },
+	{ FL, FC, FR, BL, BR },
+	{ FL, FC, FR, BL, BR, LFE },
+	{ FL, FC, FR, SL, SR, BC, LFE },
+	{ FL, FC, FR, SL, SR, BL, BR, LFE }
+};
+
+/* WAVEFORMATEXTENSIBLE channel order, which FLAC also uses */
+static const ices_speaker_t wave_layouts[ICES_DOWNMIX_MAXCHANNELS][ICES_DOWNMIX_MAXCHANNELS] = {
+	{ FC },
+	{ FL, FR },
+	{ FL, FR, FC },
+	{ FL, FR, BL, BR },
+	{ FL, FR, FC, BL, BR },
+	{ FL, FR, FC, LFE, BL, BR },
+	{ FL, FR, FC, LFE, BC, SL, SR },
+	{ FL, FR, FC, LFE, BL, BR, SL, SR }
+};
+
+/* Private function declarations */
+static void downmix_planar(const ices_downmix_t* dm, const float* const* planes,
+			   float scale, int frames, int16_t* left,
+			   int16_t* right);
+static inline int16_t downmix_clip(float sample);
+
+/* Public function definitions */
+
+/* Return the standard speaker layout for a Vorbis stream of this many
+ * channels, or NULL if there isn't one */
+const ices_speaker_t* ices_downmix_layout_vorbis(int channels) {
+	if (channels < 1 || channels > ICES_DOWNMIX_MAXCHANNELS)
+		return NULL;
+
+	return vorbis_layouts[channels - 1];
+}
+
+/* Return the standard WAVE/FLAC speaker layout for this many channels */
+const ices_speaker_t* ices_downmix_layout_wave(int channels) {
+	if (channels < 1 || channels > ICES_DOWNMIX_MAXCHANNELS)
+		return NULL;
+
+	return wave_layouts[channels - 1];
+}
+
+/* Build the mixing matrix for a layout. Centre and surround channels are
+ * folded in at -3 dB, LFE is dropped, and the matrix is then normalised so
+ * that no output can exceed full scale. Returns 0 on success, -1 if the
+ * layout can't be handled. */
+int ices_downmix_init(ices_downmix_t* dm, int channels,
+		      const ices_speaker_t* layout) {
+	float lsum = 0;
+	float rsum = 0;
+	float norm;
+	int i;
+
+	if (!layout || channels < 1 || channels > ICES_DOWNMIX_MAXCHANNELS) {
+		ices_log_error("Cannot downmix %d channels of audio", channels);
+		return -1;
+	}
+
+	dm->channels = channels;
+	for (i = 0; i < channels; i++) {
+		switch (layout[i]) {
+		case ices_speaker_front_left_e:
+			dm->left[i] = 1;
+			dm->right[i] = 0;
+			break;
+		case ices_speaker_front_right_e:
+			dm->left[i] = 0;
+			dm->right[i] = 1;
+			break;
+		case ices_speaker_back_left_e:
+		case ices_speaker_side_left_e:
+			dm->left[i] = DOWNMIX_M3DB;
+			dm->right[i] = 0;
+			break;
+		case ices_speaker_back_right_e:
+		case ices_speaker_side_right_e:
+			dm->left[i] = 0;
+			dm->right[i] = DOWNMIX_M3DB;
+			break;
+		case ices_speaker_back_center_e:
+			dm->left[i] = dm->right[i] = DOWNMIX_M3DB * DOWNMIX_M3DB;
+			break;
+		case ices_speaker_lfe_e:
+			dm->left[i] = dm->right[i] = 0;
+			break;
+		default:
+			/* centre, or something we don't know where to put */
+			dm->left[i] = dm->right[i] = channels == 1 ? 1 : DOWNMIX_M3DB;
+		}
+		lsum += dm->left[i];
+		rsum += dm->right[i];
+	}
+
+	norm = lsum > rsum ? lsum : rsum;
+	if (norm > 1) {
+		for (i = 0; i < channels; i++) {
+			dm->left[i] /= norm;
+			dm->right[i] /= norm;
+		}
+	}
+
+	ices_log_debug("Downmixing %d channels to stereo (%.1f dB headroom)",
+		       channels, norm > 1 ? 20 * log10(norm) : 0.0);
+
+	return 0;
+}
+
+/* Downmix interleaved 16 bit samples (Vorbis, AAC) */
+void ices_downmix_int16(const ices_downmix_t* dm, const int16_t* in,
+			int frames, int16_t* left, int16_t* right) {
+	float scratch[ICES_DOWNMIX_MAXCHANNELS][DOWNMIX_BLOCK];
+	const float* planes[ICES_DOWNMIX_MAXCHANNELS];
+	int channels = dm->channels;
+	int n, c, i;
+
+	for (c = 0; c < channels; c++)
+		planes[c] = scratch[c];
+
+	while (frames > 0) {
+		n = frames < DOWNMIX_BLOCK ? frames : DOWNMIX_BLOCK;
+		for (c = 0; c < channels; c++)
+			for (i = 0; i < n; i++)
+				scratch[c][i] = in[i * channels + c];
+
+		downmix_planar(dm, planes, 1, n, left, right);
+
+		in += n * channels;
+		left += n;
+		right += n;
+		frames -= n;
+	}
+}
+
+/* Downmix planar samples of bps bits held in 32 bit words (FLAC) */
+void ices_downmix_int32(const ices_downmix_t* dm, const int32_t* const* in,
+			int frames, int bps, int16_t* left, int16_t* right) {
+	float scratch[ICES_DOWNMIX_MAXCHANNELS][DOWNMIX_BLOCK];
+	const float* planes[ICES_DOWNMIX_MAXCHANNELS];
+	float scale = ldexpf(1, 16 - bps);
+	int channels = dm->channels;
+	int off, n, c, i;
+
+	for (c = 0; c < channels; c++)
+		planes[c] = scratch[c];
+
+	for (off = 0; off < frames; off += n) {
+		n = frames - off < DOWNMIX_BLOCK ? frames - off : DOWNMIX_BLOCK;
+		for (c = 0; c < channels; c++)
+			for (i = 0; i < n; i++)
+				scratch[c][i] = in[c][off + i];
+
+		downmix_planar(dm, planes, scale, n, left + off, right + off);
+	}
+}
+
+/* Private function definitions */
+
+/* Mix planar float input down to saturated 16 bit stereo. This is the
+ * hot loop: with SSE2 it mixes eight frames per pass and lets the pack
+ * instruction do the clipping. */
+static void downmix_planar(const ices_downmix_t* dm, const float* const* planes,
+			   float scale, int frames, int16_t* left,
+			   int16_t* right) {
+	float cl[ICES_DOWNMIX_MAXCHANNELS];
+	float cr[ICES_DOWNMIX_MAXCHANNELS];
+	int channels = dm->channels;
+	float l, r;
+	int c, i;
+
+	for (c = 0; c < channels; c++) {
+		cl[c] = dm->left[c] * scale;
+		cr[c] = dm->right[c] * scale;
+	}
+
+	i = 0;
+#ifdef __SSE2__
+	for (; i + 8 <= frames; i += 8) {
+		__m128 l0 = _mm_setzero_ps();
+		__m128 l1 = _mm_setzero_ps();
+		__m128 r0 = _mm_setzero_ps();
+		__m128 r1 = _mm_setzero_ps();
+
+		for (c = 0; c < channels; c++) {
+			__m128 x0 = _mm_loadu_ps(planes[c] + i);
+			__m128 x1 = _mm_loadu_ps(planes[c] + i + 4);
+			__m128 kl = _mm_set1_ps(cl[c]);
+			__m128 kr = _mm_set1_ps(cr[c]);
+
+			l0 = _mm_add_ps(l0, _mm_mul_ps(x0, kl));
+			l1 = _mm_add_ps(l1, _mm_mul_ps(x1, kl));
+			r0 = _mm_add_ps(r0, _mm_mul_ps(x0, kr));
+			r1 = _mm_add_ps(r1, _mm_mul_ps(x1, kr));
+		}
+
+		_mm_storeu_si128((__m128i*) (left + i),
+				 _mm_packs_epi32(_mm_cvtps_epi32(l0), _mm_cvtps_epi32(l1)));
+		_mm_storeu_si128((__m128i*) (right + i),
+				 _mm_packs_epi32(_mm_cvtps_epi32(r0), _mm_cvtps_epi32(r1)));
+	}
+#endif
+
+	for (; i < frames; i++) {
+		l = r = 0;
+		for (c = 0; c < channels; c++) {
+			l += planes[c][i] * cl[c];
+			r += planes[c][i] * cr[c];
+		}
+		left[i] = downmix_clip(l);
+		right[i] = downmix_clip(r);
+	}
+}
+
+static inline int16_t downmix_clip(float sample) {
+	if (sample >= 32767)
+		return 32767;
+	if (sample <= -32768)
+		return -32768;
+
+	return (int16_t) lrintf(sample);
+}
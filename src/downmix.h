@@ -0,0 +1,56 @@
+/* downmix.h
+ * - Multichannel to stereo downmix declarations for ices
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#ifndef _ICES_DOWNMIX_H
+#define _ICES_DOWNMIX_H
+
+#define ICES_DOWNMIX_MAXCHANNELS 8
+
+/* speaker positions, as far as the input formats tell us about them */
+typedef enum {
+	ices_speaker_unknown_e,
+	ices_speaker_front_left_e,
+	ices_speaker_front_right_e,
+	ices_speaker_front_center_e,
+	ices_speaker_lfe_e,
+	ices_speaker_back_left_e,
+	ices_speaker_back_right_e,
+	ices_speaker_back_center_e,
+	ices_speaker_side_left_e,
+	ices_speaker_side_right_e
+} ices_speaker_t;
+
+/* per-channel contribution to the left and right output */
+typedef struct {
+	int channels;
+	float left[ICES_DOWNMIX_MAXCHANNELS];
+	float right[ICES_DOWNMIX_MAXCHANNELS];
+} ices_downmix_t;
+
+/* Public function declarations */
+const ices_speaker_t* ices_downmix_layout_vorbis(int channels);
+const ices_speaker_t* ices_downmix_layout_wave(int channels);
+int ices_downmix_init(ices_downmix_t* dm, int channels,
+		      const ices_speaker_t* layout);
+void ices_downmix_int16(const ices_downmix_t* dm, const int16_t* in,
+			int frames, int16_t* left, int16_t* right);
+void ices_downmix_int32(const ices_downmix_t* dm, const int32_t* const* in,
+			int frames, int bps, int16_t* left, int16_t* right);
+
+#endif
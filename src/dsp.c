@@ -0,0 +1,325 @@
+/* dsp.c
+ * - Run-time loadable DSP plugins for ices
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#include "definitions.h"
+#include "ices_dsp.h"
+
+#include <dlfcn.h>
+#include <math.h>
+
+/* frames per call for plugins that take any block size */
+#define DSP_MAXBLOCK 4096
+/* largest fixed block size we agree to */
+#define DSP_MAXFIXED 65536
+
+/* a loaded plugin, wrapped up as an ordinary ices_plugin_t */
+typedef struct {
+	ices_plugin_t plugin;
+
+	void* handle;
+	const ices_dsp_module_t* module;
+	void* state;
+	int failed;
+
+	/* negotiated in dsp_init */
+	unsigned int format;
+	unsigned int blocksize;
+
+	/* fixed block sizes only: input is gathered in inl/inr while the
+	 * last processed block is handed back from outl/outr */
+	int16_t* inl;
+	int16_t* inr;
+	int16_t* outl;
+	int16_t* outr;
+	unsigned int fill;
+	int primed;
+
+	/* float conversion, if the plugin doesn't do int16 */
+	float* fl;
+	float* fr;
+} dsp_t;
+
+/* Private function declarations */
+static int dsp_init(ices_plugin_t* self);
+static void dsp_new_track(ices_plugin_t* self, input_stream_t* source);
+static int dsp_process(ices_plugin_t* self, int ilen, int16_t* il, int16_t* ir);
+static void dsp_shutdown(ices_plugin_t* self);
+static int dsp_options(ices_plugin_t* self, int optid, void* opt);
+static void dsp_run(dsp_t* dsp, int16_t* left, int16_t* right, unsigned int frames);
+static inline int16_t dsp_clip(float sample);
+
+/* Public function definitions */
+
+/* Load a plugin from the module directory (or a path, if module has a
+ * slash in it). Returns NULL with the error set if it can't be used. */
+ices_plugin_t* ices_dsp_load(const char* module) {
+	char path[1024];
+	const ices_dsp_module_t* m;
+	ices_dsp_entry_t entry;
+	void* handle;
+	dsp_t* dsp;
+	size_t len = strlen(module);
+
+	if (strchr(module, '/'))
+		snprintf(path, sizeof(path), "%s", module);
+	else
+		snprintf(path, sizeof(path), "%s/%s%s", ICES_MODULEDIR, module,
+			 len > 3 && !strcmp(module + len - 3, ".so") ? "" : ".so");
+
+	if (!(handle = dlopen(path, RTLD_NOW | RTLD_LOCAL))) {
+		ices_log_error("Could not load DSP plugin: %s", dlerror());
+		return NULL;
+	}
+
+	*(void**) &entry = dlsym(handle, ICES_DSP_ENTRY);
+	if (!entry || !(m = entry())) {
+		ices_log_error("%s is not an ices DSP plugin", path);
+		goto err;
+	}
+	if (m->abi_version != ICES_DSP_ABI_VERSION) {
+		ices_log_error("%s was built for plugin ABI %u, this ices uses %d",
+			       path, m->abi_version, ICES_DSP_ABI_VERSION);
+		goto err;
+	}
+	if (!m->name || !m->create || !m->start || !m->process || !m->destroy) {
+		ices_log_error("%s is missing required plugin functions", path);
+		goto err;
+	}
+
+	if (!(dsp = calloc(1, sizeof(dsp_t)))) {
+		ices_log_error("Could not allocate DSP plugin");
+		goto err;
+	}
+	if (!(dsp->state = m->create())) {
+		ices_log_error("DSP plugin %s could not be created", path);
+		free(dsp);
+		goto err;
+	}
+
+	dsp->handle = handle;
+	dsp->module = m;
+
+	dsp->plugin.name = m->name;
+	dsp->plugin.init = dsp_init;
+	dsp->plugin.new_track = dsp_new_track;
+	dsp->plugin.process = dsp_process;
+	dsp->plugin.shutdown = dsp_shutdown;
+	dsp->plugin.options = dsp_options;
+	dsp->plugin.data = dsp;
+
+	ices_log_debug("Loaded DSP plugin %s from %s", dsp->plugin.name, path);
+
+	return &dsp->plugin;
+
+ err:
+	dlclose(handle);
+	return NULL;
+}
+
+/* Pass a config file option to a plugin loaded with ices_dsp_load */
+int ices_dsp_option(ices_plugin_t* plugin, const char* key, const char* value) {
+	dsp_t* dsp = (dsp_t*) plugin->data;
+
+	if (!dsp->module->option)
+		return -1;
+
+	return dsp->module->option(dsp->state, key, value);
+}
+
+/* Private function definitions */
+
+/* Agree on a sample format and block size with the plugin */
+static int dsp_init(ices_plugin_t* self) {
+	dsp_t* dsp = (dsp_t*) self->data;
+	const ices_dsp_module_t* m = dsp->module;
+	size_t size;
+
+	if (m->formats & ICES_DSP_INT16)
+		dsp->format = ICES_DSP_INT16;
+	else if (m->formats & ICES_DSP_FLOAT)
+		dsp->format = ICES_DSP_FLOAT;
+	else {
+		ices_log_error("DSP plugin %s supports no known sample format", self->name);
+		return -1;
+	}
+
+	if (m->blocksize > DSP_MAXFIXED) {
+		ices_log_error("DSP plugin %s wants %u frame blocks, the most is %d",
+			       self->name, m->blocksize, DSP_MAXFIXED);
+		return -1;
+	}
+	dsp->blocksize = m->blocksize ? m->blocksize : DSP_MAXBLOCK;
+	size = dsp->blocksize * sizeof(int16_t);
+
+	if (m->blocksize)
+		if (!(dsp->inl = malloc(size)) || !(dsp->inr = malloc(size))
+		    || !(dsp->outl = malloc(size)) || !(dsp->outr = malloc(size)))
+			goto nomem;
+
+	size = dsp->blocksize * sizeof(float);
+	if (dsp->format == ICES_DSP_FLOAT)
+		if (!(dsp->fl = malloc(size)) || !(dsp->fr = malloc(size)))
+			goto nomem;
+
+	if (m->start(dsp->state, dsp->format, dsp->blocksize) < 0) {
+		ices_log_error("DSP plugin %s refused %s samples in blocks of %u",
+			       self->name, dsp->format == ICES_DSP_INT16 ? "int16" : "float",
+			       dsp->blocksize);
+		return -1;
+	}
+
+	ices_log_debug("DSP plugin %s: %s samples, %s%u frame blocks", self->name,
+		       dsp->format == ICES_DSP_INT16 ? "int16" : "float",
+		       m->blocksize ? "" : "up to ", dsp->blocksize);
+
+	return 0;
+
+ nomem:
+	ices_log_error("Could not allocate buffers for DSP plugin %s", self->name);
+	return -1;
+}
+
+static void dsp_new_track(ices_plugin_t* self, input_stream_t* source) {
+	dsp_t* dsp = (dsp_t*) self->data;
+	ices_dsp_track_t track;
+
+	if (!dsp->module->new_track)
+		return;
+
+	track.path = source->path;
+	track.samplerate = source->samplerate;
+	track.channels = source->channels;
+	track.bitrate = source->bitrate;
+	track.filesize = source->filesize;
+
+	dsp->module->new_track(dsp->state, &track);
+}
+
+static int dsp_process(ices_plugin_t* self, int ilen, int16_t* il, int16_t* ir) {
+	dsp_t* dsp = (dsp_t*) self->data;
+	int16_t* tmp;
+	int out = 0;
+	int i, n;
+
+	if (!dsp->module->blocksize) {
+		for (i = 0; i < ilen; i += n) {
+			n = ilen - i < DSP_MAXBLOCK ? ilen - i : DSP_MAXBLOCK;
+			dsp_run(dsp, il + i, ir + i, n);
+		}
+
+		return ilen;
+	}
+
+	/* Fixed blocks: run one block behind the input, handing back the
+	 * previous block's output as new input comes in. Until the first
+	 * block is done there is nothing to hand back. */
+	for (i = 0; i < ilen; i += n) {
+		n = dsp->blocksize - dsp->fill;
+		if (n > ilen - i)
+			n = ilen - i;
+
+		memcpy(dsp->inl + dsp->fill, il + i, n * sizeof(int16_t));
+		memcpy(dsp->inr + dsp->fill, ir + i, n * sizeof(int16_t));
+		if (dsp->primed) {
+			memcpy(il + out, dsp->outl + dsp->fill, n * sizeof(int16_t));
+			memcpy(ir + out, dsp->outr + dsp->fill, n * sizeof(int16_t));
+			out += n;
+		}
+
+		dsp->fill += n;
+		if (dsp->fill == dsp->blocksize) {
+			dsp_run(dsp, dsp->inl, dsp->inr, dsp->blocksize);
+
+			tmp = dsp->outl;
+			dsp->outl = dsp->inl;
+			dsp->inl = tmp;
+			tmp = dsp->outr;
+			dsp->outr = dsp->inr;
+			dsp->inr = tmp;
+
+			dsp->fill = 0;
+			dsp->primed = 1;
+		}
+	}
+
+	return out;
+}
+
+/* releases the instance and unloads the plugin */
+static void dsp_shutdown(ices_plugin_t* self) {
+	dsp_t* dsp = (dsp_t*) self->data;
+
+	ices_log_debug("DSP plugin %s shutting down", self->name);
+
+	dsp->module->destroy(dsp->state);
+	dlclose(dsp->handle);
+
+	ices_util_free(dsp->inl);
+	ices_util_free(dsp->inr);
+	ices_util_free(dsp->outl);
+	ices_util_free(dsp->outr);
+	ices_util_free(dsp->fl);
+	ices_util_free(dsp->fr);
+	free(dsp);
+}
+
+/* loaded plugins take string options, through ices_dsp_option */
+static int dsp_options(ices_plugin_t* self, int optid, void* opt) {
+	return -1;
+}
+
+/* Hand frames to the plugin, converting if it wants float. A plugin that
+ * fails is bypassed from then on. */
+static void dsp_run(dsp_t* dsp, int16_t* left, int16_t* right, unsigned int frames) {
+	unsigned int i;
+	int rc;
+
+	if (dsp->failed)
+		return;
+
+	if (dsp->format == ICES_DSP_INT16)
+		rc = dsp->module->process(dsp->state, left, right, frames);
+	else {
+		for (i = 0; i < frames; i++) {
+			dsp->fl[i] = left[i] * (1.0f / 32768);
+			dsp->fr[i] = right[i] * (1.0f / 32768);
+		}
+
+		rc = dsp->module->process(dsp->state, dsp->fl, dsp->fr, frames);
+
+		for (i = 0; rc >= 0 && i < frames; i++) {
+			left[i] = dsp_clip(dsp->fl[i] * 32768);
+			right[i] = dsp_clip(dsp->fr[i] * 32768);
+		}
+	}
+
+	if (rc < 0) {
+		ices_log("DSP plugin %s failed, bypassing it", dsp->plugin.name);
+		dsp->failed = 1;
+	}
+}
+
+static inline int16_t dsp_clip(float sample) {
+	if (sample >= 32767)
+		return 32767;
+	if (sample <= -32768)
+		return -32768;
+
+	return (int16_t) lrintf(sample);
+}
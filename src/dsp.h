@@ -0,0 +1,27 @@
+/* dsp.h
+ * - Loadable DSP plugin declarations for ices
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#ifndef _ICES_DSP_LOADER_H
+#define _ICES_DSP_LOADER_H
+
+/* Public function declarations */
+ices_plugin_t* ices_dsp_load(const char* module);
+int ices_dsp_option(ices_plugin_t* plugin, const char* key, const char* value);
+
+#endif
@@ -0,0 +1,165 @@
+/* dspbench.c
+ * - Time the built in DSP plugins on synthetic audio
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+/* Usage: dspbench [seconds of audio per plugin]
+ *
+ * Each plugin is fed the same loud, level-varying test signal in chunks
+ * the size ices decodes, and timed with the monotonic clock. The "copy"
+ * row is the cost of refilling the buffers and scanning the output for
+ * its peak, which is included in every other row. */
+
+#include "definitions.h"
+
+#include <math.h>
+#include <time.h>
+
+#define BENCH_RATE 44100
+#define BENCH_SIGNAL (10 * BENCH_RATE)
+/* one MP3 frame's worth per call, as stream_send hands over */
+#define BENCH_CHUNK 1152
+
+ices_config_t ices_config;
+
+static int16_t sigl[BENCH_SIGNAL];
+static int16_t sigr[BENCH_SIGNAL];
+
+/* Private function declarations */
+static void bench_signal(void);
+static void bench_run(const char* name, ices_plugin_t* chain, int seconds);
+static double bench_now(void);
+
+int main(int argc, char** argv) {
+	ices_plugin_t* chain;
+	int bands = 1;
+	int seconds = 60;
+
+	if (argc > 1 && (seconds = atoi(argv[1])) < 1) {
+		fprintf(stderr, "Usage: %s [seconds]\n", argv[0]);
+		return 1;
+	}
+
+	bench_signal();
+
+	printf("%d s of 44.1 kHz stereo per plugin, %d frame chunks\n",
+	       seconds, BENCH_CHUNK);
+	printf("%-16s %10s %10s %10s %10s\n", "plugin", "ns/sample",
+	       "ns/frame", "realtime", "peak dBFS");
+
+	bench_run("copy", NULL, seconds);
+	bench_run("limiter", limiter_plugin(-1.0), seconds);
+
+	chain = agc_plugin(-18.0);
+	chain->options(chain, AGCOPT_BANDS, &bands);
+	bench_run("agc 1 band", chain, seconds);
+	bench_run("agc 3 band", agc_plugin(-18.0), seconds);
+
+	chain = agc_plugin(-18.0);
+	chain->next = limiter_plugin(-1.0);
+	bench_run("agc+limiter", chain, seconds);
+
+	bench_run("crossfade 5s", crossfade_plugin(5), seconds);
+
+	return 0;
+}
+
+/* Private function definitions */
+
+/* A tone and noise, with the level swept from -30 to +3 dBFS (so that
+ * the input itself clips) once a second */
+static void bench_signal(void) {
+	unsigned int seed = 1;
+	double level, noise;
+	int i;
+
+	for (i = 0; i < BENCH_SIGNAL; i++) {
+		level = pow(10, (-30 + 33.0 * (i % BENCH_RATE) / BENCH_RATE) / 20);
+		seed = seed * 1103515245 + 12345;
+		noise = ((seed >> 16) & 0x7fff) / 32768.0 - 0.5;
+
+		sigl[i] = lrint(fmax(-32768, fmin(32767, 32767 * level * (0.8 * sin(i * 0.0712) + 0.4 * noise))));
+		sigr[i] = lrint(fmax(-32768, fmin(32767, 32767 * level * (0.8 * sin(i * 0.0531) - 0.4 * noise))));
+	}
+}
+
+/* Run a chain (or nothing) over seconds of audio and print the timing */
+static void bench_run(const char* name, ices_plugin_t* chain, int seconds) {
+	static int16_t left[BENCH_CHUNK];
+	static int16_t right[BENCH_CHUNK];
+	input_stream_t source;
+	ices_plugin_t* plugin;
+	ices_plugin_t* next;
+	long frames = (long) seconds * BENCH_RATE;
+	long done;
+	int peak = 0;
+	int pos = 0;
+	int n, i;
+	double start, ns;
+
+	memset(&source, 0, sizeof(source));
+	source.path = "dspbench";
+	source.samplerate = BENCH_RATE;
+	source.channels = 2;
+
+	for (plugin = chain; plugin; plugin = plugin->next) {
+		if (plugin->init(plugin) < 0) {
+			printf("%-16s could not initialize: %s\n", name, ices_log_get_error());
+			goto out;
+		}
+		plugin->new_track(plugin, &source);
+	}
+
+	start = bench_now();
+	for (done = 0; done < frames; done += BENCH_CHUNK) {
+		memcpy(left, sigl + pos, sizeof(left));
+		memcpy(right, sigr + pos, sizeof(right));
+		pos += BENCH_CHUNK;
+		if (pos + BENCH_CHUNK > BENCH_SIGNAL)
+			pos = 0;
+
+		n = BENCH_CHUNK;
+		for (plugin = chain; plugin && n > 0; plugin = plugin->next)
+			n = plugin->process(plugin, n, left, right);
+
+		/* keep the work observable, and check the ceiling */
+		for (i = 0; i < n; i++) {
+			if (abs(left[i]) > peak)
+				peak = abs(left[i]);
+			if (abs(right[i]) > peak)
+				peak = abs(right[i]);
+		}
+	}
+	ns = (bench_now() - start) * 1e9 / done;
+
+	printf("%-16s %10.2f %10.2f %9.0fx %10.2f\n", name, ns / 2, ns,
+	       1e9 / BENCH_RATE / ns, peak ? 20 * log10(peak / 32768.0) : -INFINITY);
+
+out:
+	for (plugin = chain; plugin; plugin = next) {
+		next = plugin->next;
+		plugin->shutdown(plugin);
+	}
+}
+
+static double bench_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,185 @@
+/* flight.c
+ * - A flight recorder of recent stream loop events
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+/* The stream loop always notes what it does in a ring of the last
+ * FLIGHT_EVENTS fixed size events: tracks opened, the time each stage
+ * of each buffer took, how each send went and how late it was,
+ * connects and errors. Noting one is a few stores, and nothing is
+ * formatted until the ring is dumped to BaseDirectory/ices.flight, as
+ * text, oldest first. That happens as ices shuts down, whatever the
+ * reason, and on the control socket's dump command, so a stall or a
+ * run of errors can be looked into afterwards.
+ *
+ * Only the stream loop's thread may note events. */
+
+#include "definitions.h"
+
+#include <sys/time.h>
+#include <time.h>
+
+/* events kept, a power of two */
+#define FLIGHT_EVENTS 8192
+/* most of a path or message kept with an event */
+#define FLIGHT_TEXT 48
+
+typedef struct {
+	double time;            /* ices_metrics_clock() */
+	double seconds;
+	const ices_stream_t* stream;
+	int value;
+	ices_flight_type_t type;
+	char text[FLIGHT_TEXT];
+} flight_event_t;
+
+extern ices_config_t ices_config;
+
+static flight_event_t Ring[FLIGHT_EVENTS];
+static unsigned int Next = 0;
+static int Full = 0;
+
+/* Private function declarations */
+static flight_event_t* flight_note(ices_flight_type_t type, const ices_stream_t* stream);
+static const char* flight_filename(void);
+
+/* Public function definitions */
+
+/* A buffer stage took seconds */
+void ices_flight_stage(const ices_stream_t* stream, ices_stage_t stage, double seconds) {
+	flight_event_t* event = flight_note(ices_flight_stage_e, stream);
+
+	event->value = stage;
+	event->seconds = seconds;
+}
+
+/* A send to stream returned rc, lateness seconds behind the sample clock */
+void ices_flight_send(const ices_stream_t* stream, int rc, double lateness) {
+	flight_event_t* event = flight_note(ices_flight_send_e, stream);
+
+	event->value = rc;
+	event->seconds = lateness;
+}
+
+/* Anything else: a track, a connect or an error, with as much of text
+ * as fits. The end of a path says more than its start. */
+void ices_flight_event(ices_flight_type_t type, const ices_stream_t* stream, int value,
+		       const char* text) {
+	flight_event_t* event = flight_note(type, stream);
+	size_t len;
+
+	event->value = value;
+	text = ices_util_nullcheck(text);
+	if ((len = strlen(text)) >= FLIGHT_TEXT) {
+		if (type == ices_flight_track_e)
+			text += len - FLIGHT_TEXT + 1;
+		len = FLIGHT_TEXT - 1;
+	}
+	memcpy(event->text, text, len);
+	event->text[len] = '\0';
+}
+
+/* Write the ring out, saying why. Returns the file written, or NULL. */
+const char* ices_flight_dump(const char* reason) {
+	static const char* types[] = { "track", "stage", "send", "connect", "error" };
+	const char* filename;
+	char tmp[1040];
+	char stamp[32];
+	flight_event_t* event;
+	struct timeval tv;
+	struct tm tm;
+	time_t sec;
+	double now;
+	unsigned int i;
+	unsigned int n;
+	FILE* fp;
+
+	if (!(filename = flight_filename()))
+		return NULL;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", filename);
+	if (!(fp = fopen(tmp, "w"))) {
+		ices_log_error("Error writing %s: %s", tmp, strerror(errno));
+		return NULL;
+	}
+
+	now = ices_metrics_clock();
+	gettimeofday(&tv, NULL);
+	sec = tv.tv_sec;
+	localtime_r(&sec, &tm);
+	strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+	fprintf(fp, "# ices flight recorder, dumped %s.%03d (%s)\n", stamp,
+		(int) (tv.tv_usec / 1000), ices_util_nullcheck(reason));
+	fprintf(fp, "# seconds before the dump, event, mount, what\n");
+
+	n = Full ? FLIGHT_EVENTS : Next;
+	for (i = 0; i < n; i++) {
+		event = &Ring[((Full ? Next : 0) + i) % FLIGHT_EVENTS];
+		fprintf(fp, "%10.6f %-7s %s ", now - event->time, types[event->type],
+			event->stream ? ices_util_nullcheck(event->stream->mount) : "-");
+		switch (event->type) {
+		case ices_flight_stage_e:
+			fprintf(fp, "%s %.6f\n", ices_metrics_stage_name(event->value),
+				event->seconds);
+			break;
+		case ices_flight_send_e:
+			fprintf(fp, "%s late %.6f\n", event->value ? "failed" : "ok", event->seconds);
+			break;
+		case ices_flight_connect_e:
+			fprintf(fp, "%s %s\n", event->value ? "failed" : "ok", event->text);
+			break;
+		default:
+			fprintf(fp, "%d %s\n", event->value, event->text);
+		}
+	}
+
+	if (fclose(fp) || rename(tmp, filename) < 0) {
+		ices_log_error("Error writing %s: %s", filename, strerror(errno));
+		remove(tmp);
+		return NULL;
+	}
+
+	return filename;
+}
+
+/* Private function definitions */
+
+static flight_event_t* flight_note(ices_flight_type_t type, const ices_stream_t* stream) {
+	flight_event_t* event = &Ring[Next];
+
+	if (++Next == FLIGHT_EVENTS) {
+		Next = 0;
+		Full = 1;
+	}
+
+	event->time = ices_metrics_clock();
+	event->type = type;
+	event->stream = stream;
+
+	return event;
+}
+
+static const char* flight_filename(void) {
+	static char buf[1024];
+
+	if (!ices_config.base_directory)
+		return NULL;
+
+	snprintf(buf, sizeof(buf), "%s/ices.flight", ices_config.base_directory);
+
+	return buf;
+}
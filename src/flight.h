@@ -0,0 +1,38 @@
+/* flight.h
+ * - Flight recorder declarations
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#ifndef _ICES_FLIGHT_H
+#define _ICES_FLIGHT_H
+
+typedef enum {
+	ices_flight_track_e,    /* value: playlist line, text: path */
+	ices_flight_stage_e,
+	ices_flight_send_e,
+	ices_flight_connect_e,  /* value: 0 or -1, text: mount or error */
+	ices_flight_error_e     /* value: errors in a row, text: error */
+} ices_flight_type_t;
+
+/* Public function declarations */
+void ices_flight_stage(const ices_stream_t* stream, ices_stage_t stage, double seconds);
+void ices_flight_send(const ices_stream_t* stream, int rc, double lateness);
+void ices_flight_event(ices_flight_type_t type, const ices_stream_t* stream, int value,
+		       const char* text);
+const char* ices_flight_dump(const char* reason);
+
+#endif
@@ -35,6 +35,11 @@ static void parse_execution_node(xmlDocPtr doc, xmlNsPtr ns, xmlNodePtr cur, ice
 static void parse_server_node(xmlDocPtr doc, xmlNsPtr ns, xmlNodePtr cur,
 			      ices_stream_t *ices_config);
 static void parse_stream_node(xmlDocPtr doc, xmlNsPtr ns, xmlNodePtr cur, ices_stream_t *stream);
+static int parse_plugin_node(xmlDocPtr doc, xmlNodePtr cur, ices_plugin_t **chain);
+static void parse_dsp_node(xmlDocPtr doc, xmlNodePtr cur, ices_plugin_t **chain);
+static void append_plugin(ices_plugin_t **chain, ices_plugin_t *plugin);
+static void set_plugin_option(ices_plugin_t *chain, const char *name,
+			      const char *keyword, int optid, int val);
 static char* ices_xml_read_node(xmlDocPtr doc, xmlNodePtr node);
 
 /* Global function definitions */
@@ -117,7 +122,7 @@ static int parse_file(const char *configfile, ices_config_t *ices_config) {
 		if (xmlstrcmp(cur->name, "Stream") == 0) {
 			/* first stream is preallocated */
 			if (nstreams) {
-				stream->next = (ices_stream_t*) malloc(sizeof(ices_stream_t));
+				stream->next = (ices_stream_t*) calloc(1, sizeof(ices_stream_t));
 				stream = stream->next;
 				/* in case fields are omitted in the config file */
 				ices_setup_parse_stream_defaults(stream);
@@ -185,7 +190,7 @@ static void parse_stream_node(xmlDocPtr doc, xmlNsPtr ns, xmlNodePtr cur,
 			stream->out_samplerate = atoi(ices_xml_read_node(doc, cur));
 		else if (xmlstrcmp(cur->name, "Channels") == 0)
 			stream->out_numchannels = atoi(ices_xml_read_node(doc, cur));
-		else
+		else if (!parse_plugin_node(doc, cur, &stream->plugins))
 			ices_log("Unknown Stream keyword: %s", cur->name);
 	}
 }
@@ -235,6 +240,22 @@ static void parse_execution_node(xmlDocPtr doc, xmlNsPtr ns, xmlNodePtr cur,
 			ices_config->verbose = atoi(ices_xml_read_node(doc, cur));
 		else if (xmlstrcmp(cur->name, "CueFile") == 0)
 			ices_config->cuefile = atoi(ices_xml_read_node(doc, cur));
+		else if (xmlstrcmp(cur->name, "AutoCue") == 0)
+			ices_config->autocue = atoi(ices_xml_read_node(doc, cur));
+		else if (xmlstrcmp(cur->name, "PlayLog") == 0)
+			ices_config->playlog = atoi(ices_xml_read_node(doc, cur));
+		else if (xmlstrcmp(cur->name, "Trace") == 0) {
+			ices_util_free(ices_config->trace);
+			ices_config->trace = ices_util_strdup(ices_xml_read_node(doc, cur));
+		}
+		else if (xmlstrcmp(cur->name, "ControlSocket") == 0) {
+			ices_util_free(ices_config->control);
+			ices_config->control = ices_util_strdup(ices_xml_read_node(doc, cur));
+		}
+		else if (xmlstrcmp(cur->name, "Metrics") == 0) {
+			ices_util_free(ices_config->metrics);
+			ices_config->metrics = ices_util_strdup(ices_xml_read_node(doc, cur));
+		}
 		else if (xmlstrcmp(cur->name, "BaseDirectory") == 0) {
 			if (ices_config->base_directory)
 				ices_config->base_directory =
@@ -246,14 +267,14 @@ static void parse_execution_node(xmlDocPtr doc, xmlNsPtr ns, xmlNodePtr cur,
 
 /* Parse the playlist specific configuration */
 static void parse_playlist_node(xmlDocPtr doc, xmlNsPtr ns, xmlNodePtr cur, ices_config_t *ices_config) {
-	int i;
-
 	for (; cur; cur = cur->next) {
 		if (cur->type == XML_COMMENT_NODE)
 			continue;
 
 		if (xmlstrcmp(cur->name, "Randomize") == 0)
 			ices_config->pm.randomize = atoi(ices_xml_read_node(doc, cur));
+		else if (xmlstrcmp(cur->name, "NoRepeat") == 0)
+			ices_config->pm.norepeat = atoi(ices_xml_read_node(doc, cur));
 		else if (xmlstrcmp(cur->name, "Type") == 0) {
 			unsigned char *str = (unsigned char *)ices_xml_read_node(doc, cur);
 			if (str && (xmlstrcmp(str, "python") == 0))
@@ -262,6 +283,12 @@ static void parse_playlist_node(xmlDocPtr doc, xmlNsPtr ns, xmlNodePtr cur, ices
 				ices_config->pm.playlist_type = ices_playlist_perl_e;
 			else if (str && (xmlstrcmp(str, "script") == 0))
 				ices_config->pm.playlist_type = ices_playlist_script_e;
+			else if (str && (xmlstrcmp(str, "native") == 0))
+				ices_config->pm.playlist_type = ices_playlist_native_e;
+			else if (str && (xmlstrcmp(str, "library") == 0))
+				ices_config->pm.playlist_type = ices_playlist_library_e;
+			else if (str && (xmlstrcmp(str, "rotation") == 0))
+				ices_config->pm.playlist_type = ices_playlist_rotation_e;
 			else
 				ices_config->pm.playlist_type = ices_playlist_builtin_e;
 		} else if (xmlstrcmp(cur->name, "File") == 0) {
@@ -271,41 +298,123 @@ static void parse_playlist_node(xmlDocPtr doc, xmlNsPtr ns, xmlNodePtr cur, ices
 		} else if (xmlstrcmp(cur->name, "Module") == 0) {
 			ices_util_free(ices_config->pm.module);
 			ices_config->pm.module = ices_util_strdup(ices_xml_read_node(doc, cur));
-		} else if (xmlstrcmp(cur->name, "Crossfade") == 0) {
-			if ((i = atoi(ices_xml_read_node(doc, cur))) > 0)
-				ices_config->plugins = crossfade_plugin(i);
-			/* TODO: stack plugins */
-		} else if (xmlstrcmp(cur->name, "MinCrossfade") == 0) {
-			if ((i = atoi(ices_xml_read_node(doc, cur))) > 0) {
-				ices_plugin_t *plugin = ices_config->plugins;
-				while (plugin) {
-					if (strcmp(plugin->name, "crossfade") == 0) {
-						int plugret = plugin->options(CFOPT_FADEMINLEN, &i);
-						if (plugret < 0) ices_log("Invalid plugin option value for: %s", cur->name);
-						break;
-					}
-					plugin = plugin->next;
-				}
-				if (plugin == NULL) ices_log("Option specified for non-registered plugin: %s", cur->name);
-			}
-		} else if (xmlstrcmp(cur->name, "CrossMix") == 0) {
-			if ((i = atoi(ices_xml_read_node(doc, cur))) > 0) {
-				ices_plugin_t *plugin = ices_config->plugins;
-				while (plugin) {
-					if (strcmp(plugin->name, "crossfade") == 0) {
-						int plugret = plugin->options(CFOPT_CROSSMIX, &i);
-						if (plugret < 0) ices_log("Invalid plugin option value for: %s", cur->name);
-						break;
-					}
-					plugin = plugin->next;
-				}
-				if (plugin == NULL) ices_log("Option specified for non-registered plugin: %s", cur->name);
-			}
-		} else
+		} else if (xmlstrcmp(cur->name, "Category") == 0) {
+			ices_util_free(ices_config->pm.category);
+			ices_config->pm.category = ices_util_strdup(ices_xml_read_node(doc, cur));
+		} else if (xmlstrcmp(cur->name, "Persistent") == 0)
+			ices_config->pm.persistent = atoi(ices_xml_read_node(doc, cur));
+		else if (xmlstrcmp(cur->name, "Timeout") == 0)
+			ices_config->pm.timeout = atoi(ices_xml_read_node(doc, cur));
+		else if (xmlstrcmp(cur->name, "Lookahead") == 0)
+			ices_config->pm.lookahead = atoi(ices_xml_read_node(doc, cur));
+		else if (!parse_plugin_node(doc, cur, &ices_config->plugins))
 			ices_log("Unknown playlist keyword: %s", cur->name);
 	}
 }
 
+/* Handle the plugin keywords shared by the Playlist and Stream sections,
+ * adding to the given chain. Returns 0 if cur isn't a plugin keyword. */
+static int parse_plugin_node(xmlDocPtr doc, xmlNodePtr cur, ices_plugin_t **chain) {
+	char *str;
+	int i;
+
+	if (xmlstrcmp(cur->name, "Crossfade") == 0) {
+		if ((i = atoi(ices_xml_read_node(doc, cur))) > 0)
+			append_plugin(chain, crossfade_plugin(i));
+	} else if (xmlstrcmp(cur->name, "MinCrossfade") == 0) {
+		if ((i = atoi(ices_xml_read_node(doc, cur))) > 0)
+			set_plugin_option(*chain, "crossfade", (char *) cur->name,
+					  CFOPT_FADEMINLEN, i);
+	} else if (xmlstrcmp(cur->name, "CrossMix") == 0) {
+		if ((i = atoi(ices_xml_read_node(doc, cur))) > 0)
+			set_plugin_option(*chain, "crossfade", (char *) cur->name,
+					  CFOPT_CROSSMIX, i);
+	} else if (xmlstrcmp(cur->name, "Limiter") == 0) {
+		str = ices_xml_read_node(doc, cur);
+		append_plugin(chain, limiter_plugin(str ? atof(str) : ICES_DEFAULT_LIMITER));
+	} else if (xmlstrcmp(cur->name, "LimiterLookahead") == 0) {
+		set_plugin_option(*chain, "limiter", (char *) cur->name, LIMOPT_LOOKAHEAD,
+				  atoi(ices_util_nullcheck(ices_xml_read_node(doc, cur))));
+	} else if (xmlstrcmp(cur->name, "LimiterRelease") == 0) {
+		set_plugin_option(*chain, "limiter", (char *) cur->name, LIMOPT_RELEASE,
+				  atoi(ices_util_nullcheck(ices_xml_read_node(doc, cur))));
+	} else if (xmlstrcmp(cur->name, "AGC") == 0) {
+		str = ices_xml_read_node(doc, cur);
+		append_plugin(chain, agc_plugin(str ? atof(str) : ICES_DEFAULT_AGC));
+	} else if (xmlstrcmp(cur->name, "AGCMaxGain") == 0) {
+		set_plugin_option(*chain, "agc", (char *) cur->name, AGCOPT_MAXGAIN,
+				  atoi(ices_util_nullcheck(ices_xml_read_node(doc, cur))));
+	} else if (xmlstrcmp(cur->name, "AGCBands") == 0) {
+		set_plugin_option(*chain, "agc", (char *) cur->name, AGCOPT_BANDS,
+				  atoi(ices_util_nullcheck(ices_xml_read_node(doc, cur))));
+	} else if (xmlstrcmp(cur->name, "Plugin") == 0)
+		parse_dsp_node(doc, cur->xmlChildrenNode, chain);
+	else
+		return 0;
+
+	return 1;
+}
+
+/* Add a plugin to the end of a chain, so plugins run in config file order */
+static void append_plugin(ices_plugin_t **chain, ices_plugin_t *plugin) {
+	if (!plugin) {
+		ices_log("%s", ices_log_get_error());
+		return;
+	}
+
+	while (*chain)
+		chain = &(*chain)->next;
+	*chain = plugin;
+}
+
+/* Load the DSP plugin named by Module and give it the other keywords
+ * as options */
+static void parse_dsp_node(xmlDocPtr doc, xmlNodePtr cur, ices_plugin_t **chain) {
+#if defined (HAVE_DLOPEN) && defined (HAVE_LIBLAME)
+	ices_plugin_t *plugin;
+	xmlNodePtr node;
+	char *module = NULL;
+
+	for (node = cur; node; node = node->next)
+		if (node->type != XML_COMMENT_NODE && xmlstrcmp(node->name, "Module") == 0)
+			module = ices_xml_read_node(doc, node);
+
+	if (!module) {
+		ices_log("Plugin section without a Module, ignoring it");
+		return;
+	}
+	if (!(plugin = ices_dsp_load(module))) {
+		ices_log("%s", ices_log_get_error());
+		return;
+	}
+
+	for (node = cur; node; node = node->next) {
+		if (node->type == XML_COMMENT_NODE || xmlstrcmp(node->name, "Module") == 0)
+			continue;
+
+		if (ices_dsp_option(plugin, (char *) node->name, ices_xml_read_node(doc, node)) < 0)
+			ices_log("Invalid option for plugin %s: %s", plugin->name, node->name);
+	}
+
+	append_plugin(chain, plugin);
+#else
+	ices_log("Support for loadable plugins was not compiled in, ignoring Plugin section");
+#endif
+}
+
+/* Pass an option to the first plugin called name in the chain */
+static void set_plugin_option(ices_plugin_t *chain, const char *name,
+			      const char *keyword, int optid, int val) {
+	for (; chain; chain = chain->next)
+		if (strcmp(chain->name, name) == 0) {
+			if (chain->options(chain, optid, &val) < 0)
+				ices_log("Invalid plugin option value for: %s", keyword);
+			return;
+		}
+
+	ices_log("Option specified for non-registered plugin: %s", keyword);
+}
+
 static char* ices_xml_read_node(xmlDocPtr doc, xmlNodePtr node) {
 	return (char *) xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
 }
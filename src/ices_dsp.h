@@ -0,0 +1,90 @@
+/* ices_dsp.h
+ * - Interface for run-time loadable ices DSP plugins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+/* A DSP plugin is a shared object in the module directory which exports
+ * ICES_DSP_ENTRY, a function returning a pointer to a static
+ * ices_dsp_module_t. It is named in the config file with a <Plugin>
+ * section, eg
+ *
+ *   <Plugin>
+ *     <Module>limiter</Module>
+ *     <Ceiling>-1.0</Ceiling>
+ *   </Plugin>
+ *
+ * which loads limiter.so and passes it the option "Ceiling". This header
+ * is all a plugin needs from ices. */
+
+#ifndef _ICES_DSP_H
+#define _ICES_DSP_H
+
+#include <stddef.h>
+
+/* Bump when ices_dsp_module_t or the calling rules change incompatibly */
+#define ICES_DSP_ABI_VERSION 1
+
+#define ICES_DSP_ENTRY "ices_dsp_module"
+
+/* sample formats, also used as a bit mask in ices_dsp_module_t.formats.
+ * Buffers are always planar stereo: one array for each channel. */
+#define ICES_DSP_INT16 0x1 /* native endian int16_t */
+#define ICES_DSP_FLOAT 0x2 /* float, full scale is [-1.0, 1.0] */
+
+/* what a plugin is told about each new track */
+typedef struct {
+	const char* path;
+	unsigned int samplerate;
+	unsigned int channels;   /* of the source: the buffers are always stereo */
+	unsigned int bitrate;    /* kbps, 0 if unknown */
+	size_t filesize;         /* bytes, 0 if unknown */
+} ices_dsp_track_t;
+
+typedef struct {
+	/* must be ICES_DSP_ABI_VERSION */
+	unsigned int abi_version;
+	const char* name;
+
+	/* formats the plugin can process. If both are offered ices uses
+	 * int16, which saves a conversion. */
+	unsigned int formats;
+	/* frames the plugin wants per process call, or 0 for any number. A
+	 * fixed block size adds that many frames of latency. */
+	unsigned int blocksize;
+
+	/* Returns new plugin state, or NULL on failure. */
+	void* (*create)(void);
+	/* Set an option from the config file. Returns 0 on success, -1 if the
+	 * key is unknown or the value bad. Only called before start. */
+	int (*option)(void* state, const char* key, const char* value);
+	/* Called once before any audio with the negotiated format and block
+	 * size (the largest a call will see if blocksize was 0). Returns 0
+	 * to accept, -1 to refuse. */
+	int (*start)(void* state, unsigned int format, unsigned int blocksize);
+	/* Called before each track. May be NULL. */
+	void (*new_track)(void* state, const ices_dsp_track_t* track);
+	/* Process frames in place. Output must be the same length as the
+	 * input: plugins needing lookahead delay the signal themselves.
+	 * Returns 0, or -1 on error, after which ices bypasses the plugin. */
+	int (*process)(void* state, void* left, void* right, unsigned int frames);
+	/* Free the state. */
+	void (*destroy)(void* state);
+} ices_dsp_module_t;
+
+typedef const ices_dsp_module_t* (*ices_dsp_entry_t)(void);
+
+#endif
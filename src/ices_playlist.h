@@ -0,0 +1,69 @@
+/* ices_playlist.h
+ * - Interface for run-time loadable native playlist modules
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+/* A native playlist module is a shared object in the module directory
+ * which exports ICES_PLAYLIST_ENTRY, a function returning a pointer to a
+ * static ices_playlist_module_t. It is selected with
+ *
+ *   <Type>native</Type>
+ *   <Module>rotation</Module>
+ *
+ * which loads rotation.so. Tracks are asked for several at a time, so a
+ * module may be called well before the first of them plays, and its
+ * functions are called from one thread at a time, though not always
+ * the main one. This header is all a module needs from ices. */
+
+#ifndef _ICES_PLAYLIST_H
+#define _ICES_PLAYLIST_H
+
+/* Bump when ices_playlist_module_t or the calling rules change incompatibly */
+#define ICES_PLAYLIST_ABI_VERSION 1
+
+#define ICES_PLAYLIST_ENTRY "ices_playlist_module"
+
+/* one track handed out by a module */
+typedef struct {
+	const char* path;
+	const char* metadata;   /* NULL to use the file's tags */
+	int timelimit;          /* seconds, 0 for no limit */
+	int lineno;             /* for the cue file, 0 if it means nothing */
+} ices_playlist_track_t;
+
+typedef struct {
+	/* must be ICES_PLAYLIST_ABI_VERSION */
+	unsigned int abi_version;
+	const char* name;
+
+	/* Called once with Playlist/File and Playlist/Randomize. Returns
+	 * module state, or NULL on failure. */
+	void* (*init)(const char* playlist, int randomize);
+	/* Fill in up to max tracks and return how many, 0 if there are no
+	 * more or -1 on error. The strings must stay valid until the next
+	 * call to get_next or shutdown. */
+	int (*get_next)(void* state, ices_playlist_track_t* tracks, unsigned int max);
+	/* Called on SIGHUP, before the next get_next. Tracks already
+	 * handed out are dropped. Returns 0, or -1 on error. May be NULL. */
+	int (*reload)(void* state);
+	/* Free the state. */
+	void (*shutdown)(void* state);
+} ices_playlist_module_t;
+
+typedef const ices_playlist_module_t* (*ices_playlist_entry_t)(void);
+
+#endif
@@ -0,0 +1,80 @@
+/* ices_status.h
+ * - Layout of the status file ices keeps up to date for monitors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+/* With the cue file enabled, ices keeps BaseDirectory/ices.status, a
+ * file of exactly one ices_status_t, mapped into memory and updated in
+ * place after every buffer sent. A monitor maps it read-only (or just
+ * reads it) and uses ices_status_read to get a consistent copy: the
+ * writer makes seq odd while it changes anything, so a copy taken while
+ * seq was odd, or changed, is retried. The file is in host byte order,
+ * for monitors on the same machine. */
+
+#ifndef _ICES_STATUS_H
+#define _ICES_STATUS_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define ICES_STATUS_MAGIC 0x49434553 /* "ICES" */
+/* Bump when ices_status_t changes incompatibly */
+#define ICES_STATUS_VERSION 1
+
+typedef struct {
+	uint32_t magic;         /* ICES_STATUS_MAGIC */
+	uint32_t version;       /* ICES_STATUS_VERSION */
+	uint32_t seq;           /* odd while being written */
+	uint32_t pid;
+	int64_t started;        /* when the track started, seconds since the epoch */
+	int64_t updated;        /* when this was last written */
+	uint64_t filesize;      /* bytes, 0 if unknown */
+	uint64_t bytes_read;
+	uint32_t bitrate;       /* kbps, 0 if unknown */
+	uint32_t duration;      /* ms, 0 if unknown */
+	int32_t lineno;         /* playlist line, 0 if it means nothing */
+	uint32_t tracks;        /* tracks started since ices did */
+	char path[1024];
+	char artist[256];
+	char title[256];
+} ices_status_t;
+
+/* Copy a consistent snapshot of *status into *copy. Returns 0, or -1 if
+ * it isn't an ices status file this header describes or never settles
+ * (ices died while writing it). */
+static inline int ices_status_read(const volatile ices_status_t* status,
+				   ices_status_t* copy) {
+	uint32_t seq;
+	int tries = 0;
+
+	do {
+		if (++tries > 1000000)
+			return -1;
+		if ((seq = status->seq) & 1)
+			continue;
+		__sync_synchronize();
+		memcpy(copy, (const void*) status, sizeof(ices_status_t));
+		__sync_synchronize();
+	} while ((seq & 1) || status->seq != seq);
+
+	if (copy->magic != ICES_STATUS_MAGIC || copy->version != ICES_STATUS_VERSION)
+		return -1;
+
+	return 0;
+}
+
+#endif
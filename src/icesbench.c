@@ -0,0 +1,501 @@
+/* icesbench.c
+ * - Time the whole stream pipeline on real files, as fast as it goes
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+/* Usage: ices-bench [-n passes] [-c ices.conf] [-P] [-C] file...
+ *        ices-bench -M mounts[:step] [-n passes] [-o file.csv] file...
+ *
+ * ices-bench is ices built with a null sink in place of libshout: each
+ * file is opened, decoded, run through replaygain and the plugins,
+ * encoded and "sent" by the same stream_send() ices uses, but nothing
+ * waits for the sample clock or a server: the null sink keeps the clock
+ * for reencoded streams and notes how late each send would have been,
+ * had it slept where libshout would. The streams, reencoding
+ * settings and plugins come from the config file, as for ices; every
+ * stream is reencoded unless -P is given, so MP3 may pass through.
+ *
+ * It reports, for each input format, how much faster than real time it
+ * went and how many allocations each track took (with glibc), then the
+ * time spent in each stage per sample (of one channel) of audio. "other"
+ * is what isn't in a stage: opening and parsing files, closing them and
+ * the loop. The real-time factor is, as for the metrics endpoint, the
+ * time taken over the length of the audio. -C gives the figures as one
+ * line of CSV instead.
+ *
+ * -M plays the files again and again with 1, then 1 + step and so on
+ * up to mounts reencoded streams, at a mix of bitrates, each time in a
+ * fresh ices-bench with a config of its own, and writes a CSV line for
+ * each run: the real-time factor, CPU time per mount, the most memory
+ * used, and how many sends were late and by how much. Whether ices
+ * scales with its mounts is then a matter of plotting the columns. */
+
+#include "definitions.h"
+
+#include <dirent.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define BENCH_FORMATS 4
+/* bitrates of the streams -M makes, in turn */
+#define BENCH_BITRATES 6
+
+typedef struct {
+	unsigned int tracks;
+	double audio;
+	double wall;
+	unsigned long long allocs;
+} bench_format_t;
+
+ices_config_t ices_config;
+
+static const char* FormatNames[BENCH_FORMATS] = { "vorbis", "mp3", "mp4", "flac" };
+static bench_format_t Formats[BENCH_FORMATS];
+static const int Bitrates[BENCH_BITRATES] = { 128, 64, 192, 96, 256, 160 };
+static volatile unsigned long long Allocs = 0;
+
+/* Private function declarations */
+static void bench_usage(const char* name);
+static int bench_scale(char** argv, int files, int mounts, int step, int passes,
+		       const char* output);
+static int bench_config(const char* dir, int mounts);
+static void bench_clean(const char* dir);
+static void bench_report(double audio, double samples, double wall);
+static void bench_csv(FILE* fp, double audio, double wall);
+static void bench_lateness(uint64_t* sends, uint64_t* late, double* p99, double* max);
+static void bench_stage(const char* name, double seconds, double samples, double wall);
+
+int main(int argc, char** argv) {
+	char playlist[] = "/tmp/ices-bench.XXXXXX";
+	char* args[12];
+	const char* config = NULL;
+	const char* output = NULL;
+	input_stream_t source;
+	unsigned long long allocs;
+	FILE* out = NULL;
+	char* colon;
+	int passthrough = 0;
+	int csv = 0;
+	int mounts = 0;
+	int step = 1;
+	int passes = 1;
+	int nargs = 0;
+	int failed = 0;
+	double audio = 0;
+	double samples = 0;
+	double wall = 0;
+	double t;
+	FILE* fp;
+	int fd;
+	int pass;
+	int opt;
+	int i;
+
+	while ((opt = getopt(argc, argv, "n:c:PCM:o:")) != -1)
+		switch (opt) {
+		case 'n':
+			if ((passes = atoi(optarg)) < 1)
+				bench_usage(argv[0]);
+			break;
+		case 'c':
+			config = optarg;
+			break;
+		case 'P':
+			passthrough = 1;
+			break;
+		case 'C':
+			csv = 1;
+			break;
+		case 'M':
+			mounts = atoi(optarg);
+			if ((colon = strchr(optarg, ':')))
+				step = atoi(colon + 1);
+			if (mounts < 1 || step < 1)
+				bench_usage(argv[0]);
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		default:
+			bench_usage(argv[0]);
+		}
+	if (optind >= argc || (mounts && (config || passthrough || csv)))
+		bench_usage(argv[0]);
+
+	if (mounts)
+		return bench_scale(argv, argc - optind, mounts, step, passes, output);
+
+	/* ices wants a playlist, even though the files are played from here */
+	if ((fd = mkstemp(playlist)) < 0 || !(fp = fdopen(fd, "w"))) {
+		perror(playlist);
+		return 1;
+	}
+	for (i = optind; i < argc; i++)
+		fprintf(fp, "%s\n", argv[i]);
+	fclose(fp);
+
+	args[nargs++] = argv[0];
+	if (config) {
+		args[nargs++] = "-c";
+		args[nargs++] = (char*) config;
+	}
+	args[nargs++] = "-S";
+	args[nargs++] = "builtin";
+	args[nargs++] = "-F";
+	args[nargs++] = playlist;
+	if (!passthrough)
+		args[nargs++] = "-R";
+	args[nargs] = NULL;
+
+	/* with -C, the line is all that goes to standard output */
+	if (csv && ((fd = dup(STDOUT_FILENO)) < 0 || !(out = fdopen(fd, "w"))
+		    || !freopen("/dev/null", "w", stdout))) {
+		perror("stdout");
+		return 1;
+	}
+
+	ices_util_set_args(nargs, args);
+	ices_setup_initialize();
+	/* from here on ices' own messages only go to its log file */
+	ices_config.daemon = 1;
+
+	for (pass = 0; pass < passes; pass++)
+		for (i = optind; i < argc; i++) {
+			memset(&source, 0, sizeof(source));
+			source.path = argv[i];
+
+			allocs = Allocs;
+			t = ices_metrics_clock();
+			if (ices_stream_play(&ices_config, &source) < 0) {
+				if (!pass)
+					fprintf(stderr, "%s: %s\n", argv[i], ices_log_get_error());
+				failed++;
+				continue;
+			}
+			t = ices_metrics_clock() - t;
+
+			Formats[source.type].tracks++;
+			Formats[source.type].audio += ices_metrics_track_audio();
+			Formats[source.type].wall += t;
+			Formats[source.type].allocs += Allocs - allocs;
+			audio += ices_metrics_track_audio();
+			samples += ices_metrics_track_audio() * source.samplerate;
+			wall += t;
+		}
+
+	remove(playlist);
+
+	if (failed)
+		fprintf(stderr, "%d tracks could not be played\n", failed);
+	if (samples > 0 && csv)
+		bench_csv(out, audio, wall);
+	else if (samples > 0)
+		bench_report(audio, samples, wall);
+
+	return failed && samples <= 0;
+}
+
+/* Private function definitions */
+
+static void bench_usage(const char* name) {
+	fprintf(stderr, "Usage: %s [-n passes] [-c ices.conf] [-P] [-C] file...\n"
+		"       %s -M mounts[:step] [-n passes] [-o file.csv] file...\n", name, name);
+	exit(1);
+}
+
+/* Run ices-bench -C on the files, from argv[optind], with each number
+ * of mounts in turn, writing the CSV to output or standard output */
+static int bench_scale(char** argv, int files, int mounts, int step, int passes,
+		       const char* output) {
+	char dir[] = "/tmp/ices-bench.XXXXXX";
+	char config[1024];
+	char count[16];
+	char** args;
+	pid_t pid;
+	FILE* fp;
+	int status;
+	int rc = 1;
+	int n;
+	int i;
+
+	if (!output)
+		fp = stdout;
+	else if (!(fp = fopen(output, "w"))) {
+		perror(output);
+		return 1;
+	}
+	if (!mkdtemp(dir)) {
+		perror(dir);
+		return 1;
+	}
+
+	snprintf(config, sizeof(config), "%s/ices.conf", dir);
+	snprintf(count, sizeof(count), "%d", passes);
+	args = malloc((files + 7) * sizeof(char*));
+	args[0] = argv[0];
+	args[1] = "-C";
+	args[2] = "-n";
+	args[3] = count;
+	args[4] = "-c";
+	args[5] = config;
+	for (i = 0; i < files; i++)
+		args[6 + i] = argv[optind + i];
+	args[6 + files] = NULL;
+
+	fprintf(fp, "mounts,kbps,audio_s,wall_s,realtime_factor,cpu_s,cpu_per_mount_s,"
+		"cpu_per_mount_pct,max_rss_kb,allocs_per_track,sends,late_sends,late_p99_s,"
+		"late_max_s\n");
+	fflush(fp);
+
+	for (n = 1; n <= mounts; n = n < mounts && n + step > mounts ? mounts : n + step) {
+		if (bench_config(dir, n) < 0)
+			break;
+		fprintf(stderr, "%d mount%s...\n", n, n == 1 ? "" : "s");
+
+		if ((pid = fork()) < 0) {
+			perror("fork");
+			break;
+		}
+		if (!pid) {
+			dup2(fileno(fp), STDOUT_FILENO);
+			execv("/proc/self/exe", args);
+			execvp(argv[0], args);
+			perror(argv[0]);
+			_exit(1);
+		}
+		if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status)) {
+			/* keep its log */
+			fprintf(stderr, "ices-bench with %d mounts failed, see %s/ices.log\n", n, dir);
+			free(args);
+			return 1;
+		}
+		if (n == mounts) {
+			rc = 0;
+			break;
+		}
+	}
+
+	bench_clean(dir);
+	free(args);
+	if (fp != stdout)
+		fclose(fp);
+
+	return rc;
+}
+
+/* dir/ices.conf, with mounts reencoded streams at Bitrates in turn */
+static int bench_config(const char* dir, int mounts) {
+	char path[1024];
+	FILE* fp;
+	int i;
+
+	snprintf(path, sizeof(path), "%s/ices.conf", dir);
+	if (!(fp = fopen(path, "w"))) {
+		perror(path);
+		return -1;
+	}
+
+	fprintf(fp, "<?xml version=\"1.0\"?>\n"
+		"<ices:Configuration xmlns:ices=\"http://www.icecast.org/projects/ices\">\n"
+		"  <Playlist><Type>builtin</Type></Playlist>\n"
+		"  <Execution><Background>0</Background><Verbose>0</Verbose>"
+		"<BaseDirectory>%s</BaseDirectory></Execution>\n", dir);
+	for (i = 0; i < mounts; i++)
+		fprintf(fp, "  <Stream><Server><Hostname>127.0.0.1</Hostname></Server>"
+			"<Mountpoint>/bench%d</Mountpoint><Bitrate>%d</Bitrate>"
+			"<Reencode>1</Reencode><Samplerate>44100</Samplerate>"
+			"<Channels>2</Channels></Stream>\n", i + 1, Bitrates[i % BENCH_BITRATES]);
+	fprintf(fp, "</ices:Configuration>\n");
+
+	if (fclose(fp)) {
+		perror(path);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Remove dir and what the runs left in it */
+static void bench_clean(const char* dir) {
+	char path[1024];
+	struct dirent* entry;
+	DIR* dp;
+
+	if (!(dp = opendir(dir)))
+		return;
+	while ((entry = readdir(dp))) {
+		if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+		remove(path);
+	}
+	closedir(dp);
+	rmdir(dir);
+}
+
+static void bench_report(double audio, double samples, double wall) {
+	bench_format_t* format;
+	ices_stream_t* stream;
+	uint64_t sends;
+	uint64_t late;
+	double p99;
+	double max;
+	double plugin;
+	double encode = 0;
+	double send = 0;
+	double staged;
+	int streams = 0;
+	int i;
+
+	for (stream = ices_config.streams; stream; stream = stream->next)
+		streams++;
+
+	printf("%d stream%s, %s\n", streams, streams == 1 ? "" : "s",
+	       ices_config.reencode ? "reencoding" : "passing through");
+	printf("%-8s %8s %10s %10s %10s %12s\n", "format", "tracks", "audio s",
+	       "wall s", "realtime", "allocs/track");
+	for (i = 0; i < BENCH_FORMATS; i++) {
+		format = &Formats[i];
+		if (!format->tracks)
+			continue;
+		printf("%-8s %8u %10.1f %10.3f %9.1fx", FormatNames[i], format->tracks,
+		       format->audio, format->wall, format->wall > 0 ? format->audio / format->wall : 0);
+#ifdef __GLIBC__
+		printf(" %12.1f\n", (double) format->allocs / format->tracks);
+#else
+		printf(" %12s\n", "-");
+#endif
+	}
+
+	plugin = ices_metrics_stage_seconds(NULL, ices_stage_plugin_e);
+	for (stream = ices_config.streams; stream; stream = stream->next) {
+		plugin += ices_metrics_stage_seconds(stream, ices_stage_plugin_e);
+		encode += ices_metrics_stage_seconds(stream, ices_stage_encode_e);
+		send += ices_metrics_stage_seconds(stream, ices_stage_send_e);
+	}
+
+	printf("\n%-12s %10s %10s %8s\n", "stage", "seconds", "ns/sample", "share");
+	staged = ices_metrics_stage_seconds(NULL, ices_stage_decode_e)
+		+ ices_metrics_stage_seconds(NULL, ices_stage_replaygain_e)
+		+ plugin + encode + send;
+	bench_stage("decode", ices_metrics_stage_seconds(NULL, ices_stage_decode_e), samples, wall);
+	bench_stage("replaygain", ices_metrics_stage_seconds(NULL, ices_stage_replaygain_e),
+		    samples, wall);
+	bench_stage("plugin", plugin, samples, wall);
+	bench_stage("encode", encode, samples, wall);
+	bench_stage("send", send, samples, wall);
+	bench_stage("other", wall > staged ? wall - staged : 0, samples, wall);
+	bench_stage("total", wall, samples, wall);
+	printf("\nreal-time factor %.5f: %.1f s of audio in %.3f s\n", wall / audio, audio, wall);
+
+	bench_lateness(&sends, &late, &p99, &max);
+	if (sends)
+		printf("%llu of %llu sends behind the sample clock, late by %.3f/%.3fs (99%%/max)\n",
+		       (unsigned long long) late, (unsigned long long) sends, p99, max);
+}
+
+/* One line: see bench_scale() for the columns */
+static void bench_csv(FILE* fp, double audio, double wall) {
+	ices_stream_t* stream;
+	struct rusage usage;
+	unsigned long long allocs = 0;
+	unsigned int tracks = 0;
+	uint64_t sends;
+	uint64_t late;
+	double cpu;
+	double p99;
+	double max;
+	int streams = 0;
+	int kbps = 0;
+	int i;
+
+	for (stream = ices_config.streams; stream; stream = stream->next) {
+		streams++;
+		kbps += stream->bitrate;
+	}
+	for (i = 0; i < BENCH_FORMATS; i++) {
+		tracks += Formats[i].tracks;
+		allocs += Formats[i].allocs;
+	}
+
+	getrusage(RUSAGE_SELF, &usage);
+	cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6
+		+ usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+	bench_lateness(&sends, &late, &p99, &max);
+
+	fprintf(fp, "%d,%d,%.3f,%.3f,%.6f,%.3f,%.4f,%.4f,%ld,", streams, kbps, audio, wall,
+		wall / audio, cpu, cpu / streams, cpu * 100 / streams / audio,
+		(long) usage.ru_maxrss);
+#ifdef __GLIBC__
+	fprintf(fp, "%.1f,", tracks ? (double) allocs / tracks : 0);
+#else
+	fprintf(fp, ",");
+#endif
+	fprintf(fp, "%llu,%llu,%.6f,%.6f\n", (unsigned long long) sends, (unsigned long long) late,
+		p99, max);
+}
+
+/* How the sends of all the streams kept to the sample clock */
+static void bench_lateness(uint64_t* sends, uint64_t* late, double* p99, double* max) {
+	ices_histogram_t all;
+	ices_stream_t* stream;
+	int i;
+
+	memset(&all, 0, sizeof(all));
+	*late = 0;
+	for (stream = ices_config.streams; stream; stream = stream->next) {
+		all.count += stream->lateness.count;
+		all.sum += stream->lateness.sum;
+		if (stream->lateness.max > all.max)
+			all.max = stream->lateness.max;
+		for (i = 0; i < ICES_HISTOGRAM_BUCKETS; i++)
+			all.buckets[i] += stream->lateness.buckets[i];
+		*late += stream->behind;
+	}
+
+	*sends = all.count;
+	*p99 = ices_histogram_percentile(&all, 99);
+	*max = all.max;
+}
+
+static void bench_stage(const char* name, double seconds, double samples, double wall) {
+	printf("%-12s %10.3f %10.2f %7.1f%%\n", name, seconds, seconds * 1e9 / samples,
+	       wall > 0 ? seconds * 100 / wall : 0);
+}
+
+#ifdef __GLIBC__
+/* Count allocations, whoever makes them */
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t nmemb, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+void* malloc(size_t size) {
+	__sync_fetch_and_add(&Allocs, 1);
+	return __libc_malloc(size);
+}
+
+void* calloc(size_t nmemb, size_t size) {
+	__sync_fetch_and_add(&Allocs, 1);
+	return __libc_calloc(nmemb, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+	__sync_fetch_and_add(&Allocs, 1);
+	return __libc_realloc(ptr, size);
+}
+#endif
@@ -32,9 +32,37 @@ typedef enum {
 	ices_playlist_builtin_e,
 	ices_playlist_script_e,
 	ices_playlist_python_e,
-	ices_playlist_perl_e
+	ices_playlist_perl_e,
+	ices_playlist_native_e,
+	ices_playlist_library_e,
+	ices_playlist_rotation_e
 } playlist_type_t;
 
+/* Where the time to send a buffer goes. Decode and replaygain are only
+ * timed once for all streams. */
+typedef enum {
+	ices_stage_decode_e,
+	ices_stage_replaygain_e,
+	ices_stage_plugin_e,
+	ices_stage_encode_e,
+	ices_stage_sync_e,      /* waiting in shout_sync, not work */
+	ices_stage_send_e,
+	ices_stages_e
+} ices_stage_t;
+
+/* HDR style histogram of microseconds: values below 16 are counted
+ * exactly, and each power of two above that is split into 8 steps, so a
+ * bucket's bound is never more than 1/8 above what it counts. The last
+ * bucket takes everything from about 35 minutes up. */
+#define ICES_HISTOGRAM_BUCKETS (16 + 28 * 8)
+
+typedef struct {
+	uint64_t count;
+	double sum;             /* seconds */
+	double max;             /* seconds */
+	uint64_t buckets[ICES_HISTOGRAM_BUCKETS];
+} ices_histogram_t;
+
 typedef struct ices_stream_St {
 	shout_t* conn;
 	time_t connect_delay;
@@ -61,18 +89,51 @@ typedef struct ices_stream_St {
 	int out_samplerate;
 	int out_numchannels;
 
+	/* DSP chain for this stream only, run after the global chain */
+	struct _ices_plugin* plugins;
+	/* set per track: this stream is fed decoded PCM */
+	int encode;
+
+	/* for the metrics endpoint */
+	uint64_t bytes_sent;
+	unsigned int connects;
+	ices_histogram_t stages[ices_stages_e];
+	/* how far behind libshout's sample clock each send was, and how
+	 * many were behind at all, since ices started and this track */
+	ices_histogram_t lateness;
+	uint64_t behind;
+	ices_histogram_t track_lateness;
+	ices_histogram_t track_sync;
+	unsigned int track_sends;
+	unsigned int track_behind;
+	/* for the play log: this track's bytes sent, time spent encoding
+	 * and failed sends */
+	uint64_t track_bytes;
+	double track_encode;
+	unsigned int track_errors;
+	/* ices-bench's null sink: when this stream's sample clock started,
+	 * and how long shout_sync would have slept on it so far */
+	double bench_start;
+	double bench_slept;
+
 	struct ices_stream_St* next;
 } ices_stream_t;
 
 typedef struct {
 	playlist_type_t playlist_type;
 	int randomize;
+	int norepeat;
 	char* playlist_file;
 	char* module;
+	char* category;     /* library module: category to play, NULL for all */
+	int persistent;     /* script module: keep the script running */
+	int timeout;        /* script module: seconds to wait for an answer */
+	int lookahead;      /* entries to resolve before they are needed */
 
 	char* (*get_next)(void);        /* caller frees result */
 	char* (*get_metadata)(void);    /* caller frees result */
 	int (*get_timelimit)(void);
+	int (*get_duration)(void);      /* ms, 0 if unknown */
 	int (*get_lineno)(void);
 	int (*reload)(void);
 	void (*shutdown)(void);
@@ -97,6 +158,7 @@ typedef struct _input_stream_t {
 	unsigned int bitrate;
 	unsigned int samplerate;
 	unsigned int channels;
+	unsigned int duration;   /* ms, 0 if unknown */
 
 	void* data;
 
@@ -111,12 +173,14 @@ typedef struct _input_stream_t {
 typedef struct _ices_plugin {
 	const char *name;
 
-	int (*init)(void);
-	void (*new_track)(input_stream_t *source);
-	int (*process)(int ilen, int16_t *il, int16_t *ir);
-	void (*shutdown)(void);
-	int (*options)(int optid, void *opt);
+	int (*init)(struct _ices_plugin *self);
+	void (*new_track)(struct _ices_plugin *self, input_stream_t *source);
+	int (*process)(struct _ices_plugin *self, int ilen, int16_t *il, int16_t *ir);
+	void (*shutdown)(struct _ices_plugin *self);
+	int (*options)(struct _ices_plugin *self, int optid, void *opt);
 
+	/* instance state, owned by the plugin */
+	void *data;
 	struct _ices_plugin *next;
 } ices_plugin_t;
 
@@ -125,8 +189,13 @@ typedef struct {
 	int verbose;
 	int reencode;
 	int cuefile;
+	int autocue;
 	char *configfile;
 	char *base_directory;
+	char *control;      /* control socket path, NULL for none */
+	char *metrics;      /* metrics [host:]port or socket path, NULL for none */
+	int playlog;        /* write a JSON record per track */
+	char *trace;        /* trace events to this file from the start, NULL for none */
 	FILE *logfile;
 
 	ices_stream_t* streams;
@@ -95,6 +95,10 @@ void ices_id3v1_parse(input_stream_t* source) {
 		/* Don't stream the tag */
 		source->filesize -= 128;
 
+		/* it holds nothing but names, which the playlist has given */
+		if (ices_metadata_from_playlist())
+			goto out;
+
 		if (read(source->fd, title, 30) != 30) {
 			ices_log("Error reading ID3v1 song title: %s",
 				 ices_util_strerror(errno, buffer, sizeof(buffer)));
@@ -37,6 +37,8 @@ typedef struct {
         int16_t *left;
         int16_t *right;
         size_t olen;
+        /* for more than two channels */
+        ices_downmix_t downmix;
 } flac_in_t;
 
 /* -- static prototypes -- */
@@ -137,6 +139,11 @@ ices_flac_open (input_stream_t* self, char* buf, size_t len)
                 return 1;
         }
 
+        if (self->channels > 2
+            && ices_downmix_init(&flac_data->downmix, self->channels,
+                                 ices_downmix_layout_wave(self->channels)) < 0)
+                goto errData;
+
         self->type = ICES_INPUT_FLAC;
 
         self->read = NULL;
@@ -232,6 +239,15 @@ flac_write_cb(const FLAC__StreamDecoder* decoder, const FLAC__Frame* frame,
         flac_in_t* flac_data = (flac_in_t*)self->data;
         int i;
 
+        if (self->channels > 2) {
+                ices_downmix_int32(&flac_data->downmix, buffer, frame->header.blocksize,
+                                   frame->header.bits_per_sample,
+                                   flac_data->left, flac_data->right);
+                flac_data->olen = frame->header.blocksize;
+
+                return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+        }
+
         for (i = 0; i < frame->header.blocksize; i++) {
                 flac_data->left[i] = scale16(buffer[0][i], frame->header.bits_per_sample);
                 if (self->channels > 1) {
@@ -261,6 +277,9 @@ flac_metadata_cb(const FLAC__StreamDecoder* decoder,
         case FLAC__METADATA_TYPE_STREAMINFO:
                 self->samplerate = metadata->data.stream_info.sample_rate;
                 self->channels = metadata->data.stream_info.channels;
+                if (self->samplerate)
+                        self->duration = metadata->data.stream_info.total_samples * 1000
+                                / self->samplerate;
                 flac_data->parsed = 1;
                 ices_log_debug("Found FLAC file, %d Hz, %d channels, %d bits", self->samplerate, self->channels, metadata->data.stream_info.bits_per_sample);
                 break;
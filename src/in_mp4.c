@@ -38,6 +38,7 @@ typedef struct {
 	MP4TrackId track;
 	faacDecHandle decoder;
 	MP4SampleId cur_sample;
+	ices_downmix_t downmix;
 } mp4_in_t;
 
 /* -- static prototypes -- */
@@ -45,6 +46,7 @@ static void ices_mp4_read_metadata(MP4FileHandle mp4file);
 static int ices_mp4_readpcm(input_stream_t* self, size_t len,
 			    int16_t* left, int16_t* right);
 static int ices_mp4_close(input_stream_t* self);
+static int ices_mp4_init_downmix(mp4_in_t* mp4_data, faacDecFrameInfo* fi);
 
 /* try to open an MP4 file for decoding. Returns:
  *   0: success
@@ -105,7 +107,7 @@ int ices_mp4_open(input_stream_t* self, char* buf, size_t len) {
 
 	ices_log_debug("Found MP4 audio at track %u, sample rate %u, %u channels", track, samplerate, channels);
 
-	if (channels != 2) {
+	if (channels < 1 || channels > ICES_DOWNMIX_MAXCHANNELS) {
 		ices_log_error("ices_mp4_open: Bad number of channels");
 		goto errFAAC;
 	}
@@ -119,11 +121,16 @@ int ices_mp4_open(input_stream_t* self, char* buf, size_t len) {
 
 	self->samplerate = samplerate;
 	self->channels = channels;
+	self->duration = MP4ConvertFromTrackDuration(mp4file, track,
+						     MP4GetTrackDuration(mp4file, track),
+						     MP4_MSECS_TIME_SCALE);
 
 	mp4_data->mp4file = mp4file;
 	mp4_data->track = track;
 	mp4_data->decoder = decoder;
 	mp4_data->cur_sample = 1;
+	/* the channel layout is only known once a frame has been decoded */
+	mp4_data->downmix.channels = 0;
 
 	self->type = ICES_INPUT_MP4;
 	self->data = mp4_data;
@@ -250,6 +257,24 @@ static int ices_mp4_readpcm(input_stream_t* self, size_t olen, int16_t* left,
 		}
 
 	}
+
+	if (fi.channels == 1) {
+		for (i = 0; i < fi.samples; i++)
+			left[i] = right[i] = ((int16_t*) decbuf)[i];
+
+		return fi.samples;
+	}
+
+	if (fi.channels > 2) {
+		if (mp4_data->downmix.channels != fi.channels
+		    && ices_mp4_init_downmix(mp4_data, &fi) < 0)
+			return -1;
+		ices_downmix_int16(&mp4_data->downmix, (int16_t*) decbuf,
+				   fi.samples / fi.channels, left, right);
+
+		return fi.samples / fi.channels;
+	}
+
 	i = 0;
 	while (i < fi.samples) {
 		*left++ = ((int16_t*) decbuf)[i++];
@@ -259,6 +284,53 @@ static int ices_mp4_readpcm(input_stream_t* self, size_t olen, int16_t* left,
 	return fi.samples / 2;
 }
 
+/* build the downmix matrix from the channel positions FAAD reports */
+static int ices_mp4_init_downmix(mp4_in_t* mp4_data, faacDecFrameInfo* fi) {
+	ices_speaker_t layout[ICES_DOWNMIX_MAXCHANNELS];
+	int i;
+
+	if (fi->channels > ICES_DOWNMIX_MAXCHANNELS) {
+		ices_log_error("Cannot downmix %d channels of MP4 audio", fi->channels);
+		return -1;
+	}
+
+	for (i = 0; i < fi->channels; i++) {
+		switch (fi->channel_position[i]) {
+		case FRONT_CHANNEL_LEFT:
+			layout[i] = ices_speaker_front_left_e;
+			break;
+		case FRONT_CHANNEL_RIGHT:
+			layout[i] = ices_speaker_front_right_e;
+			break;
+		case FRONT_CHANNEL_CENTER:
+			layout[i] = ices_speaker_front_center_e;
+			break;
+		case SIDE_CHANNEL_LEFT:
+			layout[i] = ices_speaker_side_left_e;
+			break;
+		case SIDE_CHANNEL_RIGHT:
+			layout[i] = ices_speaker_side_right_e;
+			break;
+		case BACK_CHANNEL_LEFT:
+			layout[i] = ices_speaker_back_left_e;
+			break;
+		case BACK_CHANNEL_RIGHT:
+			layout[i] = ices_speaker_back_right_e;
+			break;
+		case BACK_CHANNEL_CENTER:
+			layout[i] = ices_speaker_back_center_e;
+			break;
+		case LFE_CHANNEL:
+			layout[i] = ices_speaker_lfe_e;
+			break;
+		default:
+			layout[i] = ices_speaker_unknown_e;
+		}
+	}
+
+	return ices_downmix_init(&mp4_data->downmix, fi->channels, layout);
+}
+
 static int ices_mp4_close(input_stream_t* self) {
 	mp4_in_t* mp4_data = (mp4_in_t*) self->data;
 
@@ -41,13 +41,14 @@ typedef struct {
 	int16_t buf[2048];
 	size_t samples;
 	int offset;
+	ices_downmix_t downmix;
 } ices_vorbis_in_t;
 
 /* -- static prototypes -- */
 static int ices_vorbis_readpcm(input_stream_t* self, size_t len,
 			       int16_t* left, int16_t* right);
 static int ices_vorbis_close(input_stream_t* self);
-static void in_vorbis_parse(input_stream_t* self);
+static int in_vorbis_parse(input_stream_t* self);
 static void in_vorbis_set_metadata(ices_vorbis_in_t* vorbis_data);
 
 /* try to open a vorbis file for decoding. Returns:
@@ -126,7 +127,11 @@ int ices_vorbis_open(input_stream_t* self, char* buf, size_t len) {
 	self->readpcm = ices_vorbis_readpcm;
 	self->close = ices_vorbis_close;
 
-	in_vorbis_parse(self);
+	if (in_vorbis_parse(self) < 0) {
+		ices_vorbis_close(self);
+
+		return -1;
+	}
 
 	return 0;
 }
@@ -136,7 +141,6 @@ static int ices_vorbis_readpcm(input_stream_t* self, size_t olen, int16_t* left,
 	ices_vorbis_in_t* vorbis_data = (ices_vorbis_in_t*) self->data;
 	int link;
 	int len;
-	int i;
 
 	/* refill buffer if necessary */
 	if (!vorbis_data->samples) {
@@ -156,7 +160,8 @@ static int ices_vorbis_readpcm(input_stream_t* self, size_t olen, int16_t* left,
 		else if (vorbis_data->link != link) {
 			vorbis_data->link = link;
 			ices_log_debug("New Ogg link found in bitstream");
-			in_vorbis_parse(self);
+			if (in_vorbis_parse(self) < 0)
+				return -1;
 			ices_reencode_reset(self);
 			ices_metadata_update(0);
 		}
@@ -167,6 +172,19 @@ static int ices_vorbis_readpcm(input_stream_t* self, size_t olen, int16_t* left,
 		self->bytes_read = ov_raw_tell(vorbis_data->vf);
 	}
 
+	/* more than two channels: fold them down instead of dropping them */
+	if (vorbis_data->info->channels > 2) {
+		len = vorbis_data->samples;
+		if (len > olen / SAMPLESIZE)
+			len = olen / SAMPLESIZE;
+		ices_downmix_int16(&vorbis_data->downmix,
+				   vorbis_data->buf + vorbis_data->offset, len, left, right);
+		vorbis_data->offset += len * vorbis_data->info->channels;
+		vorbis_data->samples -= len;
+
+		return len;
+	}
+
 	len = 0;
 	while (vorbis_data->samples && olen) {
 		if (vorbis_data->info->channels == 1) {
@@ -177,8 +195,6 @@ static int ices_vorbis_readpcm(input_stream_t* self, size_t olen, int16_t* left,
 			*left++ = vorbis_data->buf[vorbis_data->offset++];
 			*right++ = vorbis_data->buf[vorbis_data->offset++];
 		}
-		for (i = 0; i < vorbis_data->info->channels - 2; i++)
-			vorbis_data->offset++;
 		vorbis_data->samples--;
 		olen -= SAMPLESIZE;
 		len++;
@@ -197,8 +213,9 @@ static int ices_vorbis_close(input_stream_t* self) {
 	return 0;
 }
 
-static void in_vorbis_parse(input_stream_t* self) {
+static int in_vorbis_parse(input_stream_t* self) {
 	ices_vorbis_in_t* vorbis_data = (ices_vorbis_in_t*) self->data;
+	double secs;
 
 	vorbis_data->info = ov_info(vorbis_data->vf, vorbis_data->link);
 	self->bitrate = vorbis_data->info->bitrate_nominal / 1000;
@@ -206,11 +223,19 @@ static void in_vorbis_parse(input_stream_t* self) {
 		self->bitrate = ov_bitrate(vorbis_data->vf, vorbis_data->link) / 1000;
 	self->samplerate = (unsigned int) vorbis_data->info->rate;
 	self->channels = vorbis_data->info->channels;
+	if ((secs = ov_time_total(vorbis_data->vf, -1)) > 0)
+		self->duration = secs * 1000;
 
 	ices_log_debug("Ogg vorbis file found, version %d, %d kbps, %d channels, %ld Hz",
 		       vorbis_data->info->version, self->bitrate, vorbis_data->info->channels,
 		       self->samplerate);
 	in_vorbis_set_metadata(vorbis_data);
+
+	if (self->channels > 2)
+		return ices_downmix_init(&vorbis_data->downmix, self->channels,
+					 ices_downmix_layout_vorbis(self->channels));
+
+	return 0;
 }
 
 static void in_vorbis_set_metadata(ices_vorbis_in_t* vorbis_data) {
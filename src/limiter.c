@@ -0,0 +1,359 @@
+/* limiter.c
+ * - Lookahead brickwall limiter plugin for ices
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+/* The audio is delayed by the lookahead window W. For every frame the
+ * gain needed to keep it under the ceiling is computed, then the
+ * minimum of that over the last W+1 frames is taken, the release is
+ * applied, and the result is averaged over W frames. Every gain in that
+ * average was computed from a window which contains the frame coming
+ * out of the delay line, so no output can pass the ceiling. The gain
+ * still ramps smoothly, over W frames. */
+
+#include "definitions.h"
+
+#include <math.h>
+
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+/* frames handled per pass; scratch lives on the stack */
+#define LIM_BLOCK 256
+/* longest lookahead, and the highest samplerate it is sized for */
+#define LIM_MAXLOOKAHEAD 20
+#define LIM_MAXRATE 96000
+#define LIM_MAXWINDOW (LIM_MAXLOOKAHEAD * LIM_MAXRATE / 1000 + 1)
+
+typedef struct {
+	ices_plugin_t plugin;
+
+	/* in int16 units */
+	float ceiling;
+	int lookahead;
+	int release;
+
+	unsigned int samplerate;
+	int window;
+	float relcoef;
+
+	/* delay line */
+	int16_t* dl;
+	int16_t* dr;
+	int dpos;
+
+	/* running minimum: a monotonic queue of (frame, gain) */
+	unsigned long frame;
+	unsigned long* qframe;
+	float* qgain;
+	int qhead;
+	int qlen;
+
+	/* released gain and its running average */
+	float relgain;
+	float* box;
+	int bpos;
+	double boxsum;
+} limiter_t;
+
+/* Private function declarations */
+static int lim_init(ices_plugin_t* self);
+static void lim_new_track(ices_plugin_t* self, input_stream_t* source);
+static int lim_process(ices_plugin_t* self, int ilen, int16_t* il, int16_t* ir);
+static void lim_shutdown(ices_plugin_t* self);
+static int lim_options(ices_plugin_t* self, int optid, void* opt);
+
+static void lim_reset(limiter_t* lim, unsigned int samplerate);
+static void lim_peakgain(const limiter_t* lim, const int16_t* left,
+			 const int16_t* right, int frames, float* gain);
+static void lim_envelope(limiter_t* lim, float* gain, int frames);
+static void lim_apply(const float* gain, const int16_t* left,
+		      const int16_t* right, int frames, int16_t* outl,
+		      int16_t* outr);
+static inline int16_t lim_clip(float sample);
+
+/* Public function definitions */
+
+/* Create a limiter holding peaks to ceiling dBFS */
+ices_plugin_t* limiter_plugin(double ceiling) {
+	limiter_t* lim;
+
+	if (!(lim = calloc(1, sizeof(limiter_t)))) {
+		ices_log_error("Limiter could not allocate memory");
+		return NULL;
+	}
+
+	lim->plugin.name = "limiter";
+	lim->plugin.init = lim_init;
+	lim->plugin.new_track = lim_new_track;
+	lim->plugin.process = lim_process;
+	lim->plugin.shutdown = lim_shutdown;
+	lim->plugin.options = lim_options;
+	lim->plugin.data = lim;
+
+	if (ceiling > 0)
+		ceiling = 0;
+	lim->ceiling = 32768 * pow(10, ceiling / 20);
+	if (lim->ceiling > 32767)
+		lim->ceiling = 32767;
+	lim->lookahead = 5;
+	lim->release = 100;
+
+	return &lim->plugin;
+}
+
+/* Private function definitions */
+
+static int lim_options(ices_plugin_t* self, int optid, void* opt) {
+	limiter_t* lim = (limiter_t*) self->data;
+	int val = *((int*) opt);
+
+	switch (optid) {
+	case LIMOPT_LOOKAHEAD:
+		if (val < 1 || val > LIM_MAXLOOKAHEAD)
+			return -1;
+		lim->lookahead = val;
+		return 0;
+	case LIMOPT_RELEASE:
+		if (val < 1)
+			return -1;
+		lim->release = val;
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+/* All buffers are sized here for the longest window, so that nothing is
+ * allocated while streaming */
+static int lim_init(ices_plugin_t* self) {
+	limiter_t* lim = (limiter_t*) self->data;
+
+	if (!(lim->dl = malloc(LIM_MAXWINDOW * sizeof(int16_t)))
+	    || !(lim->dr = malloc(LIM_MAXWINDOW * sizeof(int16_t)))
+	    || !(lim->qframe = malloc((LIM_MAXWINDOW + 1) * sizeof(unsigned long)))
+	    || !(lim->qgain = malloc((LIM_MAXWINDOW + 1) * sizeof(float)))
+	    || !(lim->box = malloc(LIM_MAXWINDOW * sizeof(float)))) {
+		ices_log_error("Limiter could not allocate memory");
+		return -1;
+	}
+
+	lim_reset(lim, 44100);
+
+	ices_log_debug("Limiting to %.1f dBFS with %d ms lookahead, %d ms release",
+		       20 * log10(lim->ceiling / 32768), lim->lookahead, lim->release);
+
+	return 0;
+}
+
+static void lim_new_track(ices_plugin_t* self, input_stream_t* source) {
+	limiter_t* lim = (limiter_t*) self->data;
+
+	/* the few ms still in the delay line are lost, but so is the audio
+	 * continuity anyway */
+	if (source->samplerate && source->samplerate != lim->samplerate)
+		lim_reset(lim, source->samplerate);
+}
+
+static int lim_process(ices_plugin_t* self, int ilen, int16_t* il, int16_t* ir) {
+	limiter_t* lim = (limiter_t*) self->data;
+	float gain[LIM_BLOCK];
+	int16_t tl[LIM_BLOCK];
+	int16_t tr[LIM_BLOCK];
+	int off, n, i, seg;
+
+	for (off = 0; off < ilen; off += n) {
+		n = ilen - off < LIM_BLOCK ? ilen - off : LIM_BLOCK;
+
+		lim_peakgain(lim, il + off, ir + off, n, gain);
+		lim_envelope(lim, gain, n);
+
+		/* swap the block through the delay line */
+		for (i = 0; i < n; i += seg) {
+			seg = lim->window - lim->dpos;
+			if (seg > n - i)
+				seg = n - i;
+			memcpy(tl + i, lim->dl + lim->dpos, seg * sizeof(int16_t));
+			memcpy(tr + i, lim->dr + lim->dpos, seg * sizeof(int16_t));
+			memcpy(lim->dl + lim->dpos, il + off + i, seg * sizeof(int16_t));
+			memcpy(lim->dr + lim->dpos, ir + off + i, seg * sizeof(int16_t));
+			lim->dpos = (lim->dpos + seg) % lim->window;
+		}
+
+		lim_apply(gain, tl, tr, n, il + off, ir + off);
+	}
+
+	return ilen;
+}
+
+static void lim_shutdown(ices_plugin_t* self) {
+	limiter_t* lim = (limiter_t*) self->data;
+
+	ices_util_free(lim->dl);
+	ices_util_free(lim->dr);
+	ices_util_free(lim->qframe);
+	ices_util_free(lim->qgain);
+	ices_util_free(lim->box);
+	free(lim);
+
+	ices_log_debug("Limiter shutting down");
+}
+
+/* Size the window for a samplerate and start from silence */
+static void lim_reset(limiter_t* lim, unsigned int samplerate) {
+	int i;
+
+	if (samplerate > LIM_MAXRATE)
+		samplerate = LIM_MAXRATE;
+
+	lim->samplerate = samplerate;
+	lim->window = lim->lookahead * samplerate / 1000;
+	if (lim->window < 1)
+		lim->window = 1;
+	lim->relcoef = 1 - exp(-1000.0 / (lim->release * (double) samplerate));
+
+	memset(lim->dl, 0, lim->window * sizeof(int16_t));
+	memset(lim->dr, 0, lim->window * sizeof(int16_t));
+	lim->dpos = 0;
+
+	lim->frame = 0;
+	lim->qhead = 0;
+	lim->qlen = 0;
+
+	lim->relgain = 1;
+	for (i = 0; i < lim->window; i++)
+		lim->box[i] = 1;
+	lim->bpos = 0;
+	lim->boxsum = lim->window;
+}
+
+/* The gain each frame needs on its own: ceiling / max(peak, ceiling) */
+static void lim_peakgain(const limiter_t* lim, const int16_t* left,
+			 const int16_t* right, int frames, float* gain) {
+	float peak;
+	int i = 0;
+
+#ifdef __SSE2__
+	const __m128 ceil = _mm_set1_ps(lim->ceiling);
+	const __m128 absmask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+	for (; i + 8 <= frames; i += 8) {
+		__m128i l = _mm_loadu_si128((const __m128i*) (left + i));
+		__m128i r = _mm_loadu_si128((const __m128i*) (right + i));
+		/* sign-extend to 32 bits by unpacking into the high half */
+		__m128 l0 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(l, l), 16));
+		__m128 l1 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(l, l), 16));
+		__m128 r0 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(r, r), 16));
+		__m128 r1 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(r, r), 16));
+		__m128 p0 = _mm_max_ps(_mm_and_ps(l0, absmask), _mm_and_ps(r0, absmask));
+		__m128 p1 = _mm_max_ps(_mm_and_ps(l1, absmask), _mm_and_ps(r1, absmask));
+
+		_mm_storeu_ps(gain + i, _mm_div_ps(ceil, _mm_max_ps(p0, ceil)));
+		_mm_storeu_ps(gain + i + 4, _mm_div_ps(ceil, _mm_max_ps(p1, ceil)));
+	}
+#endif
+
+	for (; i < frames; i++) {
+		peak = abs(left[i]) > abs(right[i]) ? abs(left[i]) : abs(right[i]);
+		gain[i] = lim->ceiling / (peak > lim->ceiling ? peak : lim->ceiling);
+	}
+}
+
+/* Turn per-frame gains into the smoothed gain for the frames leaving the
+ * delay line. This part is inherently serial. */
+static void lim_envelope(limiter_t* lim, float* gain, int frames) {
+	int size = lim->window + 1;
+	float g, m;
+	int i, tail;
+
+	for (i = 0; i < frames; i++, lim->frame++) {
+		g = gain[i];
+
+		/* drop the oldest gain once it leaves the window */
+		if (lim->qlen && lim->frame - lim->qframe[lim->qhead] > (unsigned long) lim->window) {
+			lim->qhead = (lim->qhead + 1) % size;
+			lim->qlen--;
+		}
+
+		/* and queued gains that can never be the minimum again */
+		while (lim->qlen) {
+			tail = (lim->qhead + lim->qlen - 1) % size;
+			if (lim->qgain[tail] < g)
+				break;
+			lim->qlen--;
+		}
+		tail = (lim->qhead + lim->qlen) % size;
+		lim->qframe[tail] = lim->frame;
+		lim->qgain[tail] = g;
+		lim->qlen++;
+		m = lim->qgain[lim->qhead];
+
+		/* attack at once, release exponentially; never above m */
+		if (m < lim->relgain)
+			lim->relgain = m;
+		else
+			lim->relgain += (m - lim->relgain) * lim->relcoef;
+
+		lim->boxsum += lim->relgain - lim->box[lim->bpos];
+		lim->box[lim->bpos] = lim->relgain;
+		if (++lim->bpos == lim->window)
+			lim->bpos = 0;
+
+		gain[i] = lim->boxsum / lim->window;
+	}
+}
+
+static void lim_apply(const float* gain, const int16_t* left,
+		      const int16_t* right, int frames, int16_t* outl,
+		      int16_t* outr) {
+	int i = 0;
+
+#ifdef __SSE2__
+	for (; i + 8 <= frames; i += 8) {
+		__m128i l = _mm_loadu_si128((const __m128i*) (left + i));
+		__m128i r = _mm_loadu_si128((const __m128i*) (right + i));
+		__m128 g0 = _mm_loadu_ps(gain + i);
+		__m128 g1 = _mm_loadu_ps(gain + i + 4);
+		__m128 l0 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(l, l), 16));
+		__m128 l1 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(l, l), 16));
+		__m128 r0 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(r, r), 16));
+		__m128 r1 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(r, r), 16));
+
+		_mm_storeu_si128((__m128i*) (outl + i),
+				 _mm_packs_epi32(_mm_cvtps_epi32(_mm_mul_ps(l0, g0)),
+						 _mm_cvtps_epi32(_mm_mul_ps(l1, g1))));
+		_mm_storeu_si128((__m128i*) (outr + i),
+				 _mm_packs_epi32(_mm_cvtps_epi32(_mm_mul_ps(r0, g0)),
+						 _mm_cvtps_epi32(_mm_mul_ps(r1, g1))));
+	}
+#endif
+
+	for (; i < frames; i++) {
+		outl[i] = lim_clip(left[i] * gain[i]);
+		outr[i] = lim_clip(right[i] * gain[i]);
+	}
+}
+
+static inline int16_t lim_clip(float sample) {
+	if (sample >= 32767)
+		return 32767;
+	if (sample <= -32768)
+		return -32768;
+
+	return (int16_t) lrintf(sample);
+}
@@ -0,0 +1,248 @@
+/* listener.c
+ * - Local sockets answered between buffers, for control and metrics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+/* The control socket and the metrics endpoint are both looked at only
+ * between buffers, so their clients are never waited for: everything is
+ * non-blocking, what has been read is handed to the listener's input
+ * function as it comes, and what can't be written to a client at once
+ * is kept until it reads. */
+
+#include "definitions.h"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* Private function declarations */
+static void listener_accept(ices_listener_t* listener);
+static int listener_read(ices_listener_t* listener, ices_client_t* client);
+static int listener_flush(ices_client_t* client);
+static void listener_drop(ices_listener_t* listener, ices_client_t* client);
+
+/* Public function definitions */
+
+/* Listen on a UNIX socket, taking over one left behind by an ices that
+ * is gone. A private one can only be connected to by our user. Returns
+ * 0, or -1 after logging why not. */
+int ices_listener_open_unix(ices_listener_t* listener, const char* path, int private) {
+	struct sockaddr_un addr;
+	struct stat st;
+	mode_t mask = 0;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		ices_log("The %s socket path %s is too long", listener->what, path);
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+		ices_log("Could not create %s socket: %s", listener->what, strerror(errno));
+		return -1;
+	}
+
+	if (lstat(path, &st) == 0) {
+		if (!S_ISSOCK(st.st_mode)) {
+			ices_log("Not using %s as %s socket, something else is there", path,
+				 listener->what);
+			close(fd);
+			return -1;
+		}
+		if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) == 0) {
+			ices_log("Another ices is listening on %s, not opening the %s socket", path,
+				 listener->what);
+			close(fd);
+			return -1;
+		}
+		unlink(path);
+	}
+
+	if (private)
+		mask = umask(077);
+	if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(fd, 4) < 0) {
+		ices_log("Could not listen on %s: %s", path, strerror(errno));
+		if (private)
+			umask(mask);
+		close(fd);
+		return -1;
+	}
+	if (private)
+		umask(mask);
+
+	ices_listener_open_fd(listener, fd);
+	listener->path = ices_util_strdup(path);
+
+	return 0;
+}
+
+/* Take a socket that is listening already */
+void ices_listener_open_fd(ices_listener_t* listener, int fd) {
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	listener->fd = fd;
+}
+
+/* Serve the clients and take new ones, without waiting for anything */
+void ices_listener_poll(ices_listener_t* listener) {
+	struct pollfd fds[ICES_LISTENER_CLIENTS + 1];
+	ices_client_t* client;
+	int n = 0;
+	int i;
+
+	if (listener->fd < 0)
+		return;
+
+	fds[n].fd = listener->fd;
+	fds[n++].events = POLLIN;
+	for (i = 0; i < listener->nclients; i++) {
+		fds[n].fd = listener->clients[i].fd;
+		fds[n++].events = POLLIN | (listener->clients[i].outlen ? POLLOUT : 0);
+	}
+
+	if (poll(fds, n, 0) <= 0)
+		return;
+
+	/* last to first, so dropping one doesn't move those still to come */
+	for (i = n - 1; i > 0; i--) {
+		client = &listener->clients[i - 1];
+
+		if (!fds[i].revents)
+			continue;
+		if (((fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+		     && listener_read(listener, client) < 0)
+		    || listener_flush(client) < 0 || (client->done && !client->outlen))
+			listener_drop(listener, client);
+	}
+
+	if (fds[0].revents)
+		listener_accept(listener);
+}
+
+void ices_listener_close(ices_listener_t* listener) {
+	while (listener->nclients)
+		listener_drop(listener, &listener->clients[0]);
+
+	if (listener->fd >= 0) {
+		close(listener->fd);
+		listener->fd = -1;
+	}
+	if (listener->path) {
+		unlink(listener->path);
+		ices_util_free(listener->path);
+		listener->path = NULL;
+	}
+}
+
+/* Add to what is to be written to the client. One that isn't reading
+ * gets no more once it has outmax waiting. */
+void ices_client_printf(ices_client_t* client, const char* fmt, ...) {
+	va_list ap;
+	char* grown;
+	int len;
+
+	for (;;) {
+		va_start(ap, fmt);
+		len = vsnprintf(client->out + client->outlen, client->outsize - client->outlen,
+				fmt, ap);
+		va_end(ap);
+		if (len < 0)
+			return;
+		if (client->outlen + len < client->outsize) {
+			client->outlen += len;
+			return;
+		}
+
+		if (client->outmax && client->outsize >= client->outmax)
+			return;
+		if (!(grown = realloc(client->out, client->outsize + len + 4096)))
+			return;
+		client->out = grown;
+		client->outsize += len + 4096;
+	}
+}
+
+/* Private function definitions */
+
+static void listener_accept(ices_listener_t* listener) {
+	ices_client_t* client;
+	int fd;
+
+	while ((fd = accept(listener->fd, NULL, NULL)) >= 0) {
+		if (listener->nclients == ICES_LISTENER_CLIENTS) {
+			if (!listener->replace) {
+				ices_log_debug("Too many %s clients, turning one away", listener->what);
+				close(fd);
+				continue;
+			}
+			/* someone not sending anything shouldn't keep everyone out */
+			ices_log_debug("Too many %s clients, dropping the oldest", listener->what);
+			listener_drop(listener, &listener->clients[0]);
+		}
+
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+		client = &listener->clients[listener->nclients++];
+		memset(client, 0, sizeof(ices_client_t));
+		client->fd = fd;
+		client->outmax = listener->outmax;
+	}
+}
+
+/* Read what the client has sent and hand it on. Returns -1 when the
+ * client should be dropped. */
+static int listener_read(ices_listener_t* listener, ices_client_t* client) {
+	ssize_t len;
+
+	/* it has had its answer */
+	if (client->done)
+		return 0;
+
+	len = read(client->fd, client->in + client->inlen, sizeof(client->in) - client->inlen - 1);
+	if (len < 0)
+		return errno == EAGAIN || errno == EINTR ? 0 : -1;
+	if (!len)
+		return -1;
+	client->inlen += len;
+	client->in[client->inlen] = '\0';
+
+	return listener->input(client);
+}
+
+/* Write as much of the client's output as it will take */
+static int listener_flush(ices_client_t* client) {
+	ssize_t len;
+
+	while (client->outlen) {
+		if ((len = write(client->fd, client->out, client->outlen)) < 0)
+			return errno == EAGAIN || errno == EINTR ? 0 : -1;
+		client->outlen -= len;
+		memmove(client->out, client->out + len, client->outlen);
+	}
+
+	return 0;
+}
+
+static void listener_drop(ices_listener_t* listener, ices_client_t* client) {
+	close(client->fd);
+	ices_util_free(client->out);
+	*client = listener->clients[--listener->nclients];
+}
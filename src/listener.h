@@ -0,0 +1,61 @@
+/* listener.h
+ * - Local sockets answered between buffers, for control and metrics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#ifndef _ICES_LISTENER_H
+#define _ICES_LISTENER_H
+
+/* most clients connected at once */
+#define ICES_LISTENER_CLIENTS 8
+/* longest command or request */
+#define ICES_CLIENT_INPUT 4096
+
+typedef struct {
+	int fd;
+	char in[ICES_CLIENT_INPUT];
+	size_t inlen;
+	char* out;
+	size_t outlen;
+	size_t outsize;
+	size_t outmax;      /* most output kept while it isn't read, 0 for no limit */
+	int done;           /* close once out has been written */
+} ices_client_t;
+
+typedef struct ices_listener_St {
+	int fd;
+	char* path;         /* UNIX socket to remove at the end, if any */
+	const char* what;   /* what it is for, in log messages */
+	/* act on what the client has sent so far, in client->in. Returns -1
+	 * when the client should be dropped. */
+	int (*input)(ices_client_t* client);
+	size_t outmax;
+	int replace;        /* when full, drop the oldest client for a new one */
+
+	ices_client_t clients[ICES_LISTENER_CLIENTS];
+	int nclients;
+} ices_listener_t;
+
+/* Public function declarations */
+int ices_listener_open_unix(ices_listener_t* listener, const char* path, int private);
+void ices_listener_open_fd(ices_listener_t* listener, int fd);
+void ices_listener_poll(ices_listener_t* listener);
+void ices_listener_close(ices_listener_t* listener);
+
+void ices_client_printf(ices_client_t* client, const char* fmt, ...);
+
+#endif
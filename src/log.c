@@ -21,25 +21,112 @@
 
 #include "definitions.h"
 
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+# include <time.h>
+#endif
+
+/* Once the log is open, lines are formatted where they are logged but
+ * written out by a thread of their own, so that a slow disk or a full
+ * pipe never holds up the stream. They are passed on through a ring of
+ * slots that any thread can claim without a lock. If the writer falls
+ * so far behind that the ring fills, debug lines are dropped and counted
+ * rather than waited for, and others are written straight away. The
+ * writer also folds runs of the same line into one, saying how often it
+ * was repeated.
+ *
+ * Without threads, in a forked child and before the log is opened or
+ * after it is closed, lines are written straight away as before. */
+
+/* lines the ring holds, a power of two */
+#define LOG_SLOTS 256
+/* longest line passed through the ring */
+#define LOG_LINE 2048
+/* how long a repeated line is held back before the count is written */
+#define LOG_REPEAT_SECS 10
+
 extern ices_config_t ices_config;
 
+const int* const ices_log_verbose = &ices_config.verbose;
+
+#ifdef HAVE_PTHREAD
+typedef struct {
+	/* the slot's turn: its ticket when free, ticket + 1 when filled */
+	volatile unsigned int seq;
+	char line[LOG_LINE];
+} log_slot_t;
+
+static log_slot_t Ring[LOG_SLOTS];
+static volatile unsigned int Head = 0;
+static unsigned int Tail = 0;
+static volatile unsigned int Dropped = 0;
+static volatile int Async = 0;
+static volatile int Stop = 0;
+
+static pthread_t Writer;
+/* held while the log file is written or reopened */
+static pthread_mutex_t Lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t WakeLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t Wake = PTHREAD_COND_INITIALIZER;
+#endif
+
 /* Private function declarations */
 static void ices_log_string(char *format, char *string);
+static void ices_log_line(const char* prefix, int debug, const char* fmt, va_list ap);
 static int ices_log_open_logfile(void);
 static int ices_log_close_logfile(void);
+#ifdef HAVE_PTHREAD
+static int log_push(const char* prefix, int debug, const char* fmt, va_list ap);
+static void* log_writer(void* arg);
+static void log_take(const char* line, char* last, unsigned int* repeats, time_t* since);
+static void log_atfork_child(void);
+#endif
 
+/* one per thread: the lookahead worker and playlist modules set it too,
+ * and mustn't change the stream loop's under its feet */
+#ifdef HAVE_PTHREAD
+static __thread char lasterror[BUFSIZE];
+#else
 static char lasterror[BUFSIZE];
+#endif
 /* Public function definitions */
 
-/* Initialize the log module, creates log file */
+/* Initialize the log module, creates log file and starts the writer */
 void ices_log_initialize(void) {
+#ifdef HAVE_PTHREAD
+	unsigned int i;
+#endif
+
 	if (!ices_log_open_logfile())
 		ices_log("%s", ices_log_get_error());
+
+#ifdef HAVE_PTHREAD
+	for (i = 0; i < LOG_SLOTS; i++)
+		Ring[i].seq = i;
+	Head = Tail = 0;
+	Stop = 0;
+
+	pthread_atfork(NULL, NULL, log_atfork_child);
+	if (ices_util_thread_create(&Writer, log_writer, NULL) == 0)
+		Async = 1;
+	else
+		ices_log("Could not start the log writer, logging as we go");
+#endif
+
 	ices_log("Logfile opened");
 }
 
-/* Shutdown the log module, close the logfile */
+/* Shutdown the log module: write out what is left, close the logfile */
 void ices_log_shutdown(void) {
+#ifdef HAVE_PTHREAD
+	if (Async) {
+		Stop = 1;
+		pthread_cond_signal(&Wake);
+		pthread_join(Writer, NULL);
+		Async = 0;
+	}
+#endif
+
 	if (!ices_log_close_logfile())
 		ices_log("%s", ices_log_get_error());
 }
@@ -58,45 +145,44 @@ void ices_log_daemonize(void) {
 	ices_log_reopen_logfile();
 }
 
-/* Cycle the logfile, usually called from the SIGHUP handler */
+/* Cycle the logfile, usually on SIGHUP. The writer is kept out while
+ * it's done. */
 int ices_log_reopen_logfile(void) {
+	int rc;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&Lock);
+#endif
 	ices_log_close_logfile();
-	return ices_log_open_logfile();
+	rc = ices_log_open_logfile();
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&Lock);
+#endif
+
+	return rc;
 }
 
-/* Log only if verbose mode is set. Prepend output with DEBUG:  */
-void ices_log_debug(const char *fmt, ...) {
-	char buff[BUFSIZE];
+/* Log only if verbose mode is set. Prepend output with DEBUG:
+ * log.h checks verbose first, so that the arguments aren't even
+ * worked out for nothing. */
+void (ices_log_debug)(const char *fmt, ...) {
 	va_list ap;
 
 	if (!ices_config.verbose)
 		return;
 
 	va_start(ap, fmt);
-#ifdef HAVE_VSNPRINTF
-	vsnprintf(buff, BUFSIZE, fmt, ap);
-#else
-	vsprintf(buff, fmt, ap);
-#endif
+	ices_log_line("DEBUG: ", 1, fmt, ap);
 	va_end(ap);
-
-	ices_log_string("DEBUG: %s\n", buff);
 }
 
 /* Log to console and file */
 void ices_log(const char *fmt, ...) {
-	char buff[BUFSIZE];
 	va_list ap;
 
 	va_start(ap, fmt);
-#ifdef HAVE_VSNPRINTF
-	vsnprintf(buff, BUFSIZE, fmt, ap);
-#else
-	vsprintf(buff, fmt, ap);
-#endif
+	ices_log_line("", 0, fmt, ap);
 	va_end(ap);
-
-	ices_log_string("%s\n", buff);
 }
 
 /* Store error information in module memory */
@@ -128,7 +214,7 @@ void ices_log_error_output(const char *fmt, ...) {
 	va_end(ap);
 
 	ices_log_error("%s",buff);
-	ices_log_string("%s\n",buff);
+	ices_log("%s", buff);
 }
 
 /* Get last error from log module */
@@ -152,6 +238,40 @@ static void ices_log_string(char *format, char *string) {
 		fprintf(stdout, format, string);
 }
 
+/* Hand a line to the writer, or write it now if there is none */
+static void ices_log_line(const char* prefix, int debug, const char* fmt, va_list ap) {
+	char buff[BUFSIZE];
+	size_t len;
+
+#ifdef HAVE_PTHREAD
+	if (Async) {
+		va_list copy;
+		int rc;
+
+		va_copy(copy, ap);
+		rc = log_push(prefix, debug, fmt, copy);
+		va_end(copy);
+		if (!rc)
+			return;
+	}
+#endif
+
+	len = snprintf(buff, BUFSIZE, "%s", prefix);
+#ifdef HAVE_VSNPRINTF
+	vsnprintf(buff + len, BUFSIZE - len, fmt, ap);
+#else
+	vsprintf(buff + len, fmt, ap);
+#endif
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&Lock);
+#endif
+	ices_log_string("%s\n", buff);
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&Lock);
+#endif
+}
+
 /* Open the ices logfile, create it if needed */
 static int ices_log_open_logfile(void) {
 	char namespace[1024], buf[1024];
@@ -189,3 +309,136 @@ static int ices_log_close_logfile(void) {
 
 	return 1;
 }
+
+#ifdef HAVE_PTHREAD
+/* Claim the next slot, format the line into it and hand it over.
+ * Returns 0 if the line was taken care of, even if it was a debug line
+ * that was dropped, or -1 if it should be written by the caller. */
+static int log_push(const char* prefix, int debug, const char* fmt, va_list ap) {
+	log_slot_t* slot;
+	unsigned int pos;
+	unsigned int seq;
+	int len;
+
+	if (!Async)
+		return -1;
+
+	pos = Head;
+	for (;;) {
+		slot = &Ring[pos % LOG_SLOTS];
+		seq = slot->seq;
+		__sync_synchronize();
+		if (seq == pos) {
+			if (__sync_bool_compare_and_swap(&Head, pos, pos + 1))
+				break;
+		} else if ((int) (seq - pos) < 0) {
+			/* the writer hasn't got to this slot since last time round */
+			if (!debug)
+				return -1;
+			__sync_fetch_and_add(&Dropped, 1);
+			return 0;
+		}
+		pos = Head;
+	}
+
+	len = snprintf(slot->line, LOG_LINE, "%s", prefix);
+	vsnprintf(slot->line + len, LOG_LINE - len, fmt, ap);
+	__sync_synchronize();
+	slot->seq = pos + 1;
+
+	pthread_cond_signal(&Wake);
+
+	return 0;
+}
+
+/* Write out lines as they come. Wakeups can be missed, since those
+ * logging don't take WakeLock, so the ring is looked at every 100ms
+ * anyway. */
+static void* log_writer(void* arg) {
+	char last[LOG_LINE];
+	unsigned int repeats = 0;
+	unsigned int dropped;
+	time_t since = 0;
+	struct timespec wake;
+	log_slot_t* slot;
+	char buf[128];
+
+	last[0] = '\0';
+
+	for (;;) {
+		slot = &Ring[Tail % LOG_SLOTS];
+		if (slot->seq == Tail + 1) {
+			__sync_synchronize();
+			log_take(slot->line, last, &repeats, &since);
+			__sync_synchronize();
+			slot->seq = Tail + LOG_SLOTS;
+			Tail++;
+			/* lines are dropped when the ring is full, so they are
+			 * said to be once a lap has been written */
+			if (Tail % LOG_SLOTS)
+				continue;
+		}
+
+		if (Dropped && (dropped = __sync_fetch_and_and(&Dropped, 0))) {
+			snprintf(buf, sizeof(buf), "%u log messages dropped, the log could not keep up",
+				 dropped);
+			log_take(buf, last, &repeats, &since);
+		}
+
+		if (Ring[Tail % LOG_SLOTS].seq == Tail + 1)
+			continue;
+
+		if (repeats && (Stop || time(NULL) - since >= LOG_REPEAT_SECS)) {
+			snprintf(buf, sizeof(buf), "Last message repeated %u times", repeats);
+			pthread_mutex_lock(&Lock);
+			ices_log_string("%s\n", buf);
+			pthread_mutex_unlock(&Lock);
+			repeats = 0;
+		}
+
+		if (Stop)
+			break;
+
+		clock_gettime(CLOCK_REALTIME, &wake);
+		wake.tv_nsec += 100000000;
+		if (wake.tv_nsec >= 1000000000) {
+			wake.tv_sec++;
+			wake.tv_nsec -= 1000000000;
+		}
+		pthread_mutex_lock(&WakeLock);
+		pthread_cond_timedwait(&Wake, &WakeLock, &wake);
+		pthread_mutex_unlock(&WakeLock);
+	}
+
+	return NULL;
+}
+
+/* Write a line, unless it's the same as the last one */
+static void log_take(const char* line, char* last, unsigned int* repeats, time_t* since) {
+	char buf[128];
+
+	if (!strcmp(line, last)) {
+		if (!(*repeats)++)
+			*since = time(NULL);
+		return;
+	}
+
+	pthread_mutex_lock(&Lock);
+	if (*repeats) {
+		snprintf(buf, sizeof(buf), "Last message repeated %u times", *repeats);
+		ices_log_string("%s\n", buf);
+		*repeats = 0;
+	}
+	ices_log_string("%s\n", (char*) line);
+	pthread_mutex_unlock(&Lock);
+
+	snprintf(last, LOG_LINE, "%s", line);
+}
+
+/* A forked child has no writer thread, and the log file's lock may have
+ * been held when it was copied */
+static void log_atfork_child(void) {
+	Async = 0;
+	pthread_mutex_init(&Lock, NULL);
+}
+#endif
@@ -29,6 +29,16 @@ void ices_log_initialize(void);
 void ices_log_shutdown(void);
 void ices_log_daemonize(void);
 
+/* Debug messages are often in loops: don't even work out the arguments
+ * unless they will be logged. This points at ices_config.verbose, which
+ * some functions can't see past an argument of the same name. */
+extern const int* const ices_log_verbose;
+#define ices_log_debug(...) \
+	do { \
+		if (*ices_log_verbose) \
+			(ices_log_debug)(__VA_ARGS__); \
+	} while (0)
+
 
 
 
@@ -0,0 +1,351 @@
+/* lookahead.c
+ * - Resolve and check the next playlist entries while a track plays
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+/* A worker thread keeps up to Playlist/Lookahead entries ready. For each
+ * it asks the playlist module for the next path, its metadata, duration
+ * and time limit, then opens the file, reads its header and asks the
+ * kernel to start reading the rest, so that opening it for real between tracks
+ * doesn't wait on the disk or network. Paths that can't be read are
+ * remembered for a while and skipped, as are those the stream loop
+ * fails to play.
+ *
+ * Without threads entries are resolved when they are needed, but still
+ * checked the same way. */
+
+#include "definitions.h"
+
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+#include <time.h>
+
+/* most entries kept ready */
+#define LOOKAHEAD_MAX 16
+/* size of the table of unreadable paths; a power of two */
+#define LOOKAHEAD_BAD 1024
+/* seconds an unreadable path is skipped for */
+#define LOOKAHEAD_BAD_TTL 600
+/* unreadable entries skipped in a row before giving up and letting the
+ * stream loop count them as errors */
+#define LOOKAHEAD_SKIPS 10
+/* ms between looks at signals and commands while waiting for an entry */
+#define LOOKAHEAD_POLL 250
+
+typedef struct {
+	uint64_t hash;
+	time_t expires;
+} lookahead_bad_t;
+
+extern ices_config_t ices_config;
+
+static lookahead_bad_t Bad[LOOKAHEAD_BAD];
+
+#ifdef HAVE_PTHREAD
+static ices_lookahead_entry_t Queue[LOOKAHEAD_MAX];
+static int QueueHead = 0;
+static int QueueLen = 0;
+static int Depth = 0;
+static volatile int Stop = 0;
+static int Running = 0;
+/* the playlist gave out, wait until that has been taken */
+static int Exhausted = 0;
+/* bumped by a flush, so an entry resolved meanwhile is dropped too */
+static unsigned int Generation = 0;
+static pthread_t Worker;
+static pthread_mutex_t Lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t Ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t Taken = PTHREAD_COND_INITIALIZER;
+#endif
+
+/* Private function declarations */
+static void lookahead_resolve(ices_lookahead_entry_t* entry);
+static int lookahead_probe(const char* path);
+static int lookahead_is_bad(const char* path);
+static void lookahead_set_bad(const char* path);
+static uint64_t lookahead_hash(const char* path);
+#ifdef HAVE_PTHREAD
+static void* lookahead_worker(void* arg);
+#endif
+
+/* Public function definitions */
+
+/* Start the worker */
+void ices_lookahead_initialize(void) {
+#ifdef HAVE_PTHREAD
+	int rc;
+
+	Depth = ices_config.pm.lookahead;
+	if (Depth > LOOKAHEAD_MAX)
+		Depth = LOOKAHEAD_MAX;
+	if (Depth <= 0)
+		return;
+
+	if ((rc = ices_util_thread_create(&Worker, lookahead_worker, NULL))) {
+		ices_log("Could not start playlist lookahead: %s", strerror(rc));
+		return;
+	}
+
+	Running = 1;
+	ices_log_debug("Looking ahead %d playlist entries", Depth);
+#endif
+}
+
+void ices_lookahead_shutdown(void) {
+#ifdef HAVE_PTHREAD
+	if (!Running)
+		return;
+
+	Stop = 1;
+	pthread_cond_broadcast(&Taken);
+	pthread_join(Worker, NULL);
+	Running = 0;
+
+	while (QueueLen) {
+		ices_lookahead_free(&Queue[QueueHead]);
+		QueueHead = (QueueHead + 1) % LOOKAHEAD_MAX;
+		QueueLen--;
+	}
+#endif
+}
+
+/* Hand out the next entry, waiting for the worker if it isn't ready.
+ * The caller owns the strings in it. */
+void ices_lookahead_get_next(ices_lookahead_entry_t* entry) {
+#ifdef HAVE_PTHREAD
+	struct timespec wake;
+
+	if (Running) {
+		pthread_mutex_lock(&Lock);
+		if (!QueueLen)
+			ices_log_debug("Waiting for the playlist lookahead");
+		while (!QueueLen) {
+			clock_gettime(CLOCK_REALTIME, &wake);
+			if ((wake.tv_nsec += LOOKAHEAD_POLL * 1000000L) >= 1000000000L) {
+				wake.tv_sec++;
+				wake.tv_nsec -= 1000000000L;
+			}
+			if (pthread_cond_timedwait(&Ready, &Lock, &wake) == ETIMEDOUT && !QueueLen) {
+				/* signals and commands can't wait for a slow playlist */
+				pthread_mutex_unlock(&Lock);
+				ices_control_poll();
+				pthread_mutex_lock(&Lock);
+			}
+		}
+
+		*entry = Queue[QueueHead];
+		QueueHead = (QueueHead + 1) % LOOKAHEAD_MAX;
+		QueueLen--;
+		pthread_cond_signal(&Taken);
+		pthread_mutex_unlock(&Lock);
+		return;
+	}
+#endif
+
+	lookahead_resolve(entry);
+}
+
+/* The stream loop couldn't play path: skip it for a while */
+void ices_lookahead_failed(const char* path) {
+	if (path)
+		lookahead_set_bad(path);
+}
+
+/* The playlist was reloaded: drop what was got ready from the old one */
+void ices_lookahead_flush(void) {
+#ifdef HAVE_PTHREAD
+	int n;
+
+	if (!Running)
+		return;
+
+	pthread_mutex_lock(&Lock);
+	for (n = 0; QueueLen; n++) {
+		ices_lookahead_free(&Queue[QueueHead]);
+		QueueHead = (QueueHead + 1) % LOOKAHEAD_MAX;
+		QueueLen--;
+	}
+	Exhausted = 0;
+	Generation++;
+	pthread_cond_signal(&Taken);
+	pthread_mutex_unlock(&Lock);
+
+	if (n)
+		ices_log_debug("Dropped %d playlist entries looked ahead before the reload", n);
+#endif
+}
+
+void ices_lookahead_free(ices_lookahead_entry_t* entry) {
+	ices_util_free(entry->path);
+	ices_util_free(entry->metadata);
+	entry->path = entry->metadata = NULL;
+}
+
+/* Private function definitions */
+
+/* Get the next entry that can be read from the playlist module */
+static void lookahead_resolve(ices_lookahead_entry_t* entry) {
+	int skips;
+
+	for (skips = 0;; skips++) {
+		memset(entry, 0, sizeof(ices_lookahead_entry_t));
+
+		if (!(entry->path = ices_playlist_get_next()))
+			return;
+		entry->lineno = ices_playlist_get_current_lineno();
+		entry->timelimit = ices_playlist_get_timelimit();
+		entry->duration = ices_playlist_get_duration();
+		entry->metadata = ices_playlist_get_metadata();
+
+		if (skips == LOOKAHEAD_SKIPS)
+			return;
+
+		if (lookahead_is_bad(entry->path))
+			ices_log_debug("Skipping %s, it could not be played recently", entry->path);
+		else if (lookahead_probe(entry->path) < 0) {
+			ices_log("Skipping %s: %s", entry->path, ices_log_get_error());
+			lookahead_set_bad(entry->path);
+		} else
+			return;
+
+		ices_lookahead_free(entry);
+	}
+}
+
+/* Check that a file can be opened and read, and have the kernel start
+ * reading it in */
+static int lookahead_probe(const char* path) {
+	char buf[4096];
+	char namespace[1024];
+	struct stat st;
+	ssize_t len;
+	int fd;
+
+	/* stdin and the like can't be checked ahead of time */
+	if (!strcmp(path, "-"))
+		return 0;
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		ices_log_error("%s", ices_util_strerror(errno, namespace, sizeof(namespace)));
+		return -1;
+	}
+
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+		ices_log_error("Not a regular file");
+		close(fd);
+		return -1;
+	}
+
+	if ((len = read(fd, buf, sizeof(buf))) <= 0) {
+		ices_log_error("%s", len ? ices_util_strerror(errno, namespace, sizeof(namespace)) : "Empty file");
+		close(fd);
+		return -1;
+	}
+
+#ifdef HAVE_POSIX_FADVISE
+	posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+	close(fd);
+
+	return 0;
+}
+
+static int lookahead_is_bad(const char* path) {
+	uint64_t hash = lookahead_hash(path);
+	lookahead_bad_t* bad = &Bad[hash & (LOOKAHEAD_BAD - 1)];
+	int rc;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&Lock);
+#endif
+	rc = bad->hash == hash && bad->expires > time(NULL);
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&Lock);
+#endif
+
+	return rc;
+}
+
+/* A colliding path simply takes the slot over; it's only a cache */
+static void lookahead_set_bad(const char* path) {
+	uint64_t hash = lookahead_hash(path);
+	lookahead_bad_t* bad = &Bad[hash & (LOOKAHEAD_BAD - 1)];
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&Lock);
+#endif
+	bad->hash = hash;
+	bad->expires = time(NULL) + LOOKAHEAD_BAD_TTL;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&Lock);
+#endif
+}
+
+/* FNV-1a */
+static uint64_t lookahead_hash(const char* path) {
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	while (*path)
+		h = (h ^ (unsigned char) *path++) * 0x100000001b3ULL;
+
+	return h;
+}
+
+#ifdef HAVE_PTHREAD
+/* Keep the queue topped up until shutdown. An empty playlist is passed
+ * on as an entry without a path, and then nothing more is resolved
+ * until it has been taken. */
+static void* lookahead_worker(void* arg) {
+	ices_lookahead_entry_t entry;
+	struct timespec wake;
+	unsigned int generation;
+
+	while (!Stop) {
+		pthread_mutex_lock(&Lock);
+		while (!Stop && (QueueLen >= Depth || (Exhausted && QueueLen))) {
+			/* wake up now and then in case a broadcast was missed */
+			clock_gettime(CLOCK_REALTIME, &wake);
+			wake.tv_sec++;
+			pthread_cond_timedwait(&Taken, &Lock, &wake);
+		}
+		Exhausted = 0;
+		generation = Generation;
+		pthread_mutex_unlock(&Lock);
+		if (Stop)
+			break;
+
+		lookahead_resolve(&entry);
+
+		pthread_mutex_lock(&Lock);
+		if (generation != Generation) {
+			pthread_mutex_unlock(&Lock);
+			ices_lookahead_free(&entry);
+			continue;
+		}
+		if (entry.path)
+			ices_log_debug("Lookahead has %s ready", entry.path);
+		Queue[(QueueHead + QueueLen) % LOOKAHEAD_MAX] = entry;
+		QueueLen++;
+		Exhausted = !entry.path;
+		pthread_cond_signal(&Ready);
+		pthread_mutex_unlock(&Lock);
+	}
+
+	return NULL;
+}
+#endif
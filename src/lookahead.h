@@ -0,0 +1,41 @@
+/* lookahead.h
+ * - Playlist lookahead declarations for ices
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#ifndef _ICES_LOOKAHEAD_H
+#define _ICES_LOOKAHEAD_H
+
+/* A playlist entry, with what the playlist module said about it at the
+ * time it was handed out */
+typedef struct {
+	char* path;         /* NULL if the playlist had nothing */
+	char* metadata;
+	int timelimit;
+	int duration;       /* ms, 0 if unknown */
+	int lineno;
+} ices_lookahead_entry_t;
+
+/* Public function declarations */
+void ices_lookahead_initialize(void);
+void ices_lookahead_shutdown(void);
+void ices_lookahead_get_next(ices_lookahead_entry_t* entry);
+void ices_lookahead_failed(const char* path);
+void ices_lookahead_flush(void);
+void ices_lookahead_free(ices_lookahead_entry_t* entry);
+
+#endif
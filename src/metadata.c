@@ -19,13 +19,28 @@
 
 #include "definitions.h"
 
+#ifdef HAVE_SYS_WAIT_H
+#include <sys/wait.h>
+#endif
+
 #define INITDELAY 500000
 
 extern ices_config_t ices_config;
 
+/* one set per thread: the library handler reads tags with the input
+ * modules while the stream loop is playing */
+#ifdef HAVE_PTHREAD
+static __thread char* Artist = NULL;
+static __thread char* Title = NULL;
+static __thread char* Filename = NULL;
+/* what the playlist module said to show for the track, if anything */
+static __thread char* Playlist = NULL;
+#else
 static char* Artist = NULL;
 static char* Title = NULL;
 static char* Filename = NULL;
+static char* Playlist = NULL;
+#endif
 
 /* Private function declarations */
 static char* metadata_clean_filename(const char* path, char* buf,
@@ -34,13 +49,32 @@ static void metadata_update(int delay);
 
 /* Global function definitions */
 
+/* The artist and title from the tags, or failing that from an
+ * "Artist - Title" the playlist gave */
 void ices_metadata_get(char* artist, size_t alen, char* title, size_t tlen) {
+	const char* dash;
+
+	if (!Artist && !Title && Playlist) {
+		if ((dash = strstr(Playlist, " - "))) {
+			snprintf(artist, alen, "%.*s", (int) (dash - Playlist), Playlist);
+			snprintf(title, tlen, "%s", dash + 3);
+		} else
+			snprintf(title, tlen, "%s", Playlist);
+		return;
+	}
+
 	if (Artist)
 		snprintf(artist, alen, "%s", Artist);
 	if (Title)
 		snprintf(title, tlen, "%s", Title);
 }
 
+/* Has the playlist said what to show for the track? Then tags that only
+ * name it needn't be read. */
+int ices_metadata_from_playlist(void) {
+	return Playlist != NULL;
+}
+
 void ices_metadata_set(const char* artist, const char* title) {
 	ices_util_free(Artist);
 	Artist = NULL;
@@ -53,6 +87,14 @@ void ices_metadata_set(const char* artist, const char* title) {
 		Title = ices_util_strdup(title);
 }
 
+void ices_metadata_set_playlist(const char* metadata) {
+	ices_util_free(Playlist);
+	Playlist = NULL;
+
+	if (metadata && *metadata)
+		Playlist = ices_util_strdup(metadata);
+}
+
 void ices_metadata_set_file(const char* filename) {
 	char buf[1024];
 
@@ -65,7 +107,8 @@ void ices_metadata_set_file(const char* filename) {
 	}
 }
 
-/* Update metadata on server via fork.
+/* Update metadata on server via fork. The update is done by a grandchild,
+ * so that only the child in between has to be waited for.
  * Note that the very first metadata update after connection is delayed,
  * because if we try to update our new info to the server and the server has
  * not yet accepted us as a source, the information is lost. */
@@ -76,26 +119,29 @@ void ices_metadata_update(int delay) {
 		ices_log_debug("Delaying metadata update...");
 
 	if ((child = fork()) == 0) {
-		metadata_update(delay ? INITDELAY : 0);
+		if (fork() == 0)
+			metadata_update(delay ? INITDELAY : 0);
 		_exit(0);
 	}
 
 	if (child == -1)
 		ices_log_debug("Metadata update failed: fork");
+	else
+		while (waitpid(child, NULL, 0) < 0 && errno == EINTR)
+			;
 }
 
 static void metadata_update(int delay) {
 	ices_stream_t* stream;
 	shout_metadata_t* metadata;
 	char song[1024];
-	char* playlist_metadata;
 	char* value;
 	int rc;
 
 	if (delay)
 		usleep(delay);
 
-	if (!(playlist_metadata = ices_playlist_get_metadata())) {
+	if (!Playlist) {
 		if (Title) {
 			if (Artist)
 				snprintf(song, sizeof(song), "%s - %s", Artist, Title);
@@ -106,17 +152,15 @@ static void metadata_update(int delay) {
 
 		value = song;
 	} else
-		value = playlist_metadata;
+		value = Playlist;
 
 	if (!(metadata = shout_metadata_new())) {
 		ices_log_error("Error allocating metadata structure");
-		ices_util_free(playlist_metadata);
 		return;
 	}
 
 	if (shout_metadata_add(metadata, "song", value) != SHOUTERR_SUCCESS) {
 		ices_log_error_output("Error adding info to metadata structure");
-		ices_util_free(playlist_metadata);
 		shout_metadata_free(metadata);
 		return;
 	}
@@ -130,7 +174,6 @@ static void metadata_update(int delay) {
 			ices_log_debug("Updated metadata on %s to: %s", stream->mount, value);
 	}
 
-	ices_util_free(playlist_metadata);
 	shout_metadata_free(metadata);
 }
 
@@ -21,4 +21,6 @@
 void ices_metadata_get(char* artist, size_t alen, char* title, size_t tlen);
 void ices_metadata_set(const char* artist, const char* title);
 void ices_metadata_set_file(const char* filename);
+void ices_metadata_set_playlist(const char* metadata);
+int ices_metadata_from_playlist(void);
 void ices_metadata_update(int delay);
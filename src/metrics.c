@@ -0,0 +1,488 @@
+/* metrics.c
+ * - Pipeline timings, served in Prometheus text format
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+/* The stream loop times each stage of every buffer it sends with the
+ * monotonic clock, into histograms: decoding, replaygain and the global
+ * plugin chain once for all streams, and each stream's own plugins,
+ * encoding, waiting in shout_sync and sending separately. Time waiting
+ * in shout_sync is pacing, so everything else is counted as work and
+ * set against the length of the audio sent, giving the real-time
+ * factor: how much of its time ices needs to keep up. Near 1 there is
+ * no headroom left.
+ *
+ * Before each send libshout is asked how far its own sample clock says
+ * the stream is behind. How late each send was, and how long shout_sync
+ * then slept, is kept for each mount and logged at the end of every
+ * track, so a stutter can be put down to ices delivering late or not.
+ *
+ * With Execution/Metrics set, ices serves all this over HTTP, on a TCP
+ * [host:]port (localhost unless a host is given) or on a UNIX socket
+ * path, in the Prometheus text format. Like the control socket it is
+ * only looked at between buffers, and clients are never waited for. */
+
+#include "definitions.h"
+
+#include <netdb.h>
+#include <sys/socket.h>
+#include <time.h>
+
+extern ices_config_t ices_config;
+
+static const char* StageNames[ices_stages_e] = {
+	"decode", "replaygain", "plugin", "encode", "sync", "send"
+};
+
+/* stages timed once for all streams */
+static ices_histogram_t Stages[ices_stages_e];
+static double WorkSeconds = 0;
+static double AudioSeconds = 0;
+static double TrackWork = 0;
+static double TrackAudio = 0;
+static double TrackDecode = 0;
+static unsigned int Tracks = 0;
+
+static ices_listener_t Listener = { -1 };
+
+/* Private function declarations */
+static int metrics_listen_tcp(const char* spec);
+static int metrics_input(ices_client_t* client);
+static void metrics_render(ices_client_t* client);
+static void metrics_histogram(ices_client_t* client, const char* name,
+			      const char* labels, const ices_histogram_t* histogram);
+static uint64_t metrics_bound(int bucket);
+static const char* metrics_label(const char* value, char* buf, size_t len);
+
+/* Public function definitions */
+
+/* Start listening on Execution/Metrics, if it is set */
+void ices_metrics_initialize(void) {
+	const char* spec = ices_config.metrics;
+	int fd;
+
+	if (!spec || !*spec)
+		return;
+
+	Listener.what = "metrics";
+	Listener.input = metrics_input;
+	/* a scraper that never sends its request shouldn't keep others out */
+	Listener.replace = 1;
+
+	if (strchr(spec, '/')) {
+		if (ices_listener_open_unix(&Listener, spec, 0) < 0)
+			return;
+	} else {
+		if ((fd = metrics_listen_tcp(spec)) < 0)
+			return;
+		ices_listener_open_fd(&Listener, fd);
+	}
+
+	ices_log_debug("Serving metrics on %s", spec);
+}
+
+void ices_metrics_shutdown(void) {
+	ices_listener_close(&Listener);
+}
+
+/* Answer whoever is asking, without waiting for anything */
+void ices_metrics_poll(void) {
+	ices_listener_poll(&Listener);
+}
+
+/* Seconds on the monotonic clock */
+double ices_metrics_clock(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Count the time since *since against stage, for stream or for all of
+ * them if stream is NULL, and start timing the next stage */
+void ices_metrics_stage(ices_stream_t* stream, ices_stage_t stage, double* since) {
+	double now = ices_metrics_clock();
+	double elapsed = now - *since;
+
+	ices_histogram_add(stream ? &stream->stages[stage] : &Stages[stage], elapsed);
+	ices_flight_stage(stream, stage, elapsed);
+	if (stage != ices_stage_sync_e) {
+		WorkSeconds += elapsed;
+		TrackWork += elapsed;
+	}
+	if (!stream && stage == ices_stage_decode_e)
+		TrackDecode += elapsed;
+	else if (stream && stage == ices_stage_encode_e)
+		stream->track_encode += elapsed;
+
+	*since = now;
+}
+
+const char* ices_metrics_stage_name(ices_stage_t stage) {
+	return StageNames[stage];
+}
+
+/* Note how much audio was sent */
+void ices_metrics_audio(double seconds) {
+	AudioSeconds += seconds;
+	TrackAudio += seconds;
+}
+
+/* A new track starts: the real-time factor and the lateness logged at
+ * its end are for the track so far */
+void ices_metrics_track(void) {
+	ices_stream_t* stream;
+
+	TrackWork = TrackAudio = TrackDecode = 0;
+	Tracks++;
+
+	for (stream = ices_config.streams; stream; stream = stream->next) {
+		memset(&stream->track_lateness, 0, sizeof(ices_histogram_t));
+		memset(&stream->track_sync, 0, sizeof(ices_histogram_t));
+		stream->track_sends = stream->track_behind = 0;
+		stream->track_bytes = 0;
+		stream->track_encode = 0;
+		stream->track_errors = 0;
+	}
+}
+
+/* Seconds of audio sent this track */
+double ices_metrics_track_audio(void) {
+	return TrackAudio;
+}
+
+/* Seconds spent reading and decoding this track */
+double ices_metrics_track_decode(void) {
+	return TrackDecode;
+}
+
+/* Seconds spent in stage since ices started, by stream or, for stream
+ * NULL, once for all streams */
+double ices_metrics_stage_seconds(const ices_stream_t* stream, ices_stage_t stage) {
+	return stream ? stream->stages[stage].sum : Stages[stage].sum;
+}
+
+/* Note how far behind the sample clock a send to stream was, and how
+ * long shout_sync slept before it */
+void ices_metrics_send(ices_stream_t* stream, double lateness, double sync) {
+	ices_histogram_add(&stream->lateness, lateness);
+	ices_histogram_add(&stream->track_lateness, lateness);
+	ices_histogram_add(&stream->track_sync, sync);
+	stream->track_sends++;
+	if (lateness > 0) {
+		stream->behind++;
+		stream->track_behind++;
+	}
+}
+
+/* Log how well each stream kept up with the track just sent. Only
+ * streams that fell behind are worth more than a debug message. */
+void ices_metrics_track_end(void) {
+	ices_stream_t* stream;
+	const ices_histogram_t* late;
+	const ices_histogram_t* sync;
+	char buf[1024];
+
+	for (stream = ices_config.streams; stream; stream = stream->next) {
+		if (!stream->track_sends)
+			continue;
+		late = &stream->track_lateness;
+		sync = &stream->track_sync;
+		snprintf(buf, sizeof(buf), "%s: %u of %u sends behind, late by %.3f/%.3f/%.3fs"
+			 " and shout_sync slept %.3f/%.3f/%.3fs (median/99%%/max)",
+			 ices_util_nullcheck(stream->mount), stream->track_behind, stream->track_sends,
+			 ices_histogram_percentile(late, 50), ices_histogram_percentile(late, 99),
+			 late->max, ices_histogram_percentile(sync, 50),
+			 ices_histogram_percentile(sync, 99), sync->max);
+		if (stream->track_behind)
+			ices_log("%s", buf);
+		else
+			ices_log_debug("%s", buf);
+	}
+}
+
+void ices_histogram_add(ices_histogram_t* histogram, double seconds) {
+	uint64_t us = seconds > 0 ? (uint64_t) (seconds * 1e6 + 0.5) : 0;
+	int bit = 0;
+	int i;
+
+	if (us < 16)
+		i = (int) us;
+	else {
+		while (us >> (bit + 1))
+			bit++;
+		i = 16 + (bit - 4) * 8 + (int) ((us >> (bit - 3)) & 7);
+		if (i >= ICES_HISTOGRAM_BUCKETS)
+			i = ICES_HISTOGRAM_BUCKETS - 1;
+	}
+
+	histogram->buckets[i]++;
+	histogram->count++;
+	histogram->sum += seconds;
+	if (seconds > histogram->max)
+		histogram->max = seconds;
+}
+
+/* The value percent of those counted were no more than, in seconds, to
+ * within a bucket */
+double ices_histogram_percentile(const ices_histogram_t* histogram, double percent) {
+	uint64_t want = (uint64_t) (histogram->count * percent / 100.0 + 0.5);
+	uint64_t seen = 0;
+	int i;
+
+	if (!histogram->count)
+		return 0;
+	if (!want)
+		want = 1;
+
+	for (i = 0; i < ICES_HISTOGRAM_BUCKETS - 1; i++)
+		if ((seen += histogram->buckets[i]) >= want)
+			break;
+
+	/* the bucket's bound can't be more than the biggest value seen */
+	if (metrics_bound(i) / 1e6 > histogram->max)
+		return histogram->max;
+
+	return metrics_bound(i) / 1e6;
+}
+
+/* Private function definitions */
+
+/* Listen on [host:]port, or [address]:port for IPv6 */
+static int metrics_listen_tcp(const char* spec) {
+	struct addrinfo hints;
+	struct addrinfo* res;
+	char host[256];
+	const char* port;
+	const char* colon;
+	int on = 1;
+	int fd;
+	int rc;
+
+	snprintf(host, sizeof(host), "127.0.0.1");
+	port = spec;
+	if ((colon = strrchr(spec, ':'))) {
+		if (spec[0] == '[' && colon > spec && colon[-1] == ']')
+			snprintf(host, sizeof(host), "%.*s", (int) (colon - spec - 2), spec + 1);
+		else
+			snprintf(host, sizeof(host), "%.*s", (int) (colon - spec), spec);
+		port = colon + 1;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	if ((rc = getaddrinfo(host, port, &hints, &res))) {
+		ices_log("Could not serve metrics on %s: %s", spec, gai_strerror(rc));
+		return -1;
+	}
+
+	if ((fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) < 0) {
+		ices_log("Could not create metrics socket: %s", strerror(errno));
+		freeaddrinfo(res);
+		return -1;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	if (bind(fd, res->ai_addr, res->ai_addrlen) < 0 || listen(fd, 4) < 0) {
+		ices_log("Could not listen on %s: %s", spec, strerror(errno));
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+
+	return fd;
+}
+
+/* Answer the request once it's all there, one per connection */
+static int metrics_input(ices_client_t* client) {
+	if (!strstr(client->in, "\r\n\r\n") && !strstr(client->in, "\n\n"))
+		return client->inlen == sizeof(client->in) - 1 ? -1 : 0;
+
+	if (strncmp(client->in, "GET ", 4))
+		ices_client_printf(client, "HTTP/1.0 405 Method Not Allowed\r\n"
+				   "Allow: GET\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+	else if (strncmp(client->in + 4, "/ ", 2) && strncmp(client->in + 4, "/metrics ", 9))
+		ices_client_printf(client, "HTTP/1.0 404 Not Found\r\n"
+				   "Content-Length: 0\r\nConnection: close\r\n\r\n");
+	else
+		metrics_render(client);
+	client->done = 1;
+
+	return 0;
+}
+
+/* Put the whole answer in the client's output. The body is written
+ * first and the headers put in front, since they need its length. */
+static void metrics_render(ices_client_t* client) {
+	ices_stream_t* stream;
+	char mount[1024];
+	char labels[1200];
+	char header[256];
+	size_t hlen;
+	char* grown;
+	int i;
+
+	ices_client_printf(client, "# HELP ices_stage_seconds Time taken by each stage of sending a buffer.\n"
+			   "# TYPE ices_stage_seconds histogram\n");
+	for (i = 0; i < ices_stages_e; i++)
+		if (i == ices_stage_decode_e || i == ices_stage_replaygain_e
+		    || i == ices_stage_plugin_e) {
+			snprintf(labels, sizeof(labels), "stage=\"%s\"", StageNames[i]);
+			metrics_histogram(client, "ices_stage_seconds", labels, &Stages[i]);
+		}
+	for (stream = ices_config.streams; stream; stream = stream->next)
+		for (i = ices_stage_plugin_e; i < ices_stages_e; i++) {
+			snprintf(labels, sizeof(labels), "stage=\"%s\",mount=\"%s\"", StageNames[i],
+				 metrics_label(stream->mount, mount, sizeof(mount)));
+			metrics_histogram(client, "ices_stage_seconds", labels, &stream->stages[i]);
+		}
+
+	ices_client_printf(client, "# HELP ices_stream_lateness_seconds How far behind libshout's sample clock each send was.\n"
+			   "# TYPE ices_stream_lateness_seconds histogram\n");
+	for (stream = ices_config.streams; stream; stream = stream->next) {
+		snprintf(labels, sizeof(labels), "mount=\"%s\"",
+			 metrics_label(stream->mount, mount, sizeof(mount)));
+		metrics_histogram(client, "ices_stream_lateness_seconds", labels, &stream->lateness);
+	}
+
+	ices_client_printf(client, "# HELP ices_stream_behind_total Sends that were behind the sample clock.\n"
+			   "# TYPE ices_stream_behind_total counter\n");
+	for (stream = ices_config.streams; stream; stream = stream->next)
+		ices_client_printf(client, "ices_stream_behind_total{mount=\"%s\"} %llu\n",
+				   metrics_label(stream->mount, mount, sizeof(mount)),
+				   (unsigned long long) stream->behind);
+
+	ices_client_printf(client, "# HELP ices_stream_sent_bytes_total Bytes sent to the server.\n"
+			   "# TYPE ices_stream_sent_bytes_total counter\n");
+	for (stream = ices_config.streams; stream; stream = stream->next)
+		ices_client_printf(client, "ices_stream_sent_bytes_total{mount=\"%s\"} %llu\n",
+				   metrics_label(stream->mount, mount, sizeof(mount)),
+				   (unsigned long long) stream->bytes_sent);
+
+	ices_client_printf(client, "# HELP ices_stream_reconnects_total Times the stream was mounted again after the first.\n"
+			   "# TYPE ices_stream_reconnects_total counter\n");
+	for (stream = ices_config.streams; stream; stream = stream->next)
+		ices_client_printf(client, "ices_stream_reconnects_total{mount=\"%s\"} %u\n",
+				   metrics_label(stream->mount, mount, sizeof(mount)),
+				   stream->connects ? stream->connects - 1 : 0);
+
+	ices_client_printf(client, "# HELP ices_stream_errors Consecutive errors on the stream.\n"
+			   "# TYPE ices_stream_errors gauge\n");
+	for (stream = ices_config.streams; stream; stream = stream->next)
+		ices_client_printf(client, "ices_stream_errors{mount=\"%s\"} %d\n",
+				   metrics_label(stream->mount, mount, sizeof(mount)), stream->errs);
+
+	ices_client_printf(client, "# HELP ices_stream_connected Whether the stream is mounted.\n"
+			   "# TYPE ices_stream_connected gauge\n");
+	for (stream = ices_config.streams; stream; stream = stream->next)
+		ices_client_printf(client, "ices_stream_connected{mount=\"%s\"} %d\n",
+				   metrics_label(stream->mount, mount, sizeof(mount)),
+				   stream->conn && shout_get_connected(stream->conn) == SHOUTERR_CONNECTED);
+
+	ices_client_printf(client, "# HELP ices_stream_backlog_bytes Bytes queued in libshout, not yet sent.\n"
+			   "# TYPE ices_stream_backlog_bytes gauge\n");
+	for (stream = ices_config.streams; stream; stream = stream->next)
+		ices_client_printf(client, "ices_stream_backlog_bytes{mount=\"%s\"} %ld\n",
+				   metrics_label(stream->mount, mount, sizeof(mount)),
+				   stream->conn ? (long) shout_queuelen(stream->conn) : 0L);
+
+	ices_client_printf(client, "# HELP ices_work_seconds_total Time spent sending, not counting waiting in shout_sync.\n"
+			   "# TYPE ices_work_seconds_total counter\n"
+			   "ices_work_seconds_total %.6f\n"
+			   "# HELP ices_audio_seconds_total Length of the audio sent.\n"
+			   "# TYPE ices_audio_seconds_total counter\n"
+			   "ices_audio_seconds_total %.6f\n"
+			   "# HELP ices_realtime_factor Work time over audio time for the current track.\n"
+			   "# TYPE ices_realtime_factor gauge\n"
+			   "ices_realtime_factor %.6f\n"
+			   "# HELP ices_tracks_total Tracks started.\n"
+			   "# TYPE ices_tracks_total counter\n"
+			   "ices_tracks_total %u\n",
+			   WorkSeconds, AudioSeconds, TrackAudio > 0 ? TrackWork / TrackAudio : 0.0,
+			   Tracks);
+
+	if (!client->out)
+		return;
+
+	hlen = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\n"
+			"Content-Type: text/plain; version=0.0.4\r\n"
+			"Content-Length: %lu\r\nConnection: close\r\n\r\n",
+			(unsigned long) client->outlen);
+	if (client->outlen + hlen >= client->outsize) {
+		if (!(grown = realloc(client->out, client->outlen + hlen + 1))) {
+			client->outlen = 0;
+			return;
+		}
+		client->out = grown;
+		client->outsize = client->outlen + hlen + 1;
+	}
+	memmove(client->out + hlen, client->out, client->outlen);
+	memcpy(client->out, header, hlen);
+	client->outlen += hlen;
+}
+
+/* Buckets are given to Prometheus at each power of two, which is plenty
+ * for it to work out quantiles from */
+static void metrics_histogram(ices_client_t* client, const char* name,
+			      const char* labels, const ices_histogram_t* histogram) {
+	uint64_t cumulative = 0;
+	int i;
+
+	for (i = 0; i < ICES_HISTOGRAM_BUCKETS - 1; i++) {
+		cumulative += histogram->buckets[i];
+		if (i >= 15 && (i - 15) % 8 == 0)
+			ices_client_printf(client, "%s_bucket{%s,le=\"%g\"} %llu\n", name, labels,
+					   (metrics_bound(i) + 1) / 1e6, (unsigned long long) cumulative);
+	}
+	ices_client_printf(client, "%s_bucket{%s,le=\"+Inf\"} %llu\n"
+			   "%s_sum{%s} %.9f\n"
+			   "%s_count{%s} %llu\n",
+			   name, labels, (unsigned long long) histogram->count,
+			   name, labels, histogram->sum,
+			   name, labels, (unsigned long long) histogram->count);
+}
+
+/* The biggest number of microseconds counted in bucket */
+static uint64_t metrics_bound(int bucket) {
+	if (bucket < 16)
+		return bucket;
+
+	bucket -= 16;
+	return ((uint64_t) (8 + bucket % 8 + 1) << (bucket / 8 + 1)) - 1;
+}
+
+/* Escape a label value */
+static const char* metrics_label(const char* value, char* buf, size_t len) {
+	size_t i = 0;
+
+	for (value = ices_util_nullcheck(value); *value && i + 2 < len; value++) {
+		if (*value == '\\' || *value == '"')
+			buf[i++] = '\\';
+		else if (*value == '\n') {
+			buf[i++] = '\\';
+			buf[i++] = 'n';
+			continue;
+		}
+		buf[i++] = *value;
+	}
+	buf[i] = '\0';
+
+	return buf;
+}
@@ -0,0 +1,43 @@
+/* metrics.h
+ * - Pipeline timings and the metrics endpoint
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#ifndef _ICES_METRICS_H
+#define _ICES_METRICS_H
+
+/* Public function declarations */
+void ices_metrics_initialize(void);
+void ices_metrics_shutdown(void);
+void ices_metrics_poll(void);
+
+double ices_metrics_clock(void);
+const char* ices_metrics_stage_name(ices_stage_t stage);
+void ices_metrics_stage(ices_stream_t* stream, ices_stage_t stage, double* since);
+void ices_metrics_audio(double seconds);
+void ices_metrics_track(void);
+
+void ices_metrics_send(ices_stream_t* stream, double lateness, double sync);
+void ices_metrics_track_end(void);
+double ices_metrics_track_audio(void);
+double ices_metrics_track_decode(void);
+double ices_metrics_stage_seconds(const ices_stream_t* stream, ices_stage_t stage);
+
+void ices_histogram_add(ices_histogram_t* histogram, double seconds);
+double ices_histogram_percentile(const ices_histogram_t* histogram, double percent);
+
+#endif
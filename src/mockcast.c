@@ -0,0 +1,834 @@
+/* mockcast.c
+ * - A stand-in Icecast server for testing ices against
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+/* Usage: ices-mockcast [-a address] [-P port] [-p password] [-b rcvbuf]
+ *                      [-o file] [-q] [fault...] [-m mount fault...]...
+ *
+ * ices-mockcast takes source connections as Icecast and Shoutcast do,
+ * in each of the protocols ices can speak: HTTP (PUT or SOURCE) and
+ * xaudiocast on the port, ICY on the port after it. Metadata updates
+ * (/admin/metadata and /admin.cgi) are answered on the port. Only one
+ * source may use a mount at once. Audio is read and thrown away.
+ *
+ * Every source connection can be given a fault:
+ *
+ *   -l seconds     wait this long before answering it, or a metadata update
+ *   -t kbit/s      read no faster than this
+ *   -s at[:for]    stop reading at seconds in, for seconds or for good
+ *   -d seconds     hang up on it this long after it started
+ *   -r count       turn the first count away, as if the mount were taken
+ *
+ * Faults given before any -m apply to every mount; those after -m mount
+ * to that mount only, in place of the general ones. -b shrinks the
+ * socket receive buffer, so throttling and stalls push back sooner.
+ *
+ * What happens is written to file, or standard output, one line each:
+ * the seconds since the server started, the connection number, the
+ * mount, the event and its details, tab separated. Every read of audio
+ * is a "data" line with its size and the total so far (unless -q), so
+ * the pacing of each mount can be plotted; when a source goes a "close"
+ * line sums it up, with the longest gap between reads. For example,
+ *
+ *   ices-mockcast -P 8000 -m /slow -t 64 -m /flaky -d 30
+ *
+ * lets /slow fall behind and /flaky reconnect every 30 seconds, while
+ * any other mount should carry on untouched. */
+
+#include "definitions.h"
+
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/* most connections at once */
+#define MOCK_CLIENTS 64
+/* most faults, general and per mount */
+#define MOCK_FAULTS 32
+/* longest request head */
+#define MOCK_HEAD 8192
+/* most read from a source at once */
+#define MOCK_READ 65536
+
+typedef struct {
+	const char* mount;      /* NULL for every mount */
+	double latency;         /* < 0 where not set */
+	double rate;            /* bytes a second, 0 for as fast as they come */
+	double stall_at;
+	double stall_for;       /* 0 for good */
+	double drop_after;
+	int reject;             /* connections still to turn away */
+} mock_fault_t;
+
+typedef enum {
+	mock_head_e,            /* reading the request */
+	mock_answer_e,          /* waiting to answer it */
+	mock_source_e,          /* reading audio */
+	mock_stall_e            /* not reading audio */
+} mock_state_t;
+
+typedef struct {
+	int fd;
+	int id;
+	int icy;                /* came in on the ICY port */
+	int source;             /* will be a source once answered */
+	mock_state_t state;
+	char head[MOCK_HEAD];
+	size_t len;
+	char mount[256];
+	const char* protocol;
+	const char* reply;
+	mock_fault_t fault;
+	double answer_at;
+	double started;
+	double stall_until;
+	double tokens;          /* bytes that may be read, when throttled */
+	double filled;
+	double last;            /* last read */
+	double gap;             /* longest between reads */
+	int stalled;            /* has been, once is enough */
+	unsigned long long bytes;
+} mock_client_t;
+
+static const char* Password = "letmein";
+static int Quiet = 0;
+static FILE* Out;
+static double Epoch;
+static volatile sig_atomic_t Done = 0;
+
+static mock_fault_t Faults[MOCK_FAULTS];
+static int NFaults = 1;
+static mock_client_t Clients[MOCK_CLIENTS];
+static int Connections = 0;
+
+/* Private function declarations */
+static void mock_usage(const char* name);
+static void mock_signal(int sig);
+static int mock_listen(const char* address, int port, int rcvbuf);
+static void mock_accept(int lfd, int icy);
+static void mock_request(mock_client_t* client);
+static void mock_metadata(mock_client_t* client, char* path);
+static void mock_answer(mock_client_t* client);
+static void mock_read(mock_client_t* client);
+static void mock_tick(mock_client_t* client, double now);
+static int mock_readable(const mock_client_t* client);
+static double mock_deadline(mock_client_t* client, double now);
+static void mock_close(mock_client_t* client, const char* why);
+static void mock_fault(mock_client_t* client);
+static int mock_taken(const mock_client_t* client);
+static void mock_word(char* buf, size_t len, const char* text);
+static const char* mock_header(const char* head, const char* name, char* buf, size_t len);
+static int mock_authorized(const char* head, const char* password);
+static char* mock_query(const char* query, const char* name, char* buf, size_t len);
+static size_t mock_base64(const char* in, char* out, size_t len);
+static void mock_log(const mock_client_t* client, const char* event, const char* fmt, ...);
+static double mock_now(void);
+
+int main(int argc, char** argv) {
+	struct pollfd fds[MOCK_CLIENTS + 2];
+	mock_fault_t* fault = &Faults[0];
+	const char* address = "127.0.0.1";
+	const char* output = NULL;
+	double deadline;
+	double next;
+	double now;
+	char* colon;
+	int port = 8000;
+	int rcvbuf = 0;
+	int lfds[2];
+	int timeout;
+	int opt;
+	int n;
+	int i;
+
+	Faults[0].latency = Faults[0].rate = Faults[0].drop_after = Faults[0].stall_at = -1;
+	Faults[0].reject = -1;
+
+	while ((opt = getopt(argc, argv, "a:P:p:b:o:qm:l:t:s:d:r:")) != -1)
+		switch (opt) {
+		case 'a':
+			address = optarg;
+			break;
+		case 'P':
+			if ((port = atoi(optarg)) < 1 || port > 65534)
+				mock_usage(argv[0]);
+			break;
+		case 'p':
+			Password = optarg;
+			break;
+		case 'b':
+			rcvbuf = atoi(optarg);
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'q':
+			Quiet = 1;
+			break;
+		case 'm':
+			if (NFaults == MOCK_FAULTS) {
+				fprintf(stderr, "At most %d mounts can be given\n", MOCK_FAULTS - 1);
+				return 1;
+			}
+			fault = &Faults[NFaults++];
+			fault->mount = optarg;
+			fault->latency = fault->rate = fault->drop_after = fault->stall_at = -1;
+			fault->reject = -1;
+			break;
+		case 'l':
+			fault->latency = atof(optarg);
+			break;
+		case 't':
+			fault->rate = atof(optarg) * 1000 / 8;
+			break;
+		case 's':
+			fault->stall_at = atof(optarg);
+			fault->stall_for = (colon = strchr(optarg, ':')) ? atof(colon + 1) : 0;
+			break;
+		case 'd':
+			fault->drop_after = atof(optarg);
+			break;
+		case 'r':
+			fault->reject = atoi(optarg);
+			break;
+		default:
+			mock_usage(argv[0]);
+		}
+	if (optind < argc)
+		mock_usage(argv[0]);
+
+	if (!output)
+		Out = stdout;
+	else if (!(Out = fopen(output, "w"))) {
+		perror(output);
+		return 1;
+	}
+	setvbuf(Out, NULL, _IOLBF, 0);
+
+	if ((lfds[0] = mock_listen(address, port, rcvbuf)) < 0
+	    || (lfds[1] = mock_listen(address, port + 1, rcvbuf)) < 0)
+		return 1;
+
+	for (i = 0; i < MOCK_CLIENTS; i++)
+		Clients[i].fd = -1;
+
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, mock_signal);
+	signal(SIGTERM, mock_signal);
+
+	Epoch = mock_now();
+	fprintf(Out, "# ices-mockcast on %s:%d, ICY on %d\n", address, port, port + 1);
+	fprintf(Out, "# seconds\tconnection\tmount\tevent\tdetails\n");
+
+	while (!Done) {
+		now = mock_now();
+		deadline = -1;
+		n = 0;
+
+		fds[n].fd = lfds[0];
+		fds[n++].events = POLLIN;
+		fds[n].fd = lfds[1];
+		fds[n++].events = POLLIN;
+		for (i = 0; i < MOCK_CLIENTS; i++) {
+			if (Clients[i].fd < 0)
+				continue;
+			mock_tick(&Clients[i], now);
+			if (Clients[i].fd < 0)
+				continue;
+
+			fds[n].fd = Clients[i].fd;
+			fds[n].events = mock_readable(&Clients[i]) ? POLLIN : 0;
+			fds[n++].revents = 0;
+
+			next = mock_deadline(&Clients[i], now);
+			if (next >= 0 && (deadline < 0 || next < deadline))
+				deadline = next;
+		}
+
+		timeout = deadline < 0 ? -1 : deadline <= now ? 0 : (int) ((deadline - now) * 1000) + 1;
+		if (poll(fds, n, timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			break;
+		}
+
+		if (fds[0].revents & POLLIN)
+			mock_accept(lfds[0], 0);
+		if (fds[1].revents & POLLIN)
+			mock_accept(lfds[1], 1);
+		for (i = 2; i < n; i++) {
+			if (!fds[i].revents)
+				continue;
+			for (opt = 0; opt < MOCK_CLIENTS; opt++)
+				if (Clients[opt].fd == fds[i].fd)
+					break;
+			if (opt == MOCK_CLIENTS)
+				continue;
+			if (Clients[opt].state == mock_head_e)
+				mock_request(&Clients[opt]);
+			else
+				mock_read(&Clients[opt]);
+		}
+	}
+
+	for (i = 0; i < MOCK_CLIENTS; i++)
+		if (Clients[i].fd >= 0)
+			mock_close(&Clients[i], "server stopped");
+
+	return 0;
+}
+
+/* Private function definitions */
+
+static void mock_usage(const char* name) {
+	fprintf(stderr, "Usage: %s [-a address] [-P port] [-p password] [-b rcvbuf] [-o file] [-q]\n"
+		"        [-l latency] [-t kbit/s] [-s at[:for]] [-d after] [-r count]\n"
+		"        [-m mount <faults>]...\n", name);
+	exit(1);
+}
+
+static void mock_signal(int sig) {
+	Done = 1;
+}
+
+static int mock_listen(const char* address, int port, int rcvbuf) {
+	struct sockaddr_in sa;
+	int one = 1;
+	int fd;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(port);
+	if (inet_pton(AF_INET, address, &sa.sin_addr) != 1) {
+		fprintf(stderr, "Not an IPv4 address: %s\n", address);
+		return -1;
+	}
+
+	if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+		perror("socket");
+		return -1;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	/* set before listening, so accepted sockets start with it */
+	if (rcvbuf > 0)
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+	if (bind(fd, (struct sockaddr*) &sa, sizeof(sa)) < 0 || listen(fd, 16) < 0) {
+		fprintf(stderr, "Error listening on %s:%d: %s\n", address, port, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static void mock_accept(int lfd, int icy) {
+	mock_client_t* client = NULL;
+	int fd;
+	int i;
+
+	if ((fd = accept(lfd, NULL, NULL)) < 0)
+		return;
+
+	for (i = 0; i < MOCK_CLIENTS; i++)
+		if (Clients[i].fd < 0) {
+			client = &Clients[i];
+			break;
+		}
+	if (!client) {
+		close(fd);
+		return;
+	}
+
+	memset(client, 0, sizeof(*client));
+	client->fd = fd;
+	client->id = ++Connections;
+	client->icy = icy;
+	client->state = mock_head_e;
+	client->last = mock_now();
+	strcpy(client->mount, "-");
+	mock_log(client, "accept", "%s", icy ? "icy port" : "port");
+}
+
+/* Read the request head and decide what to say to it */
+static void mock_request(mock_client_t* client) {
+	char type[256];
+	char bitrate[64];
+	char agent[256];
+	char buf[1024];
+	char* line;
+	char* path;
+	char* end;
+	ssize_t rc;
+	int authorized;
+
+	if ((rc = read(client->fd, client->head + client->len,
+		       sizeof(client->head) - client->len - 1)) <= 0) {
+		mock_close(client, rc ? strerror(errno) : "closed before asking");
+		return;
+	}
+	client->len += rc;
+	client->head[client->len] = '\0';
+
+	if (!(end = strstr(client->head, "\n\n")) && !(end = strstr(client->head, "\n\r\n"))) {
+		if (client->len == sizeof(client->head) - 1)
+			mock_close(client, "request too long");
+		return;
+	}
+	end = strchr(end + 1, '\n') + 1;
+
+	line = client->head;
+	client->state = mock_answer_e;
+	client->answer_at = mock_now();
+
+	if (client->icy) {
+		/* the password line, then icy- headers */
+		client->protocol = "icy";
+		snprintf(client->mount, sizeof(client->mount), "icy");
+		authorized = !strncmp(line, Password, strlen(Password))
+			&& (line[strlen(Password)] == '\r' || line[strlen(Password)] == '\n');
+		client->reply = authorized ? "OK2\r\nicy-caps:11\r\n\r\n" : "invalid password\r\n";
+		client->source = authorized;
+	} else if (!strncmp(line, "GET ", 4)) {
+		client->protocol = "http";
+		mock_word(buf, sizeof(buf), line + 4);
+		mock_metadata(client, buf);
+		return;
+	} else if (!strncmp(line, "PUT /", 5) || !strncmp(line, "SOURCE /", 8)) {
+		client->protocol = "http";
+		path = strchr(line, ' ') + 1;
+		mock_word(client->mount, sizeof(client->mount), path);
+		authorized = mock_authorized(client->head, Password);
+		if (!authorized)
+			client->reply = "HTTP/1.0 401 Authentication Required\r\n\r\n";
+		else if (mock_header(client->head, "Expect", buf, sizeof(buf))
+			 && !strcasecmp(buf, "100-continue"))
+			client->reply = "HTTP/1.1 100 Continue\r\n\r\n";
+		else
+			client->reply = "HTTP/1.0 200 OK\r\n\r\n";
+		client->source = authorized;
+	} else if (!strncmp(line, "SOURCE ", 7)) {
+		/* SOURCE password /mount */
+		client->protocol = "xaudiocast";
+		path = line + 7;
+		authorized = !strncmp(path, Password, strlen(Password)) && path[strlen(Password)] == ' ';
+		path += strcspn(path, " \r\n");
+		path += strspn(path, " ");
+		mock_word(client->mount, sizeof(client->mount), path);
+		client->reply = authorized ? "OK\n" : "ERROR - Bad Password\n";
+		client->source = authorized;
+	} else {
+		line[strcspn(line, "\r\n")] = '\0';
+		client->protocol = "?";
+		client->reply = "HTTP/1.0 400 Bad Request\r\n\r\n";
+		mock_log(client, "request", "not understood: %s", line);
+		return;
+	}
+
+	mock_fault(client);
+	client->answer_at += client->fault.latency;
+
+	if (!client->source) {
+		mock_log(client, "reject", "%s, bad password", client->protocol);
+		return;
+	}
+
+	if (mock_taken(client)) {
+		client->source = 0;
+		mock_log(client, "reject", "%s, mount in use", client->protocol);
+	} else if (client->fault.reject > 0) {
+		client->source = 0;
+		Faults[client->fault.reject - 1].reject--;
+		mock_log(client, "reject", "%s, %d more to turn away", client->protocol,
+			 Faults[client->fault.reject - 1].reject);
+	}
+	if (!client->source) {
+		if (!strcmp(client->protocol, "http"))
+			client->reply = "HTTP/1.0 403 Forbidden\r\n\r\n";
+		else if (!strcmp(client->protocol, "xaudiocast"))
+			client->reply = "ERROR - Mount Point Taken or Invalid\n";
+		else
+			client->reply = "invalid password\r\n";
+		return;
+	}
+
+	mock_log(client, "source", "%s, %s, %s kbit/s, %s", client->protocol,
+		 mock_header(client->head, "Content-Type", type, sizeof(type)) ? type : "no content type",
+		 mock_header(client->head, "ice-bitrate", bitrate, sizeof(bitrate))
+		 || mock_header(client->head, "icy-br", bitrate, sizeof(bitrate))
+		 || mock_header(client->head, "x-audiocast-bitrate", bitrate, sizeof(bitrate))
+		 ? bitrate : "?",
+		 mock_header(client->head, "User-Agent", agent, sizeof(agent)) ? agent : "no user agent");
+
+	/* audio sent before the answer was asked for */
+	client->len -= end - client->head;
+	memmove(client->head, end, client->len);
+}
+
+/* /admin/metadata?mode=updinfo&mount=..&song=.. or, for ICY and
+ * xaudiocast, /admin.cgi?pass=..&mode=updinfo&mount=..&song=.. */
+static void mock_metadata(mock_client_t* client, char* path) {
+	char song[1024];
+	char mode[64];
+	char pass[256];
+	char* query;
+
+	if (!(query = strchr(path, '?'))
+	    || (strncmp(path, "/admin/metadata?", 16) && strncmp(path, "/admin.cgi?", 11))) {
+		client->reply = "HTTP/1.0 404 Not Found\r\n\r\n";
+		mock_log(client, "request", "not found: GET %s", path);
+		return;
+	}
+	query++;
+
+	if (!mock_query(query, "mount", client->mount, sizeof(client->mount)))
+		snprintf(client->mount, sizeof(client->mount), "icy");
+	mock_fault(client);
+	client->answer_at += client->fault.latency;
+
+	if (!mock_authorized(client->head, Password)
+	    && !(mock_query(query, "pass", pass, sizeof(pass)) && !strcmp(pass, Password))) {
+		client->reply = "HTTP/1.0 401 Authentication Required\r\n\r\n";
+		mock_log(client, "reject", "metadata, bad password");
+		return;
+	}
+	if (!mock_query(query, "mode", mode, sizeof(mode)) || strcmp(mode, "updinfo")) {
+		client->reply = "HTTP/1.0 400 Bad Request\r\n\r\n";
+		mock_log(client, "request", "not understood: GET %s", path);
+		return;
+	}
+
+	client->reply = "HTTP/1.0 200 OK\r\nContent-Type: text/xml\r\n\r\n"
+		"<?xml version=\"1.0\"?>\n<iceresponse><message>Metadata update successful"
+		"</message><return>1</return></iceresponse>\n";
+	mock_log(client, "metadata", "%s", mock_query(query, "song", song, sizeof(song))
+		 ? song : "no song");
+}
+
+static void mock_answer(mock_client_t* client) {
+	size_t len = strlen(client->reply);
+
+	if (write(client->fd, client->reply, len) != (ssize_t) len) {
+		mock_close(client, "answer not taken");
+		return;
+	}
+
+	if (!client->source) {
+		mock_close(client, NULL);
+		return;
+	}
+
+	client->state = mock_source_e;
+	client->started = client->filled = client->last = mock_now();
+	client->tokens = 0;
+	if (client->len) {
+		client->bytes = client->len;
+		if (!Quiet)
+			mock_log(client, "data", "%lu\t%llu", (unsigned long) client->len, client->bytes);
+	}
+}
+
+static void mock_read(mock_client_t* client) {
+	static char buf[MOCK_READ];
+	size_t want = sizeof(buf);
+	ssize_t rc;
+	double now;
+
+	if (client->fault.rate > 0 && client->tokens < want)
+		want = (size_t) client->tokens;
+	if (!want)
+		return;
+
+	if ((rc = read(client->fd, buf, want)) <= 0) {
+		if (rc < 0 && errno == EINTR)
+			return;
+		mock_close(client, rc ? strerror(errno) : "closed by the source");
+		return;
+	}
+
+	now = mock_now();
+	if (now - client->last > client->gap)
+		client->gap = now - client->last;
+	client->last = now;
+	client->bytes += rc;
+	client->tokens -= rc;
+	if (!Quiet)
+		mock_log(client, "data", "%ld\t%llu", (long) rc, client->bytes);
+}
+
+/* Answer, stall, resume and hang up when it's time to */
+static void mock_tick(mock_client_t* client, double now) {
+	mock_fault_t* fault = &client->fault;
+
+	if (client->state == mock_answer_e) {
+		if (now >= client->answer_at)
+			mock_answer(client);
+		return;
+	}
+	if (client->state == mock_head_e)
+		return;
+
+	if (fault->drop_after >= 0 && now >= client->started + fault->drop_after) {
+		mock_close(client, "hung up on");
+		return;
+	}
+
+	if (client->state == mock_stall_e) {
+		if (fault->stall_for > 0 && now >= client->stall_until) {
+			client->state = mock_source_e;
+			client->filled = now;
+			mock_log(client, "resume", "after %.3f", fault->stall_for);
+		}
+		return;
+	}
+
+	if (!client->stalled && fault->stall_at >= 0 && now >= client->started + fault->stall_at) {
+		client->state = mock_stall_e;
+		client->stalled = 1;
+		client->stall_until = now + fault->stall_for;
+		if (fault->stall_for > 0)
+			mock_log(client, "stall", "for %.3f", fault->stall_for);
+		else
+			mock_log(client, "stall", "for good");
+		return;
+	}
+
+	/* at most a second's worth may be read at once */
+	if (fault->rate > 0) {
+		client->tokens += (now - client->filled) * fault->rate;
+		if (client->tokens > fault->rate)
+			client->tokens = fault->rate;
+		client->filled = now;
+	}
+}
+
+/* Whether to read from the client now */
+static int mock_readable(const mock_client_t* client) {
+	if (client->state == mock_head_e)
+		return 1;
+
+	return client->state == mock_source_e && (client->fault.rate <= 0 || client->tokens >= 1);
+}
+
+/* When the client next needs seeing to, whatever it sends, or -1 */
+static double mock_deadline(mock_client_t* client, double now) {
+	mock_fault_t* fault = &client->fault;
+	double deadline = -1;
+	double t;
+
+	if (client->state == mock_answer_e)
+		return client->answer_at;
+	if (client->state == mock_head_e)
+		return -1;
+
+	if (fault->drop_after >= 0)
+		deadline = client->started + fault->drop_after;
+	if (client->state == mock_stall_e) {
+		if (fault->stall_for > 0 && (deadline < 0 || client->stall_until < deadline))
+			deadline = client->stall_until;
+		return deadline;
+	}
+	if (!client->stalled && fault->stall_at >= 0) {
+		t = client->started + fault->stall_at;
+		if (deadline < 0 || t < deadline)
+			deadline = t;
+	}
+	if (fault->rate > 0 && client->tokens < 1) {
+		t = now + (1 - client->tokens) / fault->rate;
+		if (deadline < 0 || t < deadline)
+			deadline = t;
+	}
+
+	return deadline;
+}
+
+static void mock_close(mock_client_t* client, const char* why) {
+	double seconds;
+
+	if (client->state == mock_source_e || client->state == mock_stall_e) {
+		seconds = mock_now() - client->started;
+		mock_log(client, "close", "%s, %llu bytes in %.3f s, %.1f kbit/s, longest gap %.3f s",
+			 why, client->bytes, seconds, seconds > 0 ? client->bytes * 8 / seconds / 1000 : 0,
+			 client->gap);
+	} else if (why)
+		mock_log(client, "close", "%s", why);
+
+	close(client->fd);
+	client->fd = -1;
+}
+
+/* Work out the client's fault from those for its mount and in general.
+ * fault.reject is left as the index of the fault counting rejects, plus
+ * one, or 0. */
+static void mock_fault(mock_client_t* client) {
+	mock_fault_t* mount = NULL;
+	mock_fault_t* fault = &client->fault;
+	int i;
+
+	for (i = 1; i < NFaults; i++)
+		if (!strcmp(Faults[i].mount, client->mount))
+			mount = &Faults[i];
+
+	*fault = Faults[0];
+	fault->reject = Faults[0].reject > 0 ? 1 : 0;
+	if (mount) {
+		if (mount->latency >= 0)
+			fault->latency = mount->latency;
+		if (mount->rate >= 0)
+			fault->rate = mount->rate;
+		if (mount->stall_at >= 0) {
+			fault->stall_at = mount->stall_at;
+			fault->stall_for = mount->stall_for;
+		}
+		if (mount->drop_after >= 0)
+			fault->drop_after = mount->drop_after;
+		if (mount->reject >= 0)
+			fault->reject = mount->reject > 0 ? mount - Faults + 1 : 0;
+	}
+
+	if (fault->latency < 0)
+		fault->latency = 0;
+	if (fault->rate < 0)
+		fault->rate = 0;
+}
+
+static int mock_taken(const mock_client_t* client) {
+	int i;
+
+	for (i = 0; i < MOCK_CLIENTS; i++)
+		if (&Clients[i] != client && Clients[i].fd >= 0 && Clients[i].source
+		    && !strcmp(Clients[i].mount, client->mount))
+			return 1;
+
+	return 0;
+}
+
+/* The first word of text */
+static void mock_word(char* buf, size_t len, const char* text) {
+	size_t n = strcspn(text, " \r\n");
+
+	if (n >= len)
+		n = len - 1;
+	memcpy(buf, text, n);
+	buf[n] = '\0';
+}
+
+/* The value of header name in head, if it's there */
+static const char* mock_header(const char* head, const char* name, char* buf, size_t len) {
+	const char* line;
+	size_t n = strlen(name);
+
+	for (line = strchr(head, '\n'); line && line[1] != '\r' && line[1] != '\n';
+	     line = strchr(line + 1, '\n')) {
+		if (strncasecmp(line + 1, name, n) || line[n + 1] != ':')
+			continue;
+		line += n + 2;
+		line += strspn(line, " \t");
+		snprintf(buf, len, "%.*s", (int) strcspn(line, "\r\n"), line);
+		return buf;
+	}
+
+	return NULL;
+}
+
+/* Authorization: Basic, with any user */
+static int mock_authorized(const char* head, const char* password) {
+	char value[512];
+	char credentials[512];
+	char* colon;
+
+	if (!mock_header(head, "Authorization", value, sizeof(value))
+	    || strncasecmp(value, "Basic ", 6))
+		return 0;
+	mock_base64(value + 6, credentials, sizeof(credentials));
+	if (!(colon = strchr(credentials, ':')))
+		return 0;
+
+	return !strcmp(colon + 1, password);
+}
+
+/* The value of name in a query string, URL decoded */
+static char* mock_query(const char* query, const char* name, char* buf, size_t len) {
+	size_t n = strlen(name);
+	const char* c;
+	size_t i = 0;
+	unsigned int hex;
+
+	for (c = query; c; c = strchr(c, '&') ? strchr(c, '&') + 1 : NULL) {
+		if (strncmp(c, name, n) || c[n] != '=')
+			continue;
+		for (c += n + 1; *c && *c != '&' && i + 1 < len; c++) {
+			if (*c == '+')
+				buf[i++] = ' ';
+			else if (*c == '%' && isxdigit((unsigned char) c[1])
+				 && isxdigit((unsigned char) c[2]) && sscanf(c + 1, "%2x", &hex) == 1) {
+				buf[i++] = hex;
+				c += 2;
+			} else
+				buf[i++] = *c;
+		}
+		buf[i] = '\0';
+		return buf;
+	}
+
+	return NULL;
+}
+
+static size_t mock_base64(const char* in, char* out, size_t len) {
+	static const char alphabet[] =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	unsigned long bits = 0;
+	const char* c;
+	size_t i = 0;
+	int n = 0;
+
+	for (; *in && *in != '=' && i + 1 < len; in++) {
+		if (!(c = strchr(alphabet, *in)))
+			break;
+		bits = (bits << 6) | (c - alphabet);
+		if ((n += 6) >= 8) {
+			n -= 8;
+			out[i++] = (bits >> n) & 0xff;
+		}
+	}
+	out[i] = '\0';
+
+	return i;
+}
+
+static void mock_log(const mock_client_t* client, const char* event, const char* fmt, ...) {
+	va_list ap;
+
+	fprintf(Out, "%.6f\t%d\t%s\t%s\t", mock_now() - Epoch, client->id, client->mount, event);
+	va_start(ap, fmt);
+	vfprintf(Out, fmt, ap);
+	va_end(ap);
+	fputc('\n', Out);
+}
+
+static double mock_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -90,6 +90,7 @@ static void mp3_trim_file(input_stream_t* self, mp3_header_t* header);
 static int mp3_parse_frame(const unsigned char* buf, mp3_header_t* header);
 static int mp3_check_vbr(input_stream_t* source, mp3_header_t* header);
 static size_t mp3_frame_length(mp3_header_t* header);
+static void mp3_vbr_duration(input_stream_t* source, mp3_header_t* header, int offset);
 
 /* Global function definitions */
 
@@ -101,6 +102,7 @@ static int ices_mp3_parse(input_stream_t* source) {
 	size_t len, framelen;
 	int rc = 0;
 	int off = 0;
+	double span;
 
 	if (mp3_data->len < 4)
 		return 1;
@@ -110,8 +112,11 @@ static int ices_mp3_parse(input_stream_t* source) {
 		return 1;
 
 	/* first check for ID3v2 */
-	if (!strncmp("ID3", (char *) mp3_data->buf, 3))
+	if (!strncmp("ID3", (char *) mp3_data->buf, 3)) {
+		span = ices_trace_start();
 		ices_id3v2_parse(source);
+		ices_trace_end("ices_id3v2_parse", NULL, span);
+	}
 
 	/* ensure we have at least 4 bytes in the read buffer */
 	if (!mp3_data->buf || mp3_data->len - mp3_data->pos < 4)
@@ -193,6 +198,16 @@ static int ices_mp3_parse(input_stream_t* source) {
 	/* adjust file size for short frames */
 	mp3_trim_file(source, &mh);
 
+	/* CBR: the duration follows from the size of the audio after the
+	 * header. VBR files (no bitrate) got theirs from the VBR tag, if it
+	 * had a frame count. */
+	if (source->bitrate && source->filesize) {
+		off_t start = lseek(source->fd, 0, SEEK_CUR) - (mp3_data->len - mp3_data->pos);
+
+		if (start >= 0 && (size_t) start < source->filesize)
+			source->duration = (uint64_t) (source->filesize - start) * 8 / source->bitrate;
+	}
+
 	if (source->bitrate)
 		ices_log_debug("%s layer %s, %d kbps, %d Hz, %s", version_names[mh.version],
 			       layer_names[mh.layer - 1], mh.bitrate, mh.samplerate, mode_names[mh.mode]);
@@ -481,12 +496,46 @@ static int mp3_check_vbr(input_stream_t* source, mp3_header_t* header) {
 	if (!strncmp("VBRI", (char *)(mp3_data->buf + offset), 4)
 	    || !strncmp("Xing", (char *)(mp3_data->buf + offset), 4)) {
 		ices_log_debug("VBR tag found");
+		mp3_vbr_duration(source, header, offset);
 		return 1;
 	}
 
 	return 0;
 }
 
+/* Work out the duration from the frame count in a Xing or VBRI tag at
+ * offset in the buffer */
+static void mp3_vbr_duration(input_stream_t* source, mp3_header_t* header, int offset) {
+	ices_mp3_in_t* mp3_data = (ices_mp3_in_t*) source->data;
+	unsigned char* tag;
+	unsigned long frames;
+	unsigned int spf;
+
+	/* the buffer may move as it fills */
+	offset -= mp3_data->pos;
+	if (mp3_fill_buffer(source, offset + 18) <= 0 || !header->samplerate)
+		return;
+	tag = mp3_data->buf + mp3_data->pos + offset;
+
+	if (!strncmp("Xing", (char *) tag, 4)) {
+		/* frame count is optional */
+		if (!(tag[7] & 1))
+			return;
+		tag += 8;
+	} else
+		tag += 14;
+	frames = (unsigned long) tag[0] << 24 | tag[1] << 16 | tag[2] << 8 | tag[3];
+
+	if (header->layer == 1)
+		spf = 384;
+	else if (header->layer == 3 && header->version)
+		spf = 576;
+	else
+		spf = 1152;
+
+	source->duration = (uint64_t) frames * spf * 1000 / header->samplerate;
+}
+
 /* Calculate the expected length of the next frame, or return 0 if we don't know how */
 static size_t mp3_frame_length(mp3_header_t* header) {
 	if (!header->bitrate)
@@ -62,6 +62,16 @@ int ices_playlist_get_timelimit(void) {
 	return 0;
 }
 
+/* Allows a playlist to say how long the track is, so it need not be
+ *   worked out from the file. Returns 0 for 'unknown'. Modules need not
+ *   implement this. */
+int ices_playlist_get_duration(void) {
+	if (ices_config.pm.get_duration)
+		return ices_config.pm.get_duration();
+
+	return 0;
+}
+
 /* Initialize the toplevel playlist handler */
 int ices_playlist_initialize(void) {
 	int rc = -1;
@@ -70,6 +80,7 @@ int ices_playlist_initialize(void) {
 
 	ices_config.pm.reload = NULL;
 	ices_config.pm.get_timelimit = NULL;
+	ices_config.pm.get_duration = NULL;
 
 	switch (ices_config.pm.playlist_type) {
 	case ices_playlist_builtin_e:
@@ -80,18 +91,45 @@ int ices_playlist_initialize(void) {
 		break;
 	case ices_playlist_python_e:
 #ifdef HAVE_LIBPYTHON
+		if ((rc = ices_playlist_python_environment()) < 0)
+			break;
+#endif
+#if defined (HAVE_LIBPYTHON) && defined (HAVE_PTHREAD)
+		rc = ices_playlist_thread_initialize(&ices_config.pm,
+						     ices_playlist_python_initialize);
+#elif defined (HAVE_LIBPYTHON)
 		rc = ices_playlist_python_initialize(&ices_config.pm);
 #else
 		ices_log_error("This binary has no support for embedded python");
 #endif
 		break;
 	case ices_playlist_perl_e:
-#ifdef HAVE_LIBPERL
+#if defined (HAVE_LIBPERL) && defined (HAVE_PTHREAD)
+		rc = ices_playlist_thread_initialize(&ices_config.pm,
+						     ices_playlist_perl_initialize);
+#elif defined (HAVE_LIBPERL)
 		rc = ices_playlist_perl_initialize(&ices_config.pm);
 #else
 		ices_log_error("This binary has no support for embedded perl");
 #endif
 		break;
+	case ices_playlist_native_e:
+#ifdef HAVE_DLOPEN
+		rc = ices_playlist_native_initialize(&ices_config.pm);
+#else
+		ices_log_error("This binary has no support for native playlist modules");
+#endif
+		break;
+	case ices_playlist_library_e:
+#if defined (HAVE_LIBSQLITE3) && defined (HAVE_PTHREAD)
+		rc = ices_playlist_library_initialize(&ices_config.pm);
+#else
+		ices_log_error("This binary has no support for the library playlist handler");
+#endif
+		break;
+	case ices_playlist_rotation_e:
+		rc = ices_playlist_rotation_initialize(&ices_config.pm);
+		break;
 	default:
 		ices_log_error("Unknown playlist module!");
 		break;
@@ -108,6 +146,10 @@ int ices_playlist_initialize(void) {
 
 /* Reload the playlist module */
 int ices_playlist_reload(void) {
+	/* entries got ready from the old playlist shouldn't play. Dropping
+	 * them first keeps any the new one has given out already. */
+	ices_lookahead_flush();
+
 	if (ices_config.pm.reload)
 		return ices_config.pm.reload();
 
@@ -119,3 +161,54 @@ void ices_playlist_shutdown(void) {
 	if (playlist_init)
 		ices_config.pm.shutdown();
 }
+
+/* For handlers that walk a music directory: is path named like a file
+ * one of the input modules can play? */
+int ices_playlist_is_audio(const char* path) {
+	static const char* exts[] = { "mp3", "ogg", "oga", "flac", "m4a", "mp4", "aac", NULL };
+	const char* base = strrchr(path, '/');
+	const char* ext;
+	int i;
+
+	if (!(ext = strrchr(base ? base + 1 : path, '.')))
+		return 0;
+	for (i = 0; exts[i]; i++)
+		if (!strcasecmp(ext + 1, exts[i]))
+			return 1;
+
+	return 0;
+}
+
+/* Take the artist and title of a file without tags from its path: an
+ * "Artist - Title" file name, or else a file named after the title in a
+ * directory named after the artist. Both are spans of path, and the
+ * artist's may be empty. */
+void ices_playlist_guess_tags(const char* path, const char** artist, int* alen,
+			      const char** title, int* tlen) {
+	const char* base = strrchr(path, '/');
+	const char* dir = path;
+	const char* dash;
+	const char* ext;
+
+	if (!base)
+		base = path;
+	else {
+		for (dir = base; dir > path && dir[-1] != '/'; dir--)
+			;
+		base++;
+	}
+	if (!(ext = strrchr(base, '.')))
+		ext = base + strlen(base);
+
+	if ((dash = strstr(base, " - ")) && dash < ext) {
+		*artist = base;
+		*alen = dash - base;
+		*title = dash + 3;
+		*tlen = ext - dash - 3;
+	} else {
+		*artist = dir;
+		*alen = base > dir ? base - dir - 1 : 0;
+		*title = base;
+		*tlen = ext - base;
+	}
+}
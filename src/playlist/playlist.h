@@ -27,17 +27,33 @@ int ices_playlist_get_current_lineno(void);
 char *ices_playlist_get_next(void);
 char* ices_playlist_get_metadata(void);
 int ices_playlist_get_timelimit(void);
+int ices_playlist_get_duration(void);
 int ices_playlist_initialize(void);
 int ices_playlist_reload(void);
 void ices_playlist_shutdown(void);
+int ices_playlist_is_audio(const char* path);
+void ices_playlist_guess_tags(const char* path, const char** artist, int* alen,
+			      const char** title, int* tlen);
 
 int ices_playlist_builtin_initialize(playlist_module_t* pm);
 int ices_playlist_script_initialize(playlist_module_t* pm);
+int ices_playlist_rotation_initialize(playlist_module_t* pm);
 #ifdef HAVE_LIBPYTHON
+int ices_playlist_python_environment(void);
 int ices_playlist_python_initialize(playlist_module_t* pm);
 #endif
 #ifdef HAVE_LIBPERL
 int ices_playlist_perl_initialize(playlist_module_t* pm);
 #endif
+#if defined (HAVE_LIBSQLITE3) && defined (HAVE_PTHREAD)
+int ices_playlist_library_initialize(playlist_module_t* pm);
+#endif
+#ifdef HAVE_DLOPEN
+int ices_playlist_native_initialize(playlist_module_t* pm);
+#endif
+#if defined (HAVE_PTHREAD) && (defined (HAVE_LIBPYTHON) || defined (HAVE_LIBPERL))
+int ices_playlist_thread_initialize(playlist_module_t* pm,
+				    int (*init)(playlist_module_t* pm));
+#endif
 
 #endif
@@ -20,23 +20,57 @@
  */
 
 #include <definitions.h>
+#include "pm_builtin.h"
 #include "rand.h"
 
-static FILE* fp = NULL;
-static time_t playlist_modtime = 0;
+#include <limits.h>
+
+#ifdef HAVE_SYS_INOTIFY_H
+# include <sys/inotify.h>
+#endif
+
+/* The playlist is read into memory in one go, with line ends replaced by
+ * NULs and an index of where each entry and its title start. Extended M3U
+ * (#EXTINF) and PLS files give titles and durations, so tracks listed
+ * that way need not be probed for them. */
+typedef struct {
+	char* text;
+	playlist_entry_t* entries;
+	int count;
+} playlist_index_t;
+
+static playlist_index_t playlist = { NULL, NULL, 0 };
+/* entries served since the last rewind, so entries[lineno] is next */
 static int lineno = 0;
+static volatile int reload_requested = 0;
+
+/* what the index was read from, to notice changes without inotify */
+static struct stat playlist_st;
+static int watchfd = -1;
+static char* watchname = NULL;
 
 extern ices_config_t ices_config;
 
 /* Private function declarations */
 static char* playlist_builtin_get_next(void);
+static char* playlist_builtin_get_metadata(void);
 static int playlist_builtin_get_lineno(void);
+static int playlist_builtin_get_duration(void);
+static int playlist_builtin_reload(void);
 static void playlist_builtin_shutdown(void);
 
-static int playlist_builtin_open_playlist(playlist_module_t* pm);
+static int playlist_builtin_load(playlist_module_t* pm, playlist_index_t* list);
+static int playlist_builtin_index(FILE* fp, playlist_index_t* list);
+static void playlist_builtin_index_m3u(playlist_index_t* list, char* text, size_t len);
+static void playlist_builtin_index_pls(playlist_index_t* list, char* text, size_t len,
+				       int lines);
+static void playlist_builtin_extinf(char* line, playlist_entry_t* entry);
+static void playlist_builtin_free(playlist_index_t* list);
 static int playlist_builtin_reopen_playlist(playlist_module_t* pm);
-static void playlist_builtin_shuffle_playlist(void);
-static int playlist_builtin_line_skip(int lineno, FILE* fp);
+static int playlist_builtin_find(const playlist_index_t* list, const char* entry,
+				 int hint);
+static void playlist_builtin_watch(playlist_module_t* pm);
+static int playlist_builtin_changed(playlist_module_t* pm);
 
 /* Global function definitions */
 
@@ -45,180 +79,400 @@ int ices_playlist_builtin_initialize(playlist_module_t* pm) {
 	ices_log_debug("Initializing builting playlist handler...");
 
 	pm->get_next = playlist_builtin_get_next;
-	pm->get_metadata = NULL;
+	pm->get_metadata = playlist_builtin_get_metadata;
 	pm->get_lineno = playlist_builtin_get_lineno;
+	pm->get_duration = playlist_builtin_get_duration;
+	pm->reload = playlist_builtin_reload;
 	pm->shutdown = playlist_builtin_shutdown;
 
-	if (!playlist_builtin_open_playlist(pm)) {
+	if (playlist_builtin_load(pm, &playlist) < 0) {
 		ices_log("Could not find a valid playlist file.");
 		ices_setup_shutdown();
 		return -1;
 	}
 
+	if (pm->randomize) {
+		ices_log_debug("Randomizing playlist, not repeating the last %d artists or tracks",
+			       pm->norepeat);
+		rand_initialize(pm->norepeat);
+	}
+
+	playlist_builtin_watch(pm);
+
 	lineno = 0;
 	return 1;
 }
 
 static char *playlist_builtin_get_next(void) {
 	char *out;
-	static int level = 0;
-	struct stat st;
 
-	/* If the original playlist has changed on disk (and we are not
-	 * randomising) reload it. */
-	if ((!fp || ((stat(ices_config.pm.playlist_file, &st) == 0) &&
-		     (st.st_mtime > playlist_modtime))) &&
-	    !playlist_builtin_reopen_playlist(&ices_config.pm))
+	/* If the playlist has changed on disk reload it, carrying on after
+	 * the entry that was playing. If that fails the old one is kept. */
+	if (playlist_builtin_changed(&ices_config.pm))
+		playlist_builtin_reopen_playlist(&ices_config.pm);
+
+	if (!playlist.count) {
+		ices_log_error("Unreadable or empty playlist");
 		return NULL;
+	}
 
-	if (feof(fp)) {
+	if (lineno >= playlist.count) {
 		lineno = 0;
 		ices_log_debug("Reached end of playlist, rewinding");
-		rewind(fp);
 	}
 
-	if (!(out = ices_util_read_line(fp)))
-		return NULL;
+	/* shuffle as we go, so every pass through the playlist is new */
+	if (ices_config.pm.randomize)
+		rand_pick(playlist.entries, playlist.count, lineno);
 
-	/* remove trailing \n */
-	if (out[0])
-		out[strlen(out) - 1] = '\0';
-
-  /* Windoze m3u files might have CRLF as line ends, remove CR */
-	if (out[0] && out[strlen(out) - 1] == '\r')
-		out[strlen(out) - 1] = '\0';
-
-	if (!out[0]) {
-		if (level++) {
-			level = 0;
-			ices_log_error("Unreadable or empty playlist");
-			return NULL;
-		}
-		return playlist_builtin_get_next();
-	}
-
-	level = 0;
-
-	lineno++;
+	out = ices_util_strdup(playlist.entries[lineno++].path);
 
 	ices_log_debug("Builtin playlist handler serving: %s", ices_util_nullcheck(out));
 
 	return out;
 }
 
+/* The title the playlist gave the entry just served, if any */
+static char* playlist_builtin_get_metadata(void) {
+	if (lineno < 1 || lineno > playlist.count || !playlist.entries[lineno - 1].title)
+		return NULL;
+
+	return ices_util_strdup(playlist.entries[lineno - 1].title);
+}
+
 /* Return the current playlist file line number */
 static int playlist_builtin_get_lineno(void) {
 	return lineno;
 }
 
+/* The duration the playlist gave the entry just served, in ms */
+static int playlist_builtin_get_duration(void) {
+	if (lineno < 1 || lineno > playlist.count)
+		return 0;
+
+	return playlist.entries[lineno - 1].duration;
+}
+
+/* Called on SIGHUP, so only note that the playlist should be reread */
+static int playlist_builtin_reload(void) {
+	reload_requested = 1;
+
+	return 0;
+}
+
 /* Shutdown the builtin playlist handler */
 static void playlist_builtin_shutdown(void) {
-	if (fp)
-		ices_util_fclose(fp);
+	playlist_builtin_free(&playlist);
+	rand_shutdown();
+
+#ifdef HAVE_SYS_INOTIFY_H
+	if (watchfd >= 0)
+		close(watchfd);
+	watchfd = -1;
+#endif
+	ices_util_free(watchname);
+	watchname = NULL;
 }
 
 /* Private function definitions */
 
-/* Shuffle the playlist by creating a box-unique "internal" playlist
- * and using that as the playlist */
-static void playlist_builtin_shuffle_playlist(void) {
-	char *newname, namespace[1024], buf[1024];
-
-	FILE* new;
+/* Read and index the playlist file */
+static int playlist_builtin_load(playlist_module_t* pm, playlist_index_t* list) {
+	struct stat st;
+	FILE* fp;
+	int rc;
 
-	if (!ices_config.base_directory) {
-		ices_log_error("Base directory is invalid");
-		return;
+	if (!pm->playlist_file || !pm->playlist_file[0]) {
+		ices_log_error("Playlist file is not set!");
+		return -1;
 	}
 
-	newname = ices_util_get_random_filename(buf, "playlist");
-	snprintf(namespace, sizeof(namespace), "%s/%s",
-		 ices_config.base_directory, buf);
-	new = fopen(namespace, "w+");
-	if (!new) {
-		ices_log("Error writing randomized playlist file: %s", namespace);
-		return;
+	if (!(fp = ices_util_fopen_for_reading(pm->playlist_file))) {
+		ices_log_error("Could not open playlist file: %s", pm->playlist_file);
+		return -1;
 	}
-	unlink(namespace);
 
-	rand_file(fp, new);
+	fstat(fileno(fp), &st);
+
+	rc = playlist_builtin_index(fp, list);
 	ices_util_fclose(fp);
 
-	fp = new;
-	lineno = 0;
-	rewind(fp);
+	/* a file that failed to load still counts as changed, so that an edit
+	 * fixing it is picked up even within the same second */
+	if (rc >= 0)
+		playlist_st = st;
+
+	return rc;
 }
 
-/* Verify that the user specified playlist actually exists */
-static int playlist_builtin_open_playlist(playlist_module_t* pm) {
-	struct stat st;
-	FILE* tmpfp;
+/* Read all of fp and index its entries, as PLS if it starts with a
+ * [playlist] section and as (extended) M3U otherwise */
+static int playlist_builtin_index(FILE* fp, playlist_index_t* list) {
+	char namespace[1024];
+	char* text = NULL;
+	char* tmp;
+	char* p;
+	char* end;
+	size_t size = 0;
+	size_t len = 0;
+	size_t got;
+	int lines = 1;
+	int pls;
+
+	memset(list, 0, sizeof(playlist_index_t));
+
+	do {
+		if (len + 1 >= size) {
+			size = size ? size * 2 : 65536;
+			if (!(tmp = realloc(text, size))) {
+				ices_log_error("Could not allocate memory for playlist");
+				ices_util_free(text);
+				return -1;
+			}
+			text = tmp;
+		}
+		len += (got = fread(text + len, 1, size - len - 1, fp));
+	} while (got);
 
-	if (!pm->playlist_file || !pm->playlist_file[0]) {
-		ices_log_error("Playlist file is not set!");
-		return 0;
+	if (ferror(fp)) {
+		ices_log_error("Error reading playlist file: %s",
+			       ices_util_strerror(errno, namespace, sizeof(namespace)));
+		ices_util_free(text);
+		return -1;
 	}
+	text[len] = '\0';
 
-	tmpfp = ices_util_fopen_for_reading(pm->playlist_file);
+	for (p = text; (p = memchr(p, '\n', text + len - p)); p++)
+		lines++;
 
-	if (!tmpfp) {
-		ices_log_error("Could not open playlist file: %s", pm->playlist_file);
-
-		return 0;
+	if (!(list->entries = calloc(lines, sizeof(playlist_entry_t)))) {
+		ices_log_error("Could not allocate memory for playlist");
+		ices_util_free(text);
+		return -1;
+	}
+	list->text = text;
+
+	p = text + strspn(text, " \t\r\n");
+	pls = !strncasecmp(p, "[playlist]", 10) && strspn(p + 10, " \t\r") == strcspn(p + 10, "\n");
+
+	/* split the text into lines. Windoze files might have CRLF as line
+	 * ends, remove CR too. */
+	for (p = text; p < text + len; p = end + 1) {
+		if (!(end = memchr(p, '\n', text + len - p)))
+			end = text + len;
+		*end = '\0';
+		if (end > p && end[-1] == '\r')
+			end[-1] = '\0';
 	}
 
-	fp = tmpfp;
+	if (pls)
+		playlist_builtin_index_pls(list, text, len, lines);
+	else
+		playlist_builtin_index_m3u(list, text, len);
 
-	if (stat(pm->playlist_file, &st) == 0)
-		playlist_modtime = st.st_mtime;
+	ices_log_debug("Playlist has %d entries", list->count);
 
-	if (pm->randomize) {
-		ices_log_debug("Randomizing playlist");
-		playlist_builtin_shuffle_playlist();
+	return 0;
+}
+
+/* One entry per line, skipping blank lines and comments. An #EXTINF line
+ * describes the entry after it. */
+static void playlist_builtin_index_m3u(playlist_index_t* list, char* text, size_t len) {
+	playlist_entry_t info = { NULL, NULL, 0 };
+	char* p;
+
+	for (p = text; p < text + len; p += strlen(p) + 1) {
+		if (!strncmp(p, "#EXTINF:", 8)) {
+			playlist_builtin_extinf(p + 8, &info);
+			continue;
+		}
+		if (!p[0] || p[0] == '#')
+			continue;
+
+		info.path = p;
+		list->entries[list->count++] = info;
+		info.title = NULL;
+		info.duration = 0;
 	}
+}
 
-	return 1;
+/* PLS is an INI file: FileN, TitleN and LengthN give entry N, in any
+ * order. Numbers past the number of lines in the file can't be real
+ * entries, so they are dropped like entries without a file. */
+static void playlist_builtin_index_pls(playlist_index_t* list, char* text, size_t len,
+				       int lines) {
+	playlist_entry_t* entry;
+	char* line;
+	char* key;
+	char* value;
+	char* end;
+	long n;
+	int i;
+
+	for (line = text; line < text + len; line += strlen(line) + 1) {
+		if (!(value = strchr(line, '=')))
+			continue;
+
+		for (key = line; isalpha((unsigned char) *key); key++)
+			;
+		n = strtol(key, &end, 10);
+		if (end != value || n < 1 || n > lines)
+			continue;
+		*value++ = '\0';
+		entry = &list->entries[n - 1];
+
+		if (key - line == 4 && !strncasecmp(line, "File", 4))
+			entry->path = value;
+		else if (key - line == 5 && !strncasecmp(line, "Title", 5))
+			entry->title = *value ? value : NULL;
+		else if (key - line == 6 && !strncasecmp(line, "Length", 6))
+			entry->duration = atoi(value) > 0 ? atoi(value) * 1000 : 0;
+	}
+
+	for (i = 0; i < lines; i++)
+		if (list->entries[i].path && list->entries[i].path[0])
+			list->entries[list->count++] = list->entries[i];
 }
 
+/* Parse the rest of an #EXTINF line: seconds (-1 if unknown), any
+ * attributes, then a comma and the title */
+static void playlist_builtin_extinf(char* line, playlist_entry_t* entry) {
+	char* title;
+	long secs;
+
+	secs = strtol(line, NULL, 10);
+	entry->duration = secs > 0 && secs < INT_MAX / 1000 ? (int) secs * 1000 : 0;
+
+	if ((title = strchr(line, ',')))
+		title += strspn(title + 1, " \t") + 1;
+	entry->title = title && *title ? title : NULL;
+}
+
+static void playlist_builtin_free(playlist_index_t* list) {
+	ices_util_free(list->text);
+	ices_util_free(list->entries);
+	memset(list, 0, sizeof(playlist_index_t));
+}
+
+/* Reread the playlist, and carry on after the entry that was served last.
+ * If it's gone, the position is kept unless the file was shortened.
+ * A shuffled playlist starts a new shuffle instead. */
 static int playlist_builtin_reopen_playlist(playlist_module_t* pm) {
-	ices_log_debug("Reopening playlist file");
+	playlist_index_t list;
+	const char* last = NULL;
+	int pos;
 
-	if (fp) {
-		ices_util_fclose(fp);
-		fp = NULL;
-	}
+	ices_log_debug("Reopening playlist file");
 
-	if (!playlist_builtin_open_playlist(&ices_config.pm))
+	if (playlist_builtin_load(pm, &list) < 0) {
+		ices_log("Could not reload playlist, keeping the old one: %s",
+			 ices_log_get_error());
 		return 0;
+	}
 
-	/* if the file has been shortened, reset to the beginning */
-	if (!playlist_builtin_line_skip(lineno, fp)) {
-		if (!feof(fp)) {
-			ices_log_error("Error seeking in playlist file");
-			return 0;
-		} else {
-			ices_log_debug("Reached end of playlist, rewinding");
-			lineno = 0;
-			rewind(fp);
-		}
+	if (pm->randomize)
+		lineno = 0;
+	else if (lineno > 0 && lineno <= playlist.count)
+		last = playlist.entries[lineno - 1].path;
+
+	if (last && (pos = playlist_builtin_find(&list, last, lineno - 1)) >= 0) {
+		if (pos != lineno - 1)
+			ices_log_debug("Playlist entry %d moved to %d", lineno, pos + 1);
+		lineno = pos + 1;
+	} else if (lineno > list.count) {
+		ices_log_debug("Reached end of playlist, rewinding");
+		lineno = 0;
 	}
 
+	playlist_builtin_free(&playlist);
+	playlist = list;
+
 	return 1;
 }
 
-static int playlist_builtin_line_skip(int lineno, FILE* fp) {
+/* Find the copy of entry nearest to position hint, or -1 */
+static int playlist_builtin_find(const playlist_index_t* list, const char* entry,
+				 int hint) {
 	int i;
-	char buf[1024];
 
-	for (i = lineno; i > 0;) {
-		if (!fgets(buf, sizeof(buf), fp))
-			return 0;
-		if (strchr(buf, '\n'))
-			i--;
+	if (hint >= list->count)
+		hint = list->count - 1;
+
+	for (i = 0; hint - i >= 0 || hint + i < list->count; i++) {
+		if (hint + i < list->count && !strcmp(list->entries[hint + i].path, entry))
+			return hint + i;
+		if (i && hint - i >= 0 && !strcmp(list->entries[hint - i].path, entry))
+			return hint - i;
 	}
 
-	if (feof(fp))
-		return 0;
+	return -1;
+}
 
-	return 1;
+/* Ask for notification when the playlist is written or replaced. The
+ * directory is watched, since playlists are often regenerated into a
+ * temporary file and renamed into place. */
+static void playlist_builtin_watch(playlist_module_t* pm) {
+#ifdef HAVE_SYS_INOTIFY_H
+	char* dir;
+	char* slash;
+
+	dir = ices_util_strdup(pm->playlist_file);
+	if ((slash = strrchr(dir, '/'))) {
+		watchname = ices_util_strdup(slash + 1);
+		if (slash == dir)
+			slash[1] = '\0';
+		else
+			*slash = '\0';
+	} else {
+		watchname = ices_util_strdup(dir);
+		strcpy(dir, ".");
+	}
+
+	if ((watchfd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0
+	    || inotify_add_watch(watchfd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		ices_log_debug("Could not watch %s, checking playlist before each track", dir);
+		if (watchfd >= 0)
+			close(watchfd);
+		watchfd = -1;
+	}
+
+	ices_util_free(dir);
+#endif
+}
+
+/* Has the playlist file changed since it was read? */
+static int playlist_builtin_changed(playlist_module_t* pm) {
+	struct stat st;
+	int changed = reload_requested;
+
+	reload_requested = 0;
+
+#ifdef HAVE_SYS_INOTIFY_H
+	if (watchfd >= 0) {
+		union {
+			struct inotify_event ev;
+			char buf[4096];
+		} events;
+		struct inotify_event* ev;
+		ssize_t len;
+		char* p;
+
+		while ((len = read(watchfd, events.buf, sizeof(events.buf))) > 0)
+			for (p = events.buf; p < events.buf + len; p += sizeof(*ev) + ev->len) {
+				ev = (struct inotify_event*) p;
+				if ((ev->mask & IN_Q_OVERFLOW)
+				    || (ev->len && !strcmp(ev->name, watchname)))
+					changed = 1;
+			}
+
+		return changed;
+	}
+#endif
+
+	if (!changed && stat(pm->playlist_file, &st) == 0)
+		changed = st.st_mtime != playlist_st.st_mtime
+			|| st.st_ino != playlist_st.st_ino
+			|| st.st_size != playlist_st.st_size;
+
+	return changed;
 }
@@ -18,5 +18,18 @@
  *
  */
 
+#ifndef _ICES_PM_BUILTIN_H
+#define _ICES_PM_BUILTIN_H
+
+/* A playlist entry, with what an extended M3U or PLS playlist said
+ * about it */
+typedef struct {
+	char* path;
+	char* title;        /* NULL if none was given */
+	int duration;       /* ms, 0 if unknown */
+} playlist_entry_t;
+
 /* Public function declarations */
 int ices_playlist_builtin_initialize(playlist_module_t* pm);
+
+#endif
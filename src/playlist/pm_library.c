@@ -0,0 +1,673 @@
+/* pm_library.c
+ * - Playlist handler choosing from an indexed music library
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+/* Playlist/File names a music directory, which is indexed into an SQLite
+ * database in BaseDirectory. The category of a track is the first
+ * directory under the music directory that it is in. Each track asked
+ * for is the one of Playlist/Category (or of any category) that has gone
+ * longest without being played, skipping artists among the last
+ * Playlist/NoRepeat played; ties are broken at random when randomizing,
+ * or in the order the files were found.
+ *
+ * The index is built, and brought up to date, in the background at
+ * startup and on SIGHUP; until the first build has found something to
+ * play, asking for a track waits for it. Only new or changed files are
+ * looked at, by a thread per CPU which opens them with the input modules
+ * to read their tags and duration. */
+
+#include "definitions.h"
+#include "metadata.h"
+
+#include <sqlite3.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <time.h>
+
+#define LIBRARY_DB "ices.db"
+/* most probing threads */
+#define LIBRARY_WORKERS 16
+/* rows written per transaction while scanning */
+#define LIBRARY_COMMIT 1000
+
+/* a file that is new or has changed since it was indexed */
+typedef struct {
+	char* path;
+	off_t size;
+	time_t mtime;
+	/* set by a probing thread: 1 once read, -1 if it couldn't be */
+	int state;
+	char* artist;
+	char* title;
+	unsigned int duration;
+} library_file_t;
+
+extern ices_config_t ices_config;
+
+static const char* Schema =
+	"CREATE TABLE IF NOT EXISTS tracks ("
+	" id INTEGER PRIMARY KEY,"
+	" path TEXT NOT NULL UNIQUE,"
+	" size INTEGER NOT NULL,"
+	" mtime INTEGER NOT NULL,"
+	" category TEXT NOT NULL,"
+	" artist TEXT NOT NULL,"
+	" title TEXT NOT NULL,"
+	" duration INTEGER NOT NULL,"
+	" last_played INTEGER NOT NULL DEFAULT 0,"
+	" shuffle INTEGER NOT NULL,"
+	" seen INTEGER NOT NULL);"
+	"CREATE INDEX IF NOT EXISTS tracks_category"
+	" ON tracks (category, last_played, shuffle);"
+	"CREATE INDEX IF NOT EXISTS tracks_played ON tracks (last_played, shuffle);"
+	"CREATE TABLE IF NOT EXISTS artists ("
+	" artist TEXT PRIMARY KEY,"
+	" seq INTEGER NOT NULL) WITHOUT ROWID;";
+
+static char* Root = NULL;
+static char* Dbpath = NULL;
+static int Randomize;
+
+/* the playing side */
+static sqlite3* Db = NULL;
+static sqlite3_stmt* Pick = NULL;
+static sqlite3_stmt* Played = NULL;
+static sqlite3_stmt* ArtistPlayed = NULL;
+static sqlite3_int64 Seq = 0;
+static int Lineno = 0;
+/* "Artist - Title" of the track picked last */
+static char* Metadata = NULL;
+static volatile int Rescan = 0;
+
+/* the scanning side */
+static pthread_t Scanner;
+static int Scanning = 0;
+static volatile int ScanDone = 0;
+static volatile int ScanStop = 0;
+static sqlite3* ScanDb;
+static sqlite3_stmt* Lookup;
+static sqlite3_stmt* Seen;
+static sqlite3_stmt* Insert;
+static sqlite3_int64 Gen;
+static library_file_t* Todo;
+static size_t TodoLen;
+static size_t TodoSize;
+static size_t Found;
+static int Pending;
+/* the probing threads take files from Todo in turn */
+static pthread_mutex_t ProbeLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t Probed = PTHREAD_COND_INITIALIZER;
+static size_t NextProbe;
+
+/* Private function declarations */
+static char* playlist_library_get_next(void);
+static char* playlist_library_get_metadata(void);
+static int playlist_library_get_lineno(void);
+static int playlist_library_reload(void);
+static void playlist_library_shutdown(void);
+
+static sqlite3* library_open(void);
+static int library_pick(const char* category, sqlite3_int64 since,
+			char** path, char** artist, char** title);
+static void library_start_scan(void);
+static void* library_scan_thread(void* arg);
+static int library_scan(void);
+static int library_visit(const char* path, const struct stat* st, int type,
+			 struct FTW* ftw);
+static int library_probe(void);
+static void* library_probe_thread(void* arg);
+static void library_probe_file(library_file_t* file);
+static void library_insert(library_file_t* file);
+static void library_step(sqlite3_stmt* stmt);
+static void library_commit(int force);
+
+/* Global function definitions */
+
+/* Open the index, and build it or bring it up to date in the
+ * background */
+int ices_playlist_library_initialize(playlist_module_t* pm) {
+	char buf[1024];
+	sqlite3_stmt* stmt;
+	struct stat st;
+	int empty = 1;
+
+	if (!pm->playlist_file || stat(pm->playlist_file, &st) < 0 || !S_ISDIR(st.st_mode)) {
+		ices_log_error("The library playlist handler needs a music directory as Playlist/File");
+		return -1;
+	}
+
+	Root = ices_util_strdup(pm->playlist_file);
+	snprintf(buf, sizeof(buf), "%s/" LIBRARY_DB, ices_config.base_directory);
+	Dbpath = ices_util_strdup(buf);
+	Randomize = pm->randomize;
+
+	if (!(Db = library_open()))
+		return -1;
+
+	if (sqlite3_prepare_v2(Db, "SELECT EXISTS (SELECT 1 FROM tracks)", -1, &stmt, NULL) == SQLITE_OK) {
+		if (sqlite3_step(stmt) == SQLITE_ROW)
+			empty = !sqlite3_column_int(stmt, 0);
+		sqlite3_finalize(stmt);
+	}
+
+	if (empty)
+		ices_log("Indexing %s, this may take a while...", Root);
+	library_start_scan();
+	/* with nothing to play meanwhile, there's no point going on without it */
+	if (empty && !Scanning && library_scan() < 0) {
+		ices_log_error("Indexing %s failed", Root);
+		return -1;
+	}
+
+	if (pm->category && *pm->category)
+		sqlite3_prepare_v2(Db,
+				   "SELECT id, path, artist, title FROM tracks"
+				   " WHERE category = ?1 AND NOT EXISTS (SELECT 1 FROM artists"
+				   "  WHERE artists.artist = tracks.artist AND artists.seq > ?2)"
+				   " ORDER BY last_played, shuffle LIMIT 1", -1, &Pick, NULL);
+	else
+		sqlite3_prepare_v2(Db,
+				   "SELECT id, path, artist, title FROM tracks"
+				   " WHERE NOT EXISTS (SELECT 1 FROM artists"
+				   "  WHERE artists.artist = tracks.artist AND artists.seq > ?2)"
+				   " ORDER BY last_played, shuffle LIMIT 1", -1, &Pick, NULL);
+	sqlite3_prepare_v2(Db, "UPDATE tracks SET last_played = ?1 WHERE id = ?2", -1,
+			   &Played, NULL);
+	sqlite3_prepare_v2(Db, "INSERT INTO artists (artist, seq) VALUES (?1, ?2)"
+			   " ON CONFLICT (artist) DO UPDATE SET seq = excluded.seq", -1,
+			   &ArtistPlayed, NULL);
+
+	if (!Pick || !Played || !ArtistPlayed) {
+		ices_log_error("Could not query the library: %s", sqlite3_errmsg(Db));
+		return -1;
+	}
+
+	if (sqlite3_prepare_v2(Db, "SELECT coalesce(max(seq), 0) FROM artists", -1, &stmt,
+			       NULL) == SQLITE_OK) {
+		if (sqlite3_step(stmt) == SQLITE_ROW)
+			Seq = sqlite3_column_int64(stmt, 0);
+		sqlite3_finalize(stmt);
+	}
+
+	pm->get_next = playlist_library_get_next;
+	pm->get_metadata = playlist_library_get_metadata;
+	pm->get_lineno = playlist_library_get_lineno;
+	pm->reload = playlist_library_reload;
+	pm->shutdown = playlist_library_shutdown;
+
+	return 1;
+}
+
+/* Private function definitions */
+
+/* The track of the category that has gone longest unplayed, by an artist
+ * not heard recently if there is one */
+static char* playlist_library_get_next(void) {
+	const char* category = ices_config.pm.category;
+	char* path = NULL;
+	char* artist = NULL;
+	char* title = NULL;
+	char buf[1024];
+	int scanning;
+	int waited = 0;
+	int id;
+
+	if (ScanDone) {
+		pthread_join(Scanner, NULL);
+		Scanning = ScanDone = 0;
+	}
+	if (Rescan && !Scanning) {
+		Rescan = 0;
+		library_start_scan();
+	}
+
+	/* the first build may not have got far enough yet */
+	while (1) {
+		scanning = Scanning && !ScanDone;
+		if ((id = library_pick(category, Seq - ices_config.pm.norepeat, &path, &artist,
+				       &title)) == 0)
+			id = library_pick(category, Seq, &path, &artist, &title);
+		if (id || !scanning || ices_signals_stopping())
+			break;
+
+		if (!waited++)
+			ices_log("Waiting for the library scan to find something to play...");
+		sleep(1);
+	}
+	if (id <= 0) {
+		if (!id && !ices_signals_stopping())
+			ices_log_error("The library has no tracks%s%s",
+				       category && *category ? " in " : "",
+				       category && *category ? category : "");
+		return NULL;
+	}
+
+	Lineno = id;
+	Seq++;
+
+	sqlite3_exec(Db, "BEGIN", NULL, NULL, NULL);
+	sqlite3_bind_int64(Played, 1, time(NULL));
+	sqlite3_bind_int(Played, 2, id);
+	sqlite3_step(Played);
+	sqlite3_reset(Played);
+	if (*artist) {
+		sqlite3_bind_text(ArtistPlayed, 1, artist, -1, SQLITE_STATIC);
+		sqlite3_bind_int64(ArtistPlayed, 2, Seq);
+		sqlite3_step(ArtistPlayed);
+		sqlite3_reset(ArtistPlayed);
+	}
+	if (sqlite3_exec(Db, "COMMIT", NULL, NULL, NULL) != SQLITE_OK) {
+		ices_log("Could not mark %s as played: %s", path, sqlite3_errmsg(Db));
+		sqlite3_exec(Db, "ROLLBACK", NULL, NULL, NULL);
+	}
+
+	ices_util_free(Metadata);
+	Metadata = NULL;
+	if (*artist && *title) {
+		snprintf(buf, sizeof(buf), "%s - %s", artist, title);
+		Metadata = ices_util_strdup(buf);
+	} else if (*title)
+		Metadata = ices_util_strdup(title);
+
+	ices_util_free(artist);
+	ices_util_free(title);
+
+	return path;
+}
+
+/* What was indexed for the track picked last */
+static char* playlist_library_get_metadata(void) {
+	return Metadata ? ices_util_strdup(Metadata) : NULL;
+}
+
+static int playlist_library_get_lineno(void) {
+	return Lineno;
+}
+
+/* Called on SIGHUP: rescan when the next track is asked for */
+static int playlist_library_reload(void) {
+	Rescan = 1;
+
+	return 0;
+}
+
+static void playlist_library_shutdown(void) {
+	if (Scanning) {
+		pthread_mutex_lock(&ProbeLock);
+		ScanStop = 1;
+		pthread_cond_broadcast(&Probed);
+		pthread_mutex_unlock(&ProbeLock);
+		pthread_join(Scanner, NULL);
+		Scanning = 0;
+	}
+
+	sqlite3_finalize(Pick);
+	sqlite3_finalize(Played);
+	sqlite3_finalize(ArtistPlayed);
+	sqlite3_close(Db);
+	Db = NULL;
+
+	ices_util_free(Root);
+	ices_util_free(Dbpath);
+	ices_util_free(Metadata);
+	Metadata = NULL;
+}
+
+/* Open the database, creating the tables if need be */
+static sqlite3* library_open(void) {
+	sqlite3* db;
+
+	if (sqlite3_open_v2(Dbpath, &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL)
+	    != SQLITE_OK) {
+		ices_log_error("Could not open %s: %s", Dbpath, sqlite3_errmsg(db));
+		sqlite3_close(db);
+		return NULL;
+	}
+
+	/* the scanner writes while tracks are picked */
+	sqlite3_busy_timeout(db, 10000);
+	if (sqlite3_exec(db, "PRAGMA journal_mode = WAL; PRAGMA synchronous = NORMAL;",
+			 NULL, NULL, NULL) != SQLITE_OK
+	    || sqlite3_exec(db, Schema, NULL, NULL, NULL) != SQLITE_OK) {
+		ices_log_error("Could not set up %s: %s", Dbpath, sqlite3_errmsg(db));
+		sqlite3_close(db);
+		return NULL;
+	}
+
+	return db;
+}
+
+/* Returns the id of the track picked, 0 if there is none or -1 on error */
+static int library_pick(const char* category, sqlite3_int64 since,
+			char** path, char** artist, char** title) {
+	int rc;
+	int id = 0;
+
+	if (category && *category)
+		sqlite3_bind_text(Pick, 1, category, -1, SQLITE_STATIC);
+	sqlite3_bind_int64(Pick, 2, since);
+
+	if ((rc = sqlite3_step(Pick)) == SQLITE_ROW) {
+		id = sqlite3_column_int(Pick, 0);
+		*path = ices_util_strdup((const char*) sqlite3_column_text(Pick, 1));
+		*artist = ices_util_strdup((const char*) sqlite3_column_text(Pick, 2));
+		*title = ices_util_strdup((const char*) sqlite3_column_text(Pick, 3));
+	} else if (rc != SQLITE_DONE) {
+		ices_log_error("Library query failed: %s", sqlite3_errmsg(Db));
+		id = -1;
+	}
+	sqlite3_reset(Pick);
+
+	return id;
+}
+
+static void library_start_scan(void) {
+	int rc;
+
+	if ((rc = ices_util_thread_create(&Scanner, library_scan_thread, NULL)))
+		ices_log("Could not start the library scanner: %s", strerror(rc));
+	else
+		Scanning = 1;
+}
+
+static void* library_scan_thread(void* arg) {
+	library_scan();
+	ScanDone = 1;
+
+	return NULL;
+}
+
+/* Walk the music directory, probe what is new or has changed, and drop
+ * what has gone */
+static int library_scan(void) {
+	time_t start = time(NULL);
+	sqlite3_stmt* gone;
+	int removed = 0;
+	int walked;
+	size_t i;
+	int rc = -1;
+
+	if (!(ScanDb = library_open()))
+		return -1;
+
+	Gen = start;
+	Found = TodoLen = 0;
+	Pending = 0;
+
+	sqlite3_prepare_v2(ScanDb, "SELECT size, mtime FROM tracks WHERE path = ?1", -1,
+			   &Lookup, NULL);
+	sqlite3_prepare_v2(ScanDb, "UPDATE tracks SET seen = ?1 WHERE path = ?2", -1,
+			   &Seen, NULL);
+	sqlite3_prepare_v2(ScanDb,
+			   "INSERT INTO tracks (path, size, mtime, category, artist, title,"
+			   " duration, shuffle, seen)"
+			   " VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9)"
+			   " ON CONFLICT (path) DO UPDATE SET size = excluded.size,"
+			   " mtime = excluded.mtime, category = excluded.category,"
+			   " artist = excluded.artist, title = excluded.title,"
+			   " duration = excluded.duration, seen = excluded.seen", -1,
+			   &Insert, NULL);
+	if (!Lookup || !Seen || !Insert) {
+		ices_log("Could not update the library: %s", sqlite3_errmsg(ScanDb));
+		goto out;
+	}
+
+	walked = !nftw(Root, library_visit, 64, FTW_PHYS);
+	library_commit(1);
+	if (ScanStop)
+		goto out;
+	if (!walked)
+		ices_log("Could not read all of %s, not removing anything from the library", Root);
+
+	if ((rc = library_probe()) < 0 || !walked)
+		goto out;
+
+	if (sqlite3_prepare_v2(ScanDb, "DELETE FROM tracks WHERE seen <> ?1", -1, &gone,
+			       NULL) == SQLITE_OK) {
+		sqlite3_bind_int64(gone, 1, Gen);
+		if (sqlite3_step(gone) == SQLITE_DONE)
+			removed = sqlite3_changes(ScanDb);
+		sqlite3_finalize(gone);
+	}
+
+	ices_log("Library scanned in %ld seconds: %lu files, %lu new or changed, %d removed",
+		 (long) (time(NULL) - start), (unsigned long) Found,
+		 (unsigned long) TodoLen, removed);
+
+ out:
+	for (i = 0; i < TodoLen; i++) {
+		ices_util_free(Todo[i].path);
+		ices_util_free(Todo[i].artist);
+		ices_util_free(Todo[i].title);
+	}
+	ices_util_free(Todo);
+	Todo = NULL;
+	TodoLen = TodoSize = 0;
+
+	sqlite3_finalize(Lookup);
+	sqlite3_finalize(Seen);
+	sqlite3_finalize(Insert);
+	Lookup = Seen = Insert = NULL;
+	sqlite3_close(ScanDb);
+
+	return rc;
+}
+
+/* Mark known files as seen, and keep new or changed ones for probing */
+static int library_visit(const char* path, const struct stat* st, int type,
+			 struct FTW* ftw) {
+	library_file_t* grown;
+
+	if (ScanStop)
+		return 1;
+	if (type != FTW_F || !S_ISREG(st->st_mode) || !ices_playlist_is_audio(path))
+		return 0;
+
+	Found++;
+
+	sqlite3_bind_text(Lookup, 1, path, -1, SQLITE_STATIC);
+	if (sqlite3_step(Lookup) == SQLITE_ROW && sqlite3_column_int64(Lookup, 0) == st->st_size
+	    && sqlite3_column_int64(Lookup, 1) == st->st_mtime) {
+		sqlite3_reset(Lookup);
+
+		sqlite3_bind_int64(Seen, 1, Gen);
+		sqlite3_bind_text(Seen, 2, path, -1, SQLITE_STATIC);
+		library_step(Seen);
+
+		return 0;
+	}
+	sqlite3_reset(Lookup);
+
+	if (TodoLen == TodoSize) {
+		TodoSize = TodoSize ? TodoSize * 2 : 1024;
+		if (!(grown = realloc(Todo, TodoSize * sizeof(library_file_t)))) {
+			ices_log("Out of memory while scanning the library");
+			return 1;
+		}
+		Todo = grown;
+	}
+
+	memset(&Todo[TodoLen], 0, sizeof(library_file_t));
+	Todo[TodoLen].path = ices_util_strdup(path);
+	Todo[TodoLen].size = st->st_size;
+	Todo[TodoLen].mtime = st->st_mtime;
+	TodoLen++;
+
+	return 0;
+}
+
+/* Read the new files with a thread per CPU, and store what they found
+ * in the order the files were walked */
+static int library_probe(void) {
+	pthread_t threads[LIBRARY_WORKERS];
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int nthreads, n, state, rc;
+	size_t i;
+
+	if (!TodoLen)
+		return 0;
+
+	nthreads = cpus > 0 ? cpus : 1;
+	if (nthreads > LIBRARY_WORKERS)
+		nthreads = LIBRARY_WORKERS;
+	if ((size_t) nthreads > TodoLen)
+		nthreads = TodoLen;
+
+	NextProbe = 0;
+	for (n = 0; n < nthreads; n++)
+		if ((rc = ices_util_thread_create(&threads[n], library_probe_thread, NULL))) {
+			ices_log("Could not start a library probing thread: %s", strerror(rc));
+			break;
+		}
+
+	ices_log_debug("Probing %lu files with %d threads", (unsigned long) TodoLen, n);
+	/* without any, do it all here */
+	if (!n)
+		library_probe_thread(NULL);
+
+	for (i = 0; i < TodoLen; i++) {
+		pthread_mutex_lock(&ProbeLock);
+		while (!Todo[i].state && !ScanStop)
+			pthread_cond_wait(&Probed, &ProbeLock);
+		state = Todo[i].state;
+		pthread_mutex_unlock(&ProbeLock);
+
+		if (!state)
+			break;
+		if (state > 0)
+			library_insert(&Todo[i]);
+	}
+
+	while (n--)
+		pthread_join(threads[n], NULL);
+
+	library_commit(1);
+
+	return ScanStop ? -1 : 0;
+}
+
+/* Take files to probe until there are none left or the scan is stopped */
+static void* library_probe_thread(void* arg) {
+	size_t i;
+
+	while (1) {
+		pthread_mutex_lock(&ProbeLock);
+		i = ScanStop ? TodoLen : NextProbe++;
+		pthread_mutex_unlock(&ProbeLock);
+		if (i >= TodoLen)
+			break;
+
+		library_probe_file(&Todo[i]);
+	}
+
+	/* the tags read are kept per thread */
+	ices_metadata_set(NULL, NULL);
+	ices_metadata_set_playlist(NULL);
+
+	return NULL;
+}
+
+/* Open a file with the input modules to read its artist, title and
+ * duration, and hand it back to the scanner */
+static void library_probe_file(library_file_t* file) {
+	input_stream_t source;
+	char artist[1024];
+	char title[1024];
+	const char* guess[2];
+	int guesslen[2];
+	int state = -1;
+
+	memset(&source, 0, sizeof(source));
+	source.path = file->path;
+
+	ices_metadata_set(NULL, NULL);
+	ices_metadata_set_playlist(NULL);
+	if (ices_stream_probe(&source) >= 0) {
+		artist[0] = title[0] = '\0';
+		ices_metadata_get(artist, sizeof(artist), title, sizeof(title));
+		if (!*artist || !*title) {
+			ices_playlist_guess_tags(source.path, &guess[0], &guesslen[0], &guess[1],
+						 &guesslen[1]);
+			if (!*artist)
+				snprintf(artist, sizeof(artist), "%.*s", guesslen[0], guess[0]);
+			if (!*title)
+				snprintf(title, sizeof(title), "%.*s", guesslen[1], guess[1]);
+		}
+
+		file->artist = ices_util_strdup(artist);
+		file->title = ices_util_strdup(title);
+		file->duration = source.duration;
+		state = 1;
+	}
+
+	pthread_mutex_lock(&ProbeLock);
+	file->state = state;
+	pthread_cond_broadcast(&Probed);
+	pthread_mutex_unlock(&ProbeLock);
+}
+
+static void library_insert(library_file_t* file) {
+	const char* category;
+	const char* slash;
+	size_t rootlen = strlen(Root);
+	unsigned int shuffle = 0;
+
+	/* the first directory under the root */
+	category = file->path + rootlen;
+	while (*category == '/')
+		category++;
+	if (!(slash = strchr(category, '/')))
+		category = slash = "";
+
+	sqlite3_bind_text(Insert, 1, file->path, -1, SQLITE_STATIC);
+	sqlite3_bind_int64(Insert, 2, file->size);
+	sqlite3_bind_int64(Insert, 3, file->mtime);
+	sqlite3_bind_text(Insert, 4, category, slash - category, SQLITE_STATIC);
+	sqlite3_bind_text(Insert, 5, file->artist, -1, SQLITE_STATIC);
+	sqlite3_bind_text(Insert, 6, file->title, -1, SQLITE_STATIC);
+	sqlite3_bind_int64(Insert, 7, file->duration);
+	if (Randomize)
+		sqlite3_randomness(sizeof(shuffle), &shuffle);
+	sqlite3_bind_int64(Insert, 8, shuffle & 0x7fffffff);
+	sqlite3_bind_int64(Insert, 9, Gen);
+	library_step(Insert);
+}
+
+/* Run a write while scanning, in a transaction of a few */
+static void library_step(sqlite3_stmt* stmt) {
+	if (!Pending++)
+		sqlite3_exec(ScanDb, "BEGIN", NULL, NULL, NULL);
+
+	if (sqlite3_step(stmt) != SQLITE_DONE)
+		ices_log_debug("Library update failed: %s", sqlite3_errmsg(ScanDb));
+	sqlite3_reset(stmt);
+
+	library_commit(0);
+}
+
+/* Commit every so often, so that tracks can be picked meanwhile */
+static void library_commit(int force) {
+	if (!Pending || (!force && Pending < LIBRARY_COMMIT))
+		return;
+
+	Pending = 0;
+	if (sqlite3_exec(ScanDb, "COMMIT", NULL, NULL, NULL) != SQLITE_OK) {
+		ices_log("Could not update the library: %s", sqlite3_errmsg(ScanDb));
+		sqlite3_exec(ScanDb, "ROLLBACK", NULL, NULL, NULL);
+	}
+}
@@ -0,0 +1,210 @@
+/* pm_native.c
+ * - Playlist modules loaded from shared objects at run time
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#include "definitions.h"
+#include "ices_playlist.h"
+
+#include <dlfcn.h>
+
+/* tracks asked for at a time */
+#define NATIVE_BATCH 32
+
+/* a track as handed out by the module, copied so that it can be kept */
+typedef struct {
+	char* path;
+	char* metadata;
+	int timelimit;
+	int lineno;
+} native_track_t;
+
+static void* Handle = NULL;
+static const ices_playlist_module_t* Module;
+static void* State;
+
+static native_track_t Batch[NATIVE_BATCH];
+static int BatchLen = 0;
+static int BatchPos = 0;
+/* the track last handed out */
+static native_track_t Current;
+static volatile int Reload = 0;
+
+/* Private function declarations */
+static char* playlist_native_get_next(void);
+static char* playlist_native_get_metadata(void);
+static int playlist_native_get_lineno(void);
+static int playlist_native_get_timelimit(void);
+static int playlist_native_reload(void);
+static void playlist_native_shutdown(void);
+
+static int playlist_native_fill(void);
+static void playlist_native_drop(void);
+
+/* Global function definitions */
+
+/* Load the module named by Playlist/Module from the module directory
+ * (or a path, if it has a slash in it) */
+int ices_playlist_native_initialize(playlist_module_t* pm) {
+	char path[1024];
+	ices_playlist_entry_t entry;
+	size_t len = strlen(pm->module);
+
+	if (strchr(pm->module, '/'))
+		snprintf(path, sizeof(path), "%s", pm->module);
+	else
+		snprintf(path, sizeof(path), "%s/%s%s", ICES_MODULEDIR, pm->module,
+			 len > 3 && !strcmp(pm->module + len - 3, ".so") ? "" : ".so");
+
+	if (!(Handle = dlopen(path, RTLD_NOW | RTLD_LOCAL))) {
+		ices_log_error("Could not load playlist module: %s", dlerror());
+		return -1;
+	}
+
+	*(void**) &entry = dlsym(Handle, ICES_PLAYLIST_ENTRY);
+	if (!entry || !(Module = entry())) {
+		ices_log_error("%s is not an ices playlist module", path);
+		goto err;
+	}
+	if (Module->abi_version != ICES_PLAYLIST_ABI_VERSION) {
+		ices_log_error("%s was built for playlist ABI %u, this ices uses %d",
+			       path, Module->abi_version, ICES_PLAYLIST_ABI_VERSION);
+		goto err;
+	}
+	if (!Module->name || !Module->init || !Module->get_next || !Module->shutdown) {
+		ices_log_error("%s is missing required playlist functions", path);
+		goto err;
+	}
+
+	if (!(State = Module->init(pm->playlist_file, pm->randomize))) {
+		ices_log_error("Playlist module %s could not be started", Module->name);
+		goto err;
+	}
+
+	ices_log_debug("Loaded playlist module %s from %s", Module->name, path);
+
+	pm->get_next = playlist_native_get_next;
+	pm->get_metadata = playlist_native_get_metadata;
+	pm->get_lineno = playlist_native_get_lineno;
+	pm->get_timelimit = playlist_native_get_timelimit;
+	pm->reload = playlist_native_reload;
+	pm->shutdown = playlist_native_shutdown;
+
+	return 1;
+
+ err:
+	dlclose(Handle);
+	Handle = NULL;
+	return -1;
+}
+
+/* Private function definitions */
+
+/* Hand out the next track of the batch, asking for another batch when it
+ * runs out. The path is handed over as it is: the caller frees it. */
+static char* playlist_native_get_next(void) {
+	char* path;
+
+	ices_util_free(Current.path);
+	ices_util_free(Current.metadata);
+	memset(&Current, 0, sizeof(Current));
+
+	if (Reload) {
+		Reload = 0;
+		playlist_native_drop();
+		if (Module->reload && Module->reload(State) < 0)
+			ices_log("Playlist module %s could not reload", Module->name);
+	}
+
+	if (BatchPos == BatchLen && playlist_native_fill() <= 0)
+		return NULL;
+
+	Current = Batch[BatchPos++];
+	path = Current.path;
+	Current.path = NULL;
+
+	return path;
+}
+
+static char* playlist_native_get_metadata(void) {
+	return Current.metadata ? ices_util_strdup(Current.metadata) : NULL;
+}
+
+static int playlist_native_get_lineno(void) {
+	return Current.lineno;
+}
+
+static int playlist_native_get_timelimit(void) {
+	return Current.timelimit;
+}
+
+/* Called on SIGHUP, so the module is only told on the next request */
+static int playlist_native_reload(void) {
+	Reload = 1;
+
+	return 0;
+}
+
+static void playlist_native_shutdown(void) {
+	playlist_native_drop();
+	ices_util_free(Current.path);
+	ices_util_free(Current.metadata);
+	memset(&Current, 0, sizeof(Current));
+
+	Module->shutdown(State);
+	dlclose(Handle);
+	Handle = NULL;
+}
+
+/* Ask the module for another batch of tracks and keep copies of them */
+static int playlist_native_fill(void) {
+	ices_playlist_track_t tracks[NATIVE_BATCH];
+	int i, n;
+
+	BatchLen = BatchPos = 0;
+
+	memset(tracks, 0, sizeof(tracks));
+	if ((n = Module->get_next(State, tracks, NATIVE_BATCH)) < 0) {
+		ices_log_error("Playlist module %s failed", Module->name);
+		return -1;
+	}
+	if (n > NATIVE_BATCH)
+		n = NATIVE_BATCH;
+
+	for (i = 0; i < n; i++) {
+		if (!tracks[i].path || !*tracks[i].path)
+			continue;
+
+		Batch[BatchLen].path = ices_util_strdup(tracks[i].path);
+		Batch[BatchLen].metadata = tracks[i].metadata ?
+			ices_util_strdup(tracks[i].metadata) : NULL;
+		Batch[BatchLen].timelimit = tracks[i].timelimit;
+		Batch[BatchLen].lineno = tracks[i].lineno;
+		BatchLen++;
+	}
+
+	return BatchLen;
+}
+
+/* forget the rest of the batch */
+static void playlist_native_drop(void) {
+	for (; BatchPos < BatchLen; BatchPos++) {
+		ices_util_free(Batch[BatchPos].path);
+		ices_util_free(Batch[BatchPos].metadata);
+	}
+	BatchLen = BatchPos = 0;
+}
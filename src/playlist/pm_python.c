@@ -45,7 +45,6 @@ static void playlist_python_shutdown(void);
 
 static int python_init(void);
 static void python_shutdown(void);
-static int python_setup_path(void);
 static PyObject* python_eval(char *functionname);
 static char* python_find_attr(PyObject* module, char* f1, char* f2);
 
@@ -64,8 +63,8 @@ int ices_playlist_python_initialize(playlist_module_t* pm) {
 		return -1;
 
 	if (pl_init_hook) {
-		if ((res = python_eval(pl_init_hook)) && PyInt_Check(res))
-			rc = PyInt_AsLong(res);
+		if ((res = python_eval(pl_init_hook)) && PyLong_Check(res))
+			rc = PyLong_AsLong(res);
 		else
 			ices_log_error("ices_init failed");
 
@@ -81,8 +80,8 @@ static int playlist_python_get_lineno(void) {
 	int rc = 0;
 
 	if (pl_get_lineno_hook) {
-		if ((res = python_eval(pl_get_lineno_hook)) && PyInt_Check(res))
-			rc = PyInt_AsLong(res);
+		if ((res = python_eval(pl_get_lineno_hook)) && PyLong_Check(res))
+			rc = PyLong_AsLong(res);
 		else
 			ices_log_error("ices_get_lineno failed");
 
@@ -97,8 +96,8 @@ static char *playlist_python_get_next(void) {
 	PyObject* res;
 	char* rc = NULL;
 
-	if ((res = python_eval(pl_get_next_hook)) && PyString_Check(res))
-		rc = ices_util_strdup(PyString_AsString(res));
+	if ((res = python_eval(pl_get_next_hook)) && PyUnicode_Check(res))
+		rc = ices_util_strdup(PyUnicode_AsUTF8(res));
 	else
 		ices_log_error("ices_get_next failed");
 
@@ -112,8 +111,8 @@ static char*playlist_python_get_metadata(void) {
 	char* rc = NULL;
 
 	if (pl_get_metadata_hook) {
-		if ((res = python_eval(pl_get_metadata_hook)) && PyString_Check(res))
-			rc = ices_util_strdup(PyString_AsString(res));
+		if ((res = python_eval(pl_get_metadata_hook)) && PyUnicode_Check(res))
+			rc = ices_util_strdup(PyUnicode_AsUTF8(res));
 		else
 			ices_log_error("ices_get_metadata failed");
 
@@ -145,7 +144,7 @@ static void playlist_python_shutdown(void) {
 	PyObject* res;
 
 	if (pl_shutdown_hook) {
-		if (!((res = python_eval(pl_shutdown_hook)) && PyInt_Check(res)))
+		if (!((res = python_eval(pl_shutdown_hook)) && PyLong_Check(res)))
 			ices_log_error("ices_shutdown failed");
 
 		Py_XDECREF(res);
@@ -156,14 +155,11 @@ static void playlist_python_shutdown(void) {
 
 /* -- Python interpreter management -- */
 
-/* Function to initialize the python interpreter */
+/* Function to initialize the python interpreter. PYTHONPATH has been
+ * set by ices_playlist_python_environment() already. */
 static int python_init(void) {
-	/* For some reason, python refuses to look in the
-	 * current directory for modules */
-	if (python_setup_path() < 0)
-		return -1;
-
-	Py_Initialize();
+	/* leave the signal handlers to ices */
+	Py_InitializeEx(0);
 
 	ices_log_debug("Importing %s.py module...", ices_config.pm.module);
 
@@ -195,8 +191,9 @@ static int python_init(void) {
 }
 
 /* Force the python interpreter to look in our module path
- * and in the current directory for modules */
-static int python_setup_path(void) {
+ * and in the current directory for modules. This is done on the main
+ * thread, before the interpreter gets a thread of its own. */
+int ices_playlist_python_environment(void) {
 	char *oldpath = getenv("PYTHONPATH");
 
 	if (oldpath && (python_path = (char*) malloc(strlen(oldpath) + strlen(ICES_MODULEDIR) + 15)))
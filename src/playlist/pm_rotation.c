@@ -0,0 +1,977 @@
+/* pm_rotation.c
+ * - Playlist handler scheduling categories by hour clocks
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+/* Playlist/File names a clock file like this one:
+ *
+ *   category current /music/current      # a directory or a playlist
+ *   category gold    /music/gold.m3u
+ *   category id      /music/ids
+ *
+ *   separate artist 45                   # minutes
+ *   separate title 180
+ *
+ *   clock day   current gold current id current gold:2,current
+ *   clock night gold gold current id
+ *
+ *   hours night * 0-5,22-23
+ *   hours night sat,sun *
+ *
+ * A clock is a list of slots played in turn, from the first one at the
+ * top of every hour, going round again if the hour runs long. A slot
+ * names a category, or several with weights to choose between at
+ * random. "hours" lines say which clock to use on which days and hours,
+ * later lines winning; the first clock is used where none does.
+ *
+ * Each category keeps its tracks in a heap ordered by when they were
+ * last played, so the next one is found in O(log n). Tracks whose artist
+ * or title was played within its separation window are passed over, a
+ * bounded number of times, so small categories still play. The artist
+ * and title are taken from "Artist - Title" style file names, or else
+ * the directory is the artist.
+ *
+ * What was played, and where the clock was, is appended to
+ * BaseDirectory/ices.rotation, so a restart carries on where it left off.
+ * SIGHUP rereads the clock file and the categories. */
+
+#include "definitions.h"
+
+#include <ftw.h>
+#include <time.h>
+
+#define ROTATION_STATE "ices.rotation"
+/* tracks looked at per pick before separation is given up on */
+#define ROTATION_TRIES 16
+/* categories a slot may choose between */
+#define ROTATION_CHOICES 8
+
+typedef struct {
+	char* path;
+	uint64_t artist;
+	uint64_t title;
+	time_t played;
+	/* breaks ties in played: random or the order the tracks were found
+	 * until played, then the order they were played in */
+	uint32_t order;
+	int category;
+} rotation_track_t;
+
+typedef struct {
+	char* name;
+	/* indices into tracks, least recently played first */
+	int* heap;
+	int count;
+	int size;
+} rotation_category_t;
+
+typedef struct {
+	int choices;
+	int category[ROTATION_CHOICES];
+	int weight[ROTATION_CHOICES];
+} rotation_slot_t;
+
+typedef struct {
+	char* name;
+	rotation_slot_t* slots;
+	int count;
+} rotation_clock_t;
+
+/* open addressed hash of 64 bit keys, 0 meaning unused */
+typedef struct {
+	uint64_t* keys;
+	int64_t* values;
+	size_t size;
+	size_t used;
+} rotation_map_t;
+
+typedef struct {
+	rotation_track_t* tracks;
+	int ntracks;
+	int tracks_size;
+	rotation_category_t* categories;
+	int ncategories;
+	rotation_clock_t* clocks;
+	int nclocks;
+	/* clock for each day of the week and hour, -1 for the first */
+	int week[7][24];
+	int artist_sep;
+	int title_sep;
+
+	/* category and path to track, and when artists and titles last played */
+	rotation_map_t paths;
+	rotation_map_t artists;
+	rotation_map_t titles;
+
+	/* the hour the clock was last consulted in, and the slot it is at */
+	int64_t hour;
+	int slot;
+	uint32_t picks;
+
+	FILE* state;
+	int appended;
+} rotation_t;
+
+extern ices_config_t ices_config;
+
+static const char* Days[] = { "sun", "mon", "tue", "wed", "thu", "fri", "sat" };
+
+static rotation_t Rotation;
+static char* Statepath = NULL;
+static int Randomize;
+static uint64_t Random;
+static int Lineno = 0;
+static volatile int Reload = 0;
+
+/* where nftw is putting what it finds */
+static rotation_t* Loading;
+static int LoadingCategory;
+
+/* Private function declarations */
+static char* playlist_rotation_get_next(void);
+static int playlist_rotation_get_lineno(void);
+static int playlist_rotation_reload(void);
+static void playlist_rotation_shutdown(void);
+
+static int rotation_load(rotation_t* rot, const char* file);
+static int rotation_parse(rotation_t* rot, const char* file);
+static int rotation_parse_slot(rotation_t* rot, char* word, rotation_slot_t* slot);
+static int rotation_parse_set(const char* spec, int* set, int n, const char** names);
+static int rotation_find_category(rotation_t* rot, const char* name);
+static int rotation_add_source(rotation_t* rot, int category, const char* source);
+static int rotation_visit(const char* path, const struct stat* st, int type,
+			  struct FTW* ftw);
+static int rotation_add_track(rotation_t* rot, int category, const char* path);
+static void rotation_read_state(rotation_t* rot);
+static int rotation_write_state(rotation_t* rot);
+static void rotation_free(rotation_t* rot);
+
+static int rotation_choose(rotation_t* rot, const rotation_slot_t* slot);
+static int rotation_pick(rotation_t* rot, int category, time_t now);
+static time_t rotation_conflict(rotation_t* rot, const rotation_track_t* track, time_t now);
+static int rotation_before(const rotation_t* rot, int a, int b);
+static void rotation_push(rotation_t* rot, rotation_category_t* cat, int track);
+static int rotation_pop(rotation_t* rot, rotation_category_t* cat);
+
+static int64_t* rotation_map_get(rotation_map_t* map, uint64_t key);
+static int rotation_map_put(rotation_map_t* map, uint64_t key, int64_t value);
+static void rotation_map_free(rotation_map_t* map);
+static uint64_t rotation_hash(uint64_t h, const char* s, size_t len);
+static uint64_t rotation_key(const char* category, const char* path);
+static uint32_t rotation_random(void);
+
+/* Global function definitions */
+
+/* Read the clock file and the categories, and carry on from the saved
+ * rotation */
+int ices_playlist_rotation_initialize(playlist_module_t* pm) {
+	char buf[1024];
+
+	if (!pm->playlist_file) {
+		ices_log_error("The rotation playlist handler needs a clock file as Playlist/File");
+		return -1;
+	}
+
+	snprintf(buf, sizeof(buf), "%s/" ROTATION_STATE, ices_config.base_directory);
+	Statepath = ices_util_strdup(buf);
+	Randomize = pm->randomize;
+	Random = ((uint64_t) time(NULL) << 32) ^ ices_util_get_random() ^ 0x9e3779b97f4a7c15ULL;
+
+	if (rotation_load(&Rotation, pm->playlist_file) < 0) {
+		ices_util_free(Statepath);
+		Statepath = NULL;
+		return -1;
+	}
+
+	pm->get_next = playlist_rotation_get_next;
+	pm->get_metadata = NULL;
+	pm->get_lineno = playlist_rotation_get_lineno;
+	pm->reload = playlist_rotation_reload;
+	pm->shutdown = playlist_rotation_shutdown;
+
+	return 1;
+}
+
+/* Private function definitions */
+
+/* Play the next slot of this hour's clock */
+static char* playlist_rotation_get_next(void) {
+	rotation_t* rot = &Rotation;
+	rotation_t fresh;
+	const rotation_clock_t* clock;
+	const rotation_track_t* track;
+	time_t now = time(NULL);
+	struct tm tm;
+	int64_t hour;
+	int c, t, slot;
+
+	/* keep going with the old clocks if the new ones are no good */
+	if (Reload) {
+		Reload = 0;
+		if (rotation_load(&fresh, ices_config.pm.playlist_file) < 0)
+			ices_log("Could not reload %s: %s", ices_config.pm.playlist_file,
+				 ices_log_get_error());
+		else {
+			rotation_free(rot);
+			*rot = fresh;
+		}
+	}
+
+	localtime_r(&now, &tm);
+	hour = ((int64_t) tm.tm_year * 366 + tm.tm_yday) * 24 + tm.tm_hour;
+	c = rot->week[tm.tm_wday][tm.tm_hour];
+	clock = &rot->clocks[c < 0 ? 0 : c];
+
+	if (hour != rot->hour) {
+		rot->hour = hour;
+		rot->slot = 0;
+	}
+	slot = rot->slot++ % clock->count;
+	Lineno = slot + 1;
+
+	if ((c = rotation_choose(rot, &clock->slots[slot])) < 0) {
+		/* all of this slot's categories are empty, play anything */
+		for (c = 0; c < rot->ncategories && !rot->categories[c].count; c++)
+			;
+		ices_log_debug("Nothing to play in slot %d of clock %s, using %s", slot + 1,
+			       clock->name, rot->categories[c].name);
+	}
+
+	t = rotation_pick(rot, c, now);
+	track = &rot->tracks[t];
+
+	rotation_map_put(&rot->artists, track->artist, now);
+	rotation_map_put(&rot->titles, track->title, now);
+
+	if (rot->state) {
+		fprintf(rot->state, "P %lld %u %s %s\nC %lld %d\n", (long long) now,
+			track->order, rot->categories[c].name, track->path, (long long) rot->hour,
+			rot->slot);
+		fflush(rot->state);
+		rot->appended += 2;
+		if (rot->appended > 2 * rot->ntracks + 1024)
+			rotation_write_state(rot);
+	}
+
+	ices_log_debug("Rotation playing %s from %s, slot %d of clock %s", track->path,
+		       rot->categories[c].name, slot + 1, clock->name);
+
+	return ices_util_strdup(track->path);
+}
+
+/* The slot of the clock being played */
+static int playlist_rotation_get_lineno(void) {
+	return Lineno;
+}
+
+/* Called on SIGHUP, so only note that the clocks should be reread */
+static int playlist_rotation_reload(void) {
+	Reload = 1;
+
+	return 0;
+}
+
+static void playlist_rotation_shutdown(void) {
+	rotation_free(&Rotation);
+	ices_util_free(Statepath);
+	Statepath = NULL;
+}
+
+/* Read the clock file and what it refers to, then the saved rotation */
+static int rotation_load(rotation_t* rot, const char* file) {
+	int i, empty = 1;
+
+	memset(rot, 0, sizeof(rotation_t));
+	memset(rot->week, -1, sizeof(rot->week));
+	rot->hour = -1;
+
+	if (rotation_parse(rot, file) < 0)
+		goto err;
+
+	if (!rot->nclocks) {
+		ices_log_error("%s has no clocks", file);
+		goto err;
+	}
+
+	for (i = 0; i < rot->ncategories; i++) {
+		if (rot->categories[i].count)
+			empty = 0;
+		else
+			ices_log("Rotation category %s has no tracks", rot->categories[i].name);
+	}
+	if (empty) {
+		ices_log_error("None of the categories in %s have any tracks", file);
+		goto err;
+	}
+
+	rotation_read_state(rot);
+	if (rotation_write_state(rot) < 0)
+		ices_log("Could not save the rotation to %s, it will start over next time: %s",
+			 Statepath, ices_log_get_error());
+
+	ices_log_debug("Rotating %d tracks in %d categories by %d clocks", rot->ntracks,
+		       rot->ncategories, rot->nclocks);
+
+	return 0;
+
+ err:
+	rotation_free(rot);
+	return -1;
+}
+
+static int rotation_parse(rotation_t* rot, const char* file) {
+	char line[4096];
+	char* words[3];
+	char* word;
+	char* p;
+	rotation_clock_t* clock;
+	void* grown;
+	FILE* fp;
+	int lineno = 0;
+	int i, n, c;
+	int days[7], hours[24];
+
+	if (!(fp = fopen(file, "r"))) {
+		ices_log_error("Could not open clock file %s: %s", file, strerror(errno));
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		lineno++;
+
+		/* a comment starts with # at the beginning of a word */
+		for (p = line; *p; p++)
+			if (*p == '#' && (p == line || isspace((unsigned char) p[-1])))
+				break;
+		while (p > line && isspace((unsigned char) p[-1]))
+			p--;
+		*p = '\0';
+
+		/* the first two words, and the rest of the line */
+		p = line;
+		for (n = 0; n < 3; n++) {
+			while (isspace((unsigned char) *p))
+				p++;
+			if (!*p)
+				break;
+			words[n] = p;
+			if (n == 2) {
+				n++;
+				break;
+			}
+			while (*p && !isspace((unsigned char) *p))
+				p++;
+			if (*p)
+				*p++ = '\0';
+		}
+		if (!n)
+			continue;
+
+		if (!strcmp(words[0], "category") && n == 3) {
+			if (rotation_find_category(rot, words[1]) >= 0) {
+				ices_log_error("%s:%d: category %s is already defined", file, lineno,
+					       words[1]);
+				goto err;
+			}
+			c = rot->ncategories;
+			if (!(grown = realloc(rot->categories, (c + 1) * sizeof(rotation_category_t)))) {
+				ices_log_error("Out of memory reading %s", file);
+				goto err;
+			}
+			rot->categories = grown;
+			memset(&rot->categories[c], 0, sizeof(rotation_category_t));
+			rot->categories[c].name = ices_util_strdup(words[1]);
+			rot->ncategories++;
+			if (rotation_add_source(rot, c, words[2]) < 0) {
+				ices_log_error("%s:%d: %s", file, lineno, ices_log_get_error());
+				goto err;
+			}
+		} else if (!strcmp(words[0], "separate") && n == 3
+			   && (!strcmp(words[1], "artist") || !strcmp(words[1], "title"))) {
+			if (words[1][0] == 'a')
+				rot->artist_sep = atoi(words[2]) * 60;
+			else
+				rot->title_sep = atoi(words[2]) * 60;
+		} else if (!strcmp(words[0], "clock") && n == 3) {
+			if (!(grown = realloc(rot->clocks, (rot->nclocks + 1) * sizeof(rotation_clock_t)))) {
+				ices_log_error("Out of memory reading %s", file);
+				goto err;
+			}
+			rot->clocks = grown;
+			clock = &rot->clocks[rot->nclocks++];
+			memset(clock, 0, sizeof(rotation_clock_t));
+			clock->name = ices_util_strdup(words[1]);
+
+			for (word = strtok(words[2], " \t"); word; word = strtok(NULL, " \t")) {
+				if (!(grown = realloc(clock->slots,
+						      (clock->count + 1) * sizeof(rotation_slot_t)))) {
+					ices_log_error("Out of memory reading %s", file);
+					goto err;
+				}
+				clock->slots = grown;
+				if (rotation_parse_slot(rot, word, &clock->slots[clock->count]) < 0) {
+					ices_log_error("%s:%d: %s", file, lineno, ices_log_get_error());
+					goto err;
+				}
+				clock->count++;
+			}
+		} else if (!strcmp(words[0], "hours") && n == 3) {
+			for (c = 0; c < rot->nclocks && strcmp(rot->clocks[c].name, words[1]); c++)
+				;
+			if (c == rot->nclocks) {
+				ices_log_error("%s:%d: no clock called %s", file, lineno, words[1]);
+				goto err;
+			}
+			if (!(p = strpbrk(words[2], " \t"))) {
+				ices_log_error("%s:%d: hours needs a clock, days and hours", file, lineno);
+				goto err;
+			}
+			*p++ = '\0';
+			while (isspace((unsigned char) *p))
+				p++;
+			if (rotation_parse_set(words[2], days, 7, Days) < 0
+			    || rotation_parse_set(p, hours, 24, NULL) < 0) {
+				ices_log_error("%s:%d: can't make out the days or hours", file, lineno);
+				goto err;
+			}
+			for (n = 0; n < 7; n++)
+				for (i = 0; i < 24; i++)
+					if (days[n] && hours[i])
+						rot->week[n][i] = c;
+		} else {
+			ices_log_error("%s:%d: can't make sense of this line", file, lineno);
+			goto err;
+		}
+	}
+
+	fclose(fp);
+	return 0;
+
+ err:
+	fclose(fp);
+	return -1;
+}
+
+/* "cat" or "cat:weight,cat:weight,..." */
+static int rotation_parse_slot(rotation_t* rot, char* word, rotation_slot_t* slot) {
+	char* choice;
+	char* weight;
+	char* next;
+
+	memset(slot, 0, sizeof(rotation_slot_t));
+
+	for (choice = word; choice; choice = next) {
+		if ((next = strchr(choice, ',')))
+			*next++ = '\0';
+		if ((weight = strchr(choice, ':')))
+			*weight++ = '\0';
+
+		if (slot->choices == ROTATION_CHOICES) {
+			ices_log_error("a slot can choose between at most %d categories",
+				       ROTATION_CHOICES);
+			return -1;
+		}
+		if ((slot->category[slot->choices] = rotation_find_category(rot, choice)) < 0) {
+			ices_log_error("no category called %s", choice);
+			return -1;
+		}
+		if ((slot->weight[slot->choices] = weight ? atoi(weight) : 1) <= 0) {
+			ices_log_error("the weight of %s must be more than 0", choice);
+			return -1;
+		}
+		slot->choices++;
+	}
+
+	return 0;
+}
+
+/* Mark the members of a list like "mon-fri,sun" or "0-5,22" in set, where
+ * the members are numbered or named by names. "*" is all of them, and
+ * ranges may wrap around. */
+static int rotation_parse_set(const char* spec, int* set, int n, const char** names) {
+	char buf[256];
+	char* item;
+	char* dash;
+	char* next;
+	int i, from, to;
+
+	memset(set, 0, n * sizeof(int));
+	snprintf(buf, sizeof(buf), "%s", spec);
+
+	for (item = buf; item; item = next) {
+		if ((next = strchr(item, ',')))
+			*next++ = '\0';
+
+		if (!strcmp(item, "*")) {
+			for (i = 0; i < n; i++)
+				set[i] = 1;
+			continue;
+		}
+
+		if ((dash = strchr(item, '-')))
+			*dash++ = '\0';
+
+		for (i = 0; i < 2; i++) {
+			const char* s = i ? (dash ? dash : item) : item;
+			int* v = i ? &to : &from;
+
+			if (names) {
+				for (*v = 0; *v < n && strcasecmp(s, names[*v]); (*v)++)
+					;
+			} else {
+				*v = isdigit((unsigned char) *s) ? atoi(s) : n;
+			}
+			if (*v >= n)
+				return -1;
+		}
+
+		for (i = from; ; i = (i + 1) % n) {
+			set[i] = 1;
+			if (i == to)
+				break;
+		}
+	}
+
+	return 0;
+}
+
+static int rotation_find_category(rotation_t* rot, const char* name) {
+	int i;
+
+	for (i = 0; i < rot->ncategories; i++)
+		if (!strcmp(rot->categories[i].name, name))
+			return i;
+
+	return -1;
+}
+
+/* Add the audio files under a directory, or the entries of a playlist */
+static int rotation_add_source(rotation_t* rot, int category, const char* source) {
+	char line[1024];
+	struct stat st;
+	FILE* fp;
+	size_t len;
+
+	if (stat(source, &st) < 0) {
+		ices_log_error("%s: %s", source, strerror(errno));
+		return -1;
+	}
+
+	if (S_ISDIR(st.st_mode)) {
+		Loading = rot;
+		LoadingCategory = category;
+		if (nftw(source, rotation_visit, 16, FTW_PHYS) != 0) {
+			ices_log_error("Could not read all of %s", source);
+			return -1;
+		}
+		return 0;
+	}
+
+	if (!(fp = fopen(source, "r"))) {
+		ices_log_error("%s: %s", source, strerror(errno));
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		len = strcspn(line, "\r\n");
+		line[len] = '\0';
+		if (!len || *line == '#')
+			continue;
+		if (rotation_add_track(rot, category, line) < 0) {
+			fclose(fp);
+			return -1;
+		}
+	}
+
+	fclose(fp);
+	return 0;
+}
+
+static int rotation_visit(const char* path, const struct stat* st, int type,
+			  struct FTW* ftw) {
+	if (type != FTW_F || !S_ISREG(st->st_mode) || !ices_playlist_is_audio(path))
+		return 0;
+
+	return rotation_add_track(Loading, LoadingCategory, path) < 0;
+}
+
+static int rotation_add_track(rotation_t* rot, int category, const char* path) {
+	rotation_category_t* cat = &rot->categories[category];
+	rotation_track_t* track;
+	const char* artist;
+	const char* title;
+	int alen, tlen;
+	void* grown;
+
+	if (rot->ntracks == rot->tracks_size) {
+		rot->tracks_size = rot->tracks_size ? rot->tracks_size * 2 : 256;
+		if (!(grown = realloc(rot->tracks, rot->tracks_size * sizeof(rotation_track_t)))) {
+			ices_log_error("Out of memory");
+			return -1;
+		}
+		rot->tracks = grown;
+	}
+	if (cat->count == cat->size) {
+		cat->size = cat->size ? cat->size * 2 : 64;
+		if (!(grown = realloc(cat->heap, cat->size * sizeof(int)))) {
+			ices_log_error("Out of memory");
+			return -1;
+		}
+		cat->heap = grown;
+	}
+
+	ices_playlist_guess_tags(path, &artist, &alen, &title, &tlen);
+
+	track = &rot->tracks[rot->ntracks];
+	track->path = ices_util_strdup(path);
+	track->played = 0;
+	track->order = Randomize ? rotation_random() : (uint32_t) rot->ntracks;
+	track->category = category;
+	track->artist = rotation_hash(0, artist, alen);
+	track->title = rotation_hash(0, title, tlen);
+
+	if (rotation_map_put(&rot->paths, rotation_key(cat->name, path), rot->ntracks) < 0) {
+		ices_log_error("Out of memory");
+		return -1;
+	}
+
+	/* everything is unplayed so far, so the heap is ordered by order */
+	rot->ntracks++;
+	rotation_push(rot, cat, rot->ntracks - 1);
+
+	return 0;
+}
+
+/* Carry over when tracks were played, and where the clock was */
+static void rotation_read_state(rotation_t* rot) {
+	char line[4096];
+	rotation_track_t* track;
+	rotation_category_t* cat;
+	long long when;
+	unsigned long order;
+	int64_t* index;
+	char* category;
+	char* path;
+	FILE* fp;
+	int i, slot;
+
+	if (!(fp = fopen(Statepath, "r")))
+		return;
+
+	while (fgets(line, sizeof(line), fp)) {
+		line[strcspn(line, "\r\n")] = '\0';
+
+		if (sscanf(line, "C %lld %d", &when, &slot) == 2) {
+			rot->hour = when;
+			rot->slot = slot;
+			continue;
+		}
+		if (line[0] != 'P' || line[1] != ' ')
+			continue;
+		when = strtoll(line + 2, &category, 10);
+		order = strtoul(category, &category, 10);
+		if (*category++ != ' ' || !(path = strchr(category, ' ')))
+			continue;
+		*path++ = '\0';
+
+		if ((index = rotation_map_get(&rot->paths, rotation_key(category, path)))
+		    && rot->tracks[*index].played <= when) {
+			rot->tracks[*index].played = when;
+			rot->tracks[*index].order = order;
+		}
+		if (order >= rot->picks)
+			rot->picks = order + 1;
+	}
+
+	fclose(fp);
+
+	/* order the heaps by the times read */
+	for (i = 0; i < rot->ncategories; i++)
+		rot->categories[i].count = 0;
+	for (i = 0; i < rot->ntracks; i++) {
+		track = &rot->tracks[i];
+		cat = &rot->categories[track->category];
+		rotation_push(rot, cat, i);
+
+		if (!track->played)
+			continue;
+		if (!(index = rotation_map_get(&rot->artists, track->artist)) || *index < track->played)
+			rotation_map_put(&rot->artists, track->artist, track->played);
+		if (!(index = rotation_map_get(&rot->titles, track->title)) || *index < track->played)
+			rotation_map_put(&rot->titles, track->title, track->played);
+	}
+}
+
+/* Write out the rotation afresh, and keep it open to add to */
+static int rotation_write_state(rotation_t* rot) {
+	char tmp[1024];
+	FILE* fp;
+	int i;
+
+	if (rot->state) {
+		fclose(rot->state);
+		rot->state = NULL;
+	}
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", Statepath);
+	if (!(fp = fopen(tmp, "w"))) {
+		ices_log_error("Could not write %s: %s", tmp, strerror(errno));
+		return -1;
+	}
+
+	for (i = 0; i < rot->ntracks; i++)
+		if (rot->tracks[i].played)
+			fprintf(fp, "P %lld %u %s %s\n", (long long) rot->tracks[i].played,
+				rot->tracks[i].order,
+				rot->categories[rot->tracks[i].category].name, rot->tracks[i].path);
+	fprintf(fp, "C %lld %d\n", (long long) rot->hour, rot->slot);
+
+	if (fflush(fp) || rename(tmp, Statepath) < 0) {
+		ices_log_error("Could not write %s: %s", Statepath, strerror(errno));
+		fclose(fp);
+		remove(tmp);
+		return -1;
+	}
+
+	rot->state = fp;
+	rot->appended = 0;
+
+	return 0;
+}
+
+static void rotation_free(rotation_t* rot) {
+	int i;
+
+	if (rot->state)
+		fclose(rot->state);
+
+	for (i = 0; i < rot->ntracks; i++)
+		ices_util_free(rot->tracks[i].path);
+	ices_util_free(rot->tracks);
+
+	for (i = 0; i < rot->ncategories; i++) {
+		ices_util_free(rot->categories[i].name);
+		ices_util_free(rot->categories[i].heap);
+	}
+	ices_util_free(rot->categories);
+
+	for (i = 0; i < rot->nclocks; i++) {
+		ices_util_free(rot->clocks[i].name);
+		ices_util_free(rot->clocks[i].slots);
+	}
+	ices_util_free(rot->clocks);
+
+	rotation_map_free(&rot->paths);
+	rotation_map_free(&rot->artists);
+	rotation_map_free(&rot->titles);
+
+	memset(rot, 0, sizeof(rotation_t));
+}
+
+/* One of the slot's categories that has tracks, by weight */
+static int rotation_choose(rotation_t* rot, const rotation_slot_t* slot) {
+	int total = 0;
+	int i, r;
+
+	for (i = 0; i < slot->choices; i++)
+		if (rot->categories[slot->category[i]].count)
+			total += slot->weight[i];
+	if (!total)
+		return -1;
+
+	r = rotation_random() % total;
+	for (i = 0; i < slot->choices; i++) {
+		if (!rot->categories[slot->category[i]].count)
+			continue;
+		if (r < slot->weight[i])
+			break;
+		r -= slot->weight[i];
+	}
+
+	return slot->category[i];
+}
+
+/* Take the least recently played track of the category that keeps its
+ * separation. If none of the first few do, take the one that breaks it
+ * least. It goes back in as played now. */
+static int rotation_pick(rotation_t* rot, int category, time_t now) {
+	rotation_category_t* cat = &rot->categories[category];
+	int held[ROTATION_TRIES];
+	time_t conflict, least = 0;
+	int n, i, pick = -1;
+
+	for (n = 0; n < ROTATION_TRIES && cat->count; n++) {
+		held[n] = rotation_pop(rot, cat);
+		conflict = rotation_conflict(rot, &rot->tracks[held[n]], now);
+		if (pick < 0 || conflict < least) {
+			pick = held[n];
+			least = conflict;
+		}
+		if (!conflict) {
+			n++;
+			break;
+		}
+	}
+
+	for (i = 0; i < n; i++)
+		if (held[i] != pick)
+			rotation_push(rot, cat, held[i]);
+
+	rot->tracks[pick].played = now;
+	rot->tracks[pick].order = rot->picks++;
+	rotation_push(rot, cat, pick);
+
+	return pick;
+}
+
+/* When the artist or title was last played, if that was too recently */
+static time_t rotation_conflict(rotation_t* rot, const rotation_track_t* track, time_t now) {
+	int64_t* when;
+	time_t conflict = 0;
+
+	if (rot->artist_sep && (when = rotation_map_get(&rot->artists, track->artist))
+	    && now - *when < rot->artist_sep)
+		conflict = *when;
+	if (rot->title_sep && (when = rotation_map_get(&rot->titles, track->title))
+	    && now - *when < rot->title_sep && *when > conflict)
+		conflict = *when;
+
+	return conflict;
+}
+
+static int rotation_before(const rotation_t* rot, int a, int b) {
+	const rotation_track_t* ta = &rot->tracks[a];
+	const rotation_track_t* tb = &rot->tracks[b];
+
+	if (ta->played != tb->played)
+		return ta->played < tb->played;
+
+	return ta->order < tb->order;
+}
+
+/* There is always room, as a category's heap never holds more than it
+ * was grown to when its tracks were added */
+static void rotation_push(rotation_t* rot, rotation_category_t* cat, int track) {
+	int i = cat->count++;
+
+	while (i && rotation_before(rot, track, cat->heap[(i - 1) / 2])) {
+		cat->heap[i] = cat->heap[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	cat->heap[i] = track;
+}
+
+static int rotation_pop(rotation_t* rot, rotation_category_t* cat) {
+	int top = cat->heap[0];
+	int last = cat->heap[--cat->count];
+	int i = 0, child;
+
+	while ((child = 2 * i + 1) < cat->count) {
+		if (child + 1 < cat->count && rotation_before(rot, cat->heap[child + 1], cat->heap[child]))
+			child++;
+		if (!rotation_before(rot, cat->heap[child], last))
+			break;
+		cat->heap[i] = cat->heap[child];
+		i = child;
+	}
+	if (cat->count)
+		cat->heap[i] = last;
+
+	return top;
+}
+
+static int64_t* rotation_map_get(rotation_map_t* map, uint64_t key) {
+	size_t i;
+
+	if (!map->size)
+		return NULL;
+	if (!key)
+		key = 1;
+
+	for (i = key & (map->size - 1); map->keys[i]; i = (i + 1) & (map->size - 1))
+		if (map->keys[i] == key)
+			return &map->values[i];
+
+	return NULL;
+}
+
+static int rotation_map_put(rotation_map_t* map, uint64_t key, int64_t value) {
+	rotation_map_t grown;
+	size_t i;
+
+	if (!key)
+		key = 1;
+
+	if (2 * (map->used + 1) > map->size) {
+		grown.size = map->size ? map->size * 2 : 64;
+		grown.used = 0;
+		grown.keys = calloc(grown.size, sizeof(uint64_t));
+		grown.values = malloc(grown.size * sizeof(int64_t));
+		if (!grown.keys || !grown.values) {
+			rotation_map_free(&grown);
+			return -1;
+		}
+		for (i = 0; i < map->size; i++)
+			if (map->keys[i])
+				rotation_map_put(&grown, map->keys[i], map->values[i]);
+		rotation_map_free(map);
+		*map = grown;
+	}
+
+	for (i = key & (map->size - 1); map->keys[i] && map->keys[i] != key;
+	     i = (i + 1) & (map->size - 1))
+		;
+	if (!map->keys[i]) {
+		map->keys[i] = key;
+		map->used++;
+	}
+	map->values[i] = value;
+
+	return 0;
+}
+
+static void rotation_map_free(rotation_map_t* map) {
+	ices_util_free(map->keys);
+	ices_util_free(map->values);
+	memset(map, 0, sizeof(rotation_map_t));
+}
+
+/* FNV-1a, carrying on from h (0 to start) */
+static uint64_t rotation_hash(uint64_t h, const char* s, size_t len) {
+	if (!h)
+		h = 0xcbf29ce484222325ULL;
+	while (len--)
+		h = (h ^ (unsigned char) *s++) * 0x100000001b3ULL;
+
+	return h;
+}
+
+/* the same file may be in more than one category */
+static uint64_t rotation_key(const char* category, const char* path) {
+	return rotation_hash(rotation_hash(0, category, strlen(category) + 1), path,
+			     strlen(path));
+}
+
+/* splitmix64 */
+static uint32_t rotation_random(void) {
+	uint64_t z = (Random += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+	return (uint32_t) ((z ^ (z >> 31)) >> 32);
+}
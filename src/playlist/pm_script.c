@@ -25,12 +25,30 @@
 #include "definitions.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <poll.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/wait.h>
 
 #define STR_BUFFER 1024
 
+/* The running script. In persistent mode it is started once and asked
+ * for each track by writing "next" to its stdin; otherwise it is run
+ * once per track with stdin at EOF. Either way it answers with the file
+ * name, metadata and time limit on separate lines. */
+typedef struct {
+	pid_t pid;
+	int in;
+	int out;
+	char buf[STR_BUFFER];
+	size_t len;
+	int timedout;       /* didn't answer in time, so may still be running */
+} script_t;
+
 static char *playlist_metadata = NULL;
 static int playlist_track_timelimit = 0;
 static char *cmd = NULL;
+static script_t script = { 0, -1, -1 };
 
 extern ices_config_t ices_config;
 
@@ -39,7 +57,11 @@ static char* playlist_script_get_next(void);
 static void playlist_script_shutdown(void);
 static char* playlist_script_get_metadata(void);
 static int playlist_script_get_timelimit(void);
-static FILE *ices_pm_script_popen(char *cmd, char *mode);
+static int playlist_script_request(char** lines);
+static int playlist_script_read_line(char* line, time_t deadline);
+static int ices_pm_script_start(char *cmd, int persistent);
+static void ices_pm_script_stop(void);
+static int ices_pm_script_reap(int tenths);
 static char **brk_string(register char *str, int *store_argc);
 
 /* Global function definitions */
@@ -82,65 +104,26 @@ int ices_playlist_script_initialize(playlist_module_t* pm) {
 	pm->get_lineno = NULL;
 	pm->shutdown = playlist_script_shutdown;
 
-	return 1;
-}
-
-static void strclean(char *str) {
-	if (str == NULL) return;
-	/* Remove linefeeds etc. */
-	int i = 0;
-	while (str[i]) {
-		if (str[i] == '\r' || str[i] == '\n') {
-			str[i] = '\0';
-			break;
-		}
-		i++;
-	}
+	/* start a persistent script now, so it can load while we connect */
+	if (pm->persistent && ices_pm_script_start(cmd, 1) < 0)
+		ices_log("Could not start playlist script \"%s\", will retry: %s", cmd,
+			 ices_log_get_error());
 
+	return 1;
 }
 
 static char *playlist_script_get_next(void) {
-	char *filename = NULL, *metadata = NULL, *timelimit = NULL, *temp = NULL;
-	FILE *pipe;
-	
-	filename = malloc(STR_BUFFER);
-	metadata = malloc(STR_BUFFER);
-	timelimit = malloc(STR_BUFFER);
-
-	pipe = ices_pm_script_popen(cmd, "r");
-
-	if (!pipe) {
-		ices_log_error_output("Couldn't open pipe to program \"%s\"", cmd);
-		return NULL;
-	}
+	char *lines[3];
+	char *filename, *metadata, *timelimit;
 
-	if (fgets(filename, STR_BUFFER, pipe) == NULL) {
-		temp = malloc(STR_BUFFER);
-		ices_log_error_output("Couldn't read filename from pipe to program \"%s\": %s", cmd, ices_util_strerror(errno, temp, STR_BUFFER));
-		free(temp);
-		free(filename); filename = NULL;
-		free(metadata); metadata = NULL;
-		free(timelimit); timelimit = NULL;
-		fclose(pipe);
+	if (playlist_script_request(lines) < 0)
 		return NULL;
-	}
-
-	if (fgets(metadata, STR_BUFFER, pipe) == NULL) {
-		/* This is non-fatal. */
-		temp = malloc(STR_BUFFER);
-		ices_log_debug("No metadata received from pipe to program \"%s\": %s", cmd, ices_util_strerror(errno, temp, STR_BUFFER));
-		free(temp);
-		free(metadata); metadata = NULL;
-	}
-
-	if (fgets(timelimit, STR_BUFFER, pipe) == NULL) {
-		/* This is non-fatal, and in fact can be totally ignored. */
-		free(timelimit); timelimit = NULL;
-	}
 
-	fclose(pipe);
+	filename = lines[0];
+	metadata = lines[1];
+	timelimit = lines[2];
 
-	if (filename[0] == '\n' || (filename[0] == '\r' && filename[1] == '\n')) {
+	if (!filename[0]) {
 		ices_log_error_output("Got newlines instead of filename from program \"%s\"", cmd);
 		free(filename); filename = NULL;
 		if (metadata) free(metadata); metadata = NULL;
@@ -148,10 +131,6 @@ static char *playlist_script_get_next(void) {
 		return NULL;
 	}
 	
-	strclean(filename);
-	strclean(metadata);
-	strclean(timelimit);
-	
 	/* require absolute paths, or relative paths starting with ./, to ensure that
 	 * we don't end up interpreting garbage output (error messages, etc.) as filenames */
 	if (filename[0] != '/' && !(filename[0] == '.' && filename[1] == '/')) {
@@ -173,10 +152,12 @@ static char *playlist_script_get_next(void) {
 	
 	if (playlist_metadata) free(playlist_metadata);
 	
-	if (metadata)
-		playlist_metadata = metadata;
-	else
-		playlist_metadata = NULL;
+	/* an empty line means no metadata */
+	if (metadata && !metadata[0]) {
+		free(metadata);
+		metadata = NULL;
+	}
+	playlist_metadata = metadata;
 
 	playlist_track_timelimit = 0;
 	if (timelimit) {
@@ -189,10 +170,10 @@ static char *playlist_script_get_next(void) {
 	return filename;
 }
 
-/* Return the file metadata. */
+/* Return the file metadata. The caller frees it. */
 static char*playlist_script_get_metadata(void) {
 	if (playlist_metadata)
-		return playlist_metadata;
+		return ices_util_strdup(playlist_metadata);
 	return NULL;
 }
 
@@ -202,90 +183,245 @@ static int playlist_script_get_timelimit(void) {
 
 /* Shutdown the script playlist handler */
 static void playlist_script_shutdown(void) {
+	ices_pm_script_stop();
 	if (cmd)
 		free(cmd);
 	if (playlist_metadata)
 		free(playlist_metadata);
 }
 
-static FILE *ices_pm_script_popen(char *cmd, char *mode) {
+/* Private function definitions */
+
+/* Get the three lines for the next track into lines. Only the file name
+ * is required from a script run per track. A persistent script that
+ * doesn't answer in time, or has died, is restarted and asked again
+ * once. */
+static int playlist_script_request(char** lines) {
+	playlist_module_t* pm = &ices_config.pm;
+	time_t deadline;
+	int attempt, i, n;
+
+	for (attempt = 0; attempt < 2; attempt++) {
+		lines[0] = lines[1] = lines[2] = NULL;
+
+		if (script.pid <= 0 && ices_pm_script_start(cmd, pm->persistent) < 0) {
+			ices_log_error_output("Couldn't open pipe to program \"%s\"", cmd);
+			return -1;
+		}
+
+		if (pm->persistent && write(script.in, "next\n", 5) != 5) {
+			ices_log("Playlist script \"%s\" has gone away, restarting it", cmd);
+			ices_pm_script_stop();
+			continue;
+		}
+
+		deadline = time(NULL) + pm->timeout;
+		for (n = 0; n < 3; n++) {
+			if (!(lines[n] = malloc(STR_BUFFER)))
+				break;
+			if (playlist_script_read_line(lines[n], deadline) < 0) {
+				free(lines[n]);
+				lines[n] = NULL;
+				break;
+			}
+		}
+
+		if (!pm->persistent)
+			ices_pm_script_stop();
+
+		if (n == 3 || (n > 0 && !pm->persistent))
+			return 0;
+
+		for (i = 0; i < n; i++)
+			free(lines[i]);
+
+		if (!pm->persistent) {
+			ices_log_error_output("Couldn't read filename from pipe to program \"%s\": %s", cmd, ices_log_get_error());
+			return -1;
+		}
+
+		ices_log("Playlist script \"%s\" did not answer: %s, restarting it", cmd,
+			 ices_log_get_error());
+		ices_pm_script_stop();
+	}
+
+	ices_log_error("Playlist script \"%s\" failed twice", cmd);
+	return -1;
+}
+
+/* Read a line from the script, without its line end, waiting no later
+ * than deadline. Overlong lines are cut short. */
+static int playlist_script_read_line(char* line, time_t deadline) {
+	struct pollfd pfd;
+	char* eol;
+	ssize_t len;
+	int timeout;
+	int rc;
+
+	pfd.fd = script.out;
+	pfd.events = POLLIN;
+
+	while (!(eol = memchr(script.buf, '\n', script.len))) {
+		if (script.len == sizeof(script.buf)) {
+			eol = script.buf + script.len - 1;
+			break;
+		}
+
+		if ((timeout = (deadline - time(NULL)) * 1000) < 0)
+			timeout = 0;
+		if ((rc = poll(&pfd, 1, timeout)) == 0) {
+			ices_log_error("timed out");
+			script.timedout = 1;
+			return -1;
+		}
+		if (rc < 0) {
+			/* a signal: wait out what's left */
+			if (errno == EINTR)
+				continue;
+			ices_log_error("%s", ices_util_strerror(errno, line, STR_BUFFER));
+			return -1;
+		}
+
+		if ((len = read(script.out, script.buf + script.len,
+				sizeof(script.buf) - script.len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			ices_log_error("%s", ices_util_strerror(errno, line, STR_BUFFER));
+			return -1;
+		}
+		if (len == 0) {
+			/* a last line without a line end still counts */
+			if (!script.len) {
+				ices_log_error("end of output");
+				return -1;
+			}
+			eol = script.buf + script.len;
+			break;
+		}
+		script.len += len;
+	}
+
+	len = eol - script.buf;
+	memcpy(line, script.buf, len);
+	line[len] = '\0';
+	if (len && line[len - 1] == '\r')
+		line[len - 1] = '\0';
+
+	if (eol < script.buf + script.len)
+		eol++;
+	script.len -= eol - script.buf;
+	memmove(script.buf, eol, script.len);
+
+	return 0;
+}
+
+/* Run the script with its stdout (and stderr, if it isn't persistent)
+ * on a pipe to us. A persistent script also gets its stdin from us. */
+static int ices_pm_script_start(char *cmd, int persistent) {
+	char namespace[1024];
+	int readpipe[2], writepipe[2] = { -1, -1 };
 	pid_t pid;
+	int fd;
 
-	#define	PARENT_READ		readpipe[0]
-	#define	CHILD_WRITE		readpipe[1]
-	#define CHILD_READ		writepipe[0]
-	#define PARENT_WRITE	writepipe[1]	
-	
-	int readpipe[2], writepipe[2];
-	
-//	ices_log_debug("executing: %s",cmd);
-	
-	/* setup our pipes */
 	if (pipe(readpipe)) {
-		ices_log_debug("pipe(readpipe) failed");
-		return NULL;
+		ices_log_error("pipe failed: %s", ices_util_strerror(errno, namespace, sizeof(namespace)));
+		return -1;
 	}
-	if (pipe(writepipe)) {
-		ices_log_debug("pipe(writepipe) failed");
-		return NULL;
+	if (persistent && pipe(writepipe)) {
+		ices_log_error("pipe failed: %s", ices_util_strerror(errno, namespace, sizeof(namespace)));
+		close(readpipe[0]);
+		close(readpipe[1]);
+		return -1;
 	}
-	
-	/* fork */
-	if ( (pid = fork()) == -1) {
-		ices_log_debug("unable to fork");
-		return NULL;
-		
+
+	if ((pid = fork()) == -1) {
+		ices_log_error("unable to fork: %s", ices_util_strerror(errno, namespace, sizeof(namespace)));
+		close(readpipe[0]);
+		close(readpipe[1]);
+		if (persistent) {
+			close(writepipe[0]);
+			close(writepipe[1]);
+		}
+		return -1;
 	} else if (pid == 0) {
 		char **execargv;
 		int execargc;
-		
-		execargv = brk_string(cmd,&execargc);
-		//ices_log_debug("Our argv[0] is: %s",execargv[0]);
 
-		/* child process */
-		/* close(ccpipe[1]); */
-		
-		/* close parent ends of the pipes */
-		close(PARENT_WRITE);
-		close(PARENT_READ);
-		
-		/* duplicate and close our descriptors */
-		dup2(CHILD_READ,0);
-		dup2(CHILD_WRITE,1);
-		dup2(CHILD_WRITE,2);
-		
-		close(CHILD_READ);
-		close(CHILD_WRITE);
-		
-		/* create a new session */
-		//setsid();
+		execargv = brk_string(cmd, &execargc);
 
-		execv(execargv[0],execargv);
-		
-		ices_log_debug("execv failed");
-		return NULL;
+		/* a script run per track sees EOF on stdin, as it always has */
+		if (persistent) {
+			dup2(writepipe[0], 0);
+			close(writepipe[0]);
+			close(writepipe[1]);
+		} else if ((fd = open("/dev/null", O_RDONLY)) >= 0) {
+			dup2(fd, 0);
+			close(fd);
+		}
+
+		dup2(readpipe[1], 1);
+		if (!persistent)
+			dup2(readpipe[1], 2);
+		close(readpipe[0]);
+		close(readpipe[1]);
+
+		execv(execargv[0], execargv);
+
+		/* don't return into a second copy of ices */
+		_exit(127);
 	}
-	
-	/* close the child's ends of te pipes */
-	close(CHILD_READ);
-	close(CHILD_WRITE);
-	
-	int rpipe;
-	
-	if (*mode=='r') {
-		close(PARENT_WRITE);
-		rpipe = PARENT_READ;
-	} else if (*mode=='w') {
-		close(PARENT_READ);
-		rpipe = PARENT_WRITE;
-	} else {
-		close(PARENT_WRITE);
-		close(PARENT_READ);
-		
-		return NULL;
+
+	close(readpipe[1]);
+	if (persistent) {
+		close(writepipe[0]);
+		script.in = writepipe[1];
+		ices_log_debug("Started playlist script \"%s\" as pid %d", cmd, (int) pid);
 	}
-	
-	return fdopen(rpipe,mode);
+	script.out = readpipe[0];
+	script.pid = pid;
+	script.len = 0;
+	script.timedout = 0;
+
+	return 0;
+}
+
+/* Close our ends of the pipes and make sure the script is gone */
+static void ices_pm_script_stop(void) {
+	if (script.in >= 0)
+		close(script.in);
+	if (script.out >= 0)
+		close(script.out);
+	script.in = script.out = -1;
+	script.len = 0;
+
+	/* it's only reaped here, so the pid is still the script's to kill.
+	 * A script run per track exits by itself once it has answered, unless
+	 * it has hung; anything else gets a second to go before being killed. */
+	if (script.pid > 0
+	    && (ices_config.pm.persistent || script.timedout || !ices_pm_script_reap(10))) {
+		kill(script.pid, SIGTERM);
+		if (!ices_pm_script_reap(10)) {
+			kill(script.pid, SIGKILL);
+			while (waitpid(script.pid, NULL, 0) < 0 && errno == EINTR)
+				;
+		}
+	}
+	script.pid = 0;
+	script.timedout = 0;
+}
+
+/* Wait up to tenths of a second for the script to exit. Returns 1 once
+ * it is gone, 0 if it is still running. */
+static int ices_pm_script_reap(int tenths) {
+	int i;
+
+	for (i = 0; waitpid(script.pid, NULL, WNOHANG) == 0; i++) {
+		if (i == tenths)
+			return 0;
+		usleep(100000);
+	}
+
+	return 1;
 }
 
 /*-
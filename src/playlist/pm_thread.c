@@ -0,0 +1,303 @@
+/* pm_thread.c
+ * - Run an embedded interpreter playlist module on a thread of its own
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+/* The python and perl modules are started, called and shut down only
+ * from one thread, which keeps a couple of answers ready: the path
+ * along with the line number, metadata and time limit for it. Asking
+ * for the next track takes the oldest one, waiting at most
+ * Playlist/Timeout seconds. If the hooks take longer than that, or fail,
+ * the builtin handler plays from Playlist/File if there is one, and
+ * the late answer is used next time. */
+
+#include "definitions.h"
+
+#include <pthread.h>
+#include <time.h>
+
+/* answers kept ready */
+#define THREAD_PREFETCH 2
+
+typedef struct {
+	char* path;
+	char* metadata;
+	int lineno;
+	int timelimit;
+	int duration;
+} thread_entry_t;
+
+extern ices_config_t ices_config;
+
+/* the module, as seen from its own thread */
+static playlist_module_t Inner;
+static int (*InnerInit)(playlist_module_t* pm);
+static int InitResult;
+
+static playlist_module_t Fallback;
+static int HaveFallback = 0;
+
+static thread_entry_t Queue[THREAD_PREFETCH];
+static int QueueHead = 0;
+static int QueueLen = 0;
+/* what the last answer handed out said */
+static thread_entry_t Current;
+
+static pthread_t Thread;
+static pthread_mutex_t Lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t Wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t Ready = PTHREAD_COND_INITIALIZER;
+static int Started = 0;
+static int Done = 0;
+static volatile int Stop = 0;
+static volatile int Reload = 0;
+
+/* Private function declarations */
+static char* playlist_thread_get_next(void);
+static char* playlist_thread_get_metadata(void);
+static int playlist_thread_get_lineno(void);
+static int playlist_thread_get_timelimit(void);
+static int playlist_thread_get_duration(void);
+static int playlist_thread_reload(void);
+static void playlist_thread_shutdown(void);
+
+static void* playlist_thread_main(void* arg);
+static void playlist_thread_clear(thread_entry_t* entry);
+static void playlist_thread_deadline(struct timespec* ts, int secs);
+
+/* Global function definitions */
+
+/* Start the module on its thread, and wait for its init hook */
+int ices_playlist_thread_initialize(playlist_module_t* pm,
+				    int (*init)(playlist_module_t* pm)) {
+	int rc;
+
+	Inner = *pm;
+	InnerInit = init;
+
+	if ((rc = ices_util_thread_create(&Thread, playlist_thread_main, NULL))) {
+		ices_log_error("Could not start playlist thread: %s", strerror(rc));
+		return -1;
+	}
+
+	pthread_mutex_lock(&Lock);
+	while (!Started)
+		pthread_cond_wait(&Ready, &Lock);
+	rc = InitResult;
+	pthread_mutex_unlock(&Lock);
+
+	pm->get_next = playlist_thread_get_next;
+	pm->get_metadata = playlist_thread_get_metadata;
+	pm->get_lineno = playlist_thread_get_lineno;
+	pm->get_timelimit = playlist_thread_get_timelimit;
+	pm->get_duration = playlist_thread_get_duration;
+	pm->reload = playlist_thread_reload;
+	pm->shutdown = playlist_thread_shutdown;
+
+	if (rc < 0)
+		return rc;
+
+	if (pm->playlist_file && access(pm->playlist_file, R_OK) == 0) {
+		Fallback = *pm;
+		if (ices_playlist_builtin_initialize(&Fallback) > 0) {
+			HaveFallback = 1;
+			ices_log_debug("Playing from %s if the playlist module is late",
+				       pm->playlist_file);
+		}
+	}
+
+	return rc;
+}
+
+/* Private function definitions */
+
+/* Take the oldest answer, falling back to the builtin handler if there
+ * is none in time */
+static char* playlist_thread_get_next(void) {
+	struct timespec deadline;
+	char* path;
+	int waited = 0;
+	int answered = 0;
+
+	playlist_thread_clear(&Current);
+	playlist_thread_deadline(&deadline, ices_config.pm.timeout);
+
+	pthread_mutex_lock(&Lock);
+	while (!QueueLen && !Done) {
+		if (pthread_cond_timedwait(&Ready, &Lock, &deadline) != ETIMEDOUT)
+			continue;
+		if (HaveFallback)
+			break;
+		if (!waited++)
+			ices_log("Playlist module has not answered in %d seconds, still waiting",
+				 ices_config.pm.timeout);
+		playlist_thread_deadline(&deadline, ices_config.pm.timeout);
+	}
+
+	if (QueueLen) {
+		Current = Queue[QueueHead];
+		QueueHead = (QueueHead + 1) % THREAD_PREFETCH;
+		QueueLen--;
+		answered = 1;
+		pthread_cond_signal(&Wake);
+	}
+	pthread_mutex_unlock(&Lock);
+
+	/* the caller owns the path, the rest is ours */
+	path = Current.path;
+	Current.path = NULL;
+	if (path || !HaveFallback)
+		return path;
+
+	ices_log("Playlist module %s, playing from %s",
+		 answered || Done ? "failed" : "is late", ices_config.pm.playlist_file);
+	if ((path = Fallback.get_next())) {
+		Current.lineno = Fallback.get_lineno();
+		Current.metadata = Fallback.get_metadata();
+		Current.duration = Fallback.get_duration();
+	}
+
+	return path;
+}
+
+static char* playlist_thread_get_metadata(void) {
+	return Current.metadata ? ices_util_strdup(Current.metadata) : NULL;
+}
+
+static int playlist_thread_get_lineno(void) {
+	return Current.lineno;
+}
+
+static int playlist_thread_get_timelimit(void) {
+	return Current.timelimit;
+}
+
+static int playlist_thread_get_duration(void) {
+	return Current.duration;
+}
+
+/* Called on SIGHUP, so only flag it for the thread */
+static int playlist_thread_reload(void) {
+	Reload = 1;
+	if (HaveFallback)
+		Fallback.reload();
+
+	return 0;
+}
+
+/* Let the module shut down on its thread, but don't wait forever */
+static void playlist_thread_shutdown(void) {
+	struct timespec deadline;
+
+	playlist_thread_deadline(&deadline, ices_config.pm.timeout);
+
+	pthread_mutex_lock(&Lock);
+	Stop = 1;
+	pthread_cond_broadcast(&Wake);
+	while (!Done)
+		if (pthread_cond_timedwait(&Ready, &Lock, &deadline) == ETIMEDOUT)
+			break;
+	pthread_mutex_unlock(&Lock);
+
+	if (Done)
+		pthread_join(Thread, NULL);
+	else
+		ices_log("Playlist module did not shut down in time");
+
+	if (HaveFallback)
+		Fallback.shutdown();
+	playlist_thread_clear(&Current);
+}
+
+/* The module's thread: initialize it, then keep answers ready */
+static void* playlist_thread_main(void* arg) {
+	struct timespec wake;
+	thread_entry_t entry;
+	int rc;
+
+	rc = InnerInit(&Inner);
+
+	pthread_mutex_lock(&Lock);
+	InitResult = rc;
+	Started = 1;
+	pthread_cond_broadcast(&Ready);
+	pthread_mutex_unlock(&Lock);
+
+	while (rc >= 0) {
+		pthread_mutex_lock(&Lock);
+		/* SIGHUP can't signal the condition, so look now and then */
+		while (!Stop && !Reload && QueueLen >= THREAD_PREFETCH) {
+			playlist_thread_deadline(&wake, 1);
+			pthread_cond_timedwait(&Wake, &Lock, &wake);
+		}
+		if (Reload)
+			while (QueueLen) {
+				playlist_thread_clear(&Queue[QueueHead]);
+				QueueHead = (QueueHead + 1) % THREAD_PREFETCH;
+				QueueLen--;
+			}
+		pthread_mutex_unlock(&Lock);
+
+		if (Stop)
+			break;
+		if (Reload) {
+			Reload = 0;
+			if (Inner.reload && Inner.reload() < 0)
+				ices_log("Playlist module reload failed: %s", ices_log_get_error());
+			continue;
+		}
+
+		entry.path = Inner.get_next();
+		entry.lineno = Inner.get_lineno ? Inner.get_lineno() : 0;
+		entry.metadata = Inner.get_metadata ? Inner.get_metadata() : NULL;
+		entry.timelimit = Inner.get_timelimit ? Inner.get_timelimit() : 0;
+		entry.duration = Inner.get_duration ? Inner.get_duration() : 0;
+
+		pthread_mutex_lock(&Lock);
+		Queue[(QueueHead + QueueLen) % THREAD_PREFETCH] = entry;
+		QueueLen++;
+		pthread_cond_signal(&Ready);
+		pthread_mutex_unlock(&Lock);
+	}
+
+	/* a module that didn't initialize has nothing to shut down */
+	if (rc >= 0 && Inner.shutdown)
+		Inner.shutdown();
+
+	pthread_mutex_lock(&Lock);
+	while (QueueLen) {
+		playlist_thread_clear(&Queue[QueueHead]);
+		QueueHead = (QueueHead + 1) % THREAD_PREFETCH;
+		QueueLen--;
+	}
+	Done = 1;
+	pthread_cond_broadcast(&Ready);
+	pthread_mutex_unlock(&Lock);
+
+	return NULL;
+}
+
+static void playlist_thread_clear(thread_entry_t* entry) {
+	ices_util_free(entry->path);
+	ices_util_free(entry->metadata);
+	memset(entry, 0, sizeof(thread_entry_t));
+}
+
+static void playlist_thread_deadline(struct timespec* ts, int secs) {
+	clock_gettime(CLOCK_REALTIME, ts);
+	ts->tv_sec += secs > 0 ? secs : 1;
+}
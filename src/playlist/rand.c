@@ -1,131 +1,164 @@
-/* Rand.c, modified slighly for use in ices, 980120 <eel@musiknet.se> */
-/*****************************************************************************
- *    rand.c : write a randomization of files or stdin or parms to stdout
- *    Usage:
- *        blah | rand
- *        rand -f <file>
- *        rand <parms to be randomized>
+/* rand.c
+ * - Shuffle the builtin playlist in place, without repeating artists
+ *   or tracks too soon
  *
- *     Copyright (C) 1998 Erik Greenwald <br0ke@math.smsu.edu>
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
  *
- *     This program is free software; you can redistribute it and/or modify
- *     it under the terms of the GNU General Public License as published by
- *     the Free Software Foundation; either version 2 of the License, or
- *     (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
  *
- *     This program is distributed in the hope that it will be useful,
- *     but WITHOUT ANY WARRANTY; without even the implied warranty of
- *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- *     GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
  *
- *     You should have received a copy of the GNU General Public License
- *     along with this program; if not, write to the Free Software
- *     Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
- ******************************************************************************/
-
-/* NOTE: the method I'm using to get a random number LOOKS ineffecient. But
- * that's on purpose. random number generators tend to make the most
- * significant bits the most random, and teh least significant the least
- * random, to generate the optimal spread across the entire range. When a
- * modulus is used to extract the number inside of the range, it takes the
- * LEAST significant bits, which are the least random. When a plain old slow
- * division is done, it takes the MOST significant bits. This isn't a serious
- * speed loss because % calls a div opcode anyways.
  */
 
+/* The shuffle is a Fisher-Yates shuffle done one step per track: the
+ * entry for position pos is drawn from entries[pos..count) and swapped
+ * into place, so wrapping around to position 0 starts a new shuffle
+ * without any extra work. A draw whose artist or track was among the
+ * last few played is put back and drawn again, a bounded number of
+ * times, so small or one-artist playlists still play.
+ *
+ * The artist is taken from "Artist - Title" style file names, or else
+ * from the name of the directory the file is in. */
+
 #include "definitions.h"
+#include "pm_builtin.h"
+#include "rand.h"
+
+#include <time.h>
+
+/* draws per track before accepting a repeat */
+#define RAND_TRIES 16
 
-/* Private data structures */
-#define LINE 0
-static unsigned char method;
+static uint64_t state = 0;
 
-/*** struct for the linked lists ***/
-struct ll {
-	char *data;
-	struct ll *next;
-};
+/* hashes of the artists and tracks played most recently */
+static uint64_t* history = NULL;
+static int window = 0;
+static int played = 0;
 
 /* Private function declarations */
-static void scramble(FILE *fp, FILE *out);
+static uint64_t rand_next(void);
+static uint32_t rand_below(uint32_t n);
+static uint64_t rand_hash(const char* s, size_t len);
+static uint64_t rand_artist(const char* path);
+static int rand_recent(uint64_t artist, uint64_t track, int span);
 
 /* Public function definitions */
 
-void rand_file(FILE *fp, FILE *out) {
-	method = LINE;  /* default to LINE method */
-	scramble(fp, out);
+/* Set up the generator and a history of the last norepeat tracks */
+int rand_initialize(int norepeat) {
+	state = ((uint64_t) time(NULL) << 32) ^ ices_util_get_random() ^ 0x9e3779b97f4a7c15ULL;
+	window = norepeat > 0 ? norepeat : 0;
+	played = 0;
+
+	if (window && !(history = calloc(2 * window, sizeof(uint64_t)))) {
+		ices_log_error("Could not allocate shuffle history");
+		window = 0;
+		return -1;
+	}
+
+	return 0;
+}
+
+void rand_shutdown(void) {
+	ices_util_free(history);
+	history = NULL;
+	window = played = 0;
+}
+
+/* Draw the entry to play at position pos into place */
+void rand_pick(playlist_entry_t* entries, int count, int pos) {
+	uint64_t artist = 0, track = 0;
+	/* a window as wide as the playlist can't be satisfied */
+	int span = window < count / 2 ? window : count / 2;
+	int tries = 0;
+	int i;
+	playlist_entry_t tmp;
+
+	do {
+		i = pos + rand_below(count - pos);
+		if (!span)
+			break;
+		artist = rand_artist(entries[i].path);
+		track = rand_hash(entries[i].path, strlen(entries[i].path));
+	} while (rand_recent(artist, track, span) && ++tries < RAND_TRIES);
+
+	tmp = entries[pos];
+	entries[pos] = entries[i];
+	entries[i] = tmp;
+
+	if (window) {
+		if (!span) {
+			artist = rand_artist(entries[pos].path);
+			track = rand_hash(entries[pos].path, strlen(entries[pos].path));
+		}
+		history[2 * (played % window)] = artist;
+		history[2 * (played % window) + 1] = track;
+		played++;
+	}
 }
 
 /* Private function definitions */
 
-/*** scramble function, for files */
-static void scramble(FILE *fp, FILE *out) {
-	static int seeded = 0;
+/* xorshift64* */
+static uint64_t rand_next(void) {
+	state ^= state >> 12;
+	state ^= state << 25;
+	state ^= state >> 27;
 
-	char *line_storage = NULL, **table = NULL;
-	struct ll *llist = NULL, *ptr = NULL;
-	int size = 0, n = 0, x = 0;
+	return state * 0x2545f4914f6cdd1dULL;
+}
 
-	if (!seeded) {
-		srand(ices_util_get_random());
-		seeded = 1;
-	}
+/* Uniform in [0, n), from the high 32 bits, which are the most random.
+ * Draws past the last whole multiple of n are thrown away. */
+static uint32_t rand_below(uint32_t n) {
+	uint32_t limit = UINT32_MAX - UINT32_MAX % n;
+	uint32_t r;
 
-	llist = malloc(sizeof(struct ll));
-	llist->data = NULL;
-	ptr = llist;
-
-	line_storage = (char *) malloc(sizeof(char) * 1024 + 2);
-
-	/*** make linked list     ***/
-	if (method == LINE) {
-		while (fgets(line_storage, 1024, fp)) {
-			/* skip lines beginning with '#' (for M3U files) */
-			if (line_storage[0] == '#')
-				continue;
-			struct ll *x = malloc(sizeof(struct ll));
-			x->data = malloc(strlen(line_storage) * sizeof(char) + 2);
-			memcpy(x->data, line_storage, strlen(line_storage) * sizeof(char) + 1);
-			x->data[strlen(x->data) - 1] = 0;
-			x->next = NULL;
-			ptr->next = x;
-			ptr = x;
-			size++;
-		}
-	}
+	do
+		r = (uint32_t) (rand_next() >> 32);
+	while (r >= limit);
 
-	/*** make table from list ***/
-	table = malloc(size * sizeof(void *));
-	ptr = llist->next;
-	for (x = 0; x < size; x++) {
-		table[x] = ptr->data;
-		ptr = ptr->next;
-	}
+	return r % n;
+}
 
-	/* shuffle it  (thanks to Dr Shade) */
-	n = size;
+/* FNV-1a */
+static uint64_t rand_hash(const char* s, size_t len) {
+	uint64_t h = 0xcbf29ce484222325ULL;
 
-	while (n > 1) {
-		int d = (int) ((double) size * rand() / (RAND_MAX + 1.0));
-		char *temp = table[d];
-		table[d] = table[n - 1];
-		table[n - 1] = temp;
-		--n;
-	}
+	while (len--)
+		h = (h ^ (unsigned char) *s++) * 0x100000001b3ULL;
 
-	/*** print it   ***/
-	while (size) {
-		fprintf(out, "%s\n", table[size - 1]);
-		size--;
-	}
+	return h;
+}
+
+static uint64_t rand_artist(const char* path) {
+	const char* artist;
+	const char* title;
+	int alen, tlen;
+
+	ices_playlist_guess_tags(path, &artist, &alen, &title, &tlen);
+
+	return rand_hash(artist, alen);
+}
+
+/* Was the artist or track among the last span played? */
+static int rand_recent(uint64_t artist, uint64_t track, int span) {
+	int i, j;
 
-	/*** delete the linked list and clean up ***/
-	ptr = llist->next;
-	while (ptr) {
-		free(llist);
-		llist = ptr;
-		ptr = ptr->next;
+	for (i = 1; i <= span && i <= played; i++) {
+		j = 2 * ((played - i) % window);
+		if (history[j] == artist || history[j + 1] == track)
+			return 1;
 	}
 
-	free(line_storage);
-	return;
+	return 0;
 }
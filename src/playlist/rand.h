@@ -19,4 +19,6 @@
  */
 
 /* Public function declarations */
-void rand_file(FILE *in, FILE *out);
+int rand_initialize(int norepeat);
+void rand_shutdown(void);
+void rand_pick(playlist_entry_t* entries, int count, int pos);
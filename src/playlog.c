@@ -0,0 +1,376 @@
+/* playlog.c
+ * - One JSON record per track played, for reporting
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+/* With Execution/PlayLog set, every track ices tries to play gets a
+ * line in BaseDirectory/ices.plays.jsonl: a JSON object saying what it
+ * was, when it played, how much of it was sent, how long decoding and
+ * encoding took and how each mount fared, or why it failed. Once the
+ * file reaches PLAYLOG_ROTATE bytes it is renamed to ices.plays.jsonl.1,
+ * replacing the one before.
+ *
+ * Records are put together in the stream loop and written by a thread
+ * of their own, which opens the file for each one, so it may be moved
+ * away at any time. If the disk is so slow that PLAYLOG_QUEUE records
+ * are waiting, later ones are dropped and counted rather than waited
+ * for. */
+
+#include "definitions.h"
+#include "metadata.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
+/* records waiting to be written */
+#define PLAYLOG_QUEUE 32
+/* size the file is rotated at */
+#define PLAYLOG_ROTATE (16 * 1024 * 1024)
+
+typedef struct {
+	char* data;
+	size_t len;
+	size_t size;
+} playlog_buf_t;
+
+extern ices_config_t ices_config;
+
+static int Active = 0;
+static struct timeval Started;
+/* the track being sent, if any */
+static const input_stream_t* Playing = NULL;
+
+#ifdef HAVE_PTHREAD
+static char* Queue[PLAYLOG_QUEUE];
+static int QueueHead = 0;
+static int QueueLen = 0;
+static unsigned int Dropped = 0;
+static int Stop = 0;
+static int Running = 0;
+static pthread_t Writer;
+static pthread_mutex_t Lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t Ready = PTHREAD_COND_INITIALIZER;
+#endif
+
+/* Private function declarations */
+static void playlog_record(const input_stream_t* source, const char* path,
+			   const char* error);
+static void playlog_queue(char* record);
+static void playlog_write(const char* record);
+static void playlog_printf(playlog_buf_t* buf, const char* fmt, ...);
+static void playlog_string(playlog_buf_t* buf, const char* name, const char* value);
+static void playlog_time(playlog_buf_t* buf, const char* name, const struct timeval* tv);
+static const char* playlog_format(input_type_t type);
+#ifdef HAVE_PTHREAD
+static void* playlog_writer(void* arg);
+#endif
+
+/* Public function definitions */
+
+void ices_playlog_initialize(void) {
+	if (!ices_config.playlog)
+		return;
+
+	Active = 1;
+
+#ifdef HAVE_PTHREAD
+	Stop = 0;
+	if (ices_util_thread_create(&Writer, playlog_writer, NULL) == 0)
+		Running = 1;
+	else
+		ices_log("Could not start the play log writer, writing as we go");
+#endif
+}
+
+/* Write out what is waiting, and the track cut short, if any */
+void ices_playlog_shutdown(void) {
+	if (Active && Playing)
+		playlog_record(Playing, Playing->path, "ices shut down");
+
+#ifdef HAVE_PTHREAD
+	if (Running) {
+		pthread_mutex_lock(&Lock);
+		Stop = 1;
+		pthread_cond_signal(&Ready);
+		pthread_mutex_unlock(&Lock);
+		pthread_join(Writer, NULL);
+		Running = 0;
+	}
+#endif
+
+	Active = 0;
+}
+
+/* source starts playing now */
+void ices_playlog_start(const input_stream_t* source) {
+	gettimeofday(&Started, NULL);
+	Playing = source;
+}
+
+/* source is done with, error saying why if it didn't play to the end */
+void ices_playlog_track(const input_stream_t* source, const char* error) {
+	if (Active)
+		playlog_record(source, source->path, error);
+	Playing = NULL;
+}
+
+/* path could not even be opened */
+void ices_playlog_failed(const char* path, const char* error) {
+	if (Active)
+		playlog_record(NULL, path, error);
+	Playing = NULL;
+}
+
+/* Private function definitions */
+
+static void playlog_record(const input_stream_t* source, const char* path,
+			   const char* error) {
+	playlog_buf_t buf;
+	ices_stream_t* stream;
+	struct timeval now;
+	char artist[1024];
+	char title[1024];
+	double seconds;
+
+	buf.data = NULL;
+	buf.len = buf.size = 0;
+	gettimeofday(&now, NULL);
+
+	playlog_printf(&buf, "{");
+	playlog_string(&buf, "path", path);
+
+	if (source) {
+		ices_metadata_get(artist, sizeof(artist), title, sizeof(title));
+		playlog_printf(&buf, ",");
+		playlog_string(&buf, "artist", artist[0] ? artist : NULL);
+		playlog_printf(&buf, ",");
+		playlog_string(&buf, "title", title[0] ? title : NULL);
+		playlog_printf(&buf, ",\"format\":\"%s\"", playlog_format(source->type));
+		if (source->bitrate)
+			playlog_printf(&buf, ",\"bitrate\":%u", source->bitrate);
+		else
+			playlog_printf(&buf, ",\"bitrate\":null");
+		playlog_printf(&buf, ",\"samplerate\":%u,\"channels\":%u",
+			       source->samplerate, source->channels);
+		if (source->duration)
+			playlog_printf(&buf, ",\"duration\":%.3f", source->duration / 1000.0);
+		else
+			playlog_printf(&buf, ",\"duration\":null");
+	}
+
+	if (Playing) {
+		seconds = ices_metrics_track_audio();
+		playlog_printf(&buf, ",");
+		playlog_time(&buf, "start", &Started);
+		playlog_printf(&buf, ",");
+		playlog_time(&buf, "end", &now);
+		playlog_printf(&buf, ",\"seconds\":%.3f,\"samples\":%.0f,\"decode_seconds\":%.6f",
+			       seconds, source && source->samplerate ? seconds * source->samplerate : 0,
+			       ices_metrics_track_decode());
+
+		playlog_printf(&buf, ",\"mounts\":[");
+		for (stream = ices_config.streams; stream; stream = stream->next) {
+			playlog_printf(&buf, "%s{", stream == ices_config.streams ? "" : ",");
+			playlog_string(&buf, "mount", stream->mount);
+			playlog_printf(&buf, ",\"reencoded\":%s", stream->encode ? "true" : "false");
+			if (stream->encode)
+				playlog_printf(&buf, ",\"bitrate\":%d,\"encode_seconds\":%.6f",
+					       stream->bitrate, stream->track_encode);
+			playlog_printf(&buf, ",\"bytes\":%llu,\"errors\":%u}",
+				       (unsigned long long) stream->track_bytes, stream->track_errors);
+		}
+		playlog_printf(&buf, "]");
+	} else {
+		playlog_printf(&buf, ",");
+		playlog_time(&buf, "end", &now);
+	}
+
+	playlog_printf(&buf, ",");
+	playlog_string(&buf, "error", error && error[0] ? error : NULL);
+	playlog_printf(&buf, "}\n");
+
+	if (buf.data)
+		playlog_queue(buf.data);
+}
+
+static void playlog_queue(char* record) {
+#ifdef HAVE_PTHREAD
+	if (Running) {
+		pthread_mutex_lock(&Lock);
+		if (QueueLen < PLAYLOG_QUEUE) {
+			Queue[(QueueHead + QueueLen++) % PLAYLOG_QUEUE] = record;
+			record = NULL;
+			pthread_cond_signal(&Ready);
+		} else
+			Dropped++;
+		pthread_mutex_unlock(&Lock);
+		ices_util_free(record);
+		return;
+	}
+#endif
+
+	playlog_write(record);
+	free(record);
+}
+
+/* Append record to the play log, rotating it once it's big enough */
+static void playlog_write(const char* record) {
+	char path[1024];
+	char old[1030];
+	char err[128];
+	struct stat st;
+	size_t len = strlen(record);
+	ssize_t rc;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/ices.plays.jsonl", ices_config.base_directory);
+	if ((fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644)) < 0) {
+		ices_log("Error opening play log %s: %s", path, ices_util_strerror(errno, err, sizeof(err)));
+		return;
+	}
+
+	while (len) {
+		if ((rc = write(fd, record, len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			ices_log("Error writing play log %s: %s", path,
+				 ices_util_strerror(errno, err, sizeof(err)));
+			break;
+		}
+		record += rc;
+		len -= rc;
+	}
+
+	if (!fstat(fd, &st) && st.st_size >= PLAYLOG_ROTATE) {
+		snprintf(old, sizeof(old), "%s.1", path);
+		if (rename(path, old) < 0)
+			ices_log("Error rotating play log %s: %s", path,
+				 ices_util_strerror(errno, err, sizeof(err)));
+	}
+
+	close(fd);
+}
+
+static void playlog_printf(playlog_buf_t* buf, const char* fmt, ...) {
+	va_list ap;
+	char* grown;
+	int len;
+
+	for (;;) {
+		va_start(ap, fmt);
+		len = vsnprintf(buf->data + buf->len, buf->size - buf->len, fmt, ap);
+		va_end(ap);
+		if (len < 0)
+			return;
+		if (buf->len + len < buf->size) {
+			buf->len += len;
+			return;
+		}
+
+		if (!(grown = realloc(buf->data, buf->size + len + 1024)))
+			return;
+		buf->data = grown;
+		buf->size += len + 1024;
+	}
+}
+
+/* "name":value, with value quoted and escaped, or null */
+static void playlog_string(playlog_buf_t* buf, const char* name, const char* value) {
+	const unsigned char* c;
+
+	playlog_printf(buf, "\"%s\":", name);
+	if (!value) {
+		playlog_printf(buf, "null");
+		return;
+	}
+
+	playlog_printf(buf, "\"");
+	for (c = (const unsigned char*) value; *c; c++) {
+		if (*c == '"' || *c == '\\')
+			playlog_printf(buf, "\\%c", *c);
+		else if (*c == '\n')
+			playlog_printf(buf, "\\n");
+		else if (*c < 0x20)
+			playlog_printf(buf, "\\u%04x", *c);
+		else
+			playlog_printf(buf, "%c", *c);
+	}
+	playlog_printf(buf, "\"");
+}
+
+/* "name":"2024-01-31T12:00:00.000Z" */
+static void playlog_time(playlog_buf_t* buf, const char* name, const struct timeval* tv) {
+	char stamp[32];
+	time_t sec = tv->tv_sec;
+	struct tm tm;
+
+	gmtime_r(&sec, &tm);
+	strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &tm);
+	playlog_printf(buf, "\"%s\":\"%s.%03dZ\"", name, stamp, (int) (tv->tv_usec / 1000));
+}
+
+static const char* playlog_format(input_type_t type) {
+	switch (type) {
+	case ICES_INPUT_VORBIS:
+		return "vorbis";
+	case ICES_INPUT_MP3:
+		return "mp3";
+	case ICES_INPUT_MP4:
+		return "mp4";
+	case ICES_INPUT_FLAC:
+		return "flac";
+	}
+
+	return "unknown";
+}
+
+#ifdef HAVE_PTHREAD
+static void* playlog_writer(void* arg) {
+	char* record;
+	unsigned int dropped;
+
+	pthread_mutex_lock(&Lock);
+	for (;;) {
+		while (!QueueLen && !Stop)
+			pthread_cond_wait(&Ready, &Lock);
+		if (!QueueLen)
+			break;
+
+		record = Queue[QueueHead];
+		QueueHead = (QueueHead + 1) % PLAYLOG_QUEUE;
+		QueueLen--;
+		dropped = Dropped;
+		Dropped = 0;
+		pthread_mutex_unlock(&Lock);
+
+		if (dropped)
+			ices_log("%u play log records dropped, the disk could not keep up", dropped);
+		playlog_write(record);
+		free(record);
+
+		pthread_mutex_lock(&Lock);
+	}
+	pthread_mutex_unlock(&Lock);
+
+	return NULL;
+}
+#endif
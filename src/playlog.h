@@ -0,0 +1,30 @@
+/* playlog.h
+ * - Per-track play log declarations
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#ifndef _ICES_PLAYLOG_H
+#define _ICES_PLAYLOG_H
+
+/* Public function declarations */
+void ices_playlog_initialize(void);
+void ices_playlog_shutdown(void);
+void ices_playlog_start(const input_stream_t* source);
+void ices_playlog_track(const input_stream_t* source, const char* error);
+void ices_playlog_failed(const char* path, const char* error);
+
+#endif
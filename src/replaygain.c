@@ -2,14 +2,22 @@
 #include <math.h>
 
 /**
- * Current track gain.
+ * Current track gain, per thread like the metadata.
  */
+#ifdef HAVE_PTHREAD
+static __thread double track_gain = 0.0;
+#else
 static double track_gain = 0.0;
+#endif
 
 /**
  * Current track peak.
  */
+#ifdef HAVE_PTHREAD
+static __thread double track_peak = 0.0;
+#else
 static double track_peak = 0.0;
+#endif
 
 /**
  * Track preamp (dB).  Not used currently, but can be.
@@ -21,7 +29,7 @@ static double rg_preamp = 1.0;
  *
  * @param float gain The value as stored in the tags.
  */
-static int rg_plugin_init(void)
+static int rg_plugin_init(ices_plugin_t* self)
 {
 	track_gain = 0.0;
 	ices_log_debug("ReplayGain initialized.");
@@ -35,7 +43,7 @@ static int rg_plugin_init(void)
  * @param int16_t* il Samples for the left channel.
  * @param int16_t* ir Samples for the right channel.
  */
-static int rg_plugin_process(int ilen, int16_t* il, int16_t* ir)
+static int rg_plugin_process(ices_plugin_t* self, int ilen, int16_t* il, int16_t* ir)
 {
   return 0;
 }
@@ -45,7 +53,7 @@ static int rg_plugin_process(int ilen, int16_t* il, int16_t* ir)
  *
  * Does nothing case.
  */
-static void rg_plugin_new_track(input_stream_t* source)
+static void rg_plugin_new_track(ices_plugin_t* self, input_stream_t* source)
 {
 	ices_log_debug("ReplayGain got new track.");
 }
@@ -53,7 +61,7 @@ static void rg_plugin_new_track(input_stream_t* source)
 /**
  * Plugin clean-up.  Does nothing.
  */
-static void rg_plugin_shutdown(void)
+static void rg_plugin_shutdown(ices_plugin_t* self)
 {
 }
 
@@ -63,7 +71,9 @@ static ices_plugin_t Plugin = {
 	rg_plugin_new_track,
 	rg_plugin_process,
 	rg_plugin_shutdown,
+	NULL,
 
+	NULL,
 	NULL
 };
 
@@ -36,6 +36,10 @@ static void ices_setup_version(void);
 static void ices_setup_update_pidfile(int icespid);
 static void ices_setup_daemonize(void);
 static void ices_free_all(ices_config_t *ices_config);
+#ifdef HAVE_LIBLAME
+static ices_plugin_t* ices_setup_initialize_plugins(ices_plugin_t* chain);
+#endif
+static void ices_setup_shutdown_plugins(ices_plugin_t* chain);
 
 extern ices_config_t ices_config;
 
@@ -46,7 +50,6 @@ extern ices_config_t ices_config;
  * and if requested, become a daemon. */
 void ices_setup_initialize(void) {
 	ices_stream_t* stream;
-	ices_plugin_t* plugin;
 
 	shout_init();
 
@@ -74,17 +77,28 @@ void ices_setup_initialize(void) {
 
 	/* Initialize the playlist handler */
 	ices_playlist_initialize();
+	ices_lookahead_initialize();
+
+	/* Take requests and commands */
+	ices_control_initialize();
+	ices_metrics_initialize();
+	ices_playlog_initialize();
+	ices_trace_initialize();
+
+	/* Load remembered cue points */
+	ices_autocue_initialize();
 
 #ifdef HAVE_LIBLAME
 	/* Initialize liblame for reeencoding */
 	ices_reencode_initialize();
 
-	while (ices_config.plugins && ices_config.plugins->init() < 0)
-		ices_config.plugins = ices_config.plugins->next;
-
-	for (plugin = ices_config.plugins; plugin && plugin->next; plugin = plugin->next)
-		if (plugin->next->init() < 0)
-			plugin->next = plugin->next->next;
+	ices_config.plugins = ices_setup_initialize_plugins(ices_config.plugins);
+	for (stream = ices_config.streams; stream; stream = stream->next) {
+		if (stream->plugins && !stream->reencode)
+			ices_log("Plugins for mount %s are ignored since it is not reencoded",
+				 stream->mount);
+		stream->plugins = ices_setup_initialize_plugins(stream->plugins);
+	}
 #endif
 
 	ices_log_debug("Startup complete\n");
@@ -94,7 +108,9 @@ void ices_setup_initialize(void) {
  * This is the _only_ way out of here */
 void ices_setup_shutdown(void) {
 	ices_stream_t* stream;
-	ices_plugin_t* plugin;
+
+	/* Keep what led up to this */
+	ices_flight_dump("shutting down");
 
 	/* Tell libshout to disconnect from server */
 	for (stream = ices_config.streams; stream; stream = stream->next)
@@ -102,19 +118,27 @@ void ices_setup_shutdown(void) {
 			shout_close(stream->conn);
 
 #ifdef HAVE_LIBLAME
-	for (plugin = ices_config.plugins; plugin; plugin = plugin->next)
-		plugin->shutdown();
+	ices_setup_shutdown_plugins(ices_config.plugins);
+	for (stream = ices_config.streams; stream; stream = stream->next)
+		ices_setup_shutdown_plugins(stream->plugins);
 
 	/* Order the reencoding engine to shutdown */
 	ices_reencode_shutdown();
 #endif
 
 	/* Tell the playlist module to shutdown and cleanup */
+	ices_trace_shutdown();
+	ices_playlog_shutdown();
+	ices_metrics_shutdown();
+	ices_control_shutdown();
+	ices_lookahead_shutdown();
 	ices_playlist_shutdown();
 
 	/* Cleanup the cue file (the cue module has no init yet) */
 	ices_cue_shutdown();
 
+	ices_autocue_shutdown();
+
 	/* Make sure we're not leaving any memory allocated around when
 	 * we exit. This makes it easier to find memory leaks, and
 	 * some systems actually don't clean up that well */
@@ -164,14 +188,25 @@ static void ices_setup_parse_defaults(ices_config_t *ices_config) {
 	ices_config->verbose = ICES_DEFAULT_VERBOSE;
 	ices_config->reencode = ICES_DEFAULT_REENCODE;
 	ices_config->cuefile = ICES_DEFAULT_CUEFILE;
+	ices_config->autocue = ICES_DEFAULT_AUTOCUE;
+	ices_config->playlog = ICES_DEFAULT_PLAYLOG;
+	ices_config->control = NULL;
+	ices_config->metrics = NULL;
+	ices_config->trace = NULL;
 
 	ices_config->pm.playlist_file =
 		ices_util_strdup(ICES_DEFAULT_PLAYLIST_FILE);
 	ices_config->pm.module = ices_util_strdup(ICES_DEFAULT_MODULE);
+	ices_config->pm.category = NULL;
 	ices_config->pm.randomize = ICES_DEFAULT_RANDOMIZE_PLAYLIST;
+	ices_config->pm.norepeat = ICES_DEFAULT_NOREPEAT;
+	ices_config->pm.persistent = ICES_DEFAULT_SCRIPT_PERSISTENT;
+	ices_config->pm.timeout = ICES_DEFAULT_SCRIPT_TIMEOUT;
+	ices_config->pm.lookahead = ICES_DEFAULT_LOOKAHEAD;
 	ices_config->pm.playlist_type = ICES_DEFAULT_PLAYLIST_TYPE;
 
-	ices_config->streams = (ices_stream_t*) malloc(sizeof(ices_stream_t));
+	/* counters and histograms start at zero */
+	ices_config->streams = (ices_stream_t*) calloc(1, sizeof(ices_stream_t));
 
 	ices_setup_parse_stream_defaults(ices_config->streams);
 }
@@ -202,6 +237,9 @@ void ices_setup_parse_stream_defaults(ices_stream_t* stream) {
 	stream->encoder_state = NULL;
 	stream->connect_delay = 0;
 
+	stream->plugins = NULL;
+	stream->encode = 0;
+
 	stream->next = NULL;
 }
 
@@ -228,9 +266,13 @@ static void ices_free_all(ices_config_t *ices_config) {
 
 	ices_util_free(ices_config->configfile);
 	ices_util_free(ices_config->base_directory);
+	ices_util_free(ices_config->control);
+	ices_util_free(ices_config->metrics);
+	ices_util_free(ices_config->trace);
 
 	ices_util_free(ices_config->pm.playlist_file);
 	ices_util_free(ices_config->pm.module);
+	ices_util_free(ices_config->pm.category);
 
 	for (stream = ices_config->streams; stream; stream = next) {
 		next = stream->next;
@@ -240,6 +282,39 @@ static void ices_free_all(ices_config_t *ices_config) {
 	}
 }
 
+#ifdef HAVE_LIBLAME
+/* Initialize each plugin in a chain, dropping (and shutting down) the ones
+ * that fail. Returns the new head of the chain. */
+static ices_plugin_t* ices_setup_initialize_plugins(ices_plugin_t* chain) {
+	ices_plugin_t *plugin, *next;
+	ices_plugin_t **link = &chain;
+
+	for (plugin = chain; plugin; plugin = next) {
+		next = plugin->next;
+
+		if (plugin->init(plugin) < 0) {
+			ices_log("Could not initialize plugin %s: %s", plugin->name,
+				 ices_log_get_error());
+			*link = next;
+			plugin->shutdown(plugin);
+		} else
+			link = &plugin->next;
+	}
+
+	return chain;
+}
+#endif
+
+/* Shut down every plugin in a chain. Plugins may free themselves. */
+static void ices_setup_shutdown_plugins(ices_plugin_t* chain) {
+	ices_plugin_t *next;
+
+	for (; chain; chain = next) {
+		next = chain->next;
+		chain->shutdown(chain);
+	}
+}
+
 #ifdef HAVE_LIBXML
 /* Tell the xml module to parse the config file. */
 static void ices_setup_parse_config_file(ices_config_t *ices_config, const char *configfile) {
@@ -330,9 +405,11 @@ static void ices_setup_parse_command_line(ices_config_t *ices_config, char **arg
 				break;
 			case 'C':
 				arg++;
-				if (atoi(argv[arg]) > 0)
-					/* TODO: stack plugins */
+				if (atoi(argv[arg]) > 0) {
+					/* replaces whatever the config file asked for */
+					ices_setup_shutdown_plugins(ices_config->plugins);
 					ices_config->plugins = crossfade_plugin(atoi(argv[arg]));
+				}
 			case 'c':
 				arg++;
 				break;
@@ -379,7 +456,7 @@ static void ices_setup_parse_command_line(ices_config_t *ices_config, char **arg
 				arg++;
 				if (nstreams > 1) {
 					stream->next =
-						(ices_stream_t*) malloc(sizeof(ices_stream_t));
+						(ices_stream_t*) calloc(1, sizeof(ices_stream_t));
 					stream = stream->next;
 					ices_setup_parse_stream_defaults(stream);
 				}
@@ -427,6 +504,12 @@ static void ices_setup_parse_command_line(ices_config_t *ices_config, char **arg
 					ices_config->pm.playlist_type = ices_playlist_perl_e;
 				else if (strcmp(argv[arg], "script") == 0)
 					ices_config->pm.playlist_type = ices_playlist_script_e;
+				else if (strcmp(argv[arg], "native") == 0)
+					ices_config->pm.playlist_type = ices_playlist_native_e;
+				else if (strcmp(argv[arg], "library") == 0)
+					ices_config->pm.playlist_type = ices_playlist_library_e;
+				else if (strcmp(argv[arg], "rotation") == 0)
+					ices_config->pm.playlist_type = ices_playlist_rotation_e;
 				else
 					ices_config->pm.playlist_type = ices_playlist_builtin_e;
 				break;
@@ -542,7 +625,7 @@ static void ices_setup_usage(void) {
 	printf("\t-F <playlist>\n");
 	printf("\t-g <stream genre>\n");
 	printf("\t-h <host>\n");
-	printf("\t-M <interpreter module>\n");
+	printf("\t-M <interpreter or native module>\n");
 	printf("\t-m <mountpoint>\n");
 	printf("\t-n <stream name>\n");
 	printf("\t-p <port>\n");
@@ -551,7 +634,7 @@ static void ices_setup_usage(void) {
 	printf("\t-R (activate reencoding)\n");
 	printf("\t-r (randomize playlist)\n");
 	printf("\t-s (private stream)\n");
-	printf("\t-S <script|perl|python|builtin>\n");
+	printf("\t-S <script|perl|python|native|library|rotation|builtin>\n");
 	printf("\t-t <http|xaudiocast|icy>\n");
 	printf("\t-u <stream url>\n");
 	printf("\t-U <user>\n");
@@ -587,7 +670,7 @@ static void ices_setup_version(void) {
 #endif
 	       "\n"
 	       "System configuration file: " ICES_ETCDIR "/ices.conf\n"
-#if defined (HAVE_LIBPERL) || defined (HAVE_LIBPYTHON)
+#if defined (HAVE_LIBPERL) || defined (HAVE_LIBPYTHON) || defined (HAVE_DLOPEN)
 	       "Playlist module directory: " ICES_MODULEDIR "\n"
 #endif
 	       );
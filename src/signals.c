@@ -36,11 +36,15 @@
 #include <sys/signal.h>
 #endif
 
+/* Signals are written to this pipe by their handlers, and acted on when
+ * the stream loop gets round to reading it. Children are reaped by
+ * whoever started them, as only they know which pids are theirs. */
+static int Pipe[2] = { -1, -1 };
+static volatile sig_atomic_t Stopping = 0;
+
 /* Private function declarations */
-static RETSIGTYPE signals_child(const int sig);
 static RETSIGTYPE signals_int(const int sig);
-static RETSIGTYPE signals_hup(const int sig);
-static RETSIGTYPE signals_usr1(const int sig);
+static RETSIGTYPE signals_queue(const int sig);
 
 /* Global function definitions */
 
@@ -51,6 +55,15 @@ static RETSIGTYPE signals_usr1(const int sig);
 void ices_signals_setup(void) {
 #ifndef _WIN32
 	struct sigaction sa;
+	int i;
+
+	if (pipe(Pipe) == 0)
+		for (i = 0; i < 2; i++) {
+			fcntl(Pipe[i], F_SETFL, fcntl(Pipe[i], F_GETFL) | O_NONBLOCK);
+			fcntl(Pipe[i], F_SETFD, FD_CLOEXEC);
+		}
+	else
+		Pipe[0] = Pipe[1] = -1;
 
 	sigemptyset(&sa.sa_mask);
 	sa.sa_flags = 0;
@@ -67,39 +80,72 @@ void ices_signals_setup(void) {
 #ifdef SA_RESTART
 	sa.sa_flags = SA_RESTART;
 #endif
-	sa.sa_handler = signals_child;
-	sigaction(SIGCHLD, &sa, NULL);
-
-	sa.sa_handler = signals_hup;
+	sa.sa_handler = signals_queue;
 	sigaction(SIGHUP, &sa, NULL);
-
-	sa.sa_handler = signals_usr1;
 	sigaction(SIGUSR1, &sa, NULL);
+#endif
 }
 
-/* Guess we fork()ed, let's take care of the dead process */
-static RETSIGTYPE signals_child(const int sig) {
-	int stat;
-	while (waitpid (WAIT_ANY, &stat, WNOHANG) <= 0);
+/* Act on the signals that have arrived since last time */
+void ices_signals_dispatch(void) {
+#ifndef _WIN32
+	unsigned char sigs[64];
+	ssize_t len, i;
+
+	if (Pipe[0] < 0)
+		return;
+
+	while ((len = read(Pipe[0], sigs, sizeof(sigs))) > 0)
+		for (i = 0; i < len; i++)
+			switch (sigs[i]) {
+			case SIGINT:
+			case SIGTERM:
+				ices_log_debug("Caught signal, shutting down...");
+				ices_setup_shutdown();
+				break;
+			case SIGHUP:
+				/* cycle logfiles and try to reload the playlist module */
+				ices_log_debug("Caught SIGHUP, cycling logfiles and reloading playlist...");
+				ices_log_reopen_logfile();
+				ices_playlist_reload();
+				break;
+			case SIGUSR1:
+				ices_log_debug("Caught SIGUSR1, skipping to next track...");
+				ices_stream_next();
+				break;
+			}
+#endif
 }
 
-/* SIGINT, ok, let's be nice and just drop dead */
-static RETSIGTYPE signals_int(const int sig) {
-	ices_log_debug("Caught signal, shutting down...");
-	ices_setup_shutdown();
+/* Has ices been asked to stop? For threads that wait on something, so
+ * that they don't hold up the shutdown. */
+int ices_signals_stopping(void) {
+	return Stopping != 0;
 }
 
-/* SIGHUP caught, let's cycle logfiles and try to reload the playlist module */
-static RETSIGTYPE signals_hup(const int sig) {
-	ices_log_debug("Caught SIGHUP, cycling logfiles and reloading playlist...");
-	ices_log_reopen_logfile();
-	ices_playlist_reload();
+#ifndef _WIN32
+/* SIGINT, ok, let's be nice and shut down between buffers. If we're
+ * asked again before getting there, or can't queue it, just drop dead:
+ * shutting down from inside the handler could deadlock on whatever the
+ * signal interrupted. */
+static RETSIGTYPE signals_int(const int sig) {
+	if (Stopping++ || Pipe[1] < 0) {
+		signal(sig, SIG_DFL);
+		raise(sig);
+		return;
+	}
+	signals_queue(sig);
 }
 
-/* I'm not sure whether I'll keep this... */
-static RETSIGTYPE signals_usr1(const int sig) {
-	ices_log_debug("Caught SIGUSR1, skipping to next track...");
-	ices_stream_next();
-#endif
+/* Leave the rest to ices_signals_dispatch() */
+static RETSIGTYPE signals_queue(const int sig) {
+	unsigned char c = sig;
+	int saved = errno;
+
+	if (Pipe[1] >= 0 && write(Pipe[1], &c, 1) < 0) {
+		/* the pipe is full, so it will be read soon enough */
+	}
+	errno = saved;
 }
+#endif
 
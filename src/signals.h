@@ -20,3 +20,5 @@
 
 /* Public function declarations */
 void ices_signals_setup(void);
+void ices_signals_dispatch(void);
+int ices_signals_stopping(void);
@@ -63,11 +63,17 @@ typedef struct {
 static volatile int finish_send = 0;
 
 /* Private function declarations */
+#ifndef ICES_BENCH
 static int stream_connect(ices_stream_t* stream);
+#endif
 static int stream_send(ices_config_t* config, input_stream_t* source);
 static int stream_send_data(ices_stream_t* stream, unsigned char* buf, size_t len);
 static int stream_open_source(input_stream_t* source);
 static int stream_needs_reencoding(input_stream_t* source, ices_stream_t* stream);
+#ifdef HAVE_LIBLAME
+static int stream_run_plugins(ices_stream_t* stream, int samples, int16_t* left,
+			      int16_t* right, int16_t** leftp, int16_t** rightp);
+#endif
 
 /* Public function definitions */
 
@@ -75,43 +81,70 @@ static int stream_needs_reencoding(input_stream_t* source, ices_stream_t* stream
  * connect to server and start streaming */
 void ices_stream_loop(ices_config_t* config) {
 	int consecutive_errors = 0;
+	ices_lookahead_entry_t entry;
 	input_stream_t source;
 	ices_stream_t* stream;
 	int rc;
 	int timelimit;
+	int duration;
 	time_t now;
+	double span;
 
 	while (1) {
-		source.path = ices_playlist_get_next();
+		/* requests go before the playlist */
+		ices_control_poll();
+		if (!ices_control_get_request(&entry))
+			ices_lookahead_get_next(&entry);
+		source.path = entry.path;
 
 		if (!(source.path && source.path[0])) {
 			ices_log("Playlist handler returned an empty file name; no media to play, shutting down.");
+			ices_lookahead_free(&entry);
 			ices_setup_shutdown();
 		}
 
-		ices_cue_set_lineno(ices_playlist_get_current_lineno());
+		ices_cue_set_lineno(entry.lineno);
 
 		ices_metadata_set(NULL, NULL);
 		ices_metadata_set_file(source.path);
+		ices_metadata_set_playlist(entry.metadata);
+		ices_util_free(entry.metadata);
+		timelimit = entry.timelimit;
+		duration = entry.duration;
 
 		/* This stops ices from entering a loop with 10-20 lines of output per
 		     second. Usually caused by a playlist handler that produces only
 		     invalid file names. */
 		if (consecutive_errors > 10) {
 			ices_log("Exiting after 10 consecutive errors.");
+			ices_flight_event(ices_flight_error_e, NULL, consecutive_errors,
+					  "Exiting after 10 consecutive errors");
 			ices_util_free(source.path);
 			ices_setup_shutdown();
 		}
 
-		if (stream_open_source(&source) < 0) {
+		span = ices_trace_start();
+		rc = stream_open_source(&source);
+		ices_trace_end("stream_open_source", source.path, span);
+		if (rc < 0) {
 			ices_log("Error opening %s: %s", source.path, ices_log_get_error());
+			ices_playlog_failed(source.path, ices_log_get_error());
+			ices_flight_event(ices_flight_error_e, NULL, consecutive_errors + 1,
+					  ices_log_get_error());
+			ices_lookahead_failed(source.path);
 			ices_util_free(source.path);
 			consecutive_errors++;
 			continue;
 		}
 
+		ices_control_playing(source.path);
+		ices_flight_event(ices_flight_track_e, NULL, entry.lineno, source.path);
+
+		/* the playlist may know what the file doesn't say */
+		if (!source.duration)
+			source.duration = duration;
+
 		source.interrupttime = 0;
-		timelimit = ices_playlist_get_timelimit();
 		if (timelimit) {
 			now = time(NULL);
 			source.interrupttime = (time_t) ( (int) now + timelimit );
@@ -128,11 +161,14 @@ void ices_stream_loop(ices_config_t* config) {
 				}
 
 		rc = stream_send(config, &source);
+		ices_playlog_track(&source, rc < 0 ? ices_log_get_error() : NULL);
 		source.close(&source);
 
 		/* If something goes on while transfering, we just go on */
 		if (rc < 0) {
 			ices_log("Encountered error while transfering %s: %s", source.path, ices_log_get_error());
+			ices_flight_event(ices_flight_error_e, NULL, consecutive_errors + 1,
+					  ices_log_get_error());
 
 			consecutive_errors++;
 
@@ -151,6 +187,49 @@ void ices_stream_next(void) {
 	finish_send = 1;
 }
 
+#ifdef ICES_BENCH
+/* ices-bench: play source->path from start to end as the stream loop
+ * would, into the null sink */
+int ices_stream_play(ices_config_t* config, input_stream_t* source) {
+	ices_stream_t* stream;
+	int rc;
+
+	ices_metadata_set(NULL, NULL);
+	ices_metadata_set_file(source->path);
+	if (stream_open_source(source) < 0)
+		return -1;
+
+	if (!source->read)
+		for (stream = config->streams; stream; stream = stream->next)
+			if (!stream->reencode) {
+				ices_log_error("Cannot play %s without reencoding", source->path);
+				source->close(source);
+				return -1;
+			}
+
+	source->interrupttime = 0;
+	rc = stream_send(config, source);
+	source->close(source);
+
+	return rc;
+}
+#endif
+
+/* Open source->path just far enough to learn its format, duration and
+ * tags (which go to the metadata module as usual), then close it again */
+int ices_stream_probe(input_stream_t* source) {
+	double span = ices_trace_start();
+	int rc = stream_open_source(source);
+
+	ices_trace_end("stream_open_source", source->path, span);
+	if (rc < 0)
+		return -1;
+
+	source->close(source);
+
+	return 0;
+}
+
 /* This function is called to stream a single file */
 static int stream_send(ices_config_t* config, input_stream_t* source) {
 	ices_stream_t* stream;
@@ -162,15 +241,23 @@ static int stream_send(ices_config_t* config, input_stream_t* source) {
 	int samples;
 	int rc;
 	int do_sleep;
-#ifdef HAVE_LIBLAME
 	int decode = 0;
+#ifdef HAVE_LIBLAME
+	int analyse = 0;
 	buffer_t obuf;
 	ices_plugin_t *plugin;
 	/* worst case decode: 22050 Hz at 8kbs = 44.1 samples/byte */
 	static int16_t left[INPUT_BUFSIZ * 45];
 	static int16_t right[INPUT_BUFSIZ * 45];
-	static int16_t* rightp;
+	int16_t* leftp;
+	int16_t* rightp;
+	int ssamples;
 #endif
+	ices_autocue_t autocue;
+	int fadesecs = 0;
+	time_t stop;
+	double t;
+	double span;
 
 #ifdef HAVE_LIBLAME
 	obuf.data = NULL;
@@ -178,16 +265,24 @@ static int stream_send(ices_config_t* config, input_stream_t* source) {
 
 	if (config->reencode) {
 		ices_reencode_reset(source);
-		if (config->plugins) {
+		for (plugin = config->plugins; plugin; plugin = plugin->next)
+			plugin->new_track(plugin, source);
+		fadesecs = crossfade_seconds(config->plugins);
+	}
+
+	/* streams without plugins of their own pass MP3 through untouched
+	 * when they can, even if another stream is being processed */
+	for (stream = config->streams; stream; stream = stream->next) {
+		stream->encode = config->reencode && stream->reencode
+			&& (config->plugins || stream->plugins
+			    || stream_needs_reencoding(source, stream));
+		if (stream->encode) {
 			decode = 1;
-			for (plugin = config->plugins; plugin; plugin = plugin->next)
-				plugin->new_track(source);
-		} else
-			for (stream = config->streams; stream; stream = stream->next)
-				if (stream->reencode && stream_needs_reencoding(source, stream)) {
-					decode = 1;
-					break;
-				}
+			for (plugin = stream->plugins; plugin; plugin = plugin->next)
+				plugin->new_track(plugin, source);
+			if (crossfade_seconds(stream->plugins) > fadesecs)
+				fadesecs = crossfade_seconds(stream->plugins);
+		}
 	}
 
 	if (decode) {
@@ -204,25 +299,67 @@ static int stream_send(ices_config_t* config, input_stream_t* source) {
 
 	ices_log("Playing %s", source->path);
 
+	/* audio that isn't decoded can only be cut short at the cue out point */
+	ices_autocue_start(&autocue, source, fadesecs);
+	if (autocue.stop && !decode && !source->readpcm) {
+		stop = time(NULL) + (autocue.stop + 999) / 1000;
+		if (!source->interrupttime || stop < source->interrupttime)
+			source->interrupttime = stop;
+	}
+#ifdef HAVE_LIBLAME
+	/* a track passed through is still decoded the first time it plays,
+	 * but only to find its cue points */
+	if (autocue.samplerate && !autocue.known && !decode && source->read) {
+		if (!config->reencode)
+			ices_reencode_reset(source);
+		analyse = 1;
+	}
+#endif
+
+#ifndef ICES_BENCH
 	ices_metadata_update(0);
+#endif
+	ices_metrics_track();
+	ices_playlog_start(source);
 
 	finish_send = 0;
 	while (!finish_send) {
+		ices_control_poll();
+		if (finish_send)
+			break;
+
+		t = ices_metrics_clock();
 		len = samples = 0;
 		/* fetch input buffer */
 		if (source->read) {
+			span = ices_trace_start();
 			len = source->read(source, ibuf, sizeof(ibuf));
+			ices_trace_end("read", NULL, span);
 #ifdef HAVE_LIBLAME
-			if (decode) {
+			if (decode || analyse) {
+				span = ices_trace_start();
 				samples = ices_reencode_decode(ibuf, len, sizeof(left), left, right);
-				if (samples < 0) {
+				ices_trace_end("ices_reencode_decode", NULL, span);
+				if (samples < 0 && analyse) {
+					/* the audio goes out regardless, just without cue points */
+					ices_log_debug("Cannot decode %s to find its cue points", source->path);
+					autocue.samplerate = 0;
+					analyse = samples = 0;
+				} else if (samples < 0) {
 					ices_log_debug("ices_reencode_decode reports %d samples.", samples);
 					goto err;
 				}
 			}
+			if (analyse) {
+				if (samples > 0)
+					ices_autocue_process(&autocue, left, right, samples);
+				samples = 0;
+			}
 
 		} else if (source->readpcm) {
+			span = ices_trace_start();
 			len = samples = source->readpcm(source, sizeof(left), left, right);
+			ices_trace_end("readpcm", NULL, span);
 			if (samples < 0) {
 				ices_log_debug("source->readpcm returned %d samples!", samples);
 				goto err;
@@ -230,10 +367,18 @@ static int stream_send(ices_config_t* config, input_stream_t* source) {
 #endif
     }
 
+#ifdef HAVE_LIBLAME
+	if (samples > 0)
+		samples = ices_autocue_process(&autocue, left, right, samples);
+#endif
+	ices_metrics_stage(NULL, ices_stage_decode_e, &t);
 	if (samples > 0) {
 		/* ices_log_debug("Applying track gain to %d samples.", samples); */
+		span = ices_trace_start();
 		rg_apply(left, samples);
 		rg_apply(right, samples);
+		ices_trace_end("rg_apply", NULL, span);
+		ices_metrics_stage(NULL, ices_stage_replaygain_e, &t);
 	} else if (samples < 0) {
 		ices_log_debug("Decoder reported error %d.", samples);
 		goto err;
@@ -242,12 +387,18 @@ static int stream_send(ices_config_t* config, input_stream_t* source) {
 #ifdef HAVE_LIBLAME
 		/* run output through plugin */
 		for (plugin = config->plugins; plugin; plugin = plugin->next)
-			if (samples > 0)
-				samples = plugin->process(samples, left, right);
+			if (samples > 0) {
+				span = ices_trace_start();
+				samples = plugin->process(plugin, samples, left, right);
+				ices_trace_end(plugin->name, NULL, span);
+			}
+		if (config->plugins)
+			ices_metrics_stage(NULL, ices_stage_plugin_e, &t);
 #endif
 
 		if (len == 0) {
 			ices_log_debug("Done sending");
+			ices_autocue_finish(&autocue, source);
 			break;
 		}
 		if (len < 0) {
@@ -255,25 +406,39 @@ static int stream_send(ices_config_t* config, input_stream_t* source) {
 			goto err;
 		}
 
+		/* decoded audio is measured in samples, the rest by bitrate */
+#ifdef HAVE_LIBLAME
+		if (decode || !source->read) {
+			if (samples > 0 && source->samplerate)
+				ices_metrics_audio((double) samples / source->samplerate);
+		} else
+#endif
+		if (source->bitrate)
+			ices_metrics_audio(len * 8.0 / (source->bitrate * 1000.0));
+
 		do_sleep = 1;
-		while (do_sleep) {
+		while (do_sleep && !finish_send) {
 			rc = olen = 0;
 			for (stream = config->streams; stream; stream = stream->next) {
+				t = ices_metrics_clock();
 				/* don't reencode if the source is MP3 and the same bitrate */
 #ifdef HAVE_LIBLAME
-				if (stream->reencode && (config->plugins || stream_needs_reencoding(source, stream))) {
-					if (samples > 0) {
+				if (stream->encode) {
+					ssamples = 0;
+					if (samples > 0)
+						ssamples = stream_run_plugins(stream, samples, left, right, &leftp, &rightp);
+					if (stream->plugins)
+						ices_metrics_stage(stream, ices_stage_plugin_e, &t);
+					if (ssamples > 0) {
 						/* for some reason we have to manually duplicate right from left to get
 						 * LAME to output stereo from a mono source */
 						if (source->channels == 1 && stream->out_numchannels != 1)
-							rightp = left;
-						else
-							rightp = right;
-						if (obuf.len < (unsigned int)(7200 + samples + samples / 4)) {
+							rightp = leftp;
+						if (obuf.len < (unsigned int)(7200 + ssamples + ssamples / 4)) {
 							char *tmpbuf;
 
 							/* pessimistic estimate from lame.h */
-							obuf.len = 7200 + 5 * samples / 2;
+							obuf.len = 7200 + 5 * ssamples / 2;
 							if (!(tmpbuf = realloc(obuf.data, obuf.len))) {
 								ices_log_error("Error growing output buffer, aborting track");
 								goto err;
@@ -281,7 +446,11 @@ static int stream_send(ices_config_t* config, input_stream_t* source) {
 							obuf.data = tmpbuf;
 							ices_log_debug("Grew output buffer to %d bytes", obuf.len);
 						}
-						if ((olen = ices_reencode(stream, samples, left, rightp, (unsigned char *)obuf.data, obuf.len)) < -1) {
+						span = ices_trace_start();
+						olen = ices_reencode(stream, ssamples, leftp, rightp, (unsigned char *)obuf.data, obuf.len);
+						ices_trace_end("ices_reencode", stream->mount, span);
+						ices_metrics_stage(stream, ices_stage_encode_e, &t);
+						if (olen < -1) {
 							ices_log_error("Reencoding error, aborting track");
 							goto err;
 						} else if (olen == -1) {
@@ -301,6 +470,8 @@ static int stream_send(ices_config_t* config, input_stream_t* source) {
 				rc = stream_send_data(stream, ibuf, len);
 
 				if (rc < 0) {
+					ices_flight_event(ices_flight_error_e, stream, stream->errs,
+							  ices_log_get_error());
 					if (stream->errs > 10) {
 						ices_log("Too many stream errors, giving up");
 						ices_setup_shutdown();
@@ -316,17 +487,24 @@ static int stream_send(ices_config_t* config, input_stream_t* source) {
 					delay.tv_usec = ERROR_DELAY % 1000 * 1000;
 
 					select(1, NULL, NULL, NULL, &delay);
+					/* every mount may be down for a while: stay
+					 * stoppable, and give up on the buffer if asked
+					 * to skip */
+					ices_control_poll();
 				}
 			}
 		}
 		ices_cue_update(source);
+		if (autocue.done)
+			finish_send = 1;
 		if ( source->interrupttime && time(NULL)>=source->interrupttime ) finish_send = 1;
 	}
 
 #ifdef HAVE_LIBLAME
-	if (!config->plugins) /* flush is only necessary if we're not continuously reencoding */
+	/* flush is only necessary if we're not continuously reencoding */
+	if (!config->plugins)
 		for (stream = config->streams; stream; stream = stream->next)
-			if (stream->reencode && stream_needs_reencoding(source, stream)) {
+			if (stream->encode && !stream->plugins) {
 				len = ices_reencode_flush(stream, (unsigned char *)obuf.data, obuf.len);
 				if (len > 0)
 					rc = stream_send_data(stream, (unsigned char *)obuf.data, len);
@@ -336,6 +514,8 @@ static int stream_send(ices_config_t* config, input_stream_t* source) {
 		free(obuf.data);
 #endif
 
+	ices_metrics_track_end();
+
 	return 0;
 
  err:
@@ -356,6 +536,7 @@ static int stream_open_source(input_stream_t* source) {
 	source->filesize = 0;
 	source->bytes_read = 0;
 	source->channels = 2;
+	source->duration = 0;
 
 	if (source->path[0] == '-' && source->path[1] == '\0') {
 		ices_log_debug("Reading audio from stdin");
@@ -423,19 +604,67 @@ static int stream_open_source(input_stream_t* source) {
 	return -1;
 }
 
+#ifdef ICES_BENCH
+/* ices-bench's null sink: count what would have been sent, and keep
+ * the sample clock libshout would for reencoded streams, whose bitrate
+ * is known. Where shout_sync would sleep, the time is only added up in
+ * the stream's bench_slept, so its lateness is as if ices had slept but
+ * the run goes as fast as it can. */
+static int stream_send_data(ices_stream_t* stream, unsigned char* buf, size_t len) {
+	double t = ices_metrics_clock();
+	double due;
+
+	if (!stream->bench_start)
+		stream->bench_start = t;
+	if (stream->reencode && stream->bitrate > 0) {
+		due = stream->bench_start + stream->bytes_sent * 8 / (stream->bitrate * 1000.0);
+		if (t + stream->bench_slept < due) {
+			ices_metrics_send(stream, 0, due - t - stream->bench_slept);
+			stream->bench_slept = due - t;
+		} else
+			ices_metrics_send(stream, t + stream->bench_slept - due, 0);
+	}
+
+	stream->bytes_sent += len;
+	stream->track_bytes += len;
+	ices_metrics_stage(stream, ices_stage_send_e, &t);
+
+	return 0;
+}
+#else
 /* wrapper for shout_send_data, shout_sleep with error handling */
 static int stream_send_data(ices_stream_t* stream, unsigned char* buf, size_t len) {
+	double span = ices_trace_start();
+	double t;
+	double slept;
+	int delay;
+	int rc;
+
 	if (shout_get_connected(stream->conn) != SHOUTERR_CONNECTED) {
 		stream_connect(stream);
 		if (shout_get_connected(stream->conn) == SHOUTERR_CONNECTED)
 			ices_metadata_update(1);
-		else
+		else {
+			ices_trace_end("stream_send_data", stream->mount, span);
 			return -1;
+		}
 	}
 
+	/* libshout's sample clock says when this is due: negative is late */
+	delay = shout_delay(stream->conn);
+	t = ices_metrics_clock();
 	shout_sync(stream->conn);
-	if (shout_send(stream->conn, buf, len) == SHOUTERR_SUCCESS) {
+	slept = t;
+	ices_metrics_stage(stream, ices_stage_sync_e, &t);
+	ices_metrics_send(stream, delay < 0 ? -delay / 1000.0 : 0, t - slept);
+	rc = shout_send(stream->conn, buf, len);
+	ices_metrics_stage(stream, ices_stage_send_e, &t);
+	ices_flight_send(stream, rc, delay < 0 ? -delay / 1000.0 : 0);
+	ices_trace_end("stream_send_data", stream->mount, span);
+	if (rc == SHOUTERR_SUCCESS) {
 		stream->errs = 0;
+		stream->bytes_sent += len;
+		stream->track_bytes += len;
 
 		return 0;
 	}
@@ -443,6 +672,7 @@ static int stream_send_data(ices_stream_t* stream, unsigned char* buf, size_t le
 	ices_log_error("Libshout reported send error, disconnecting: %s",shout_get_error(stream->conn));
 	shout_close(stream->conn);
 	stream->errs++;
+	stream->track_errors++;
 
 	return -1;
 }
@@ -461,16 +691,50 @@ static int stream_connect(ices_stream_t* stream) {
 			       shout_get_error(stream->conn));
 		stream->connect_delay = now + 1;
 		stream->errs++;
+		ices_flight_event(ices_flight_connect_e, stream, -1, shout_get_error(stream->conn));
 
 		return -1;
 	}
 
+	stream->connects++;
+	ices_flight_event(ices_flight_connect_e, stream, 0, "");
 	ices_log("Mounted on http://%s:%d%s%s", shout_get_host(stream->conn),
 		 shout_get_port(stream->conn),
 		 (mount && mount[0] == '/') ? "" : "/", ices_util_nullcheck(mount));
 
 	return 0;
 }
+#endif
+
+#ifdef HAVE_LIBLAME
+/* Run the stream's own plugins over a private copy of the decoded audio,
+ * leaving the shared buffers for the other streams. Returns the number of
+ * samples left in *leftp and *rightp. */
+static int stream_run_plugins(ices_stream_t* stream, int samples, int16_t* left,
+			      int16_t* right, int16_t** leftp, int16_t** rightp) {
+	static int16_t sleft[INPUT_BUFSIZ * 45];
+	static int16_t sright[INPUT_BUFSIZ * 45];
+	ices_plugin_t* plugin;
+	double span;
+
+	*leftp = left;
+	*rightp = right;
+	if (!stream->plugins)
+		return samples;
+
+	memcpy(sleft, left, samples * sizeof(int16_t));
+	memcpy(sright, right, samples * sizeof(int16_t));
+	for (plugin = stream->plugins; plugin && samples > 0; plugin = plugin->next) {
+		span = ices_trace_start();
+		samples = plugin->process(plugin, samples, sleft, sright);
+		ices_trace_end(plugin->name, stream->mount, span);
+	}
+
+	*leftp = sleft;
+	*rightp = sright;
+	return samples;
+}
+#endif
 
 static int stream_needs_reencoding(input_stream_t* source, ices_stream_t* stream) {
 	if (rg_get_track_gain())
@@ -21,3 +21,6 @@
 /* Public function declarations */
 void ices_stream_loop(ices_config_t* config);
 void ices_stream_next(void);
+int ices_stream_probe(input_stream_t* source);
+/* only in ices-bench */
+int ices_stream_play(ices_config_t* config, input_stream_t* source);
@@ -0,0 +1,172 @@
+/* trace.c
+ * - Spans of pipeline work in the Chrome trace event format
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+/* While tracing, opening each source, parsing ID3v2 tags and every
+ * read, decode, replaygain pass, plugin, encode and send is written out
+ * as a complete event ("ph":"X"), with the thread that did it, to a
+ * JSON array that chrome://tracing, Perfetto and the like can open.
+ * Events are written as they end, so a trace cut short by a crash is
+ * still readable: the closing bracket is optional in this format.
+ *
+ * Tracing starts with ices if Execution/Trace names a file, and can be
+ * started and stopped with the control socket's trace command. While
+ * it is off, the only cost is the test of ices_tracing in
+ * ices_trace_start(). */
+
+#include "definitions.h"
+
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+#ifdef __linux__
+# include <sys/syscall.h>
+#endif
+
+volatile int ices_tracing = 0;
+
+extern ices_config_t ices_config;
+
+static FILE* Trace = NULL;
+static char Filename[1024];
+static int Events = 0;
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t Lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* Private function declarations */
+static long trace_thread(void);
+static void trace_string(const char* value);
+
+/* Public function definitions */
+
+void ices_trace_initialize(void) {
+	if (ices_config.trace && ices_trace_open(ices_config.trace) < 0)
+		ices_log("Not tracing: %s", ices_log_get_error());
+}
+
+void ices_trace_shutdown(void) {
+	ices_trace_close();
+}
+
+/* Start writing a trace to path, or BaseDirectory/ices.trace.json,
+ * unless a trace is being written already. Returns 0, or -1 with the
+ * reason as the last error. */
+int ices_trace_open(const char* path) {
+	int rc = 0;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&Lock);
+#endif
+	if (!Trace) {
+		if (path)
+			snprintf(Filename, sizeof(Filename), "%s", path);
+		else
+			snprintf(Filename, sizeof(Filename), "%s/ices.trace.json",
+				 ices_util_nullcheck(ices_config.base_directory));
+
+		if (!(Trace = fopen(Filename, "w"))) {
+			ices_log_error("Error opening %s: %s", Filename, strerror(errno));
+			rc = -1;
+		} else {
+			Events = 0;
+			fprintf(Trace, "[");
+			ices_tracing = 1;
+			ices_log("Tracing to %s", Filename);
+		}
+	}
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&Lock);
+#endif
+
+	return rc;
+}
+
+/* Stop tracing and close the file */
+void ices_trace_close(void) {
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&Lock);
+#endif
+	ices_tracing = 0;
+	if (Trace) {
+		fprintf(Trace, "\n]\n");
+		ices_util_fclose(Trace);
+		Trace = NULL;
+		ices_log("Trace of %d events written to %s", Events, Filename);
+	}
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&Lock);
+#endif
+}
+
+/* The file being written, if any */
+const char* ices_trace_filename(void) {
+	return Filename[0] ? Filename : NULL;
+}
+
+/* Write a span called name that began at start (from ices_trace_start()),
+ * with arg, if given, as its detail. Use ices_trace_end(). */
+void ices_trace_span(const char* name, const char* arg, double start) {
+	double now = ices_metrics_clock();
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&Lock);
+#endif
+	if (Trace) {
+		fprintf(Trace, "%s\n{\"name\":", Events++ ? "," : "");
+		trace_string(name);
+		fprintf(Trace, ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%ld,\"tid\":%ld",
+			start * 1e6, (now - start) * 1e6, (long) getpid(), trace_thread());
+		if (arg) {
+			fprintf(Trace, ",\"args\":{\"detail\":");
+			trace_string(arg);
+			fprintf(Trace, "}");
+		}
+		fprintf(Trace, "}");
+	}
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&Lock);
+#endif
+}
+
+/* Private function definitions */
+
+static long trace_thread(void) {
+#if defined(__linux__) && defined(SYS_gettid)
+	return (long) syscall(SYS_gettid);
+#elif defined(HAVE_PTHREAD)
+	return (long) (unsigned long) pthread_self() & 0x7fffffff;
+#else
+	return (long) getpid();
+#endif
+}
+
+static void trace_string(const char* value) {
+	const unsigned char* c;
+
+	fputc('"', Trace);
+	for (c = (const unsigned char*) ices_util_nullcheck(value); *c; c++) {
+		if (*c == '"' || *c == '\\')
+			fprintf(Trace, "\\%c", *c);
+		else if (*c < 0x20)
+			fprintf(Trace, "\\u%04x", *c);
+		else
+			fputc(*c, Trace);
+	}
+	fputc('"', Trace);
+}
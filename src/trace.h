@@ -0,0 +1,45 @@
+/* trace.h
+ * - Trace event export declarations
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#ifndef _ICES_TRACE_H
+#define _ICES_TRACE_H
+
+extern volatile int ices_tracing;
+
+/* A span is timed with
+ *   double t = ices_trace_start();
+ *   ...
+ *   ices_trace_end("name", detail or NULL, t);
+ * and costs nothing more than a test while tracing is off */
+#define ices_trace_start() (ices_tracing ? ices_metrics_clock() : 0.0)
+#define ices_trace_end(name, arg, start) \
+	do { \
+		if (start) \
+			ices_trace_span(name, arg, start); \
+	} while (0)
+
+/* Public function declarations */
+void ices_trace_initialize(void);
+void ices_trace_shutdown(void);
+int ices_trace_open(const char* path);
+void ices_trace_close(void);
+const char* ices_trace_filename(void);
+void ices_trace_span(const char* name, const char* arg, double start);
+
+#endif
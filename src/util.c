@@ -25,6 +25,9 @@
 #include <netdb.h>
 #include <string.h>
 #include <libgen.h>
+#ifdef HAVE_PTHREAD
+# include <signal.h>
+#endif
 
 extern ices_config_t ices_config;
 
@@ -235,16 +238,19 @@ double ices_util_percent(int num, int den) {
  * by nice formatting in string buf.
  * Note: This only works ok with CBR */
 char *ices_util_file_time(unsigned int bitrate, unsigned int filesize, char *buf) {
-	unsigned long int days, hours, minutes, nseconds, remains;
-	unsigned long int seconds;
-
 	if (!bitrate) {
 		sprintf(buf, "0:0:0:0");
 		return buf;
 	}
 
 	/* << 7 == 1024 (bits->kbits) / 8 (bits->bytes) */
-	seconds = filesize / ((bitrate * 1000) >> 3);
+	return ices_util_time(filesize / ((bitrate * 1000) >> 3), buf);
+}
+
+/* Format a number of seconds in string buf, the way ices_util_file_time
+ * does */
+char *ices_util_time(unsigned long int seconds, char *buf) {
+	unsigned long int days, hours, minutes, nseconds, remains;
 
 	if (!buf)
 		return NULL;
@@ -289,3 +295,20 @@ int ices_util_verify_file(const char *filename) {
 
 	return 1;
 }
+
+#ifdef HAVE_PTHREAD
+/* Start a thread with every signal blocked, so that they all go to the
+ * main thread and are dealt with by ices_signals_dispatch() */
+int ices_util_thread_create(pthread_t *thread, void *(*start)(void *),
+			    void *arg) {
+	sigset_t all, old;
+	int rc;
+
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	rc = pthread_create(thread, NULL, start, arg);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	return rc;
+}
+#endif
@@ -18,6 +18,10 @@
  *
  */
 
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
 /* Public function declarations */
 char **ices_util_get_argv(void);
 int ices_util_get_argc(void);
@@ -40,6 +44,11 @@ const char *ices_util_nullcheck(const char *string);
 double ices_util_percent(int this, int of_that);
 char *ices_util_file_time(unsigned int bitrate, unsigned int filesize,
 			  char *namespace);
+char *ices_util_time(unsigned long int seconds, char *namespace);
 const char *ices_util_strerror(int error, char *namespace, int maxsize);
 void ices_util_free(void *ptr);
 int ices_util_verify_file(const char *filename);
+#ifdef HAVE_PTHREAD
+int ices_util_thread_create(pthread_t *thread, void *(*start)(void *),
+			    void *arg);
+#endif